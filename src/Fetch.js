@@ -378,6 +378,14 @@ function __emscripten_fetch_xhr(fetch, onsuccess, onerror, onprogress, onreadyst
       // the most recent XHR.onprogress handler.
       Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.totalBytes }}}, len);
     }
+    if (xhr.status === 206) {
+      // For a range request, report the size of the whole resource, from "Content-Range: bytes 0-99/1234".
+      // If the header is not exposed to us (CORS), or the size is "*", report 0 for unknown, so that
+      // the response is not mistaken for the whole resource.
+      var contentRange = xhr.getResponseHeader('Content-Range');
+      var resourceBytes = contentRange ? parseInt(contentRange.split('/')[1]) : NaN;
+      Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.totalBytes }}}, resourceBytes >= 0 ? resourceBytes : 0);
+    }
     HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = xhr.readyState;
     if (xhr.readyState === 4 && xhr.status === 0) {
       if (len > 0) xhr.status = 200; // If loading files from a source that does not give HTTP status code, assume success if we got data bytes.
@@ -7,7 +7,11 @@ mergeInto(LibraryManager.library, {
   $PIPEFS__postset: function() {
     addAtInit('PIPEFS.root = FS.mount(PIPEFS, {}, null);');
   },
-  $PIPEFS__deps: ['$FS', '$ERRNO_CODES'],
+  $PIPEFS__deps: ['$FS', '$ERRNO_CODES',
+#if USE_PTHREADS
+    'emscripten_main_thread_notify_fd_event',
+#endif
+  ],
   $PIPEFS: {
     BUCKET_BUFFER_SIZE: 1024 * 8, // 8KiB Buffer
     mount: function (mount) {
@@ -57,6 +61,14 @@ mergeInto(LibraryManager.library, {
         writable_fd: writableStream.fd
       };
     },
+    // Called when data has been written to a pipe.
+    notifyReadable: function () {
+#if USE_PTHREADS
+      // Let select() and poll() calls proxied from pthreads that wait on the read end complete.
+      // The read end may have any number of descriptors, so probe all waiting calls.
+      _emscripten_main_thread_notify_fd_event(-1);
+#endif
+    },
     stream_ops: {
       poll: function (stream) {
         var pipe = stream.node.pipe;
@@ -179,6 +191,7 @@ mergeInto(LibraryManager.library, {
         if (freeBytesInCurrBuffer >= dataLen) {
           currBucket.buffer.set(data, currBucket.offset);
           currBucket.offset += dataLen;
+          PIPEFS.notifyReadable();
           return dataLen;
         } else if (freeBytesInCurrBuffer > 0) {
           currBucket.buffer.set(data.subarray(0, freeBytesInCurrBuffer), currBucket.offset);
@@ -210,6 +223,7 @@ mergeInto(LibraryManager.library, {
           newBucket.buffer.set(data);
         }
 
+        PIPEFS.notifyReadable();
         return dataLen;
       },
       close: function (stream) {
@@ -254,6 +254,8 @@ var LibraryPThread = {
         var tlsMemory = {{{ makeGetValue('pthread.threadInfoStruct', C_STRUCTS.pthread.tsd, 'i32') }}};
         {{{ makeSetValue('pthread.threadInfoStruct', C_STRUCTS.pthread.tsd, 0, 'i32') }}};
         _free(tlsMemory);
+        // Stop other threads from proxying calls to this one before its structure is freed.
+        _emscripten_unregister_live_thread(pthread.threadInfoStruct);
         _free(pthread.threadInfoStruct);
       }
       pthread.threadInfoStruct = 0;
@@ -771,6 +773,9 @@ var LibraryPThread = {
     var headPtr = threadInfoStruct + {{{ C_STRUCTS.pthread.robust_list }}};
     {{{ makeSetValue('headPtr', 0, 'headPtr', 'i32') }}};
 
+    // Calls can be proxied to the thread from now on, until freeThreadData().
+    _emscripten_register_live_thread(threadInfoStruct);
+
 #if OFFSCREENCANVAS_SUPPORT
     // Register for each of the transferred canvases that the new thread now owns the OffscreenCanvas.
     for (var i in offscreenCanvases) {
@@ -7,7 +7,11 @@ mergeInto(LibraryManager.library, {
   $SOCKFS__postset: function() {
     addAtInit('SOCKFS.root = FS.mount(SOCKFS, {}, null);');
   },
-  $SOCKFS__deps: ['$FS', '$ERRNO_CODES'], // TODO: avoid ERRNO_CODES
+  $SOCKFS__deps: ['$FS', '$ERRNO_CODES', // TODO: avoid ERRNO_CODES
+#if USE_PTHREADS
+    'emscripten_main_thread_notify_fd_event',
+#endif
+  ],
   $SOCKFS: {
     mount: function(mount) {
       // If Module['websocket'] has already been defined (e.g. for configuring
@@ -27,6 +31,10 @@ mergeInto(LibraryManager.library, {
       };
 
       Module['websocket'].emit = function(event, param) {
+#if USE_PTHREADS
+        // Let select() and poll() calls proxied from pthreads that wait on this socket complete.
+        _emscripten_main_thread_notify_fd_event(Array.isArray(param) ? param[0] : param);
+#endif
 	    if ('function' === typeof this._callbacks[event]) {
 		  this._callbacks[event].call(this, param);
         }
@@ -984,15 +984,16 @@ var SyscallsLibrary = {
     }
 
 #if USE_PTHREADS
-    // To be responsive we execute the loop for `quantum_msecs` and then we
-    // process queued calls. If this call is executed on the main thread without
-    // any proxying, we just continue to run the loop. Otherwise this call is
-    // executed from the `heavy_call_queue` and we simply return.
-    // If we didn't hit timeout, we would execute this call again.
+    // If this call is executed on the main thread without any proxying, we
+    // run the loop and process queued calls every `quantum_msecs` to stay
+    // responsive. Otherwise this call was proxied from a pthread and we only
+    // probe the descriptors once: if nothing is ready we return EAGAIN, and
+    // the call stays in the heavy call queue until a socket event or its
+    // timeout makes the main thread run it again.
     // Note: in the first case a problem may arise when during processing calls
     // we encounter a heavy call, which processing time exceeds this call's
     // timeout.
-    const quantum_msecs = this.returnEarly ? 5 : 1;
+    const quantum_msecs = 1;
     let last_processing_time = -1;
 #endif
 
@@ -1037,8 +1038,7 @@ var SyscallsLibrary = {
         break;
       }
 #if USE_PTHREADS
-      if (this.returnEarly && total === 0 &&
-          loop_end_time - start_time > quantum_msecs) {
+      if (this.returnEarly && total === 0) {
         // This is the end for now. We may return here if timeout hasn't
         // expired.
         return -{{{ cDefine('EAGAIN') }}};
@@ -1104,7 +1104,7 @@ var SyscallsLibrary = {
 
 #if USE_PTHREADS
     // See comments in `__syscall142` (newselect).
-    const quantum_msecs = this.returnEarly ? 5 : 1;
+    const quantum_msecs = 1;
     let last_processing_time = -1;
 #endif
 
@@ -1135,8 +1135,7 @@ var SyscallsLibrary = {
         break;
       }
 #if USE_PTHREADS
-      if (this.returnEarly && nonzero === 0 &&
-          loop_end_time - start_time > quantum_msecs) {
+      if (this.returnEarly && nonzero === 0) {
         // This is the end for now. We will return here.
         return -{{{ cDefine('EAGAIN') }}};
       } else if (nonzero === 0 && (last_processing_time === -1 ||
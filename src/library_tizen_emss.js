@@ -54,6 +54,9 @@ const LibraryTizenEmss = {
       videoRobustness: 32,
     },
   },
+  $CStructsSizes: {
+    ElementaryMediaPacket: 56,
+  },
 
 /*============================================================================*/
 /*= Common code:                                                             =*/
@@ -354,6 +357,18 @@ const LibraryTizenEmss = {
         "SampleFormatEac3",
       ];
 
+      // Matches samsung::wasm::EncryptedPacketDescriptor::kBlockSize
+      const ENCRYPTION_BLOCK_SIZE = 16;
+
+      // Views of key ids and initialization vectors by their address. Packets
+      // appended from C++ use pooled descriptors, so the same few addresses
+      // come back for every packet. Other callers may pass any address, so the
+      // cache is bounded: it is cleared when full, and when memory grows, which
+      // invalidates all views.
+      const MAX_BLOCK_VIEWS = 256;
+      const blockViews = new Map();
+      let blockViewsBuffer = null;
+
       EmssCommon = {
         Result: Result,
         _callFunction: function(handleMap, handle, name, ...args) {
@@ -660,21 +675,36 @@ const LibraryTizenEmss = {
           config.isEncrypted = false;
           return config;
         },
+        _blockFromPtr: function(object, ptrOffset, sizeOffset) {
+          const ptr = {{{ makeGetValue('object', 'ptrOffset', 'i32') }}};
+          const size = {{{ makeGetValue('object', 'sizeOffset', 'i32') }}};
+          if (size !== ENCRYPTION_BLOCK_SIZE) {
+            const padded = new Uint8Array(ENCRYPTION_BLOCK_SIZE);
+            padded.set(HEAPU8.subarray(ptr, ptr + size));
+            return padded;
+          }
+          if (blockViewsBuffer !== HEAPU8.buffer) {
+            blockViews.clear();
+            blockViewsBuffer = HEAPU8.buffer;
+          }
+          let view = blockViews.get(ptr);
+          if (!view) {
+            if (blockViews.size >= MAX_BLOCK_VIEWS) {
+              blockViews.clear();
+            }
+            view = HEAPU8.subarray(ptr, ptr + ENCRYPTION_BLOCK_SIZE);
+            blockViews.set(ptr, view);
+          }
+          return view;
+        },
         _extendPacketToEncrypted: function(packet, ptr) {
-          const pad = (array, goalLength = 16) => {
-            const padding = new Array(goalLength - array.length).fill(0);
-            return new Uint8Array([
-              ...array,
-              ...padding]);
-          };
-
           packet.isEncrypted = true;
-          packet.keyId = pad(EmssCommon._arrayFromPtr(ptr,
+          packet.keyId = EmssCommon._blockFromPtr(ptr,
             CStructsOffsets.ElementaryMediaPacket.keyId,
-            CStructsOffsets.ElementaryMediaPacket.keyIdSize));
-          packet.initializationVector = pad(EmssCommon._arrayFromPtr(ptr,
+            CStructsOffsets.ElementaryMediaPacket.keyIdSize);
+          packet.initializationVector = EmssCommon._blockFromPtr(ptr,
             CStructsOffsets.ElementaryMediaPacket.initializationVector,
-            CStructsOffsets.ElementaryMediaPacket.initializationVectorSize));
+            CStructsOffsets.ElementaryMediaPacket.initializationVectorSize);
           packet.encryptionMode = EmssMediaKey._encryptionModeToString(
             {{{ makeGetValue(
               'ptr',
@@ -802,18 +832,11 @@ const LibraryTizenEmss = {
       };
       return config;
     },
+    // Subsample descriptions are copied by the platform when a packet is
+    // appended, so one array and its objects are reused for all packets.
+    _subsamples: [],
+    _subsampleObjects: [],
     _getSubsamples: function(packetPtr) {
-      const arrayToInt32 = (arraySlice) => {
-        return arraySlice.map((value, index) => {
-          return value << (index * 8);
-        }).reduce((acc, val) => {
-          return acc + val;
-        }, 0);
-      };
-      const chunk = (array, begin, size) => {
-        return array.slice(begin, begin + size);
-      };
-      const subsampleSize = 8;
       const ptr = {{{ makeGetValue(
         'packetPtr',
         'CStructsOffsets.ElementaryMediaPacket.subsamples',
@@ -822,16 +845,18 @@ const LibraryTizenEmss = {
         'packetPtr',
         'CStructsOffsets.ElementaryMediaPacket.subsamplesSize',
         'i32') }}};
-      const subsamples = Array.from(HEAPU8.slice(
-        ptr, ptr + size * subsampleSize));
-      const ret = [];
-      for (let subsample = 0;
-          subsample < size * subsampleSize;
-          subsample += subsampleSize) {
-        ret.push({
-          clearBytes: arrayToInt32(chunk(subsamples, subsample, 4)),
-          encryptedBytes: arrayToInt32(chunk(subsamples, subsample + 4, 4)),
-        });
+      const objects = EmssMediaKey._subsampleObjects;
+      while (objects.length < size) {
+        objects.push({clearBytes: 0, encryptedBytes: 0});
+      }
+      const ret = EmssMediaKey._subsamples;
+      ret.length = size;
+      // EMSSEncryptedSubsampleDescription is a pair of uint32_t.
+      for (let i = 0, index = ptr >> 2; i < size; ++i, index += 2) {
+        const subsample = objects[i];
+        subsample.clearBytes = HEAPU32[index];
+        subsample.encryptedBytes = HEAPU32[index + 1];
+        ret[i] = subsample;
       }
       return ret;
     },
@@ -1949,6 +1974,9 @@ const LibraryTizenEmss = {
       WasmElementaryMediaTrack = {
         handleMap: [],
         listenerMap: {},
+        // Kept apart from listenerMap, so that clearing App's listeners
+        // doesn't stop the track from following session changes.
+        sessionIdTrackerMap: {},
         _callFunction: function(handle, name, ...args) {
           return EmssCommon._callFunction(
             WasmElementaryMediaTrack.handleMap,
@@ -2015,6 +2043,12 @@ const LibraryTizenEmss = {
       return EmssCommon.Result.WRONG_HANDLE;
     }
     EmssCommon._clearListeners(WasmElementaryMediaTrack, handle);
+    if (handle in WasmElementaryMediaTrack.sessionIdTrackerMap) {
+      WasmElementaryMediaTrack.handleMap[handle].removeEventListener(
+          'sessionidchanged',
+          WasmElementaryMediaTrack.sessionIdTrackerMap[handle]);
+      delete WasmElementaryMediaTrack.sessionIdTrackerMap[handle];
+    }
     delete WasmElementaryMediaTrack.handleMap[handle];
     delete WasmElementaryMediaTrack.listenerMap[handle];
     return EmssCommon.Result.SUCCESS;
@@ -2054,7 +2088,55 @@ const LibraryTizenEmss = {
     }
   },
 
-  elementaryMediaTrackAppendEncryptedPacket__deps: ['$EmssCommon', '$WasmElementaryMediaTrack'],
+  elementaryMediaTrackAppendPackets__deps: ['$EmssCommon', '$CStructsSizes', '$WasmElementaryMediaTrack'],
+  elementaryMediaTrackAppendPackets: function(
+      handle, packetsPtr, count, appendedPtr) {
+    let appended = 0;
+    try {
+      for (let packetPtr = packetsPtr; appended < count; ++appended) {
+        const packet = EmssCommon._makePacketFromPtr(packetPtr);
+        const data = EmssCommon._makePacketDataFromPtr(packetPtr);
+
+        tizentvwasm.SideThreadElementaryMediaTrack.appendPacketSync(
+              handle, packet, data);
+        packetPtr += CStructsSizes.ElementaryMediaPacket;
+      }
+      return EmssCommon.Result.SUCCESS;
+    } catch (error) {
+#if TIZEN_EMSS_DEBUG
+      console.error(error.message);
+#endif
+      return EmssCommon._exceptionToErrorCode(error);
+    } finally {
+      setValue(appendedPtr, appended, 'i32');
+    }
+  },
+
+  elementaryMediaTrackAppendPacketsAsync__deps: ['$EmssCommon', '$CStructsSizes', '$WasmElementaryMediaTrack'],
+  elementaryMediaTrackAppendPacketsAsync: function(
+      handle, packetsPtr, count, appendedPtr) {
+    let appended = 0;
+    try {
+      for (let packetPtr = packetsPtr; appended < count; ++appended) {
+        const packet = EmssCommon._makePacketFromPtr(packetPtr);
+        const data = EmssCommon._makePacketDataFromPtr(packetPtr);
+
+        tizentvwasm.SideThreadElementaryMediaTrack.appendPacketAsync(
+              handle, packet, data);
+        packetPtr += CStructsSizes.ElementaryMediaPacket;
+      }
+      return EmssCommon.Result.SUCCESS;
+    } catch (error) {
+#if TIZEN_EMSS_DEBUG
+      console.error(error.message);
+#endif
+      return EmssCommon._exceptionToErrorCode(error);
+    } finally {
+      setValue(appendedPtr, appended, 'i32');
+    }
+  },
+
+  elementaryMediaTrackAppendEncryptedPacket__deps: ['$EmssCommon', '$EmssMediaKey', '$WasmElementaryMediaTrack'],
   elementaryMediaTrackAppendEncryptedPacket: function(handle, packetPtr) {
     try {
       const packet = EmssCommon._makePacketFromPtr(packetPtr);
@@ -2072,7 +2154,7 @@ const LibraryTizenEmss = {
     }
   },
 
-  elementaryMediaTrackAppendEncryptedPacketAsync__deps: ['$EmssCommon', '$WasmElementaryMediaTrack'],
+  elementaryMediaTrackAppendEncryptedPacketAsync__deps: ['$EmssCommon', '$EmssMediaKey', '$WasmElementaryMediaTrack'],
   elementaryMediaTrackAppendEncryptedPacketAsync: function(handle, packetPtr) {
     try {
       const packet = EmssCommon._makePacketFromPtr(packetPtr);
@@ -2347,6 +2429,42 @@ const LibraryTizenEmss = {
     return EmssCommon.Result.SUCCESS;
   },
 
+  elementaryMediaTrackSetSessionIdTracker__deps: ['$EmssCommon', '$WasmElementaryMediaTrack'],
+  elementaryMediaTrackSetSessionIdTracker__proxy: 'sync',
+  elementaryMediaTrackSetSessionIdTracker: function(
+      handle, eventHandler, userData) {
+    const obj = WasmElementaryMediaTrack.handleMap[handle];
+    if (!obj) {
+#if TIZEN_EMSS_DEBUG
+      console.warn(`No such elementary media track: '${handle}'`);
+#endif
+      return EmssCommon.Result.WRONG_HANDLE;
+    }
+    if (handle in WasmElementaryMediaTrack.sessionIdTrackerMap) {
+      return EmssCommon.Result.LISTENER_ALREADY_SET;
+    }
+    const onSessionIdChanged = (event) => {
+      {{{ makeDynCall('vii') }}} (eventHandler, event.sessionId, userData);
+    };
+    WasmElementaryMediaTrack.sessionIdTrackerMap[handle] = onSessionIdChanged;
+    obj.addEventListener('sessionidchanged', onSessionIdChanged);
+    return EmssCommon.Result.SUCCESS;
+  },
+
+  elementaryMediaTrackUnsetSessionIdTracker__deps: ['$EmssCommon', '$WasmElementaryMediaTrack'],
+  elementaryMediaTrackUnsetSessionIdTracker__proxy: 'sync',
+  elementaryMediaTrackUnsetSessionIdTracker: function(handle) {
+    const obj = WasmElementaryMediaTrack.handleMap[handle];
+    const onSessionIdChanged =
+        WasmElementaryMediaTrack.sessionIdTrackerMap[handle];
+    if (!obj || !onSessionIdChanged) {
+      return EmssCommon.Result.NO_SUCH_LISTENER;
+    }
+    obj.removeEventListener('sessionidchanged', onSessionIdChanged);
+    delete WasmElementaryMediaTrack.sessionIdTrackerMap[handle];
+    return EmssCommon.Result.SUCCESS;
+  },
+
 /*============================================================================*/
 /*= Bindings for listeners' setters and unsetters:                           =*/
 /*============================================================================*/
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Introspection for emmalloc (-s MALLOC=emmalloc). These functions are
+// available in release builds and do not require EMMALLOC_DEBUG.
+
+// emmalloc keeps one freelist per power of 2: freelist K holds free regions
+// whose payload is at least 2^K bytes and less than 2^(K+1) bytes.
+#define EMMALLOC_NUM_FREELISTS 32
+
+struct emmalloc_freelist_stats {
+  // Number of free regions in this freelist.
+  size_t count;
+  // Total payload bytes of those regions.
+  size_t bytes;
+};
+
+struct emmalloc_stats {
+  // Total bytes emmalloc has obtained from sbrk().
+  size_t sbrk_bytes;
+  // Regions in use (including those held in per-thread caches under
+  // pthreads), and their total payload bytes.
+  size_t used_regions;
+  size_t used_bytes;
+  // Free regions, and their total payload bytes.
+  size_t free_regions;
+  size_t free_bytes;
+  // Payload size of the largest free region.
+  size_t largest_free;
+  // Bytes spent on per-region metadata.
+  size_t metadata_bytes;
+  // Bytes handed out beyond what callers asked for, due to rounding up to
+  // the allocation unit and not splitting small remainders. This is a
+  // running total over every allocation so far, and is never reduced by
+  // free(): emmalloc does not remember how much each caller asked for. For
+  // the current fragmentation of the heap, compare largest_free with
+  // free_bytes and free_regions instead.
+  uint64_t total_rounding_bytes;
+  struct emmalloc_freelist_stats freelists[EMMALLOC_NUM_FREELISTS];
+};
+
+// Fills in |stats| for the current state of the heap. This walks all
+// regions, so it takes time linear in their number.
+void emmalloc_get_stats(struct emmalloc_stats* stats);
+
+// Called for each region in address order, with the start of its payload,
+// the payload size in bytes, and whether it is in use.
+//
+// The callback runs while emmalloc holds its heap lock, so it must not call
+// malloc(), free() or anything that may use them, such as printf(); doing so
+// deadlocks. Copy what you need into memory allocated beforehand, and report
+// it after emmalloc_walk_regions() returns.
+typedef void (*emmalloc_region_callback)(void* payload, size_t size, int used, void* user_data);
+
+void emmalloc_walk_regions(emmalloc_region_callback callback, void* user_data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -146,6 +146,9 @@ typedef struct emscripten_fetch_t
 
 	// Specifies the total number of bytes that the response body will be.
 	// Note: This field may be zero, if the server does not report the Content-Length field.
+	// For a 206 Partial Content response to a request with a Range header, this is instead the size of the whole
+	// resource, as reported by the Content-Range field, and numBytes holds the size of the received range. It is
+	// zero if the Content-Range field is not readable (e.g. not exposed by CORS) or does not give the size.
 	uint64_t totalBytes;
 
 	// Specifies the readyState of the XHR request:
@@ -245,10 +248,32 @@ void emscripten_asmfs_unload_data(const char *pathname);
 // synchronous access by looking at IndexedDB only.
 EMSCRIPTEN_RESULT emscripten_asmfs_preload_file(const char *url, const char *pathname, int mode, emscripten_fetch_attr_t *options);
 
+// Sets a limit, in bytes, for the memory taken by contents of files that ASMFS downloaded and can download
+// again. When the limit is exceeded, the contents of the least recently used such files that are not open
+// are freed, and downloaded again when next opened or read. Files created or modified locally never count
+// towards the limit, and are never freed. 0 means no limit, which is the default.
+// Note: Evicted files cannot be reopened on the main browser thread, since it cannot wait for downloads.
+void emscripten_asmfs_set_cache_budget(uint64_t bytes);
+
+// Returns the number of bytes of downloaded file contents that count towards the cache budget.
+uint64_t emscripten_asmfs_get_cache_usage(void);
+
 // Computes the total amount of bytes in memory utilized by the filesystem at the moment.
 // Note: This function can be slow since it walks through the whole filesystem.
 uint64_t emscripten_asmfs_compute_memory_usage();
 
+// File contents in ASMFS are stored in fixed-size chunks. Outputs the number of chunks that are
+// currently in memory, and the number of chunks all files would take if they were fully in memory.
+// Note: This function can be slow since it walks through the whole filesystem.
+void emscripten_asmfs_compute_chunk_usage(uint64_t *residentChunks, uint64_t *totalChunks);
+
+// If enabled, files that are opened for reading from a remote server on a worker thread are not
+// downloaded as a whole. Instead, each read fetches only the chunks of the file it touches, with
+// HTTP Range requests. If the server does not support range requests, or does not report the size
+// of the file in a readable Content-Range header, the whole file is downloaded as usual.
+// Range-fetched files are not persisted to IndexedDB. Disabled by default.
+void emscripten_asmfs_set_range_requests(EM_BOOL enabled);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <sys/types.h>
 #include "websocket.h"
 
 #ifdef __cplusplus
@@ -8,6 +9,26 @@ extern "C" {
 
 extern EMSCRIPTEN_RESULT emscripten_init_websocket_to_posix_socket_bridge(const char *bridgeUrl);
 
+// A send() or recv() call that has been sent to the sockets bridge, but whose result may not have arrived yet. Calls
+// can be submitted from any thread, and many of them can be in flight at once over the single bridge connection.
+typedef struct PosixSocketCallResult *EMSCRIPTEN_POSIX_SOCKET_CALL_T;
+
+// Submits a send() without waiting for it to complete. The message is copied before this function returns. Returns 0
+// and sets errno if the call could not be submitted: EAGAIN if too many calls are already in flight, or ENOMEM.
+extern EMSCRIPTEN_POSIX_SOCKET_CALL_T emscripten_posix_socket_send_async(int socket, const void *message, size_t length, int flags);
+
+// Submits a recv() without waiting for it to complete. The received data is written to buffer, which must stay valid
+// until the call has been passed to emscripten_posix_socket_call_wait(). Returns 0 and sets errno to EAGAIN if too many
+// calls are already in flight.
+extern EMSCRIPTEN_POSIX_SOCKET_CALL_T emscripten_posix_socket_recv_async(int socket, void *buffer, size_t length, int flags);
+
+// Returns EM_TRUE if the result of the call has arrived, so that emscripten_posix_socket_call_wait() will not block.
+extern EM_BOOL emscripten_posix_socket_call_done(EMSCRIPTEN_POSIX_SOCKET_CALL_T call);
+
+// Waits for the call to complete and frees it. Returns what send() or recv() would have returned, and sets errno on
+// failure. Every submitted call must be waited for exactly once.
+extern ssize_t emscripten_posix_socket_call_wait(EMSCRIPTEN_POSIX_SOCKET_CALL_T call);
+
 #ifdef __cplusplus
 }
 #endif
@@ -123,6 +123,9 @@ typedef struct em_queued_call
   // this em_queued_call object after it has been executed. If
   // false, the caller is in control of the memory.
   int calleeDelete;
+
+  // Links the call into the queue of the thread it is proxied to. Used internally.
+  struct em_queued_call *next;
 } em_queued_call;
 
 void emscripten_sync_run_in_main_thread(em_queued_call *call);
@@ -290,7 +293,35 @@ EMSCRIPTEN_RESULT emscripten_wait_for_call_i(em_queued_call *call, double timeou
 
 void emscripten_async_waitable_close(em_queued_call *call);
 
-// Queues the given function call to be performed on the specified thread.
+// A batch records many calls to be run on the main runtime thread, and queues them all at once, with
+// a single enqueue and a single wakeup of the main thread instead of one per call. The calls of a batch
+// run in the order they were added. A batch can be built up and submitted from any thread.
+typedef struct em_queued_call_batch em_queued_call_batch;
+
+// Creates an empty batch. Returns NULL if out of memory.
+em_queued_call_batch *emscripten_create_call_batch(void);
+
+// Frees a batch that will not be submitted, along with the calls recorded in it.
+void emscripten_destroy_call_batch(em_queued_call_batch *batch);
+
+// Records a call to func_ptr with the given arguments, which are interpreted according to sig like in
+// emscripten_async_run_in_main_runtime_thread(). Returns 0 if out of memory, in which case the call is
+// not recorded.
+int emscripten_call_batch_add_(em_queued_call_batch *batch, EM_FUNC_SIGNATURE sig, void *func_ptr, ...);
+#define emscripten_call_batch_add(batch, sig, func_ptr, ...) emscripten_call_batch_add_((batch), (sig), (void*)(func_ptr),##__VA_ARGS__)
+
+// Queues all calls recorded in the batch to the main runtime thread, without waiting for them. The
+// batch is freed, and must not be used afterwards.
+void emscripten_async_run_batch_in_main_runtime_thread(em_queued_call_batch *batch);
+
+// Same as above, but returns a call object that completes when all calls of the batch have run, so
+// the caller gets one completion for the whole batch. Wait for it with emscripten_wait_for_call_v(), and
+// free it with emscripten_async_waitable_close(). Returns NULL if out of memory, in which case the
+// batch is freed without running its calls.
+em_queued_call *emscripten_async_waitable_run_batch_in_main_runtime_thread(em_queued_call_batch *batch);
+
+// Queues the given function call to be performed on the specified thread. If the target thread no
+// longer exists, the call is dropped. Calls still queued when the target thread exits are not run.
 void emscripten_async_queue_on_thread_(pthread_t target_thread, EM_FUNC_SIGNATURE sig, void *func_ptr, void *satellite, ...);
 
 #define emscripten_async_queue_on_thread(target_thread, sig, func_ptr, satellite, ...) emscripten_async_queue_on_thread_((target_thread), (sig), (void*)(func_ptr), (satellite),##__VA_ARGS__)
@@ -6,6 +6,7 @@
 #ifndef INCLUDE_SAMSUNG_WASM_ELEMENTARY_MEDIA_TRACK_H_
 #define INCLUDE_SAMSUNG_WASM_ELEMENTARY_MEDIA_TRACK_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -87,6 +88,29 @@ class ElementaryMediaTrack final {
     kUnknown,
   };
 
+  /// Identifies a callback registered with `AddSessionIdChangedCallback()`.
+  using SessionIdChangedCallbackId = uint32_t;
+
+  /// Packet append counters of a track, obtained with
+  /// `GetAppendStatistics()`. Counters are updated by all appending threads
+  /// and are never reset.
+  struct AppendStatistics {
+    /// Number of packets accepted by the platform.
+    uint64_t appended_packets;
+
+    /// Number of packets dropped when they were submitted, because they were
+    /// marked with a `SessionId` of a session that had already ended. Packets
+    /// submitted before the session changed, including asynchronous appends
+    /// still in progress, are not counted here: they have already been handed
+    /// to the platform, which ignores them.
+    uint64_t dropped_stale_packets;
+
+    /// Number of appends that the platform rejected synchronously. Errors of
+    /// asynchronous appends are reported only with
+    /// `ElementaryMediaTrackListener::OnAppendError()`.
+    uint64_t failed_packets;
+  };
+
   /// Default constructor, creates an *invalid* `ElementaryMediaTrack` object.
   /// It can be further replaced with a proper one, received with a call to
   /// `ElementaryMediaStreamSource::AddTrack()`.
@@ -114,6 +138,8 @@ class ElementaryMediaTrack final {
   /// * `AppendPacket()` cannot be called on the main thread.
   /// * `AppendPacket()` and `AppendPacketAsync()` calls for the same track can
   ///    be mixed.
+  /// * Packets of a session that has already ended are dropped as described
+  ///   for `AppendPacketAsync()`.
   ///
   /// @param[in] packet A packet to append.
   ///
@@ -133,6 +159,11 @@ class ElementaryMediaTrack final {
   ///   threads.
   /// * `AppendPacket()` and `AppendPacketAsync()` calls for the same track can
   ///   be mixed.
+  /// * A packet marked with a `SessionId` of a session that has already ended
+  ///   is dropped at submission, without reaching the platform, and
+  ///   `OperationResult::kAppendIgnored` is returned (`OperationResult::kFailed`
+  ///   where session ids are emulated on legacy platforms). An append submitted
+  ///   before the session changed is not cancelled.
   ///
   /// @param[in] packet A packet to append.
   ///
@@ -141,6 +172,49 @@ class ElementaryMediaTrack final {
   /// successful, otherwise a code describing the error.
   Result<void> AppendPacketAsync(const ElementaryMediaPacket& packet);
 
+  /// Appends `count` `ElementaryMediaPacket`s from the `packets` array to the
+  /// track, in order.
+  ///
+  /// This is equivalent to calling `AppendPacket()` on each of the packets,
+  /// but the whole batch crosses from WebAssembly to JavaScript once instead of
+  /// once per packet, which is considerably cheaper when many small packets
+  /// are appended. Packets are still appended to the platform one by one.
+  ///
+  /// @remarks
+  /// * `AppendPackets()` cannot be called on the main thread.
+  /// * Appending stops at the first packet that fails.
+  ///
+  /// @param[in] packets An array of packets to append.
+  /// @param[in] count Number of packets in the `packets` array.
+  ///
+  /// @return `Result<size_t>` with `operation_result` field set to
+  /// `OperationResult::kSuccess` if all packets were appended, otherwise a
+  /// code describing the error of the first packet that failed. Unlike in
+  /// other `Result`s, `value` is valid in both cases and holds the number of
+  /// packets that were appended.
+  Result<size_t> AppendPackets(const ElementaryMediaPacket* packets,
+                               size_t count);
+
+  /// Appends `count` `ElementaryMediaPacket`s from the `packets` array to the
+  /// track asynchronously, in order.
+  ///
+  /// This is equivalent to calling `AppendPacketAsync()` on each of the
+  /// packets, but the whole batch crosses from WebAssembly to JavaScript once
+  /// instead of once per packet. Packets are still appended to the platform
+  /// one by one.
+  ///
+  /// @remarks
+  /// * `AppendPacketsAsync()` can be called both on the main thread and on
+  ///   side threads.
+  /// * Appending stops at the first packet that fails.
+  ///
+  /// @param[in] packets An array of packets to append.
+  /// @param[in] count Number of packets in the `packets` array.
+  ///
+  /// @return `Result<size_t>` as described in `AppendPackets()`.
+  Result<size_t> AppendPacketsAsync(const ElementaryMediaPacket* packets,
+                                    size_t count);
+
   /// Appends a given `EncryptedElementaryMediaPacket` to the track.
   ///
   /// @remarks
@@ -328,8 +402,11 @@ class ElementaryMediaTrack final {
   /// Returns id of the currently active session.
   ///
   /// @remarks
-  /// This should be used sparingly, because calling this method can be slow.
-  /// It's recommended to obtain an initial value of `session_id` using
+  /// The track keeps track of the current session on its own, so this is
+  /// cheap and can be polled by packet producers on any thread to stop
+  /// producing packets for a session that has ended. On platforms that don't
+  /// support tracking, this calls the platform and can be slow; in that case
+  /// it's recommended to obtain an initial value of `session_id` using
   /// `GetSessionId()` and receive further updates with the
   /// `ElementaryMediaTrackListener::OnSessionIdChanged()` event.
   ///
@@ -447,6 +524,42 @@ class ElementaryMediaTrack final {
   /// @sa `ElementaryMediaTrackListener`
   Result<void> SetListener(ElementaryMediaTrackListener* listener);
 
+  /// Registers a callback to be called when the current session changes.
+  /// Unlike `SetListener()`, any number of callbacks can be registered, so
+  /// that several packet producers can each learn about session changes.
+  ///
+  /// Callbacks are called on the thread that delivers track events (i.e. the
+  /// main thread), before `ElementaryMediaTrackListener::OnSessionIdChanged()`.
+  /// By then, packets of the previous session are dropped when they are
+  /// submitted; appends submitted earlier are left to the platform.
+  ///
+  /// @param[in] callback Callback to call with the new `SessionId`.
+  ///
+  /// @return `Result<SessionIdChangedCallbackId>` with `operation_result` set
+  /// to `OperationResult::kSuccess` and an id to pass to
+  /// `RemoveSessionIdChangedCallback()`, otherwise a code describing the
+  /// error. `OperationResult::kNotSupported` is returned if the platform
+  /// doesn't support sessions.
+  Result<SessionIdChangedCallbackId> AddSessionIdChangedCallback(
+      std::function<void(SessionId)> callback);
+
+  /// Unregisters a callback registered with `AddSessionIdChangedCallback()`.
+  ///
+  /// @param[in] callback_id Id returned by `AddSessionIdChangedCallback()`.
+  ///
+  /// @return `Result<void>` with `operation_result` field set to
+  /// `OperationResult::kSuccess` on success, otherwise a code describing the
+  /// error.
+  Result<void> RemoveSessionIdChangedCallback(
+      SessionIdChangedCallbackId callback_id);
+
+  /// Returns packet append counters of this track, for monitoring.
+  ///
+  /// @return `Result<AppendStatistics>` with `operation_result` field set to
+  /// `OperationResult::kSuccess` and current counters on success, otherwise a
+  /// code describing the error.
+  Result<AppendStatistics> GetAppendStatistics() const;
+
  private:
   class Impl;
 
@@ -0,0 +1,144 @@
+// Copyright 2020 Samsung Electronics
+// TizenTV Emscripten extensions are available under two separate licenses, the
+// MIT license and the University of Illinois/NCSA Open Source License.  Both
+// these licenses can be found in the LICENSE file.
+
+#ifndef INCLUDE_SAMSUNG_WASM_ELEMENTARY_MEDIA_TRACK_PIPELINE_H_
+#define INCLUDE_SAMSUNG_WASM_ELEMENTARY_MEDIA_TRACK_PIPELINE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "samsung/wasm/common.h"
+#include "samsung/wasm/elementary_media_packet.h"
+#include "samsung/wasm/operation_result.h"
+
+namespace samsung {
+namespace wasm {
+
+class ElementaryMediaTrack;
+class ElementaryMediaTrackListener;
+
+/// @brief
+/// Feeds an `ElementaryMediaTrack` with packets from an App-provided producer
+/// on worker threads.
+///
+/// The pipeline takes over the loop that Apps otherwise have to write
+/// themselves: it calls the producer (which typically fetches and demuxes
+/// media segments) on one thread to prefetch packets up to
+/// `Config::buffer_duration` ahead, and appends them to the track on another
+/// thread. Both sides apply backpressure: the producer isn't called while the
+/// prefetch buffer is full, and appends are retried when the platform reports
+/// `OperationResult::kAppendBufferFull`.
+///
+/// Sessions and seeks are handled automatically. Packets are appended with the
+/// current `SessionId`, and when the session changes, packets buffered for the
+/// previous one are dropped. When the track seeks, `SeekHandler` is called on
+/// the producer thread, and production continues from the new position.
+///
+/// The pipeline registers itself as the `ElementaryMediaTrackListener` of the
+/// track. Apps that need track events should pass their listener in `Config`,
+/// and events will be forwarded to it.
+///
+/// @remarks
+/// The pipeline requires building with `-s USE_PTHREADS=1`.
+///
+/// @sa `ElementaryMediaTrack`
+class ElementaryMediaTrackPipeline final {
+ public:
+  /// A packet produced by `PacketProducer`.
+  struct Packet {
+    /// Packet metadata. `data`, `data_size` and `session_id` fields are
+    /// ignored, the pipeline sets them when appending the packet.
+    ElementaryMediaPacket packet;
+
+    /// Packet data. The pipeline keeps it until the packet is appended.
+    std::vector<uint8_t> data;
+  };
+
+  /// Value returned by `PacketProducer`.
+  enum class ProducerStatus {
+    /// A packet was produced.
+    kPacket,
+    /// There are no more packets in the stream; an end of track will be
+    /// appended once all produced packets are. The producer will not be
+    /// called again unless the track seeks.
+    kEndOfTrack,
+  };
+
+  /// Produces the next packet of the stream. Called on the producer thread,
+  /// and may block (e.g. while a segment is being downloaded).
+  using PacketProducer = std::function<ProducerStatus(Packet* packet)>;
+
+  /// Called on the producer thread when the track seeks. Packets produced
+  /// after it returns should start at the key frame preceding `new_time`.
+  using SeekHandler = std::function<void(Seconds new_time)>;
+
+  /// Pipeline configuration.
+  struct Config {
+    /// How much media (as a sum of packet durations) is prefetched ahead of
+    /// what was appended to the track.
+    Seconds buffer_duration = Seconds{2.0};
+
+    /// How long appending waits before retrying when the platform buffer is
+    /// full.
+    Seconds buffer_full_retry_interval = Seconds{0.02};
+
+    /// Listener that track events are forwarded to, or `nullptr`. Events are
+    /// forwarded on the thread they were delivered on, except for
+    /// `ElementaryMediaTrackListener::OnAppendError()` for failed appends of
+    /// the pipeline, which is called on the appending thread.
+    ElementaryMediaTrackListener* listener = nullptr;
+  };
+
+  /// Creates a pipeline for the given track. No threads are started until
+  /// `Start()` is called.
+  ///
+  /// @warning The ownership of `track` isn't transferred, and, as such, the
+  /// track must outlive the pipeline.
+  ElementaryMediaTrackPipeline(ElementaryMediaTrack* track,
+                               PacketProducer producer,
+                               SeekHandler seek_handler,
+                               Config config);
+  ElementaryMediaTrackPipeline(ElementaryMediaTrack* track,
+                               PacketProducer producer,
+                               SeekHandler seek_handler);
+
+  /// Stops the pipeline, see `Stop()`.
+  ~ElementaryMediaTrackPipeline();
+
+  ElementaryMediaTrackPipeline(const ElementaryMediaTrackPipeline&) = delete;
+  ElementaryMediaTrackPipeline& operator=(const ElementaryMediaTrackPipeline&) =
+      delete;
+
+  ElementaryMediaTrackPipeline(ElementaryMediaTrackPipeline&&);
+  ElementaryMediaTrackPipeline& operator=(ElementaryMediaTrackPipeline&&);
+
+  /// Sets the pipeline as the track's listener and starts the producer and
+  /// appending threads. Packets are appended whenever the track is open.
+  ///
+  /// @return `Result<void>` with `operation_result` field set to
+  /// `OperationResult::kSuccess` on success, otherwise a code describing the
+  /// error.
+  Result<void> Start();
+
+  /// Stops the threads and unsets the track's listener. Waits for a
+  /// `PacketProducer` or `SeekHandler` call in progress to return. Packets
+  /// that were not appended yet are dropped.
+  void Stop();
+
+  /// Returns the duration of packets that were produced but not appended yet.
+  Seconds GetBufferedDuration() const;
+
+ private:
+  class Impl;
+
+  std::unique_ptr<Impl> pimpl_;
+};
+
+}  // namespace wasm
+}  // namespace samsung
+
+#endif  // INCLUDE_SAMSUNG_WASM_ELEMENTARY_MEDIA_TRACK_PIPELINE_H_
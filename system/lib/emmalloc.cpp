@@ -9,7 +9,8 @@
  * Assumptions:
  *
  *  - Pointers are 32-bit.
- *  - Single-threaded.
+ *  - Single-threaded, unless built with pthreads, in which case a lock
+ *    and per-thread caches are used (see "Multithreading" below).
  *  - sbrk() is used, and nothing else.
  *  - sbrk() will not be accessed by anyone else.
  *  - sbrk() is very fast in most cases (internal wasm call).
@@ -46,10 +47,14 @@
 
 #include <assert.h>
 #include <emscripten.h>
+#include <emscripten/emmalloc.h>
 #include <limits.h> // CHAR_BIT
 #include <malloc.h> // mallinfo
 #include <string.h> // for memcpy, memset
 #include <unistd.h> // for sbrk()
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include <pthread.h>
+#endif
 
 #define EMMALLOC_EXPORT __attribute__((__weak__, __visibility__("default")))
 
@@ -240,6 +245,17 @@ static FreeInfo* freeLists[MAX_FREELIST_INDEX] = {nullptr, nullptr, nullptr, nul
   nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
   nullptr, nullptr, nullptr, nullptr, nullptr};
 
+static_assert(MAX_FREELIST_INDEX == EMMALLOC_NUM_FREELISTS, "expected number of freelists");
+
+// Statistics, see emmalloc_get_stats().
+
+// Total memory we received from sbrk().
+static size_t sbrkBytes = 0;
+
+// Payload bytes handed out beyond what was asked for, summed over all
+// allocations so far (free() does not subtract, see total_rounding_bytes).
+static uint64_t roundingBytes = 0;
+
 // Global utilities
 
 // The freelist index is where we would appear in a freelist if
@@ -415,6 +431,7 @@ static int extendLastRegion(size_t size) {
   }
   // sbrk() should give us new space right after the last region.
   assert(ptr == getAfter(lastRegion));
+  sbrkBytes += sbrkSize;
   // Increment the region's size.
   growRegion(lastRegion, sbrkSize);
   return 1;
@@ -505,6 +522,8 @@ void emmalloc_blank_slate_from_orbit() {
   }
   firstRegion = nullptr;
   lastRegion = nullptr;
+  sbrkBytes = 0;
+  roundingBytes = 0;
 }
 
 #ifdef EMMALLOC_DEBUG
@@ -739,6 +758,7 @@ static Region* allocateRegion(size_t size) {
     // If this fails, it means we also leak the previous allocation,
     // so we don't even try to handle it.
     assert((char*)extraPtr == (char*)ptr + sbrkSize);
+    sbrkBytes += extra;
     // After the first allocation, everything must remain aligned forever.
     assert(!lastRegion);
     // We now have a contiguous block of memory from ptr to
@@ -746,6 +766,7 @@ static Region* allocateRegion(size_t size) {
     // fixedPtr is aligned and starts a region of the right
     // amount of memory.
   }
+  sbrkBytes += sbrkSize;
   Region* region = (Region*)fixedPtr;
   // Apply globally
   if (!lastRegion) {
@@ -940,6 +961,35 @@ static struct mallinfo emmalloc_mallinfo() {
   return info;
 }
 
+static void noteAllocation(void* ptr, size_t size) {
+  if (ptr) {
+    roundingBytes += getMaxPayload(fromPayload(ptr)) - size;
+  }
+}
+
+static void emmalloc_get_stats_internal(struct emmalloc_stats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->sbrk_bytes = sbrkBytes;
+  stats->total_rounding_bytes = roundingBytes;
+  for (Region* region = firstRegion; region; region = region->next()) {
+    size_t payload = getMaxPayload(region);
+    stats->metadata_bytes += METADATA_SIZE;
+    if (region->getUsed()) {
+      stats->used_regions++;
+      stats->used_bytes += payload;
+    } else {
+      stats->free_regions++;
+      stats->free_bytes += payload;
+      if (payload > stats->largest_free) {
+        stats->largest_free = payload;
+      }
+      struct emmalloc_freelist_stats* freelist = &stats->freelists[getFreeListIndex(payload)];
+      freelist->count++;
+      freelist->bytes += payload;
+    }
+  }
+}
+
 // An aligned allocation. This is a rarer allocation path, and is
 // much less optimized - the assumption is that it is used for few
 // large allocations.
@@ -1029,6 +1079,214 @@ static void* emmalloc_memalign(size_t alignment, size_t size) {
   return ptr;
 }
 
+// Multithreading
+//
+// With pthreads, all the global state above is protected by a single lock.
+// To keep most small allocations off that lock, each thread caches free
+// regions with small payloads, binned by exact payload size. Cached regions
+// remain marked as used in the shared heap, so nothing else needs to know
+// about them. An empty bin is refilled with a batch of regions carved out
+// of one allocation, and a full bin returns half of its regions to the
+// freelists, each under a single acquisition of the lock.
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+
+// Payloads up to this size are cached.
+static const size_t MAX_CACHED_PAYLOAD = 256;
+
+static const size_t NUM_SIZE_CLASSES = MAX_CACHED_PAYLOAD / ALLOC_UNIT;
+
+// How many regions a bin may hold before we return some.
+static const size_t MAX_CACHED_PER_CLASS = 32;
+
+// How many regions we fetch at once into an empty bin.
+static const size_t CACHE_REFILL_COUNT = 8;
+
+static volatile int heapLock = 0;
+
+static void lockHeap() {
+  while (__sync_lock_test_and_set(&heapLock, 1)) {
+  }
+}
+
+static void unlockHeap() { __sync_lock_release(&heapLock); }
+
+struct ThreadCache {
+  // Singly-linked through FreeInfo::next().
+  FreeInfo* bins[NUM_SIZE_CLASSES];
+  size_t counts[NUM_SIZE_CLASSES];
+  // Not yet added to the global roundingBytes.
+  uint64_t roundingBytes;
+};
+
+static pthread_key_t threadCacheKey;
+static volatile int threadCacheKeyCreated = 0;
+
+static size_t getSizeClass(size_t payload) { return payload / ALLOC_UNIT - 1; }
+
+static void addToThreadCache(ThreadCache* cache, Region* region) {
+  size_t sizeClass = getSizeClass(getMaxPayload(region));
+  FreeInfo* freeInfo = &region->freeInfo();
+  freeInfo->next() = cache->bins[sizeClass];
+  cache->bins[sizeClass] = freeInfo;
+  cache->counts[sizeClass]++;
+}
+
+// Returns cached regions of a size class to the freelists until only
+// |keep| remain. Must be called with the lock held.
+static void releaseFromThreadCache(ThreadCache* cache, size_t sizeClass, size_t keep) {
+  roundingBytes += cache->roundingBytes;
+  cache->roundingBytes = 0;
+  while (cache->counts[sizeClass] > keep) {
+    FreeInfo* freeInfo = cache->bins[sizeClass];
+    cache->bins[sizeClass] = freeInfo->next();
+    cache->counts[sizeClass]--;
+    stopUsing(fromFreeInfo(freeInfo));
+  }
+}
+
+// Runs when a thread exits, giving everything it cached back.
+static void destroyThreadCache(void* arg) {
+  ThreadCache* cache = (ThreadCache*)arg;
+  lockHeap();
+  for (size_t i = 0; i < NUM_SIZE_CLASSES; i++) {
+    releaseFromThreadCache(cache, i, 0);
+  }
+  emmalloc_free(cache);
+  unlockHeap();
+}
+
+static ThreadCache* getThreadCache() {
+  // Workers may allocate before their pthread is set up; they go through
+  // the lock.
+  if (!pthread_self()) {
+    return nullptr;
+  }
+  if (!threadCacheKeyCreated) {
+    lockHeap();
+    if (!threadCacheKeyCreated) {
+      if (pthread_key_create(&threadCacheKey, destroyThreadCache) == 0) {
+        __sync_synchronize();
+        threadCacheKeyCreated = 1;
+      }
+    }
+    unlockHeap();
+    if (!threadCacheKeyCreated) {
+      return nullptr;
+    }
+  }
+  ThreadCache* cache = (ThreadCache*)pthread_getspecific(threadCacheKey);
+  if (!cache) {
+    lockHeap();
+    cache = (ThreadCache*)emmalloc_malloc(sizeof(ThreadCache));
+    unlockHeap();
+    if (!cache) {
+      return nullptr;
+    }
+    memset(cache, 0, sizeof(ThreadCache));
+    pthread_setspecific(threadCacheKey, cache);
+  }
+  return cache;
+}
+
+// Allocates CACHE_REFILL_COUNT adjacent regions of the given payload size
+// as one region, then splits it up and caches the pieces.
+static void refillThreadCache(ThreadCache* cache, size_t payload) {
+  size_t regionSize = METADATA_SIZE + payload;
+  lockHeap();
+  roundingBytes += cache->roundingBytes;
+  cache->roundingBytes = 0;
+  void* ptr = emmalloc_malloc(regionSize * CACHE_REFILL_COUNT - METADATA_SIZE);
+  if (ptr) {
+    Region* first = fromPayload(ptr);
+    Region* next = first->next();
+    Region* curr = first;
+    // The last piece gets any leftover (less than MIN_REGION_SIZE, or
+    // emmalloc_malloc would have split it off).
+    while (size_t((char*)getAfter(curr) - (char*)curr) >= 2 * regionSize) {
+      Region* split = (Region*)((char*)curr + regionSize);
+      split->setTotalSize(curr->getTotalSize() - regionSize);
+      split->setUsed(1);
+      split->prev() = curr;
+      curr->setTotalSize(regionSize);
+      curr = split;
+    }
+    if (next) {
+      next->prev() = curr;
+    } else {
+      lastRegion = curr;
+    }
+    if (getMaxPayload(curr) > MAX_CACHED_PAYLOAD) {
+      Region* prev = curr->prev();
+      stopUsing(curr);
+      curr = prev;
+    }
+    while (1) {
+      Region* prev = curr->prev();
+      addToThreadCache(cache, curr);
+      if (curr == first) {
+        break;
+      }
+      curr = prev;
+    }
+  }
+  unlockHeap();
+}
+
+static void* mallocFromThreadCache(size_t size) {
+  size_t payload = alignUp(size ? size : 1);
+  if (payload > MAX_CACHED_PAYLOAD) {
+    return nullptr;
+  }
+  ThreadCache* cache = getThreadCache();
+  if (!cache) {
+    return nullptr;
+  }
+  size_t sizeClass = getSizeClass(payload);
+  if (!cache->bins[sizeClass]) {
+    refillThreadCache(cache, payload);
+    if (!cache->bins[sizeClass]) {
+      return nullptr;
+    }
+  }
+  FreeInfo* freeInfo = cache->bins[sizeClass];
+  cache->bins[sizeClass] = freeInfo->next();
+  cache->counts[sizeClass]--;
+  Region* region = fromFreeInfo(freeInfo);
+  cache->roundingBytes += getMaxPayload(region) - size;
+  return getPayload(region);
+}
+
+static bool freeToThreadCache(void* ptr) {
+  if (!ptr) {
+    return true;
+  }
+  // Only this thread may touch a region it owns, so its size is stable.
+  Region* region = fromPayload(ptr);
+  if (getMaxPayload(region) > MAX_CACHED_PAYLOAD) {
+    return false;
+  }
+  ThreadCache* cache = getThreadCache();
+  if (!cache) {
+    return false;
+  }
+  addToThreadCache(cache, region);
+  size_t sizeClass = getSizeClass(getMaxPayload(region));
+  if (cache->counts[sizeClass] > MAX_CACHED_PER_CLASS) {
+    lockHeap();
+    releaseFromThreadCache(cache, sizeClass, MAX_CACHED_PER_CLASS / 2);
+    unlockHeap();
+  }
+  return true;
+}
+
+#else
+
+static void lockHeap() {}
+static void unlockHeap() {}
+
+#endif // __EMSCRIPTEN_PTHREADS__
+
 // Public API. This is a thin wrapper around our mirror of it, adding
 // logging and validation when debugging. Otherwise it should inline
 // out.
@@ -1037,6 +1295,13 @@ extern "C" {
 
 EMMALLOC_EXPORT
 void* malloc(size_t size) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+  void* cached = mallocFromThreadCache(size);
+  if (cached) {
+    return cached;
+  }
+#endif
+  lockHeap();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.malloc " + $0)}, size);
@@ -1047,6 +1312,7 @@ void* malloc(size_t size) {
 #endif
 #endif
   void* ptr = emmalloc_malloc(size);
+  noteAllocation(ptr, size);
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.malloc ==> " + $0)}, ptr);
@@ -1056,11 +1322,18 @@ void* malloc(size_t size) {
 #endif
   emmalloc_validate_all();
 #endif
+  unlockHeap();
   return ptr;
 }
 
 EMMALLOC_EXPORT
 void free(void* ptr) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+  if (freeToThreadCache(ptr)) {
+    return;
+  }
+#endif
+  lockHeap();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.free " + $0)}, ptr);
@@ -1077,10 +1350,12 @@ void free(void* ptr) {
 #endif
   emmalloc_validate_all();
 #endif
+  unlockHeap();
 }
 
 EMMALLOC_EXPORT
 void* calloc(size_t nmemb, size_t size) {
+  lockHeap();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.calloc " + $0)}, size);
@@ -1091,6 +1366,7 @@ void* calloc(size_t nmemb, size_t size) {
 #endif
 #endif
   void* ptr = emmalloc_calloc(nmemb, size);
+  noteAllocation(ptr, nmemb * size);
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.calloc ==> " + $0)}, ptr);
@@ -1100,11 +1376,13 @@ void* calloc(size_t nmemb, size_t size) {
 #endif
   emmalloc_validate_all();
 #endif
+  unlockHeap();
   return ptr;
 }
 
 EMMALLOC_EXPORT
 void* realloc(void* ptr, size_t size) {
+  lockHeap();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.realloc " + [ $0, $1 ])}, ptr, size);
@@ -1115,6 +1393,7 @@ void* realloc(void* ptr, size_t size) {
 #endif
 #endif
   void* newPtr = emmalloc_realloc(ptr, size);
+  noteAllocation(newPtr, size);
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.realloc ==> " + $0)}, newPtr);
@@ -1124,11 +1403,13 @@ void* realloc(void* ptr, size_t size) {
 #endif
   emmalloc_validate_all();
 #endif
+  unlockHeap();
   return newPtr;
 }
 
 EMMALLOC_EXPORT
 int posix_memalign(void** memptr, size_t alignment, size_t size) {
+  lockHeap();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.posix_memalign " + [ $0, $1, $2 ])}, memptr, alignment, size);
@@ -1139,6 +1420,7 @@ int posix_memalign(void** memptr, size_t alignment, size_t size) {
 #endif
 #endif
   int result = emmalloc_posix_memalign(memptr, alignment, size);
+  noteAllocation(*memptr, size);
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.posix_memalign ==> " + $0)}, result);
@@ -1148,11 +1430,13 @@ int posix_memalign(void** memptr, size_t alignment, size_t size) {
 #endif
   emmalloc_validate_all();
 #endif
+  unlockHeap();
   return result;
 }
 
 EMMALLOC_EXPORT
 void* memalign(size_t alignment, size_t size) {
+  lockHeap();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.memalign " + [ $0, $1 ])}, alignment, size);
@@ -1163,6 +1447,7 @@ void* memalign(size_t alignment, size_t size) {
 #endif
 #endif
   void* ptr = emmalloc_memalign(alignment, size);
+  noteAllocation(ptr, size);
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.memalign ==> " + $0)}, ptr);
@@ -1172,11 +1457,13 @@ void* memalign(size_t alignment, size_t size) {
 #endif
   emmalloc_validate_all();
 #endif
+  unlockHeap();
   return ptr;
 }
 
 EMMALLOC_EXPORT
 struct mallinfo mallinfo() {
+  lockHeap();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.mallinfo")});
@@ -1186,7 +1473,26 @@ struct mallinfo mallinfo() {
   emmalloc_dump_all();
 #endif
 #endif
-  return emmalloc_mallinfo();
+  // Regions in thread caches are reported as in use.
+  struct mallinfo info = emmalloc_mallinfo();
+  unlockHeap();
+  return info;
+}
+
+EMMALLOC_EXPORT
+void emmalloc_get_stats(struct emmalloc_stats* stats) {
+  lockHeap();
+  emmalloc_get_stats_internal(stats);
+  unlockHeap();
+}
+
+EMMALLOC_EXPORT
+void emmalloc_walk_regions(emmalloc_region_callback callback, void* user_data) {
+  lockHeap();
+  for (Region* region = firstRegion; region; region = region->next()) {
+    callback(region->payload(), getMaxPayload(region), region->getUsed(), user_data);
+  }
+  unlockHeap();
 }
 
 // Export malloc and free as duplicate names emscripten_builtin_malloc and
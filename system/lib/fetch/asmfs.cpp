@@ -48,8 +48,15 @@ struct inode {
   time_t mtime;   // Time when the content was last modified
   time_t atime;   // Time when the content was last accessed
   size_t size;    // Size of the file in bytes
-  size_t capacity; // Amount of bytes allocated to pointer data
-  uint8_t* data;   // The actual file contents.
+  uint8_t** chunks;  // The file contents, in chunks of ASMFS_CHUNK_SIZE bytes. A null entry is a
+                     // chunk that is not resident in memory (all zeroes, or not yet downloaded).
+  size_t num_chunks; // Number of entries allocated in chunks.
+  size_t resident_chunks; // Number of non-null entries in chunks.
+  char* chunk_url;   // If not null, the file contents are downloaded a chunk at a time on demand
+                     // from this URL with range requests, and non-resident chunks are not zeroes.
+                     // The chunk table of such a file is allocated once at open() and not moved,
+                     // and chunks are published into it atomically, as any thread reading the
+                     // file may download them.
 
   INODE_TYPE type;
 
@@ -57,6 +64,18 @@ struct inode {
 
   // Specifies a remote server address where this inode can be located.
   char* remoteurl;
+
+  uint32_t num_children; // Number of inodes in the child chain of this directory.
+  inode** child_index; // Hash buckets of the children of this directory by name, or 0 if this
+                       // directory has too few children to be worth indexing.
+  uint32_t child_index_mask; // Number of buckets in child_index minus one.
+  inode* index_next;   // Next inode in the same bucket of the parent's child_index.
+  uint32_t name_hash;  // Hash of name, computed when this inode is linked to a parent.
+
+  uint32_t open_count; // Number of open file descriptors to this inode.
+  inode* lru_prev;     // Neighbours in the least recently used list of cached remote file
+  inode* lru_next;     // contents, towards the most and least recently used ends.
+  size_t cached_bytes; // Bytes this inode accounts for in the cache, or 0 if not in the list.
 };
 
 #define EM_FILEDESCRIPTOR_MAGIC 0x64666d65U // 'emfd'
@@ -126,6 +145,290 @@ static void inode_abspath(inode* node, char* dst, int dstLen) {
   }
 }
 
+// File contents are stored in fixed-size chunks, so that growing a file does not copy what was
+// already written, and so that a file downloaded with range requests can be partially resident.
+#define ASMFS_CHUNK_SIZE (64 * 1024)
+
+static size_t num_chunks_for_size(size_t size) {
+  return (size + ASMFS_CHUNK_SIZE - 1) / ASMFS_CHUNK_SIZE;
+}
+
+static void free_chunks(inode* node) {
+  for (size_t i = 0; i < node->num_chunks; ++i)
+    free(node->chunks[i]);
+  free(node->chunks);
+  node->chunks = 0;
+  node->num_chunks = 0;
+  node->resident_chunks = 0;
+}
+
+// Frees the resident chunks of a range-fetched file, but keeps its chunk table, which readers on
+// other threads may be looking at.
+static void free_chunk_contents(inode* node) {
+  for (size_t i = 0; i < node->num_chunks; ++i) {
+    free(node->chunks[i]);
+    node->chunks[i] = 0;
+  }
+  node->resident_chunks = 0;
+}
+
+// Grows the chunk table of the given file to hold at least n chunks. Returns false if out of
+// memory.
+static bool reserve_chunks(inode* node, size_t n) {
+  if (n <= node->num_chunks)
+    return true;
+  size_t newNum = node->num_chunks * 2 > n ? node->num_chunks * 2 : n;
+  uint8_t** newChunks = (uint8_t**)realloc(node->chunks, newNum * sizeof(uint8_t*));
+  if (!newChunks)
+    return false;
+  memset(newChunks + node->num_chunks, 0, (newNum - node->num_chunks) * sizeof(uint8_t*));
+  node->chunks = newChunks;
+  node->num_chunks = newNum;
+  return true;
+}
+
+// Copies len bytes from src to the file contents at the given offset, making the chunks in that
+// range resident. Returns false if out of memory.
+static bool write_chunks(inode* node, size_t offset, const uint8_t* src, size_t len) {
+  if (len == 0)
+    return true;
+  if (!reserve_chunks(node, num_chunks_for_size(offset + len)))
+    return false;
+  while (len > 0) {
+    size_t chunk = offset / ASMFS_CHUNK_SIZE;
+    size_t chunkOffset = offset % ASMFS_CHUNK_SIZE;
+    size_t n = ASMFS_CHUNK_SIZE - chunkOffset < len ? ASMFS_CHUNK_SIZE - chunkOffset : len;
+    if (!node->chunks[chunk]) {
+      node->chunks[chunk] = (uint8_t*)calloc(1, ASMFS_CHUNK_SIZE);
+      if (!node->chunks[chunk])
+        return false;
+      ++node->resident_chunks;
+    }
+    memcpy(node->chunks[chunk] + chunkOffset, src, n);
+    src += n;
+    offset += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Makes the given chunk of a range-fetched file resident, with len bytes from src. The chunk is
+// filled before it is published to the chunk table, so concurrent readers see either no chunk or
+// all of it. If another thread downloaded the same chunk first, its copy is kept. Returns false if
+// out of memory.
+static bool publish_chunk(inode* node, size_t chunk, const uint8_t* src, size_t len) {
+  uint8_t* data = (uint8_t*)calloc(1, ASMFS_CHUNK_SIZE);
+  if (!data)
+    return false;
+  memcpy(data, src, len);
+  uint8_t* expected = 0;
+  if (__atomic_compare_exchange_n(
+        &node->chunks[chunk], &expected, data, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    __atomic_add_fetch(&node->resident_chunks, 1, __ATOMIC_RELAXED);
+  else
+    free(data);
+  return true;
+}
+
+// Copies len bytes of the file contents at the given offset to dst. Non-resident chunks read as
+// zeroes.
+static void read_chunks(inode* node, size_t offset, uint8_t* dst, size_t len) {
+  while (len > 0) {
+    size_t chunk = offset / ASMFS_CHUNK_SIZE;
+    size_t chunkOffset = offset % ASMFS_CHUNK_SIZE;
+    size_t n = ASMFS_CHUNK_SIZE - chunkOffset < len ? ASMFS_CHUNK_SIZE - chunkOffset : len;
+    uint8_t* data =
+      chunk < node->num_chunks ? __atomic_load_n(&node->chunks[chunk], __ATOMIC_ACQUIRE) : 0;
+    if (data)
+      memcpy(dst, data + chunkOffset, n);
+    else
+      memset(dst, 0, n);
+    dst += n;
+    offset += n;
+    len -= n;
+  }
+}
+
+// Synchronously downloads bytes [first, last] of the given URL. Must not be called on the main
+// browser thread.
+static emscripten_fetch_t* fetch_range(const char* url, size_t first, size_t last) {
+  char range[64];
+  sprintf(range, "bytes=%zu-%zu", first, last);
+  const char* headers[] = {"Range", range, 0};
+  emscripten_fetch_attr_t attr;
+  emscripten_fetch_attr_init(&attr);
+  strcpy(attr.requestMethod, "GET");
+  // Partial contents must not be cached in or served from IndexedDB, so always go to the server.
+  attr.attributes =
+    EMSCRIPTEN_FETCH_REPLACE | EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_WAITABLE;
+  attr.requestHeaders = headers;
+  emscripten_fetch_t* fetch = emscripten_fetch(&attr, url);
+  emscripten_fetch_wait(fetch, INFINITY);
+  return fetch;
+}
+
+// Downloads the chunks of a range-fetched file that overlap len bytes at the given offset and are
+// not yet resident. Each run of consecutive missing chunks is downloaded with a single request.
+// May be called from several threads at once for the same file. Returns 0 on success, or an errno.
+static int fetch_missing_chunks(inode* node, size_t offset, size_t len) {
+  if (!node->chunk_url || offset >= node->size || len == 0)
+    return 0;
+  size_t end = offset + len < node->size ? offset + len : node->size;
+  size_t firstChunk = offset / ASMFS_CHUNK_SIZE;
+  size_t endChunk = num_chunks_for_size(end);
+  if (endChunk > node->num_chunks)
+    return EIO; // The chunk table is allocated at open(), for the whole file.
+  for (size_t i = firstChunk; i < endChunk;) {
+    if (__atomic_load_n(&node->chunks[i], __ATOMIC_ACQUIRE)) {
+      ++i;
+      continue;
+    }
+    size_t runEnd = i + 1;
+    while (runEnd < endChunk && !__atomic_load_n(&node->chunks[runEnd], __ATOMIC_ACQUIRE))
+      ++runEnd;
+    // The main browser thread cannot block to wait for the download.
+    if (emscripten_is_main_browser_thread())
+      return ENOENT;
+    size_t first = i * ASMFS_CHUNK_SIZE;
+    size_t last = (runEnd * ASMFS_CHUNK_SIZE < node->size ? runEnd * ASMFS_CHUNK_SIZE : node->size) - 1;
+    emscripten_fetch_t* fetch = fetch_range(node->chunk_url, first, last);
+    const uint8_t* data = 0;
+    if (fetch->status == 206 && fetch->numBytes == last - first + 1)
+      data = (const uint8_t*)fetch->data;
+    else if (fetch->status == 200 && fetch->numBytes == node->size) // Server ignored the range.
+      data = (const uint8_t*)fetch->data + first;
+    bool ok = data != 0;
+    for (size_t j = i; ok && j < runEnd; ++j) {
+      size_t chunkStart = j * ASMFS_CHUNK_SIZE;
+      size_t n = last + 1 - chunkStart < ASMFS_CHUNK_SIZE ? last + 1 - chunkStart : ASMFS_CHUNK_SIZE;
+      ok = publish_chunk(node, j, data + (chunkStart - first), n);
+    }
+    int err = data ? ENOMEM : EIO;
+    emscripten_fetch_close(fetch);
+    if (!ok)
+      return err;
+    i = runEnd;
+  }
+  return 0;
+}
+
+// The contents of remote files that can be downloaded again (whole-file downloads, and the chunks
+// of range-fetched files) are kept in a least recently used list. If a cache budget is set, the
+// contents of the least recently used closed files are freed whenever the list takes up more
+// memory than the budget, and downloaded again the next time the file is opened or read.
+static uint64_t cache_budget = 0; // 0 if unlimited.
+static uint64_t cache_bytes = 0;  // Sum of cached_bytes over the list.
+static inode* cache_most_recent = 0;
+static inode* cache_least_recent = 0;
+
+// Guards the fields above, and open_count, lru_prev, lru_next and cached_bytes of all inodes.
+static uint32_t cache_lock = 0;
+
+static void lock_cache() {
+  while (__atomic_exchange_n(&cache_lock, 1, __ATOMIC_ACQUIRE))
+    ;
+}
+
+static void unlock_cache() { __atomic_store_n(&cache_lock, 0, __ATOMIC_RELEASE); }
+
+// Returns the bytes of file contents in memory that can be downloaded again.
+static size_t remote_data_bytes(inode* node) {
+  if (node->chunk_url)
+    return node->resident_chunks * ASMFS_CHUNK_SIZE;
+  if (!node->chunks && node->fetch && node->fetch->data)
+    return node->fetch->numBytes;
+  return 0;
+}
+
+// Must be called with the cache lock held.
+static void cache_unlink(inode* node) {
+  if (!node->cached_bytes)
+    return;
+  if (node->lru_prev)
+    node->lru_prev->lru_next = node->lru_next;
+  else
+    cache_most_recent = node->lru_next;
+  if (node->lru_next)
+    node->lru_next->lru_prev = node->lru_prev;
+  else
+    cache_least_recent = node->lru_prev;
+  node->lru_prev = node->lru_next = 0;
+  cache_bytes -= node->cached_bytes;
+  node->cached_bytes = 0;
+}
+
+// Frees the contents of least recently used closed files until the cache is within budget. Must be
+// called with the cache lock held.
+static void cache_evict() {
+  inode* node = cache_least_recent;
+  while (cache_budget && cache_bytes > cache_budget && node) {
+    inode* prev = node->lru_prev;
+    if (node->open_count == 0) {
+      cache_unlink(node);
+      // The size is kept, so that stat() still reports it.
+      if (node->fetch)
+        emscripten_fetch_close(node->fetch);
+      node->fetch = 0;
+      if (node->chunk_url)
+        free_chunk_contents(node);
+      else
+        free_chunks(node);
+    }
+    node = prev;
+  }
+}
+
+// Adds openCountDelta to the number of open descriptors of the given file, marks its remote
+// contents as the most recently used, and evicts others if over budget.
+static void cache_touch(inode* node, int openCountDelta) {
+  lock_cache();
+  node->open_count += openCountDelta;
+  cache_unlink(node);
+  node->cached_bytes = remote_data_bytes(node);
+  if (node->cached_bytes) {
+    node->lru_next = cache_most_recent;
+    if (cache_most_recent)
+      cache_most_recent->lru_prev = node;
+    else
+      cache_least_recent = node;
+    cache_most_recent = node;
+    cache_bytes += node->cached_bytes;
+  }
+  cache_evict();
+  unlock_cache();
+}
+
+// Removes the given file from the cache, before its contents are freed or become local.
+static void cache_remove(inode* node) {
+  lock_cache();
+  cache_unlink(node);
+  unlock_cache();
+}
+
+void emscripten_asmfs_set_cache_budget(uint64_t bytes) {
+  lock_cache();
+  cache_budget = bytes;
+  cache_evict();
+  unlock_cache();
+}
+
+uint64_t emscripten_asmfs_get_cache_usage() {
+  lock_cache();
+  uint64_t bytes = cache_bytes;
+  unlock_cache();
+  return bytes;
+}
+
+// Guards num_children and the child indices of all directories.
+static uint32_t child_index_lock = 0;
+
+static void lock_child_index() {
+  while (__atomic_exchange_n(&child_index_lock, 1, __ATOMIC_ACQUIRE))
+    ;
+}
+
+static void unlock_child_index() { __atomic_store_n(&child_index_lock, 0, __ATOMIC_RELEASE); }
+
 // Deletes the given inode. Ignores (orphans) any children there might be
 static void delete_inode(inode* node) {
   if (!node)
@@ -135,9 +438,13 @@ static void delete_inode(inode* node) {
 #ifdef ASMFS_DEBUG
   EM_ASM(err('delete_inode: ' + UTF8ToString($0)), node->name);
 #endif
+  cache_remove(node);
   if (node->fetch)
     emscripten_fetch_close(node->fetch);
+  free_chunks(node);
+  free(node->chunk_url);
   free(node->remoteurl);
+  free(node->child_index);
   free(node);
 }
 
@@ -161,10 +468,78 @@ static void delete_inode_tree(inode* node) {
     delete_inode(node);
   } else {
     // For filesystem root, just make sure all children are gone.
+    lock_child_index();
     node->child = 0;
+    node->num_children = 0;
+    free(node->child_index);
+    node->child_index = 0;
+    unlock_child_index();
   }
 }
 
+// Directories get a hash index of their children once they have this many, so that looking up a
+// path component does not need to walk the whole sibling chain.
+#define CHILD_INDEX_MIN_CHILDREN 16
+
+// The index is grown when there are more than this many children per bucket on average.
+#define CHILD_INDEX_MAX_LOAD 2
+
+// FNV-1a hash of a single path component, i.e. up to the first '/' or '\0'.
+static uint32_t hash_inodename(const char* path) {
+  uint32_t hash = 2166136261u;
+  while (*path && *path != '/')
+    hash = (hash ^ (uint8_t)*path++) * 16777619u;
+  return hash;
+}
+
+// (Re)builds the child index of the given directory with the given number of buckets. Must be
+// called with the child index lock held.
+static void build_child_index(inode* dir, uint32_t num_buckets) {
+  inode** buckets = (inode**)calloc(num_buckets, sizeof(inode*));
+  if (!buckets)
+    return; // Lookups fall back to walking the sibling chain.
+  // Append in sibling chain order, so that lookups find the same inode as a walk of the chain
+  // would.
+  for (inode* child = dir->child; child; child = child->sibling) {
+    inode** slot = &buckets[child->name_hash & (num_buckets - 1)];
+    while (*slot)
+      slot = &(*slot)->index_next;
+    child->index_next = 0;
+    *slot = child;
+  }
+  free(dir->child_index);
+  dir->child_index = buckets;
+  dir->child_index_mask = num_buckets - 1;
+}
+
+// Called after node has been added to the front of the child chain of parent. Must be called with
+// the child index lock held.
+static void child_index_add(inode* node, inode* parent) {
+  ++parent->num_children;
+  if (parent->child_index) {
+    inode** bucket = &parent->child_index[node->name_hash & parent->child_index_mask];
+    node->index_next = *bucket;
+    *bucket = node;
+    if (parent->num_children > CHILD_INDEX_MAX_LOAD * (parent->child_index_mask + 1))
+      build_child_index(parent, 2 * (parent->child_index_mask + 1));
+  } else if (parent->num_children >= CHILD_INDEX_MIN_CHILDREN)
+    build_child_index(parent, CHILD_INDEX_MIN_CHILDREN);
+}
+
+// Called when node is removed from the child chain of parent. Must be called with the child index
+// lock held.
+static void child_index_remove(inode* node, inode* parent) {
+  --parent->num_children;
+  if (parent->child_index) {
+    inode** slot = &parent->child_index[node->name_hash & parent->child_index_mask];
+    while (*slot && *slot != node)
+      slot = &(*slot)->index_next;
+    if (*slot)
+      *slot = node->index_next;
+  }
+  node->index_next = 0;
+}
+
 // Makes node the child of parent.
 static void link_inode(inode* node, inode* parent) {
   char parentName[PATH_MAX];
@@ -190,12 +565,18 @@ static void link_inode(inode* node, inode* parent) {
   // However these two operations need to occur atomically in order to be coherent. To ensure that,
   // run the two operations in a CAS loop, which is possible because the first operation is not racy
   // until the node is 'published' to the filesystem tree by the compare_exchange operation.
+  // The CAS keeps lookups that walk the chain without the lock coherent. Linking also holds the
+  // child index lock so that the chain and the index of the parent change together.
+  node->name_hash = hash_inodename(node->name);
+  lock_child_index();
   do {
     __atomic_load(
       &parent->child, &node->sibling, __ATOMIC_SEQ_CST); // node->sibling <- parent->child
   } while (
     !__atomic_compare_exchange(&parent->child, &node->sibling, &node, false, __ATOMIC_SEQ_CST,
       __ATOMIC_SEQ_CST)); // parent->child <- node if it had not raced to change value in between
+  child_index_add(node, parent);
+  unlock_child_index();
 }
 
 // Traverse back in sibling linked list, or 0 if no such node exist.
@@ -221,6 +602,8 @@ static void unlink_inode(inode* node) {
     return;
   node->parent = 0;
 
+  lock_child_index();
+  child_index_remove(node, parent);
   if (parent->child == node) {
     parent->child = node->sibling;
   } else {
@@ -228,6 +611,7 @@ static void unlink_inode(inode* node) {
     if (predecessor)
       predecessor->sibling = node->sibling;
   }
+  unlock_child_index();
   node->parent = node->sibling = 0;
 }
 
@@ -253,6 +637,28 @@ static const char* path_cmp(const char* s1, const char* s2, bool* is_directory)
   return 0;
 }
 
+// Returns the child of the given directory whose name equals the first path component of path,
+// or 0 if there is none.
+static inode* find_child(inode* dir, const char* path) {
+  bool is_directory;
+  uint32_t hash = hash_inodename(path);
+  // The index can be built or freed by another thread, so only look at it under the lock.
+  lock_child_index();
+  inode** index = dir->child_index;
+  if (index) {
+    inode* node = index[hash & dir->child_index_mask];
+    while (node && (node->name_hash != hash || !path_cmp(path, node->name, &is_directory)))
+      node = node->index_next;
+    unlock_child_index();
+    return node;
+  }
+  unlock_child_index();
+  inode* node = dir->child;
+  while (node && !path_cmp(path, node->name, &is_directory))
+    node = node->sibling;
+  return node;
+}
+
 #define NIBBLE_TO_CHAR(x) ("0123456789abcdef"[(x)])
 static void uriEncode(char* dst, int dstLengthBytes, const char* src) {
   char* end =
@@ -332,7 +738,7 @@ static inode* create_directory_hierarchy_for_file(
   if (path_to_file[0] == '\0')
     return 0;
 
-  inode* node = root->child;
+  inode* node = find_child(root, path_to_file);
   while (node) {
     bool is_directory = false;
     const char* child_path = path_cmp(path_to_file, node->name, &is_directory);
@@ -341,41 +747,38 @@ static inode* create_directory_hierarchy_for_file(
                     UTF8ToString($2) + ' .')},
       path_to_file, node->name, child_path);
 #endif
-    if (child_path) {
-      if (is_directory && node->type != INODE_DIR)
-        return 0; // "A component used as a directory in pathname is not, in fact, a directory"
-
-      // The directory name matches.
-      path_to_file = child_path;
-
-      // Traverse . and ..
-      while (path_to_file[0] == '.') {
-        if (path_to_file[1] == '/')
-          path_to_file += 2; // Skip over redundant "./././././" blocks
-        else if (path_to_file[1] == '\0')
-          path_to_file += 1;
-        else if (path_to_file[1] == '.' &&
-                 (path_to_file[2] == '/' ||
-                   path_to_file[2] == '\0')) // Go up to parent directories with ".."
-        {
-          node = node->parent;
-          if (!node)
-            return 0;
-          assert(node->type ==
-                 INODE_DIR); // Anything that is a parent should automatically be a directory.
-          path_to_file += (path_to_file[2] == '/') ? 3 : 2;
-        } else
-          break;
-      }
-      if (path_to_file[0] == '\0')
-        return node;
-      if (path_to_file[0] == '/' && path_to_file[1] == '\0' /* && node is a directory*/)
-        return node;
-      root = node;
-      node = node->child;
-    } else {
-      node = node->sibling;
+    assert(child_path); // find_child() only returns matching nodes.
+    if (is_directory && node->type != INODE_DIR)
+      return 0; // "A component used as a directory in pathname is not, in fact, a directory"
+
+    // The directory name matches.
+    path_to_file = child_path;
+
+    // Traverse . and ..
+    while (path_to_file[0] == '.') {
+      if (path_to_file[1] == '/')
+        path_to_file += 2; // Skip over redundant "./././././" blocks
+      else if (path_to_file[1] == '\0')
+        path_to_file += 1;
+      else if (path_to_file[1] == '.' &&
+               (path_to_file[2] == '/' ||
+                 path_to_file[2] == '\0')) // Go up to parent directories with ".."
+      {
+        node = node->parent;
+        if (!node)
+          return 0;
+        assert(node->type ==
+               INODE_DIR); // Anything that is a parent should automatically be a directory.
+        path_to_file += (path_to_file[2] == '/') ? 3 : 2;
+      } else
+        break;
     }
+    if (path_to_file[0] == '\0')
+      return node;
+    if (path_to_file[0] == '/' && path_to_file[1] == '\0' /* && node is a directory*/)
+      return node;
+    root = node;
+    node = find_child(node, path_to_file);
   }
   const char* basename_pos = basename_part(path_to_file);
 #ifdef ASMFS_DEBUG
@@ -453,48 +856,42 @@ static inode* find_parent_inode(inode* root, const char* path, int* out_errno) {
   const char* basename = basename_part(path);
   if (path == basename)
     RETURN_NODE_AND_ERRNO(root, 0);
-  inode* node = root->child;
+  inode* node = find_child(root, path);
   while (node) {
     bool is_directory = false;
     const char* child_path = path_cmp(path, node->name, &is_directory);
-    if (child_path) {
-      if (is_directory && node->type != INODE_DIR)
-        RETURN_NODE_AND_ERRNO(
-          0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
-
-      // The directory name matches.
-      path = child_path;
-
-      // Traverse . and ..
-      while (path[0] == '.') {
-        if (path[1] == '/')
-          path += 2; // Skip over redundant "./././././" blocks
-        else if (path[1] == '\0')
-          path += 1;
-        else if (path[1] == '.' &&
-                 (path[2] == '/' || path[2] == '\0')) // Go up to parent directories with ".."
-        {
-          node = node->parent;
-          if (!node)
-            RETURN_NODE_AND_ERRNO(0, ENOENT);
-          assert(node->type ==
-                 INODE_DIR); // Anything that is a parent should automatically be a directory.
-          path += (path[2] == '/') ? 3 : 2;
-        } else
-          break;
-      }
-
-      if (path >= basename)
-        RETURN_NODE_AND_ERRNO(node, 0);
-      if (!*path)
-        RETURN_NODE_AND_ERRNO(0, ENOENT);
-      node = node->child;
-      if (node->type != INODE_DIR)
-        RETURN_NODE_AND_ERRNO(
-          0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
-    } else {
-      node = node->sibling;
+    assert(child_path); // find_child() only returns matching nodes.
+    if (is_directory && node->type != INODE_DIR)
+      RETURN_NODE_AND_ERRNO(
+        0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
+
+    // The directory name matches.
+    path = child_path;
+
+    // Traverse . and ..
+    while (path[0] == '.') {
+      if (path[1] == '/')
+        path += 2; // Skip over redundant "./././././" blocks
+      else if (path[1] == '\0')
+        path += 1;
+      else if (path[1] == '.' &&
+               (path[2] == '/' || path[2] == '\0')) // Go up to parent directories with ".."
+      {
+        node = node->parent;
+        if (!node)
+          RETURN_NODE_AND_ERRNO(0, ENOENT);
+        assert(node->type ==
+               INODE_DIR); // Anything that is a parent should automatically be a directory.
+        path += (path[2] == '/') ? 3 : 2;
+      } else
+        break;
     }
+
+    if (path >= basename)
+      RETURN_NODE_AND_ERRNO(node, 0);
+    if (!*path)
+      RETURN_NODE_AND_ERRNO(0, ENOENT);
+    node = find_child(node, path);
   }
   RETURN_NODE_AND_ERRNO(
     0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
@@ -549,49 +946,46 @@ static inode* find_inode(inode* root, const char* path, int* out_errno) {
   if (path[0] == '\0')
     RETURN_NODE_AND_ERRNO(root, 0);
 
-  inode* node = root->child;
+  inode* node = find_child(root, path);
   while (node) {
     bool is_directory = false;
     const char* child_path = path_cmp(path, node->name, &is_directory);
-    if (child_path) {
-      if (is_directory && node->type != INODE_DIR)
-        RETURN_NODE_AND_ERRNO(
-          0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
-
-      // The directory name matches.
-      path = child_path;
-
-      // Traverse . and ..
-      while (path[0] == '.') {
-        if (path[1] == '/')
-          path += 2; // Skip over redundant "./././././" blocks
-        else if (path[1] == '\0')
-          path += 1;
-        else if (path[1] == '.' &&
-                 (path[2] == '/' || path[2] == '\0')) // Go up to parent directories with ".."
-        {
-          node = node->parent;
-          if (!node)
-            RETURN_NODE_AND_ERRNO(0, ENOENT);
-          assert(node->type ==
-                 INODE_DIR); // Anything that is a parent should automatically be a directory.
-          path += (path[2] == '/') ? 3 : 2;
-        } else
-          break;
-      }
-
-      // If we arrived to the end of the search, this is the node we were looking for.
-      if (path[0] == '\0')
-        RETURN_NODE_AND_ERRNO(node, 0);
-      if (path[0] == '/' && node->type != INODE_DIR)
-        RETURN_NODE_AND_ERRNO(
-          0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
-      if (path[0] == '/' && path[1] == '\0')
-        RETURN_NODE_AND_ERRNO(node, 0);
-      node = node->child;
-    } else {
-      node = node->sibling;
+    assert(child_path); // find_child() only returns matching nodes.
+    if (is_directory && node->type != INODE_DIR)
+      RETURN_NODE_AND_ERRNO(
+        0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
+
+    // The directory name matches.
+    path = child_path;
+
+    // Traverse . and ..
+    while (path[0] == '.') {
+      if (path[1] == '/')
+        path += 2; // Skip over redundant "./././././" blocks
+      else if (path[1] == '\0')
+        path += 1;
+      else if (path[1] == '.' &&
+               (path[2] == '/' || path[2] == '\0')) // Go up to parent directories with ".."
+      {
+        node = node->parent;
+        if (!node)
+          RETURN_NODE_AND_ERRNO(0, ENOENT);
+        assert(node->type ==
+               INODE_DIR); // Anything that is a parent should automatically be a directory.
+        path += (path[2] == '/') ? 3 : 2;
+      } else
+        break;
     }
+
+    // If we arrived to the end of the search, this is the node we were looking for.
+    if (path[0] == '\0')
+      RETURN_NODE_AND_ERRNO(node, 0);
+    if (path[0] == '/' && node->type != INODE_DIR)
+      RETURN_NODE_AND_ERRNO(
+        0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
+    if (path[0] == '/' && path[1] == '\0')
+      RETURN_NODE_AND_ERRNO(node, 0);
+    node = find_child(node, path);
   }
   RETURN_NODE_AND_ERRNO(0, ENOENT);
 }
@@ -623,9 +1017,15 @@ void emscripten_asmfs_set_file_data(const char* filename, char* data, size_t siz
     free(data);
     return;
   }
-  free(node->data);
-  node->data = (uint8_t*)data;
-  node->size = node->capacity = size;
+  cache_remove(node);
+  if (node->fetch)
+    emscripten_fetch_close(node->fetch);
+  node->fetch = 0;
+  free_chunks(node);
+  free(node->chunk_url);
+  node->chunk_url = 0;
+  node->size = write_chunks(node, 0, (const uint8_t*)data, size) ? size : 0;
+  free(data);
 }
 
 char* find_last_occurrence(char* str, char ch) {
@@ -853,6 +1253,12 @@ long __syscall4(int which, ...) // write
 }
 
 // TODO: Make thread-local storage.
+static EM_BOOL __emscripten_asmfs_range_requests = EM_FALSE;
+
+void emscripten_asmfs_set_range_requests(EM_BOOL enabled) {
+  __emscripten_asmfs_range_requests = enabled;
+}
+
 static emscripten_asmfs_open_t __emscripten_asmfs_file_open_behavior_mode =
   EMSCRIPTEN_ASMFS_OPEN_REMOTE_DISCOVER;
 
@@ -866,12 +1272,35 @@ emscripten_asmfs_open_t emscripten_asmfs_get_file_open_behavior() {
 
 // Returns true if the given file can be synchronously read by the main browser thread.
 static bool emscripten_asmfs_file_is_synchronously_accessible(inode* node) {
-  return node->data // If file was created from memory without XHR, e.g. via fopen("foo.txt", "w"),
-                    // it will have node->data ptr backing.
+  return (node->chunks && !node->chunk_url) // If file was created from memory without XHR, e.g.
+                                            // via fopen("foo.txt", "w"), it will have chunks.
          ||
          (node->fetch && node->fetch->data); // If the file was downloaded, it will be backed here.
 }
 
+// Copies the contents of a downloaded file to its own chunks, or downloads the rest of a
+// range-fetched file, so that the file can be modified. Returns 0 on success, or an errno.
+static int make_file_data_local(inode* node) {
+  cache_remove(node);
+  if (node->fetch) {
+    if (!node->chunks && node->fetch->data) {
+      if (!write_chunks(node, 0, (const uint8_t*)node->fetch->data, node->fetch->numBytes))
+        return ENOSPC;
+      node->size = node->fetch->numBytes;
+    }
+    emscripten_fetch_close(node->fetch);
+    node->fetch = 0;
+  }
+  if (node->chunk_url) {
+    int err = fetch_missing_chunks(node, 0, node->size);
+    if (err)
+      return err;
+    free(node->chunk_url);
+    node->chunk_url = 0;
+  }
+  return 0;
+}
+
 static long open(const char* pathname, int flags, int mode) {
 #ifdef ASMFS_DEBUG
   EM_ASM(err('open(pathname="' + UTF8ToString($0) + '", flags=0x' + ($1).toString(16) + ', mode=0' +
@@ -946,6 +1375,7 @@ static long open(const char* pathname, int flags, int mode) {
 
   int err;
   inode* node = find_inode(root, relpath, &err);
+  bool pinned = false; // Whether open_count of node has been incremented for this descriptor.
   if (err == ENOTDIR)
     RETURN_ERRNO(
       ENOTDIR, "A component used as a directory in pathname is not, in fact, a directory");
@@ -969,12 +1399,18 @@ static long open(const char* pathname, int flags, int mode) {
       RETURN_ERRNO(EISDIR,
         "pathname refers to a directory and the access flags specified invalid flag O_TRUNC");
 
+    // Count the descriptor as open before looking at the contents, so that they are not evicted
+    // from the cache under us. Every error return from here on must undo this.
+    cache_touch(node, 1);
+    pinned = true;
+
     // A current download exists to the file? Then wait for it to complete.
     if (node->fetch) {
       // On the main thread, the fetch must have already completed before we come here. If not, we
       // cannot stop to wait for it to finish, and must return a failure (file not found)
       if (emscripten_is_main_browser_thread()) {
         if (emscripten_fetch_wait(node->fetch, 0) != EMSCRIPTEN_RESULT_SUCCESS) {
+          cache_touch(node, -1);
           RETURN_ERRNO(ENOENT, "Attempted to open a file that is still downloading on the main browser thread. Could not block to wait! (try preloading the file to the filesystem before application start)");
         }
       } else {
@@ -987,9 +1423,13 @@ static long open(const char* pathname, int flags, int mode) {
   if ((flags & O_CREAT) && ((flags & O_TRUNC) || (flags & O_EXCL))) {
     // Create a new empty file or truncate existing one.
     if (node) {
+      cache_remove(node);
       if (node->fetch)
         emscripten_fetch_close(node->fetch);
       node->fetch = 0;
+      free_chunks(node);
+      free(node->chunk_url);
+      node->chunk_url = 0;
       node->size = 0;
     } else if ((flags & O_CREAT)) {
       inode* directory = create_directory_hierarchy_for_file(root, relpath, mode);
@@ -997,8 +1437,11 @@ static long open(const char* pathname, int flags, int mode) {
       strcpy(node->name, basename_part(pathname));
       link_inode(node, directory);
     }
-  } else if (!node || (node->type == INODE_FILE && !node->fetch && !node->data)) {
+  } else if (!node ||
+             (node->type == INODE_FILE && !node->fetch && !node->chunks && !node->chunk_url)) {
     emscripten_fetch_t* fetch = 0;
+    emscripten_fetch_t* rangeFetch = 0; // First chunk of a file to download with range requests.
+    char path[3 * PATH_MAX + 4]; // times 3 because uri-encoding can expand the filename at most 3x.
     if (!(flags & O_DIRECTORY) && accessMode != O_WRONLY) // Opening a file for reading?
     {
       // If there's no inode entry, check if we're not even interested in downloading the file?
@@ -1010,42 +1453,66 @@ static long open(const char* pathname, int flags, int mode) {
 
       // Report an error if there is an inode entry, but file data is not synchronously available
       // and it should have been.
-      if (node && !node->data &&
+      if (node && !node->chunks &&
           __emscripten_asmfs_file_open_behavior_mode == EMSCRIPTEN_ASMFS_OPEN_MEMORY) {
+        cache_touch(node, -1);
         RETURN_ERRNO(
           ENOENT, "O_CREAT is not set, the named file exists, but file data is not synchronously available in memory (EMSCRIPTEN_ASMFS_OPEN_MEMORY specified)");
       }
 
       if (emscripten_is_main_browser_thread() &&
           (!node || !emscripten_asmfs_file_is_synchronously_accessible(node))) {
+        if (pinned)
+          cache_touch(node, -1);
         RETURN_ERRNO(ENOENT,
           "O_CREAT is not set, the named file exists, but file data is not synchronously available in memory, and file open is attempted on the main thread which cannot synchronously open files! (try preloading the file to the filesystem before application start)");
       }
 
-      // Kick off the file download, either from IndexedDB or via an XHR.
-      emscripten_fetch_attr_t attr;
-      emscripten_fetch_attr_init(&attr);
-      strcpy(attr.requestMethod, "GET");
-      attr.attributes = EMSCRIPTEN_FETCH_APPEND | EMSCRIPTEN_FETCH_LOAD_TO_MEMORY |
-                        EMSCRIPTEN_FETCH_WAITABLE | EMSCRIPTEN_FETCH_PERSIST_FILE;
-      // If asked to only do a read from IndexedDB, don't perform an XHR.
-      if (__emscripten_asmfs_file_open_behavior_mode == EMSCRIPTEN_ASMFS_OPEN_INDEXEDDB) {
-        attr.attributes |= EMSCRIPTEN_FETCH_NO_DOWNLOAD;
-      }
-      char
-        path[3 * PATH_MAX + 4]; // times 3 because uri-encoding can expand the filename at most 3x.
       emscripten_asmfs_remote_url(pathname, path, 3 * PATH_MAX + 4);
-      fetch = emscripten_fetch(&attr, path);
 
-      // Synchronously wait for the fetch to complete.
-      // NOTE: Theoretically could postpone blocking until the first read to the file, but the issue
-      // there is that we wouldn't be able to return ENOENT below if the file did not exist on the
-      // server, which could be harmful for some applications. Also fread()/fseek() very often
-      // immediately follows fopen(), so the win would not be too great anyways.
-      emscripten_fetch_wait(fetch, INFINITY);
+      // If range requests are enabled, download only the first chunk of the file now, and the rest
+      // on demand when read. This also tells whether the file exists on the server. If the server
+      // does not support range requests, it returns the whole file, which is then used as is.
+      if (__emscripten_asmfs_range_requests &&
+          __emscripten_asmfs_file_open_behavior_mode != EMSCRIPTEN_ASMFS_OPEN_INDEXEDDB) {
+        rangeFetch = fetch_range(path, 0, ASMFS_CHUNK_SIZE - 1);
+        if (rangeFetch->status == 200) {
+          fetch = rangeFetch;
+          rangeFetch = 0;
+        } else if (rangeFetch->status != 206 || rangeFetch->totalBytes == 0 ||
+                   rangeFetch->totalBytes < rangeFetch->numBytes) {
+          // Not a usable partial response. A 206 reports a totalBytes of 0 if the size of the
+          // whole file is not known, e.g. if Content-Range is not exposed by CORS, or is "*".
+          emscripten_fetch_close(rangeFetch);
+          rangeFetch = 0;
+        }
+      }
+
+      if (!fetch && !rangeFetch) {
+        // Kick off the file download, either from IndexedDB or via an XHR.
+        emscripten_fetch_attr_t attr;
+        emscripten_fetch_attr_init(&attr);
+        strcpy(attr.requestMethod, "GET");
+        attr.attributes = EMSCRIPTEN_FETCH_APPEND | EMSCRIPTEN_FETCH_LOAD_TO_MEMORY |
+                          EMSCRIPTEN_FETCH_WAITABLE | EMSCRIPTEN_FETCH_PERSIST_FILE;
+        // If asked to only do a read from IndexedDB, don't perform an XHR.
+        if (__emscripten_asmfs_file_open_behavior_mode == EMSCRIPTEN_ASMFS_OPEN_INDEXEDDB) {
+          attr.attributes |= EMSCRIPTEN_FETCH_NO_DOWNLOAD;
+        }
+        fetch = emscripten_fetch(&attr, path);
+
+        // Synchronously wait for the fetch to complete.
+        // NOTE: Theoretically could postpone blocking until the first read to the file, but the
+        // issue there is that we wouldn't be able to return ENOENT below if the file did not exist
+        // on the server, which could be harmful for some applications. Also fread()/fseek() very
+        // often immediately follows fopen(), so the win would not be too great anyways.
+        emscripten_fetch_wait(fetch, INFINITY);
+      }
 
-      if (!(flags & O_CREAT) && (fetch->status != 200 || fetch->totalBytes == 0)) {
+      if (fetch && !(flags & O_CREAT) && (fetch->status != 200 || fetch->totalBytes == 0)) {
         emscripten_fetch_close(fetch);
+        if (pinned)
+          cache_touch(node, -1);
         RETURN_ERRNO(ENOENT, "O_CREAT is not set and the named file does not exist (attempted emscripten_fetch() XHR to download)");
       }
     }
@@ -1056,8 +1523,8 @@ static long open(const char* pathname, int flags, int mode) {
         node->fetch = fetch;
     } else if ((flags &
                  O_CREAT) // If the filesystem entry did not exist, but we have a create flag, ...
-               || (!node && fetch)) // ... or if it did not exist in our fs, but it could be found
-                                    // via fetch(), ...
+               || (!node && (fetch || rangeFetch))) // ... or if it did not exist in our fs, but it
+                                                    // could be found via fetch(), ...
     {
       // ... add it as a new entry to the fs.
       inode* directory = create_directory_hierarchy_for_file(root, relpath, mode);
@@ -1071,14 +1538,34 @@ static long open(const char* pathname, int flags, int mode) {
       RETURN_ERRNO(ENOENT, "O_CREAT is not set and the named file does not exist");
     }
     node->size = fetch ? node->fetch->totalBytes : 0;
+    if (rangeFetch) {
+      // The rest of the file is downloaded on demand from the same URL.
+      size_t n = rangeFetch->numBytes < ASMFS_CHUNK_SIZE ? rangeFetch->numBytes : ASMFS_CHUNK_SIZE;
+      node->size = rangeFetch->totalBytes;
+      node->chunk_url = strdup(path);
+      bool ok = node->chunk_url && reserve_chunks(node, num_chunks_for_size(node->size)) &&
+                publish_chunk(node, 0, (const uint8_t*)rangeFetch->data, n);
+      emscripten_fetch_close(rangeFetch);
+      if (!ok) {
+        free_chunks(node);
+        free(node->chunk_url);
+        node->chunk_url = 0;
+        node->size = 0;
+        if (pinned)
+          cache_touch(node, -1);
+        RETURN_ERRNO(ENOMEM, "Out of memory when storing the first chunk of a range-fetched file");
+      }
+    }
   }
 
   FileDescriptor* desc = (FileDescriptor*)malloc(sizeof(FileDescriptor));
   desc->magic = EM_FILEDESCRIPTOR_MAGIC;
   desc->node = node;
-  desc->file_pos = ((flags & O_APPEND) && node->fetch) ? node->fetch->totalBytes : 0;
+  desc->file_pos =
+    (flags & O_APPEND) ? (node->fetch ? (ssize_t)node->fetch->totalBytes : (ssize_t)node->size) : 0;
   desc->mode = mode;
   desc->flags = flags;
+  cache_touch(node, pinned ? 0 : 1);
 
   // TODO: The file descriptor needs to be a small number, man page:
   // "a small, nonnegative integer for use in subsequent system calls
@@ -1125,11 +1612,14 @@ static long close(int fd) {
     //       can work for many
     //		 cases, but some kind of custom API might be best to add in the future? (e.g.
     //emscripten_fclose_and_retain() vs emscripten_fclose_and_free()?)
-    if (!emscripten_is_main_browser_thread()) {
+    // If a cache budget is set, keep the file in memory for reopening, until it gets evicted.
+    if (!emscripten_is_main_browser_thread() && !cache_budget) {
       emscripten_fetch_close(desc->node->fetch);
       desc->node->fetch = 0;
     }
   }
+  if (desc->node)
+    cache_touch(desc->node, -1);
   desc->magic = 0;
   free(desc);
   return 0;
@@ -1549,19 +2039,26 @@ void emscripten_asmfs_unload_data(const char* pathname) {
   if (!node)
     return;
 
-  free(node->data);
-  node->data = 0;
-  node->size = node->capacity = 0;
+  cache_remove(node);
+  // A range-fetched file keeps its size, URL and chunk table, so its chunks can be downloaded again
+  // on demand.
+  if (node->chunk_url) {
+    free_chunk_contents(node);
+  } else {
+    free_chunks(node);
+    node->size = 0;
+  }
 }
 
 uint64_t emscripten_asmfs_compute_memory_usage_at_node(inode* node) {
   if (!node)
     return 0;
   uint64_t sz = sizeof(inode);
-  if (node->data)
-    sz += node->capacity > node->size ? node->capacity : node->size;
+  sz += node->num_chunks * sizeof(uint8_t*) + node->resident_chunks * ASMFS_CHUNK_SIZE;
   if (node->fetch && node->fetch->data)
     sz += node->fetch->numBytes;
+  if (node->child_index)
+    sz += (node->child_index_mask + 1) * sizeof(inode*);
   return sz + emscripten_asmfs_compute_memory_usage_at_node(node->child) +
          emscripten_asmfs_compute_memory_usage_at_node(node->sibling);
 }
@@ -1570,6 +2067,20 @@ uint64_t emscripten_asmfs_compute_memory_usage() {
   return emscripten_asmfs_compute_memory_usage_at_node(filesystem_root());
 }
 
+static void compute_chunk_usage_at_node(inode* node, uint64_t* residentChunks, uint64_t* totalChunks) {
+  for (; node; node = node->sibling) {
+    *residentChunks += node->resident_chunks;
+    if (node->type == INODE_FILE)
+      *totalChunks += num_chunks_for_size(node->size);
+    compute_chunk_usage_at_node(node->child, residentChunks, totalChunks);
+  }
+}
+
+void emscripten_asmfs_compute_chunk_usage(uint64_t* residentChunks, uint64_t* totalChunks) {
+  *residentChunks = *totalChunks = 0;
+  compute_chunk_usage_at_node(filesystem_root(), residentChunks, totalChunks);
+}
+
 long __syscall39(int which, ...) // mkdir
 {
   va_list vl;
@@ -1816,7 +2327,7 @@ long __syscall145(int which, ...) // readv
       emscripten_fetch_wait(node->fetch, INFINITY);
   }
 
-  if (node->size > 0 && !node->data && (!node->fetch || !node->fetch->data))
+  if (node->size > 0 && !node->chunks && !node->chunk_url && (!node->fetch || !node->fetch->data))
     RETURN_ERRNO(-1, "ASMFS internal error: no file data available");
   if (iovcnt < 0)
     RETURN_ERRNO(EINVAL, "The vector count, iovcnt, is less than zero");
@@ -1833,14 +2344,26 @@ long __syscall145(int which, ...) // readv
   }
 
   size_t offset = desc->file_pos;
-  uint8_t* data = node->data ? node->data : (node->fetch ? (uint8_t*)node->fetch->data : 0);
-  size_t size = node->data ? node->size : (node->fetch ? node->fetch->numBytes : 0);
+  // A downloaded file is read directly from the fetch, other files from their chunks.
+  uint8_t* data = (!node->chunks && node->fetch) ? (uint8_t*)node->fetch->data : 0;
+  size_t size = data ? node->fetch->numBytes : node->size;
+  if (!data && node->chunk_url) {
+    int err = fetch_missing_chunks(node, offset, total_read_amount);
+    if (err == ENOENT)
+      RETURN_ERRNO(ENOENT, "Attempted to read a part of a file that has not been downloaded on the main browser thread. Could not block to wait!");
+    if (err)
+      RETURN_ERRNO(err, "Downloading the requested part of the file failed");
+    cache_touch(node, 0);
+  }
   for (int i = 0; i < iovcnt; ++i) {
     ssize_t dataLeft = size - offset;
     if (dataLeft <= 0)
       break;
     size_t bytesToCopy = (size_t)dataLeft < iov[i].iov_len ? dataLeft : iov[i].iov_len;
-    memcpy(iov[i].iov_base, &data[offset], bytesToCopy);
+    if (data)
+      memcpy(iov[i].iov_base, &data[offset], bytesToCopy);
+    else
+      read_chunks(node, offset, (uint8_t*)iov[i].iov_base, bytesToCopy);
 #ifdef ASMFS_DEBUG
     EM_ASM(err('readv requested to read ' + $0 + ', read  ' + $1 + ' bytes from offset ' + $2 +
                ', new offset: ' + $3 + ' (file size: ' + $4 + ')'),
@@ -1896,30 +2419,27 @@ long __syscall146(int which, ...) // writev
     }
     return bytesWritten;
   } else {
-    // Enlarge the file in memory to fit space for the new data
-    size_t newSize = desc->file_pos + total_write_amount;
     inode* node = desc->node;
-    if (node->capacity < newSize) {
-      size_t newCapacity =
-        (newSize > (size_t)(node->capacity * 1.25)
-            ? newSize
-            : (size_t)(
-                node->capacity * 1.25)); // Geometric increases in size for amortized O(1) behavior
-      uint8_t* newData = (uint8_t*)realloc(node->data, newCapacity);
-      if (!newData) {
-        newData = (uint8_t*)malloc(newCapacity);
-        memcpy(newData, node->data, node->size);
-        // TODO: init gaps with zeroes.
-        free(node->data);
-      }
-      node->data = newData;
-      node->size = newSize;
-      node->capacity = newCapacity;
+    if (node->fetch) {
+      if (emscripten_is_main_browser_thread()) {
+        if (emscripten_fetch_wait(node->fetch, 0) != EMSCRIPTEN_RESULT_SUCCESS) {
+          RETURN_ERRNO(ENOENT, "Attempted to write a file that is still downloading on the main browser thread. Could not block to wait! (try preloading the file to the filesystem before application start)");
+        }
+      } else
+        emscripten_fetch_wait(node->fetch, INFINITY);
     }
+    int err = make_file_data_local(node);
+    if (err)
+      RETURN_ERRNO(err, "Could not bring the file contents to memory for writing");
 
+    // The file grows a chunk at a time, so earlier contents are never copied. Any gap between the
+    // old end of the file and file_pos stays non-resident, and reads back as zeroes.
     for (int i = 0; i < iovcnt; ++i) {
-      memcpy((uint8_t*)node->data + desc->file_pos, iov[i].iov_base, iov[i].iov_len);
+      if (!write_chunks(node, desc->file_pos, (const uint8_t*)iov[i].iov_base, iov[i].iov_len))
+        RETURN_ERRNO(ENOSPC, "Out of memory for the file contents");
       desc->file_pos += iov[i].iov_len;
+      if ((size_t)desc->file_pos > node->size)
+        node->size = desc->file_pos;
     }
   }
   return total_write_amount;
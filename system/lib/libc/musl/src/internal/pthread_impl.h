@@ -62,6 +62,11 @@ struct pthread {
 	void *stdio_locks;
 	uintptr_t canary_at_end;
 	void **dtv_copy;
+#ifdef __EMSCRIPTEN__
+	// Calls proxied to this thread that it has not started processing yet, most recently queued
+	// first. See emscripten_async_queue_call_on_thread().
+	void *volatile proxied_calls;
+#endif
 };
 
 struct __timer {
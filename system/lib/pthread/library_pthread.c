@@ -197,6 +197,9 @@ int emscripten_builtin_pthread_create(void *thread, void *attr,
 #endif
 #endif
 
+// Value of em_queued_call::calleeDelete for calls that are part of an em_queued_call_batch.
+#define CALL_OWNED_BY_BATCH 2
+
 static void _do_call(em_queued_call* q) {
   // C function pointer
   assert(EM_FUNC_SIG_NUM_FUNC_ARGUMENTS(q->functionEnum) <= EM_QUEUED_CALL_MAX_ARGS);
@@ -351,7 +354,9 @@ static void _do_call(em_queued_call* q) {
 
   // If the caller is detached from this operation, it is the main thread's responsibility to free
   // up the call object.
-  if (q->calleeDelete) {
+  if (q->calleeDelete == CALL_OWNED_BY_BATCH) {
+    // Nothing to do, the calls of a batch are freed together after the last one has run.
+  } else if (q->calleeDelete) {
     emscripten_async_waitable_close(q);
     // No need to wake a listener, nothing is listening to this since the call object is detached.
   } else {
@@ -361,54 +366,141 @@ static void _do_call(em_queued_call* q) {
   }
 }
 
-#define CALL_QUEUE_SIZE 128
-
-typedef struct CallQueue {
-  void* target_thread;
-  em_queued_call** call_queue;
-  int call_queue_head; // Shared data synchronized by call_queue_lock.
-  int call_queue_tail;
-  struct CallQueue* next;
-} CallQueue;
-
-// Currently global to the queue, but this can be improved to be per-queue specific. (TODO: with
-// lockfree list operations on callQueue_head, or removing the list by moving this data to
-// pthread_t)
-static pthread_mutex_t call_queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static CallQueue* callQueue_head = 0;
-
-static CallQueue* GetQueue(
-  void* target) // Not thread safe, call while having call_queue_lock obtained.
-{
-  assert(target);
-  CallQueue* q = callQueue_head;
-  while (q && q->target_thread != target)
-    q = q->next;
-  return q;
+// Calls proxied to a thread are pushed onto a lock-free list in its thread structure,
+// pthread::proxied_calls, linked through em_queued_call::next. Any number of threads can push to
+// it at once with a compare-and-swap, and the target thread takes the whole list with a single
+// atomic exchange. So producers never wait for space in the queue, and finding the queue of a
+// thread takes no lookup.
+//
+// The thread structure is freed when a thread exits, so before pushing to a thread other than the
+// main browser thread (which never exits), producers look it up in the set of live threads below.
+// The set is guarded by live_threads_lock, which is also held while a thread is removed from it
+// before its structure is freed, so a thread that is found stays valid until the lock is released.
+
+static pthread_mutex_t live_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t* live_threads = 0; // Open addressing hash set of thread structures.
+static uint32_t live_threads_mask = 0; // Number of slots in live_threads minus one.
+static uint32_t num_live_threads = 0;
+
+// Returns the slot of the given thread in live_threads, or the empty slot where it would go.
+// live_threads must not be null. Must be called with live_threads_lock held.
+static uint32_t live_thread_slot(pthread_t thread) {
+  // Thread structures are malloc()ed, so the low bits of their addresses are alike.
+  uint32_t i = (((uint32_t)thread >> 3) * 2654435761u) & live_threads_mask;
+  while (live_threads[i] && live_threads[i] != thread)
+    i = (i + 1) & live_threads_mask;
+  return i;
+}
+
+// Called when the structure of a new thread has been allocated, before calls can be proxied to it.
+void EMSCRIPTEN_KEEPALIVE emscripten_register_live_thread(pthread_t thread) {
+  pthread_t* newThreads = 0;
+  uint32_t newNumSlots = 0;
+  pthread_t* oldThreads = 0;
+  for (;;) {
+    pthread_mutex_lock(&live_threads_lock);
+    uint32_t numSlots = live_threads ? live_threads_mask + 1 : 0;
+    // Keep the set at most half full, so that lookups always find an empty slot to stop at.
+    if (2 * (num_live_threads + 1) <= numSlots)
+      break;
+    if (newThreads && newNumSlots > numSlots) {
+      oldThreads = live_threads;
+      live_threads = newThreads;
+      live_threads_mask = newNumSlots - 1;
+      newThreads = 0;
+      for (uint32_t i = 0; i < numSlots; ++i)
+        if (oldThreads[i])
+          live_threads[live_thread_slot(oldThreads[i])] = oldThreads[i];
+      break;
+    }
+    pthread_mutex_unlock(&live_threads_lock);
+    // Allocate without holding the lock: while malloc() waits, the main thread processes proxied
+    // calls, which take the lock.
+    free(newThreads);
+    newNumSlots = numSlots ? 2 * numSlots : 16;
+    newThreads = (pthread_t*)calloc(newNumSlots, sizeof(pthread_t));
+    if (!newThreads)
+      return; // Calls proxied to this thread are then dropped, as if it had exited.
+  }
+  uint32_t i = live_thread_slot(thread);
+  if (!live_threads[i]) {
+    live_threads[i] = thread;
+    ++num_live_threads;
+  }
+  pthread_mutex_unlock(&live_threads_lock);
+  free(oldThreads);
+  free(newThreads); // If another thread grew the set first.
+}
+
+// Called before the structure of an exited thread is freed. Calls proxied to it afterwards are
+// dropped.
+void EMSCRIPTEN_KEEPALIVE emscripten_unregister_live_thread(pthread_t thread) {
+  pthread_mutex_lock(&live_threads_lock);
+  if (live_threads) {
+    uint32_t i = live_thread_slot(thread);
+    if (live_threads[i]) {
+      live_threads[i] = 0;
+      --num_live_threads;
+      // Reinsert the rest of the run of occupied slots after it, so lookups do not stop at the hole.
+      for (uint32_t j = (i + 1) & live_threads_mask; live_threads[j];
+           j = (j + 1) & live_threads_mask) {
+        pthread_t t = live_threads[j];
+        live_threads[j] = 0;
+        live_threads[live_thread_slot(t)] = t;
+      }
+    }
+  }
+  pthread_mutex_unlock(&live_threads_lock);
+}
+
+// Pushes calls to the queue of the given thread. The calls are linked through next from the last
+// one to run (newest) to the first one (oldest). Returns 1 if the queue was empty.
+static int push_proxied_calls(
+  pthread_t target_thread, em_queued_call* newest, em_queued_call* oldest) {
+  uint32_t head;
+  do {
+    head = emscripten_atomic_load_u32((void*)&target_thread->proxied_calls);
+    oldest->next = (em_queued_call*)head;
+  } while (emscripten_atomic_cas_u32(
+             (void*)&target_thread->proxied_calls, head, (uint32_t)newest) != head);
+  return head == 0;
 }
 
-static CallQueue* GetOrAllocateQueue(
-  void* target) // Not thread safe, call while having call_queue_lock obtained.
-{
-  CallQueue* q = GetQueue(target);
-  if (q)
-    return q;
-
-  q = (CallQueue*)malloc(sizeof(CallQueue));
-  q->target_thread = target;
-  q->call_queue = 0;
-  q->call_queue_head = 0;
-  q->call_queue_tail = 0;
-  q->next = 0;
-  if (callQueue_head) {
-    CallQueue* last = callQueue_head;
-    while (last->next)
-      last = last->next;
-    last->next = q;
+// Called after pushing to an empty queue of the given thread. The thread is then likely idle in
+// the browser event loop, so send a message to it to ensure that it wakes up to start processing
+// the calls we have posted. If the queue was not empty, the message for the earlier calls has not
+// been handled yet, and will pick up the new calls too.
+static void wake_thread_for_proxied_calls(pthread_t target_thread) {
+  if (target_thread == emscripten_main_browser_thread_id()) {
+    EM_ASM(postMessage({cmd : 'processQueuedMainThreadWork'}));
   } else {
-    callQueue_head = q;
+    EM_ASM(
+      {
+        if (!ENVIRONMENT_IS_PTHREAD) {
+          // The thread may have exited since the calls were pushed.
+          if (PThread.pthreads[$0] && PThread.pthreads[$0].worker)
+            PThread.pthreads[$0].worker.postMessage({cmd : 'processThreadQueue'});
+        } else {
+          postMessage({targetThread : $0, cmd : 'processThreadQueue'});
+        }
+      },
+      target_thread);
   }
-  return q;
+}
+
+// Takes all calls in the queue of the calling thread, and returns them in the order they were
+// queued.
+static em_queued_call* take_proxied_calls() {
+  em_queued_call* call =
+    (em_queued_call*)emscripten_atomic_exchange_u32((void*)&pthread_self()->proxied_calls, 0);
+  em_queued_call* calls = 0;
+  while (call) {
+    em_queued_call* next = call->next;
+    call->next = calls;
+    calls = call;
+    call = next;
+  }
+  return calls;
 }
 
 EMSCRIPTEN_RESULT emscripten_wait_for_call_v(em_queued_call* call, double timeoutMSecs) {
@@ -474,80 +566,28 @@ static void EMSCRIPTEN_KEEPALIVE emscripten_async_queue_call_on_thread(
     return;
   }
 
-  // Add the operation to the call queue of the main runtime thread.
-  pthread_mutex_lock(&call_queue_lock);
-  CallQueue* q = GetOrAllocateQueue(target_thread);
-  if (!q->call_queue)
-    q->call_queue = malloc(
-      sizeof(em_queued_call*) * CALL_QUEUE_SIZE); // Shared data synchronized by call_queue_lock.
-
-  int head = emscripten_atomic_load_u32((void*)&q->call_queue_head);
-  int tail = emscripten_atomic_load_u32((void*)&q->call_queue_tail);
-  int new_tail = (tail + 1) % CALL_QUEUE_SIZE;
-
-  while (new_tail == head) { // Queue is full?
-    pthread_mutex_unlock(&call_queue_lock);
-
-    // If queue of the main browser thread is full, then we wait. (never drop messages for the main
-    // browser thread)
-    if (target_thread == emscripten_main_browser_thread_id()) {
-      emscripten_futex_wait((void*)&q->call_queue_head, head, INFINITY);
-      pthread_mutex_lock(&call_queue_lock);
-      head = emscripten_atomic_load_u32((void*)&q->call_queue_head);
-      tail = emscripten_atomic_load_u32((void*)&q->call_queue_tail);
-      new_tail = (tail + 1) % CALL_QUEUE_SIZE;
-    } else {
-      // For the queues of other threads, just drop the message.
-      // #if DEBUG TODO: a debug build of pthreads library?
-      //			EM_ASM(console.error('Pthread queue overflowed, dropping queued
-      //message to thread. ' + new Error().stack));
-      // #endif
-      em_queued_call_free(call);
-      return;
-    }
+  if (target_thread == emscripten_main_browser_thread_id()) {
+    if (push_proxied_calls(target_thread, call, call))
+      wake_thread_for_proxied_calls(target_thread);
+    return;
   }
 
-  q->call_queue[tail] = call;
-
-  // If the call queue was empty, the main runtime thread is likely idle in the browser event loop,
-  // so send a message to it to ensure that it wakes up to start processing the command we have
-  // posted.
-  if (head == tail) {
-    if (target_thread == emscripten_main_browser_thread_id()) {
-      EM_ASM(postMessage({cmd : 'processQueuedMainThreadWork'}));
-    } else {
-      int success = EM_ASM_INT(
-        {
-          if (!ENVIRONMENT_IS_PTHREAD) {
-            if (!PThread.pthreads[$0] || !PThread.pthreads[$0].worker) {
-              // #if DEBUG
-              //						Module.printErr('Cannot send message
-              //to thread with ID ' + $0 + ', unknown thread ID!');
-              // #endif
-              return 0;
-            }
-            PThread.pthreads[$0].worker.postMessage({cmd : 'processThreadQueue'});
-          } else {
-            postMessage({targetThread : $0, cmd : 'processThreadQueue'});
-          }
-          return 1;
-        },
-        target_thread);
-
-      // Failed to dispatch the thread, delete the crafted message.
-      if (!success) {
-        em_queued_call_free(call);
-        pthread_mutex_unlock(&call_queue_lock);
-        return;
-      }
-
-      // TODO: Need to postMessage() to a specific target Worker that is hosting target_thread....
-    }
+  // Calls to threads that no longer exist are dropped. The thread must be looked up and pushed to
+  // while holding the lock, so that it cannot be freed in between.
+  pthread_mutex_lock(&live_threads_lock);
+  int exists = live_threads && live_threads[live_thread_slot(target_thread)];
+  int wasEmpty = exists && push_proxied_calls(target_thread, call, call);
+  pthread_mutex_unlock(&live_threads_lock);
+  if (!exists) {
+    // #if DEBUG
+    //				Module.printErr('Cannot send message to thread with ID ' + $0 + ', unknown
+    //thread ID!');
+    // #endif
+    em_queued_call_free(call);
+    return;
   }
-
-  emscripten_atomic_store_u32((void*)&q->call_queue_tail, new_tail);
-
-  pthread_mutex_unlock(&call_queue_lock);
+  if (wasEmpty)
+    wake_thread_for_proxied_calls(target_thread);
 }
 
 void EMSCRIPTEN_KEEPALIVE emscripten_async_run_in_main_thread(em_queued_call* call) {
@@ -674,53 +714,82 @@ void* EMSCRIPTEN_KEEPALIVE emscripten_sync_run_in_main_thread_7(int function, vo
   return q.returnValue.vp;
 }
 
-// Since the number of queued heavy calls is not limited by CALL_QUEUE_SIZE,
-// we use a linked list, not a buffer.
-// Doubly-linked to make adding new calls at the end fast.
-typedef struct heavy_call_queue {
+// Heavy calls that are waiting for a descriptor to become ready, kept as a
+// binary min-heap on end_time so the earliest deadline is always at index 0.
+// Calls without a timeout have an end_time of INFINITY.
+typedef struct heavy_call {
   em_queued_call* call;
   double end_time;
   int call_no;
-  struct heavy_call_queue* next;
-  struct heavy_call_queue* prev;
-} heavy_call_queue;
+} heavy_call;
 
 // This is only relevant for the main thread.
-static heavy_call_queue heavy_call_queue_head = {
-  .next = &heavy_call_queue_head,
-  .prev = &heavy_call_queue_head,
-};
+static heavy_call* heavy_calls = 0;
+static int num_heavy_calls = 0;
+static int heavy_calls_capacity = 0;
 
-static int heavy_call_queue_empty() {
-  return heavy_call_queue_head.next == &heavy_call_queue_head;
-}
+// Set when a socket or pipe event arrives while the main thread is already
+// processing queued calls, so that the pending heavy calls are probed again
+// afterwards.
+static int heavy_calls_dirty = 0;
 
-static void heavy_call_queue_push(em_queued_call* call, double end_time,
-                                  int call_no) {
-  assert(call);
+// Deadline for which a JS timer is currently pending, or INFINITY if none is.
+static double heavy_call_timer_deadline = INFINITY;
+
+static int bool_main_thread_inside_nested_process_queued_calls = 0;
 
-  heavy_call_queue* new_node = malloc(sizeof(heavy_call_queue));
-  assert(new_node);  // catch OOM scenarios like in em_queued_call_malloc().
-  new_node->call = call;
-  new_node->call_no = call_no;
-  new_node->end_time = end_time;
+static void heavy_call_swap(int i, int j) {
+  heavy_call tmp = heavy_calls[i];
+  heavy_calls[i] = heavy_calls[j];
+  heavy_calls[j] = tmp;
+}
+
+static void heavy_call_sift_up(int i) {
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (heavy_calls[parent].end_time <= heavy_calls[i].end_time)
+      break;
+    heavy_call_swap(i, parent);
+    i = parent;
+  }
+}
 
-  new_node->next = &heavy_call_queue_head;
-  new_node->prev = heavy_call_queue_head.prev;
-  heavy_call_queue_head.prev->next = new_node;
-  heavy_call_queue_head.prev = new_node;
+static void heavy_call_sift_down(int i) {
+  for (;;) {
+    int smallest = i;
+    int left = 2 * i + 1, right = 2 * i + 2;
+    if (left < num_heavy_calls && heavy_calls[left].end_time < heavy_calls[smallest].end_time)
+      smallest = left;
+    if (right < num_heavy_calls && heavy_calls[right].end_time < heavy_calls[smallest].end_time)
+      smallest = right;
+    if (smallest == i)
+      break;
+    heavy_call_swap(i, smallest);
+    i = smallest;
+  }
 }
 
-static void heavy_call_queue_remove(heavy_call_queue* node) {
-  assert(node && node != &heavy_call_queue_head);
+static void heavy_call_queue_push(em_queued_call* call, double end_time, int call_no) {
+  assert(call);
 
-  node->prev->next = node->next;
-  node->next->prev = node->prev;
-  free(node);
+  if (num_heavy_calls == heavy_calls_capacity) {
+    heavy_calls_capacity = heavy_calls_capacity ? heavy_calls_capacity * 2 : 16;
+    heavy_calls = realloc(heavy_calls, heavy_calls_capacity * sizeof(heavy_call));
+    assert(heavy_calls);  // catch OOM scenarios like in em_queued_call_malloc().
+  }
+  heavy_calls[num_heavy_calls].call = call;
+  heavy_calls[num_heavy_calls].end_time = end_time;
+  heavy_calls[num_heavy_calls].call_no = call_no;
+  heavy_call_sift_up(num_heavy_calls++);
 }
 
 extern int heavy_call_timeout_msecs(int call_no, const void* args);
 
+// Indices of newselect and poll in proxiedFunctionTable, looked up on first use
+// so that classifying a call does not need a string compare in JS.
+static int newselect_function_index = -1;
+static int poll_function_index = -1;
+
 // The only heavy calls are newselect and poll.
 // If call is heavy, then set `timeout` and `call_no`.
 static int is_heavy_call(const em_queued_call* call, int *timeout, int *call_no) {
@@ -731,26 +800,62 @@ static int is_heavy_call(const em_queued_call* call, int *timeout, int *call_no)
       call->functionEnum != EM_PROXIED_JS_FUNCTION) {
     return 0;
   }
-  *call_no = EM_ASM_INT({
-    const index = $0;
-    if (index <= 0) {
-      // Proxied JS library funcs are encoded as positive values.
+  if (newselect_function_index < 0) {
+    // Index 0 is reserved for an undefined function, so it never matches a call.
+    newselect_function_index = EM_ASM_INT({
+      for (var i = 1; i < proxiedFunctionTable.length; ++i) {
+        if (proxiedFunctionTable[i].name === "___syscall142") return i;
+      }
       return 0;
-    }
-    const func = proxiedFunctionTable[index].name;
-    if (func === "___syscall142") {  // newselect
-       return 142;
-    } else if (func === "___syscall168") {  // poll
-      return 168;
-    } else {
+    });
+    poll_function_index = EM_ASM_INT({
+      for (var i = 1; i < proxiedFunctionTable.length; ++i) {
+        if (proxiedFunctionTable[i].name === "___syscall168") return i;
+      }
+      return 0;
+    });
+  }
+
+  // Proxied JS library funcs are encoded as positive values.
+  int index = (int)call->functionPtr;
+  if (index <= 0) {
+    return 0;
+  } else if (index == newselect_function_index) {
+    *call_no = 142;
+  } else if (index == poll_function_index) {
+    *call_no = 168;
+  } else {
+    return 0;
+  }
+
+  const void* args = &call->args[1].d;
+  *timeout = heavy_call_timeout_msecs(*call_no, args);
+  return 1;
+}
+
+// Returns whether the heavy call waits on the descriptor `fd`.
+static int heavy_call_watches_fd(const heavy_call* node, int fd) {
+  // The call arguments are the syscall number and a pointer to the syscall arguments.
+  const int* syscall_args = (const int*)(intptr_t)node->call->args[2].d;
+
+  if (node->call_no == 142) {  // newselect
+    // Currently fd_set has 64 bits.
+    if (fd >= syscall_args[0] || fd >= 64)
       return 0;
+    for (int i = 1; i <= 3; ++i) {
+      const uint32_t* fdset = (const uint32_t*)syscall_args[i];
+      if (fdset && (fdset[fd / 32] & (1u << (fd % 32))))
+        return 1;
     }
-  }, (int) call->functionPtr);
+    return 0;
+  }
 
-  if (*call_no == 142 || *call_no == 168) {
-    const void* args = &call->args[1].d;
-    *timeout = heavy_call_timeout_msecs(*call_no, args);
-    return 1;
+  // poll
+  const struct pollfd* fds = (const struct pollfd*)syscall_args[0];
+  int nfds = syscall_args[1];
+  for (int i = 0; i < nfds; ++i) {
+    if (fds[i].fd == fd)
+      return 1;
   }
   return 0;
 }
@@ -785,8 +890,7 @@ static void newselect_clear_fdsets(em_queued_call* call) {
   }, args);
 }
 
-static void heavy_call_cleanup(heavy_call_queue* node, int return_value) {
-  em_queued_call* call = node->call;
+static void heavy_call_cleanup(em_queued_call* call, int return_value) {
   call->returnValue.d = return_value;
 
   // If the caller is detached from this operation, it is the main thread's responsibility to free
@@ -799,32 +903,98 @@ static void heavy_call_cleanup(heavy_call_queue* node, int return_value) {
     call->operationDone = 1;
     emscripten_futex_wake(&call->operationDone, INT_MAX);
   }
+}
 
-  heavy_call_queue_remove(node);
-}
-
-static void process_queued_heavy_calls() {
-  heavy_call_queue* next;
-  for (heavy_call_queue* node = heavy_call_queue_head.next;
-       node != &heavy_call_queue_head; node = next) {
-    next = node->next;
-    em_queued_call* call = node->call;
-
-    int ret = emscripten_receive_on_main_thread_js((int)call->functionPtr,
-                                                   call->args[0].i,
-                                                   &call->args[1].d);
-    if (ret != -EAGAIN) {
-      // Call has finished.
-      heavy_call_cleanup(node, ret);
-    } else if (node->end_time >= 0 && emscripten_get_now() >= node->end_time) {
-      // We hit timeout, return 0.
-      if (node->call_no == 142) {  // newselect
-        // Unfortunetely we have to set all fd sets to zero manually.
-        newselect_clear_fdsets(call);
-      }
-      heavy_call_cleanup(node, 0);
+// Probes the descriptors of a heavy call once, without blocking. Completes the call and returns 1
+// if it is done, either because a descriptor is ready or because its timeout has expired.
+static int heavy_call_try(const heavy_call* node, double now) {
+  em_queued_call* call = node->call;
+
+  int ret = emscripten_receive_on_main_thread_js((int)call->functionPtr,
+                                                 call->args[0].i,
+                                                 &call->args[1].d);
+  if (ret == -EAGAIN) {
+    if (now < node->end_time)
+      return 0;
+    // We hit timeout, return 0.
+    if (node->call_no == 142) {  // newselect
+      // Unfortunetely we have to set all fd sets to zero manually.
+      newselect_clear_fdsets(call);
     }
+    ret = 0;
+  }
+  heavy_call_cleanup(call, ret);
+  return 1;
+}
+
+// Probes the pending heavy calls that wait on `fd`, or all of them if `fd` is negative, and
+// completes the ones that are done.
+static void process_queued_heavy_calls(int fd) {
+  double now = emscripten_get_now();
+  int num_pending = 0;
+  for (int i = 0; i < num_heavy_calls; ++i) {
+    heavy_call node = heavy_calls[i];
+    int probe = fd < 0 || now >= node.end_time || heavy_call_watches_fd(&node, fd);
+    if (!probe || !heavy_call_try(&node, now))
+      heavy_calls[num_pending++] = node;
+  }
+  if (num_pending != num_heavy_calls) {
+    // Restore the heap order over the calls that are still pending.
+    num_heavy_calls = num_pending;
+    for (int i = num_heavy_calls / 2 - 1; i >= 0; --i)
+      heavy_call_sift_down(i);
+  }
+}
+
+// Completes the heavy calls whose timeout has expired, and makes sure a JS timer is pending for
+// the earliest remaining deadline.
+static void expire_queued_heavy_calls() {
+  double now = emscripten_get_now();
+  if (now >= heavy_call_timer_deadline) {
+    // The pending timer has fired, or will do so without anything left to do.
+    heavy_call_timer_deadline = INFINITY;
+  }
+
+  while (num_heavy_calls > 0 && now >= heavy_calls[0].end_time) {
+    heavy_call node = heavy_calls[0];
+    heavy_calls[0] = heavy_calls[--num_heavy_calls];
+    heavy_call_sift_down(0);
+    heavy_call_try(&node, now);
+  }
+
+  if (num_heavy_calls > 0 && heavy_calls[0].end_time < heavy_call_timer_deadline) {
+    heavy_call_timer_deadline = heavy_calls[0].end_time;
+    // Round the delay up, as a timer that fires before the deadline would complete nothing.
+    EM_ASM({
+      setTimeout(function() { _emscripten_main_thread_heavy_call_timer(); }, Math.ceil($0));
+    }, heavy_call_timer_deadline - now);
+  }
+}
+
+// Called by the JS timer that expire_queued_heavy_calls() sets.
+void EMSCRIPTEN_KEEPALIVE emscripten_main_thread_heavy_call_timer() {
+  // Timers can still fire slightly before the deadline by the clock, so do not rely on the clock
+  // to tell that this one is no longer pending. Otherwise no new timer would be set for the calls
+  // that were not yet expired.
+  heavy_call_timer_deadline = INFINITY;
+  emscripten_main_thread_process_queued_calls();
+}
+
+// Called by the socket filesystem when a socket event arrives for `fd`, and by the pipe filesystem
+// with a negative `fd` when data is written to a pipe, so that heavy calls waiting on them can
+// complete without being polled. A negative `fd` probes all pending heavy calls.
+void EMSCRIPTEN_KEEPALIVE emscripten_main_thread_notify_fd_event(int fd) {
+  if (!emscripten_is_main_browser_thread() || num_heavy_calls == 0)
+    return;
+
+  if (bool_main_thread_inside_nested_process_queued_calls) {
+    // The outer call processing will probe the heavy calls when it is done.
+    heavy_calls_dirty = 1;
+    return;
   }
+  bool_main_thread_inside_nested_process_queued_calls = 1;
+  process_queued_heavy_calls(fd);
+  bool_main_thread_inside_nested_process_queued_calls = 0;
 }
 
 void EMSCRIPTEN_KEEPALIVE emscripten_current_thread_process_queued_calls() {
@@ -836,8 +1006,6 @@ void EMSCRIPTEN_KEEPALIVE emscripten_current_thread_process_queued_calls() {
   // TODO: Under certain conditions we may want to have a nesting guard also for pthreads (and it
   // will certainly be cleaner that way), but we don't yet have TLS variables outside
   // pthread_set/getspecific, so convert this to TLS after TLS is implemented.
-  static int bool_main_thread_inside_nested_process_queued_calls = 0;
-
   if (emscripten_is_main_browser_thread()) {
     // It is possible that when processing a queued call, the call flow leads back to calling this
     // function in a nested fashion! Therefore this scenario must explicitly be detected, and
@@ -845,69 +1013,44 @@ void EMSCRIPTEN_KEEPALIVE emscripten_current_thread_process_queued_calls() {
     // would be processed again and again.
     if (bool_main_thread_inside_nested_process_queued_calls)
       return;
-    // This must be before pthread_mutex_lock(), since pthread_mutex_lock() can call back to this
-    // function.
     bool_main_thread_inside_nested_process_queued_calls = 1;
   }
 
-  pthread_mutex_lock(&call_queue_lock);
-  CallQueue* q = GetQueue(pthread_self());
-  if (!q) {
-    pthread_mutex_unlock(&call_queue_lock);
-    if (emscripten_is_main_browser_thread())
-      bool_main_thread_inside_nested_process_queued_calls = 0;
-    return;
-  }
-
   // For heavy call information.
   int timeout, call_no;
-  double end_time;
+  int ran_normal_calls = 0;
 
-  int head = emscripten_atomic_load_u32((void*)&q->call_queue_head);
-  int tail = emscripten_atomic_load_u32((void*)&q->call_queue_tail);
-  while (head != tail ||
-        (emscripten_is_main_browser_thread() && !heavy_call_queue_empty())) {
-    if (head != tail) {
-      // There is some call in the call queue.
-      if (is_heavy_call(q->call_queue[head], &timeout, &call_no)) {
-        // The next call is heavy. Move it to the heavy call queue.
-        if (timeout == -1) {  // No timeout.
-          end_time = -1;
-        } else {
-          end_time = emscripten_get_now() + timeout;
-        }
-        heavy_call_queue_push(q->call_queue[head], end_time, call_no);
+  em_queued_call* call;
+  while ((call = take_proxied_calls())) {
+    while (call) {
+      // Calls that complete can be freed by whoever is waiting on them, so get the next one first.
+      em_queued_call* next = call->next;
+      if (is_heavy_call(call, &timeout, &call_no)) {
+        // The call is heavy. Probe it once, and if nothing is ready yet, park it in the heavy call
+        // queue until a socket event or its timeout.
+        double now = emscripten_get_now();
+        heavy_call node = {call, timeout < 0 ? INFINITY : now + timeout, call_no};
+        if (!heavy_call_try(&node, now))
+          heavy_call_queue_push(call, node.end_time, call_no);
       } else {
         // Normal call. Process it now.
-        pthread_mutex_unlock(&call_queue_lock);
-        _do_call(q->call_queue[head]);
-        pthread_mutex_lock(&call_queue_lock);
+        _do_call(call);
+        ran_normal_calls = 1;
       }
-
-      // Adjust head.
-      head = (head + 1) % CALL_QUEUE_SIZE;
-      emscripten_atomic_store_u32((void*)&q->call_queue_head, head);
+      call = next;
     }
-
-    if (emscripten_is_main_browser_thread() && !heavy_call_queue_empty()) {
-      // During heavy call processing we don't touch the call_queue, so we can
-      // unlock the mutex.
-      pthread_mutex_unlock(&call_queue_lock);
-      // Process heavy calls now.
-      process_queued_heavy_calls();
-      pthread_mutex_lock(&call_queue_lock);
-    }
-
-    // Update tail.
-    tail = emscripten_atomic_load_u32((void*)&q->call_queue_tail);
   }
-  pthread_mutex_unlock(&call_queue_lock);
 
-  // If the queue was full and we had waiters pending to get to put data to queue, wake them up.
-  emscripten_futex_wake((void*)&q->call_queue_head, 0x7FFFFFFF);
-
-  if (emscripten_is_main_browser_thread())
+  if (emscripten_is_main_browser_thread()) {
+    if (num_heavy_calls > 0 && (ran_normal_calls || heavy_calls_dirty)) {
+      // Other calls, like close() or send(), or socket events that arrived meanwhile, may have made
+      // descriptors ready.
+      process_queued_heavy_calls(-1);
+    }
+    heavy_calls_dirty = 0;
+    expire_queued_heavy_calls();
     bool_main_thread_inside_nested_process_queued_calls = 0;
+  }
 }
 
 void EMSCRIPTEN_KEEPALIVE emscripten_main_thread_process_queued_calls() {
@@ -1053,6 +1196,129 @@ em_queued_call* emscripten_async_waitable_run_in_main_runtime_thread_(
   return q;
 }
 
+struct em_queued_call_batch {
+  em_queued_call* calls;
+  int numCalls;
+  int capacity;
+};
+
+em_queued_call_batch* emscripten_create_call_batch() {
+  em_queued_call_batch* batch = (em_queued_call_batch*)malloc(sizeof(em_queued_call_batch));
+  if (!batch)
+    return NULL;
+  batch->calls = 0;
+  batch->numCalls = 0;
+  batch->capacity = 0;
+  return batch;
+}
+
+void emscripten_destroy_call_batch(em_queued_call_batch* batch) {
+  if (!batch)
+    return;
+  for (int i = 0; i < batch->numCalls; ++i)
+    free(batch->calls[i].satelliteData);
+  free(batch->calls);
+  free(batch);
+}
+
+int emscripten_call_batch_add_(
+  em_queued_call_batch* batch, EM_FUNC_SIGNATURE sig, void* func_ptr, ...) {
+  assert(batch);
+  if (batch->numCalls == batch->capacity) {
+    // The calls are only linked together when the batch is submitted, so they can move here.
+    int newCapacity = batch->capacity ? batch->capacity * 2 : 16;
+    em_queued_call* newCalls =
+      (em_queued_call*)realloc(batch->calls, newCapacity * sizeof(em_queued_call));
+    if (!newCalls)
+      return 0;
+    batch->calls = newCalls;
+    batch->capacity = newCapacity;
+  }
+  int numArguments = EM_FUNC_SIG_NUM_FUNC_ARGUMENTS(sig);
+  em_queued_call* q = &batch->calls[batch->numCalls++];
+  q->functionEnum = sig;
+  q->functionPtr = func_ptr;
+  q->operationDone = 0;
+  q->satelliteData = 0;
+  q->calleeDelete = CALL_OWNED_BY_BATCH;
+
+  EM_FUNC_SIGNATURE argumentsType = sig & EM_FUNC_SIG_ARGUMENTS_TYPE_MASK;
+  va_list args;
+  va_start(args, func_ptr);
+  for (int i = 0; i < numArguments; ++i) {
+    switch ((argumentsType & EM_FUNC_SIG_ARGUMENT_TYPE_SIZE_MASK)) {
+      case EM_FUNC_SIG_PARAM_I:
+        q->args[i].i = va_arg(args, int);
+        break;
+      case EM_FUNC_SIG_PARAM_I64:
+        q->args[i].i64 = va_arg(args, int64_t);
+        break;
+      case EM_FUNC_SIG_PARAM_F:
+        q->args[i].f = (float)va_arg(args, double);
+        break;
+      case EM_FUNC_SIG_PARAM_D:
+        q->args[i].d = va_arg(args, double);
+        break;
+    }
+    argumentsType >>= EM_FUNC_SIG_ARGUMENT_TYPE_SIZE_SHIFT;
+  }
+  va_end(args);
+  return 1;
+}
+
+// Runs on the main runtime thread after all calls of a batch.
+static void free_batch_calls(em_queued_call* calls) { free(calls); }
+
+// Queues the calls of the batch, followed by the call done that frees them, to the main runtime
+// thread with a single enqueue, and frees the batch.
+static void run_batch_in_main_runtime_thread(em_queued_call_batch* batch, em_queued_call* done) {
+  done->functionEnum = EM_FUNC_SIG_VI;
+  done->functionPtr = (void*)free_batch_calls;
+  done->args[0].vp = batch->calls;
+
+  pthread_t main_thread = emscripten_main_browser_thread_id();
+  if (pthread_self() == main_thread) {
+    for (int i = 0; i < batch->numCalls; ++i)
+      _do_call(&batch->calls[i]);
+    _do_call(done);
+  } else {
+    for (int i = 1; i < batch->numCalls; ++i)
+      batch->calls[i].next = &batch->calls[i - 1];
+    em_queued_call* oldest = batch->numCalls > 0 ? &batch->calls[0] : done;
+    if (batch->numCalls > 0)
+      done->next = &batch->calls[batch->numCalls - 1];
+    if (push_proxied_calls(main_thread, done, oldest))
+      wake_thread_for_proxied_calls(main_thread);
+  }
+  free(batch);
+}
+
+void emscripten_async_run_batch_in_main_runtime_thread(em_queued_call_batch* batch) {
+  assert(batch);
+  em_queued_call* done = em_queued_call_malloc();
+  if (!done) {
+    emscripten_destroy_call_batch(batch);
+    return;
+  }
+  // Fire and forget, the main runtime thread frees the call that ends the batch.
+  done->calleeDelete = 1;
+  run_batch_in_main_runtime_thread(batch, done);
+}
+
+em_queued_call* emscripten_async_waitable_run_batch_in_main_runtime_thread(
+  em_queued_call_batch* batch) {
+  assert(batch);
+  em_queued_call* done = em_queued_call_malloc();
+  if (!done) {
+    emscripten_destroy_call_batch(batch);
+    return NULL;
+  }
+  // The caller waits on the call that ends the batch, and frees it.
+  done->calleeDelete = 0;
+  run_batch_in_main_runtime_thread(batch, done);
+  return done;
+}
+
 void EMSCRIPTEN_KEEPALIVE emscripten_async_queue_on_thread_(
   pthread_t targetThread, EM_FUNC_SIGNATURE sig, void* func_ptr, void* satellite, ...) {
   int numArguments = EM_FUNC_SIG_NUM_FUNC_ARGUMENTS(sig);
@@ -7,6 +7,7 @@
 #define LIB_SAMSUNG_BINDINGS_ELEMENTARY_MEDIA_TRACK_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "samsung/bindings/emss_operation_result.h"
@@ -50,6 +51,16 @@ extern EMSSOperationResult elementaryMediaTrackAppendPacket(
 extern EMSSOperationResult elementaryMediaTrackAppendPacketAsync(
     int handle,
     EMSSElementaryMediaPacket* packet);
+extern EMSSOperationResult elementaryMediaTrackAppendPackets(
+    int handle,
+    EMSSElementaryMediaPacket* packets,
+    size_t count,
+    size_t* appendedCount);
+extern EMSSOperationResult elementaryMediaTrackAppendPacketsAsync(
+    int handle,
+    EMSSElementaryMediaPacket* packets,
+    size_t count,
+    size_t* appendedCount);
 extern EMSSOperationResult elementaryMediaTrackAppendEncryptedPacket(
     int handle,
     EMSSEncryptedElementaryMediaPacket* packet);
@@ -115,6 +126,13 @@ elementaryMediaTrackSetListenersForSessionIdEmulation(int handle,
 extern EMSSOperationResult
 elementaryMediaTrackUnsetListenersForSessionIdEmulation(int handle);
 
+extern EMSSOperationResult elementaryMediaTrackSetSessionIdTracker(
+    int handle,
+    OnSessionIdChangedCallback callback,
+    void* userData);
+extern EMSSOperationResult elementaryMediaTrackUnsetSessionIdTracker(
+    int handle);
+
 #ifdef __cplusplus
 }
 #endif
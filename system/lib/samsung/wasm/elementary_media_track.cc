@@ -6,10 +6,14 @@
 #include "samsung/wasm/elementary_media_track.h"
 
 #include <emscripten/threading.h>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <map>
+#include <mutex>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "samsung/bindings/common.h"
 #include "samsung/bindings/elementary_media_packet.h"
@@ -19,6 +23,7 @@
 #include "samsung/wasm/elementary_media_packet.h"
 #include "samsung/wasm/elementary_media_track_listener.h"
 #include "samsung/wasm/encrypted_elementary_media_packet.h"
+#include "samsung/wasm/encrypted_packet_pool.h"
 #include "samsung/wasm/media_key.h"
 #include "samsung/wasm/tizen_tv_wasm.h"
 
@@ -44,9 +49,12 @@ using TrackType = samsung::wasm::ElementaryMediaTrack::TrackType;
   return result;
 }
 
-::EMSSEncryptedElementaryMediaPacket PacketToCAPI(
-    const samsung::wasm::EncryptedElementaryMediaPacket& packet,
-    TrackType type) {
+// Fills the pooled descriptor with the packet. Fails if the key id or the
+// initialization vector is longer than the platform accepts.
+bool PacketToCAPI(const samsung::wasm::EncryptedElementaryMediaPacket& packet,
+                  TrackType type,
+                  samsung::wasm::EncryptedPacketDescriptor* descriptor) {
+  using samsung::wasm::EncryptedPacketDescriptor;
   // TODO(p.balut): A common structure should be used instead of a cast.
   static_assert(
       sizeof(EMSSEncryptedSubsampleDescription) ==
@@ -61,17 +69,32 @@ using TrackType = samsung::wasm::ElementaryMediaTrack::TrackType;
           offsetof(samsung::wasm::EncryptedSubsampleDescription, cipher_block),
       "C++ API subsample description != JS bindings subsample description.");
 
-  return {PacketToCAPI(
-              static_cast<const samsung::wasm::ElementaryMediaPacket&>(packet),
-              type),
-          packet.subsamples.size(),
-          reinterpret_cast<const EMSSEncryptedSubsampleDescription*>(
-              packet.subsamples.data()),
-          packet.key_id.size(),
-          packet.key_id.data(),
-          packet.initialization_vector.size(),
-          packet.initialization_vector.data(),
-          static_cast<MediaKeyEncryptionMode>(packet.encryption_mode)};
+  if (packet.key_id.size() > EncryptedPacketDescriptor::kBlockSize ||
+      packet.initialization_vector.size() >
+          EncryptedPacketDescriptor::kBlockSize) {
+    return false;
+  }
+
+  auto padded_copy = [](const std::vector<uint8_t>& from, uint8_t* to) {
+    auto end = std::copy(from.begin(), from.end(), to);
+    std::fill(end, to + EncryptedPacketDescriptor::kBlockSize, 0);
+  };
+  padded_copy(packet.key_id, descriptor->key_id);
+  padded_copy(packet.initialization_vector, descriptor->initialization_vector);
+
+  descriptor->packet = {
+      PacketToCAPI(
+          static_cast<const samsung::wasm::ElementaryMediaPacket&>(packet),
+          type),
+      packet.subsamples.size(),
+      reinterpret_cast<const EMSSEncryptedSubsampleDescription*>(
+          packet.subsamples.data()),
+      EncryptedPacketDescriptor::kBlockSize,
+      descriptor->key_id,
+      EncryptedPacketDescriptor::kBlockSize,
+      descriptor->initialization_vector,
+      static_cast<MediaKeyEncryptionMode>(packet.encryption_mode)};
+  return true;
 }
 
 void OnTrackClosedListenerCallback(
@@ -126,6 +149,10 @@ class ElementaryMediaTrack::Impl {
   TrackType GetType() const;
   Result<void> AppendPacket(const ElementaryMediaPacket& packet);
   Result<void> AppendPacketAsync(const ElementaryMediaPacket& packet);
+  Result<size_t> AppendPackets(const ElementaryMediaPacket* packets,
+                               size_t count);
+  Result<size_t> AppendPacketsAsync(const ElementaryMediaPacket* packets,
+                                    size_t count);
   Result<void> AppendEncryptedPacket(const EncryptedElementaryMediaPacket&);
   Result<void> AppendEncryptedPacketAsync(
       const EncryptedElementaryMediaPacket&);
@@ -142,6 +169,11 @@ class ElementaryMediaTrack::Impl {
   Result<void> RegisterCurrentGraphicsContext();
   Result<void> SetMediaKey(MediaKey* key);
   Result<void> SetListener(ElementaryMediaTrackListener* listener);
+  Result<SessionIdChangedCallbackId> AddSessionIdChangedCallback(
+      std::function<void(SessionId)> callback);
+  Result<void> RemoveSessionIdChangedCallback(
+      SessionIdChangedCallbackId callback_id);
+  AppendStatistics GetAppendStatistics() const;
 
   int handle() const { return handle_; }
 
@@ -150,10 +182,33 @@ class ElementaryMediaTrack::Impl {
   Result<void> AppendEncryptedPacketInternal(
       const EncryptedElementaryMediaPacket&);
   Result<void> AppendPacketAsyncInternal(const ElementaryMediaPacket&);
+  template <class CAPIAppendPackets>
+  Result<size_t> AppendPacketsInternal(CAPIAppendPackets capi_append_packets,
+                                       const ElementaryMediaPacket* packets,
+                                       size_t count);
   Result<void> AppendEncryptedPacketAsyncInternal(
       const EncryptedElementaryMediaPacket&);
   OperationResult SetListenerInternal(ElementaryMediaTrackListener* listener);
 
+  // session id tracking: methods
+  template <class AppendFunction>
+  Result<void> AppendIfSessionCurrent(SessionId session_id,
+                                      AppendFunction append);
+  bool IsSessionStale(SessionId session_id) const {
+    return tracks_session_id_ && session_id != kIgnoreSessionId &&
+           session_id != session_id_.load(std::memory_order_acquire);
+  }
+  OperationResult StaleSessionResult() const {
+    // Emulated sessions have always failed such appends, while Platform
+    // ignores them.
+    return use_session_id_emulation_ ? OperationResult::kFailed
+                                     : OperationResult::kAppendIgnored;
+  }
+  void CountAppendResult(OperationResult result, size_t appended);
+  void NotifySessionIdChanged(SessionId session_id);
+  void RegisterSessionIdTracker();
+  void UnregisterSessionIdTracker();
+
   // session id emulation for legacy mode: methods
   void EmulateSessionIdChange();
   void RegisterSessionIdEmulationCallbacks();
@@ -167,8 +222,23 @@ class ElementaryMediaTrack::Impl {
   ElementaryMediaTrack::TrackType type_;
   EmssVersionInfo version_info_;
 
+  // session id tracking: variables
+  // Current session, either emulated or mirrored from Platform's
+  // sessionidchanged events, so that it can be checked on every append
+  // without a call to JS.
+  std::atomic<SessionId> session_id_;
+  bool tracks_session_id_;
+  std::mutex session_id_callbacks_mutex_;
+  std::map<SessionIdChangedCallbackId, std::function<void(SessionId)>>
+      session_id_callbacks_;
+  SessionIdChangedCallbackId next_session_id_callback_id_;
+
+  // append statistics
+  std::atomic<uint64_t> appended_packets_;
+  std::atomic<uint64_t> dropped_stale_packets_;
+  std::atomic<uint64_t> failed_packets_;
+
   // session id emulation for legacy mode: variables
-  std::atomic<SessionId> emulated_session_id_;
   bool use_session_id_emulation_;
 };
 
@@ -184,16 +254,27 @@ ElementaryMediaTrack::Impl::Impl(int handle,
       listener_(nullptr),
       type_(type),
       version_info_(version_info),
-      emulated_session_id_(0),
+      session_id_(0),
+      tracks_session_id_(false),
+      next_session_id_callback_id_(0),
+      appended_packets_(0),
+      dropped_stale_packets_(0),
+      failed_packets_(0),
       use_session_id_emulation_(use_session_id_emulation) {
-  if (use_session_id_emulation_)
+  if (use_session_id_emulation_) {
     RegisterSessionIdEmulationCallbacks();
+    tracks_session_id_ = true;
+  } else if (!version_info_.has_legacy_emss) {
+    RegisterSessionIdTracker();
+  }
 }
 
 ElementaryMediaTrack::Impl::~Impl() {
   if (IsValid()) {
     if (use_session_id_emulation_)
       UnregisterSessionIdEmulationCallbacks();
+    else if (tracks_session_id_)
+      UnregisterSessionIdTracker();
     if (listener_)
       SetListenerInternal(nullptr);
     elementaryMediaTrackRemove(handle_);
@@ -212,62 +293,41 @@ ElementaryMediaTrack::TrackType ElementaryMediaTrack::Impl::GetType() const {
 
 Result<void> ElementaryMediaTrack::Impl::AppendPacket(
     const samsung::wasm::ElementaryMediaPacket& packet) {
-  if (!UseEmulatedAppend(packet.session_id)) {
-    // Use default code path.
-    return AppendPacketInternal(packet);
-  } else {
-    // Session id mechanism must be emulated, because legacy EMSS doesn't
-    // support it at Platform level.
-    if (emulated_session_id_.load() != packet.session_id) {
-      return {OperationResult::kFailed};
-    }
-    return AppendPacketInternal(packet);
-  }
+  return AppendIfSessionCurrent(
+      packet.session_id, [&] { return AppendPacketInternal(packet); });
 }
 
 Result<void> ElementaryMediaTrack::Impl::AppendPacketAsync(
     const samsung::wasm::ElementaryMediaPacket& packet) {
-  if (!UseEmulatedAppend(packet.session_id)) {
-    // Use default code path.
-    return AppendPacketAsyncInternal(packet);
-  } else {
-    // Session id mechanism must be emulated, because legacy EMSS doesn't
-    // support it at Platform level.
-    if (emulated_session_id_.load() != packet.session_id) {
-      return {OperationResult::kFailed};
-    }
-    return AppendPacketAsyncInternal(packet);
-  }
+  return AppendIfSessionCurrent(
+      packet.session_id, [&] { return AppendPacketAsyncInternal(packet); });
+}
+
+Result<size_t> ElementaryMediaTrack::Impl::AppendPackets(
+    const ElementaryMediaPacket* packets,
+    size_t count) {
+  return AppendPacketsInternal(elementaryMediaTrackAppendPackets, packets,
+                               count);
+}
+
+Result<size_t> ElementaryMediaTrack::Impl::AppendPacketsAsync(
+    const ElementaryMediaPacket* packets,
+    size_t count) {
+  return AppendPacketsInternal(elementaryMediaTrackAppendPacketsAsync, packets,
+                               count);
 }
 
 Result<void> ElementaryMediaTrack::Impl::AppendEncryptedPacket(
     const EncryptedElementaryMediaPacket& packet) {
-  if (!UseEmulatedAppend(packet.session_id)) {
-    // Use default code path.
-    return AppendEncryptedPacketInternal(packet);
-  } else {
-    // Session id mechanism must be emulated, because legacy EMSS doesn't
-    // support it at Platform level.
-    if (emulated_session_id_.load() != packet.session_id) {
-      return {OperationResult::kFailed};
-    }
-    return AppendEncryptedPacketInternal(packet);
-  }
+  return AppendIfSessionCurrent(
+      packet.session_id, [&] { return AppendEncryptedPacketInternal(packet); });
 }
 
 Result<void> ElementaryMediaTrack::Impl::AppendEncryptedPacketAsync(
     const EncryptedElementaryMediaPacket& packet) {
-  if (!UseEmulatedAppend(packet.session_id)) {
-    // Use default code path.
+  return AppendIfSessionCurrent(packet.session_id, [&] {
     return AppendEncryptedPacketAsyncInternal(packet);
-  } else {
-    // Session id mechanism must be emulated, because legacy EMSS doesn't
-    // support it at Platform level.
-    if (emulated_session_id_.load() != packet.session_id) {
-      return {OperationResult::kFailed};
-    }
-    return AppendEncryptedPacketAsyncInternal(packet);
-  }
+  });
 }
 
 Result<void> ElementaryMediaTrack::Impl::AppendEndOfTrack(
@@ -281,7 +341,7 @@ Result<void> ElementaryMediaTrack::Impl::AppendEndOfTrack(
   } else {
     // Session id mechanism must be emulated, because legacy EMSS doesn't
     // support it at Platform level.
-    if (emulated_session_id_.load() != app_session_id) {
+    if (session_id_.load() != app_session_id) {
       return {OperationResult::kFailed};
     }
     return CAPICall<void>(elementaryMediaTrackAppendEndOfTrack, handle_,
@@ -300,7 +360,7 @@ Result<void> ElementaryMediaTrack::Impl::AppendEndOfTrackAsync(
   } else {
     // Session id mechanism must be emulated, because legacy EMSS doesn't
     // support it at Platform level.
-    if (emulated_session_id_.load() != app_session_id) {
+    if (session_id_.load() != app_session_id) {
       return {OperationResult::kFailed};
     }
     return CAPICall<void>(elementaryMediaTrackAppendEndOfTrackAsync, handle_,
@@ -347,9 +407,11 @@ Result<ActiveDecodingMode> ElementaryMediaTrack::Impl::GetActiveDecodingMode()
 
 Result<SessionId> ElementaryMediaTrack::Impl::GetSessionId() const {
   if (use_session_id_emulation_) {
-    return {emulated_session_id_.load(), OperationResult::kSuccess};
+    return {session_id_.load(), OperationResult::kSuccess};
   } else if (version_info_.has_legacy_emss) {
     return {kIgnoreSessionId, OperationResult::kSuccess};
+  } else if (tracks_session_id_) {
+    return {session_id_.load(), OperationResult::kSuccess};
   }
   return CAPICall<SessionId>(elementaryMediaTrackGetSessionId, handle_);
 }
@@ -398,6 +460,33 @@ Result<void> ElementaryMediaTrack::Impl::SetListener(
   return {OperationResult::kSuccess};
 }
 
+Result<ElementaryMediaTrack::SessionIdChangedCallbackId>
+ElementaryMediaTrack::Impl::AddSessionIdChangedCallback(
+    std::function<void(SessionId)> callback) {
+  if (!tracks_session_id_)
+    return {0, OperationResult::kNotSupported};
+
+  std::lock_guard<std::mutex> lock(session_id_callbacks_mutex_);
+  auto callback_id = next_session_id_callback_id_++;
+  session_id_callbacks_.emplace(callback_id, std::move(callback));
+  return {callback_id, OperationResult::kSuccess};
+}
+
+Result<void> ElementaryMediaTrack::Impl::RemoveSessionIdChangedCallback(
+    SessionIdChangedCallbackId callback_id) {
+  std::lock_guard<std::mutex> lock(session_id_callbacks_mutex_);
+  if (!session_id_callbacks_.erase(callback_id))
+    return {OperationResult::kNoSuchListener};
+  return {OperationResult::kSuccess};
+}
+
+ElementaryMediaTrack::AppendStatistics
+ElementaryMediaTrack::Impl::GetAppendStatistics() const {
+  return {appended_packets_.load(std::memory_order_relaxed),
+          dropped_stale_packets_.load(std::memory_order_relaxed),
+          failed_packets_.load(std::memory_order_relaxed)};
+}
+
 // private:
 
 Result<void> ElementaryMediaTrack::Impl::AppendPacketInternal(
@@ -424,9 +513,49 @@ Result<void> ElementaryMediaTrack::Impl::AppendPacketAsyncInternal(
                         &capi_packet);
 }
 
+template <class CAPIAppendPackets>
+Result<size_t> ElementaryMediaTrack::Impl::AppendPacketsInternal(
+    CAPIAppendPackets capi_append_packets,
+    const ElementaryMediaPacket* packets,
+    size_t count) {
+  static_assert(sizeof(EMSSElementaryMediaPacket) == 56,
+                "C API packet size != JS bindings packet array stride.");
+
+  std::vector<EMSSElementaryMediaPacket> capi_packets;
+  capi_packets.reserve(count);
+
+  // Packets are appended up to the first one that belongs to a session
+  // which has already ended.
+  for (size_t i = 0; i < count; ++i) {
+    const auto& packet = packets[i];
+    if (IsSessionStale(packet.session_id)) {
+      dropped_stale_packets_.fetch_add(1, std::memory_order_relaxed);
+      break;
+    }
+    capi_packets.push_back(PacketToCAPI(packet, type_));
+    if (version_info_.has_legacy_emss) {
+      // Legacy EMSS didn't support session_id concept.
+      capi_packets.back().session_id = kIgnoreSessionId;
+    }
+  }
+
+  if (capi_packets.empty())
+    return {0, count ? StaleSessionResult() : OperationResult::kSuccess};
+
+  auto result = CAPICall<size_t>(capi_append_packets, handle_,
+                                 capi_packets.data(), capi_packets.size());
+  CountAppendResult(result.operation_result, result.value);
+  if (result && capi_packets.size() < count)
+    result.operation_result = StaleSessionResult();
+  return result;
+}
+
 Result<void> ElementaryMediaTrack::Impl::AppendEncryptedPacketInternal(
     const EncryptedElementaryMediaPacket& packet) {
-  auto capi_packet = PacketToCAPI(packet, type_);
+  auto descriptor = AcquireEncryptedPacketDescriptor();
+  if (!PacketToCAPI(packet, type_, descriptor.get()))
+    return {OperationResult::kInvalidArgument};
+  auto& capi_packet = descriptor->packet;
 
   if (version_info_.has_legacy_emss) {
     // Legacy EMSS didn't support session_id concept.
@@ -439,7 +568,10 @@ Result<void> ElementaryMediaTrack::Impl::AppendEncryptedPacketInternal(
 
 Result<void> ElementaryMediaTrack::Impl::AppendEncryptedPacketAsyncInternal(
     const EncryptedElementaryMediaPacket& packet) {
-  auto capi_packet = PacketToCAPI(packet, type_);
+  auto descriptor = AcquireEncryptedPacketDescriptor();
+  if (!PacketToCAPI(packet, type_, descriptor.get()))
+    return {OperationResult::kInvalidArgument};
+  auto& capi_packet = descriptor->packet;
 
   if (version_info_.has_legacy_emss) {
     // Legacy EMSS didn't support session_id concept.
@@ -464,28 +596,94 @@ OperationResult ElementaryMediaTrack::Impl::SetListenerInternal(
     LISTENER_OP(elementaryMediaTrackSetOnAppendError, handle_,
                 OnAppendErrorListenerCallback, listener);
 
-    if (!version_info_.has_legacy_emss) {
+    if (!version_info_.has_legacy_emss && !tracks_session_id_) {
       LISTENER_OP(
           elementaryMediaTrackSetOnSessionIdChanged, handle_,
           ListenerCallback<ElementaryMediaTrackListener, SessionId,
                            &ElementaryMediaTrackListener::OnSessionIdChanged>,
           listener);
     }
+    // Otherwise session id changes reach the listener through
+    // NotifySessionIdChanged().
   } else {
     LISTENER_OP(elementaryMediaTrackClearListeners, handle_);
   }
   return OperationResult::kSuccess;
 }
 
+// session id tracking: private methods
+
+template <class AppendFunction>
+Result<void> ElementaryMediaTrack::Impl::AppendIfSessionCurrent(
+    SessionId session_id,
+    AppendFunction append) {
+  if (IsSessionStale(session_id)) {
+    // The packet was produced before the session changed, don't bother
+    // Platform with it.
+    dropped_stale_packets_.fetch_add(1, std::memory_order_relaxed);
+    return {StaleSessionResult()};
+  }
+  auto result = append();
+  CountAppendResult(result.operation_result, result ? 1 : 0);
+  return result;
+}
+
+void ElementaryMediaTrack::Impl::CountAppendResult(OperationResult result,
+                                                   size_t appended) {
+  appended_packets_.fetch_add(appended, std::memory_order_relaxed);
+  if (result != OperationResult::kSuccess)
+    failed_packets_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ElementaryMediaTrack::Impl::NotifySessionIdChanged(SessionId session_id) {
+  {
+    // Callbacks are called without the lock held, so that they can remove
+    // themselves.
+    std::unique_lock<std::mutex> lock(session_id_callbacks_mutex_);
+    auto callbacks = session_id_callbacks_;
+    lock.unlock();
+    for (auto& callback : callbacks)
+      callback.second(session_id);
+  }
+
+  if (listener_)
+    listener_->OnSessionIdChanged(session_id);
+}
+
+void ElementaryMediaTrack::Impl::RegisterSessionIdTracker() {
+  auto result = CAPICall<void>(
+      elementaryMediaTrackSetSessionIdTracker, handle_,
+      [](int32_t session_id, void* user_data) {
+        auto thiz = static_cast<ElementaryMediaTrack::Impl*>(user_data);
+        thiz->session_id_.store(session_id, std::memory_order_release);
+        thiz->NotifySessionIdChanged(session_id);
+      },
+      this);
+  if (!result)
+    return;
+
+  // Events that fire from now on keep the value up to date.
+  auto session_id = CAPICall<SessionId>(elementaryMediaTrackGetSessionId,
+                                        handle_);
+  if (!session_id) {
+    UnregisterSessionIdTracker();
+    return;
+  }
+  session_id_.store(*session_id, std::memory_order_release);
+  tracks_session_id_ = true;
+}
+
+void ElementaryMediaTrack::Impl::UnregisterSessionIdTracker() {
+  CAPICall<void>(elementaryMediaTrackUnsetSessionIdTracker, handle_);
+}
+
 // session id emulation for legacy mode: private methods
 
 void ElementaryMediaTrack::Impl::EmulateSessionIdChange() {
   assert(use_session_id_emulation_);
   // atomically increases session id
-  SessionId new_sid = ++emulated_session_id_;
-
-  if (listener_)
-    listener_->OnSessionIdChanged(new_sid);
+  SessionId new_sid = ++session_id_;
+  NotifySessionIdChanged(new_sid);
 }
 
 void ElementaryMediaTrack::Impl::RegisterSessionIdEmulationCallbacks() {
@@ -551,6 +749,22 @@ Result<void> ElementaryMediaTrack::AppendPacketAsync(
   return pimpl_->AppendPacketAsync(packet);
 }
 
+Result<size_t> ElementaryMediaTrack::AppendPackets(
+    const ElementaryMediaPacket* packets,
+    size_t count) {
+  if (!pimpl_)
+    return {0, OperationResult::kInvalidObject};
+  return pimpl_->AppendPackets(packets, count);
+}
+
+Result<size_t> ElementaryMediaTrack::AppendPacketsAsync(
+    const ElementaryMediaPacket* packets,
+    size_t count) {
+  if (!pimpl_)
+    return {0, OperationResult::kInvalidObject};
+  return pimpl_->AppendPacketsAsync(packets, count);
+}
+
 Result<void> ElementaryMediaTrack::AppendEncryptedPacket(
     const EncryptedElementaryMediaPacket& packet) {
   if (!pimpl_)
@@ -636,6 +850,28 @@ Result<void> ElementaryMediaTrack::SetListener(
   return pimpl_->SetListener(listener);
 }
 
+Result<ElementaryMediaTrack::SessionIdChangedCallbackId>
+ElementaryMediaTrack::AddSessionIdChangedCallback(
+    std::function<void(SessionId)> callback) {
+  if (!pimpl_)
+    return {0, OperationResult::kInvalidObject};
+  return pimpl_->AddSessionIdChangedCallback(std::move(callback));
+}
+
+Result<void> ElementaryMediaTrack::RemoveSessionIdChangedCallback(
+    SessionIdChangedCallbackId callback_id) {
+  if (!pimpl_)
+    return {OperationResult::kInvalidObject};
+  return pimpl_->RemoveSessionIdChangedCallback(callback_id);
+}
+
+Result<ElementaryMediaTrack::AppendStatistics>
+ElementaryMediaTrack::GetAppendStatistics() const {
+  if (!pimpl_)
+    return {{}, OperationResult::kInvalidObject};
+  return {pimpl_->GetAppendStatistics(), OperationResult::kSuccess};
+}
+
 int ElementaryMediaTrack::GetHandle() const {
   return pimpl_ ? pimpl_->handle() : -1;
 }
@@ -0,0 +1,366 @@
+// Copyright 2020 Samsung Electronics
+// TizenTV Emscripten extensions are available under two separate licenses, the
+// MIT license and the University of Illinois/NCSA Open Source License.  Both
+// these licenses can be found in the LICENSE file.
+
+#include "samsung/wasm/elementary_media_track_pipeline.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "samsung/wasm/elementary_media_track.h"
+#include "samsung/wasm/elementary_media_track_listener.h"
+#include "samsung/wasm/session_id.h"
+
+namespace samsung {
+namespace wasm {
+
+/*============================================================================*/
+/*= samsung::wasm::ElementaryMediaTrackPipeline::Impl declaration            =*/
+/*============================================================================*/
+
+class ElementaryMediaTrackPipeline::Impl final
+    : public ElementaryMediaTrackListener {
+ public:
+  Impl(ElementaryMediaTrack* track,
+       PacketProducer producer,
+       SeekHandler seek_handler,
+       Config config);
+  Impl(const Impl&) = delete;
+  Impl(Impl&&) = delete;
+  Impl& operator=(const Impl&) = delete;
+  Impl& operator=(Impl&&) = delete;
+  ~Impl() override;
+
+  Result<void> Start();
+  void Stop();
+  Seconds GetBufferedDuration() const;
+
+  // ElementaryMediaTrackListener interface:
+  void OnTrackOpen() override;
+  void OnTrackClosed(ElementaryMediaTrack::CloseReason close_reason) override;
+  void OnSeek(Seconds new_time) override;
+  void OnSessionIdChanged(SessionId session_id) override;
+  void OnAppendError(OperationResult operation_result) override;
+
+ private:
+  struct QueuedPacket {
+    Packet packet;
+    bool end_of_track;
+  };
+
+  void ProducerLoop();
+  void AppenderLoop();
+  // Must be called with mutex_ held.
+  void DropQueuedPacketsLocked();
+
+  ElementaryMediaTrack* track_;
+  PacketProducer producer_;
+  SeekHandler seek_handler_;
+  Config config_;
+
+  mutable std::mutex mutex_;
+  // Signaled when there's room in the queue, a seek or a stop.
+  std::condition_variable producer_cv_;
+  // Signaled when a packet is queued, the track opens, the session changes or
+  // the pipeline stops.
+  std::condition_variable appender_cv_;
+  std::deque<QueuedPacket> queue_;
+  Seconds queued_duration_;
+  SessionId session_id_;
+  // Incremented whenever queued packets are dropped, so that packets which
+  // were being produced or appended at the time can be recognized as stale.
+  uint64_t generation_;
+  bool track_open_;
+  bool seek_pending_;
+  Seconds seek_time_;
+  bool end_of_track_produced_;
+  bool running_;
+  std::thread producer_thread_;
+  std::thread appender_thread_;
+};
+
+/*============================================================================*/
+/*= samsung::wasm::ElementaryMediaTrackPipeline::Impl definition             =*/
+/*============================================================================*/
+
+ElementaryMediaTrackPipeline::Impl::Impl(ElementaryMediaTrack* track,
+                                         PacketProducer producer,
+                                         SeekHandler seek_handler,
+                                         Config config)
+    : track_(track),
+      producer_(std::move(producer)),
+      seek_handler_(std::move(seek_handler)),
+      config_(config),
+      queued_duration_(0),
+      session_id_(kIgnoreSessionId),
+      generation_(0),
+      track_open_(false),
+      seek_pending_(false),
+      seek_time_(0),
+      end_of_track_produced_(false),
+      running_(false) {}
+
+ElementaryMediaTrackPipeline::Impl::~Impl() {
+  Stop();
+}
+
+Result<void> ElementaryMediaTrackPipeline::Impl::Start() {
+  if (!track_ || !track_->IsValid())
+    return {OperationResult::kInvalidObject};
+  if (running_)
+    return {OperationResult::kInvalidState};
+
+  auto session_id = track_->GetSessionId();
+  if (!session_id)
+    return {session_id.operation_result};
+  auto is_open = track_->IsOpen();
+  if (!is_open)
+    return {is_open.operation_result};
+  auto result = track_->SetListener(this);
+  if (!result)
+    return result;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    session_id_ = *session_id;
+    track_open_ = *is_open;
+    running_ = true;
+  }
+  producer_thread_ = std::thread(&Impl::ProducerLoop, this);
+  appender_thread_ = std::thread(&Impl::AppenderLoop, this);
+  return {OperationResult::kSuccess};
+}
+
+void ElementaryMediaTrackPipeline::Impl::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_)
+      return;
+    running_ = false;
+    DropQueuedPacketsLocked();
+  }
+  producer_cv_.notify_one();
+  appender_cv_.notify_one();
+  producer_thread_.join();
+  appender_thread_.join();
+  track_->SetListener(nullptr);
+}
+
+Seconds ElementaryMediaTrackPipeline::Impl::GetBufferedDuration() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queued_duration_;
+}
+
+void ElementaryMediaTrackPipeline::Impl::OnTrackOpen() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    track_open_ = true;
+  }
+  appender_cv_.notify_one();
+  if (config_.listener)
+    config_.listener->OnTrackOpen();
+}
+
+void ElementaryMediaTrackPipeline::Impl::OnTrackClosed(
+    ElementaryMediaTrack::CloseReason close_reason) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    track_open_ = false;
+  }
+  if (config_.listener)
+    config_.listener->OnTrackClosed(close_reason);
+}
+
+void ElementaryMediaTrackPipeline::Impl::OnSeek(Seconds new_time) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Whatever was produced so far belongs to the old playback position.
+    DropQueuedPacketsLocked();
+    seek_pending_ = true;
+    seek_time_ = new_time;
+    end_of_track_produced_ = false;
+  }
+  producer_cv_.notify_one();
+  if (config_.listener)
+    config_.listener->OnSeek(new_time);
+}
+
+void ElementaryMediaTrackPipeline::Impl::OnSessionIdChanged(
+    SessionId session_id) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The platform would drop packets of the old session anyway.
+    session_id_ = session_id;
+    DropQueuedPacketsLocked();
+    // The new session needs packets of its own, even if the old one had
+    // reached its end.
+    end_of_track_produced_ = false;
+  }
+  producer_cv_.notify_one();
+  appender_cv_.notify_one();
+  if (config_.listener)
+    config_.listener->OnSessionIdChanged(session_id);
+}
+
+void ElementaryMediaTrackPipeline::Impl::OnAppendError(
+    OperationResult operation_result) {
+  if (config_.listener)
+    config_.listener->OnAppendError(operation_result);
+}
+
+// private:
+
+void ElementaryMediaTrackPipeline::Impl::ProducerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    if (seek_pending_) {
+      seek_pending_ = false;
+      const auto new_time = seek_time_;
+      lock.unlock();
+      if (seek_handler_)
+        seek_handler_(new_time);
+      lock.lock();
+      continue;
+    }
+
+    if (end_of_track_produced_ ||
+        queued_duration_ >= config_.buffer_duration) {
+      producer_cv_.wait(lock);
+      continue;
+    }
+
+    const auto generation = generation_;
+    lock.unlock();
+    QueuedPacket queued{};
+    const auto status = producer_(&queued.packet);
+    lock.lock();
+
+    // The track seeked or the session changed while the packet was produced.
+    if (generation != generation_)
+      continue;
+
+    queued.end_of_track = status == ProducerStatus::kEndOfTrack;
+    if (queued.end_of_track)
+      end_of_track_produced_ = true;
+    else
+      queued_duration_ += queued.packet.packet.duration;
+    queue_.push_back(std::move(queued));
+    appender_cv_.notify_one();
+  }
+}
+
+void ElementaryMediaTrackPipeline::Impl::AppenderLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (running_) {
+    if (!track_open_ || queue_.empty()) {
+      appender_cv_.wait(lock);
+      continue;
+    }
+
+    // Packets are taken off the queue while they are appended, so that
+    // listener events can drop the queue in the meantime.
+    auto queued = std::move(queue_.front());
+    queue_.pop_front();
+    const auto generation = generation_;
+    const auto session_id = session_id_;
+    lock.unlock();
+
+    Result<void> result;
+    if (queued.end_of_track) {
+      result = track_->AppendEndOfTrack(session_id);
+    } else {
+      auto& packet = queued.packet.packet;
+      packet.data = queued.packet.data.data();
+      packet.data_size = queued.packet.data.size();
+      packet.session_id = session_id;
+      result = track_->AppendPacket(packet);
+    }
+
+    lock.lock();
+    if (generation != generation_)
+      continue;
+
+    if (result.operation_result == OperationResult::kAppendBufferFull) {
+      queue_.push_front(std::move(queued));
+      appender_cv_.wait_for(lock, config_.buffer_full_retry_interval, [&] {
+        return !running_ || generation != generation_;
+      });
+      continue;
+    }
+
+    if (!queued.end_of_track) {
+      queued_duration_ -= queued.packet.packet.duration;
+      producer_cv_.notify_one();
+    }
+
+    // Appends to a session that has just ended are expected to be ignored.
+    if (!result &&
+        result.operation_result != OperationResult::kAppendIgnored &&
+        config_.listener) {
+      lock.unlock();
+      config_.listener->OnAppendError(result.operation_result);
+      lock.lock();
+    }
+  }
+}
+
+void ElementaryMediaTrackPipeline::Impl::DropQueuedPacketsLocked() {
+  ++generation_;
+  queue_.clear();
+  queued_duration_ = Seconds{0};
+}
+
+/*============================================================================*/
+/*= samsung::wasm::ElementaryMediaTrackPipeline definition                   =*/
+/*============================================================================*/
+
+ElementaryMediaTrackPipeline::ElementaryMediaTrackPipeline(
+    ElementaryMediaTrack* track,
+    PacketProducer producer,
+    SeekHandler seek_handler,
+    Config config)
+    : pimpl_(std::make_unique<Impl>(track,
+                                    std::move(producer),
+                                    std::move(seek_handler),
+                                    config)) {}
+
+ElementaryMediaTrackPipeline::ElementaryMediaTrackPipeline(
+    ElementaryMediaTrack* track,
+    PacketProducer producer,
+    SeekHandler seek_handler)
+    : ElementaryMediaTrackPipeline(track,
+                                   std::move(producer),
+                                   std::move(seek_handler),
+                                   Config{}) {}
+
+ElementaryMediaTrackPipeline::~ElementaryMediaTrackPipeline() = default;
+
+ElementaryMediaTrackPipeline::ElementaryMediaTrackPipeline(
+    ElementaryMediaTrackPipeline&&) = default;
+
+ElementaryMediaTrackPipeline& ElementaryMediaTrackPipeline::operator=(
+    ElementaryMediaTrackPipeline&&) = default;
+
+Result<void> ElementaryMediaTrackPipeline::Start() {
+  if (!pimpl_)
+    return {OperationResult::kInvalidObject};
+  return pimpl_->Start();
+}
+
+void ElementaryMediaTrackPipeline::Stop() {
+  if (pimpl_)
+    pimpl_->Stop();
+}
+
+Seconds ElementaryMediaTrackPipeline::GetBufferedDuration() const {
+  if (!pimpl_)
+    return Seconds{0};
+  return pimpl_->GetBufferedDuration();
+}
+
+}  // namespace wasm
+}  // namespace samsung
@@ -0,0 +1,48 @@
+// Copyright 2020 Samsung Electronics
+// TizenTV Emscripten extensions are available under two separate licenses, the
+// MIT license and the University of Illinois/NCSA Open Source License.  Both
+// these licenses can be found in the LICENSE file.
+
+#include "samsung/wasm/encrypted_packet_pool.h"
+
+#include <mutex>
+#include <vector>
+
+namespace samsung {
+namespace wasm {
+
+namespace {
+
+std::mutex& PoolMutex() {
+  static std::mutex pool_mutex;
+  return pool_mutex;
+}
+
+std::vector<EncryptedPacketDescriptor*>& FreeDescriptors() {
+  static std::vector<EncryptedPacketDescriptor*> free_descriptors;
+  return free_descriptors;
+}
+
+}  // namespace
+
+void EncryptedPacketDescriptorDeleter::operator()(
+    EncryptedPacketDescriptor* descriptor) const {
+  std::lock_guard<std::mutex> lock(PoolMutex());
+  FreeDescriptors().push_back(descriptor);
+}
+
+PooledEncryptedPacketDescriptor AcquireEncryptedPacketDescriptor() {
+  {
+    std::lock_guard<std::mutex> lock(PoolMutex());
+    auto& free_descriptors = FreeDescriptors();
+    if (!free_descriptors.empty()) {
+      auto* descriptor = free_descriptors.back();
+      free_descriptors.pop_back();
+      return PooledEncryptedPacketDescriptor{descriptor};
+    }
+  }
+  return PooledEncryptedPacketDescriptor{new EncryptedPacketDescriptor{}};
+}
+
+}  // namespace wasm
+}  // namespace samsung
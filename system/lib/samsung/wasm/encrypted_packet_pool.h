@@ -0,0 +1,49 @@
+// Copyright 2020 Samsung Electronics
+// TizenTV Emscripten extensions are available under two separate licenses, the
+// MIT license and the University of Illinois/NCSA Open Source License.  Both
+// these licenses can be found in the LICENSE file.
+
+#ifndef LIB_SAMSUNG_WASM_ENCRYPTED_PACKET_POOL_H_
+#define LIB_SAMSUNG_WASM_ENCRYPTED_PACKET_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "samsung/bindings/elementary_media_packet.h"
+
+namespace samsung {
+namespace wasm {
+
+// Encrypted packet in the layout read by the JS bindings. Key id and
+// initialization vector are stored zero-padded to the length the platform
+// expects, so that the bindings can hand out views of them instead of copying
+// and padding them for every packet.
+//
+// Descriptors are pooled and never freed, so their addresses are reused from
+// packet to packet and the bindings can keep the views they create.
+struct EncryptedPacketDescriptor {
+  static constexpr size_t kBlockSize = 16;
+
+  EMSSEncryptedElementaryMediaPacket packet;
+  uint8_t key_id[kBlockSize];
+  uint8_t initialization_vector[kBlockSize];
+};
+
+struct EncryptedPacketDescriptorDeleter {
+  void operator()(EncryptedPacketDescriptor* descriptor) const;
+};
+
+using PooledEncryptedPacketDescriptor =
+    std::unique_ptr<EncryptedPacketDescriptor,
+                    EncryptedPacketDescriptorDeleter>;
+
+// Takes a descriptor from the pool, allocating a new one only if all are in
+// use. The descriptor returns to the pool when the pointer goes out of scope.
+// Can be called from any thread.
+PooledEncryptedPacketDescriptor AcquireEncryptedPacketDescriptor();
+
+}  // namespace wasm
+}  // namespace samsung
+
+#endif  // LIB_SAMSUNG_WASM_ENCRYPTED_PACKET_POOL_H_
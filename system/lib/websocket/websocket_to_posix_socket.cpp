@@ -4,6 +4,7 @@
 #include <emscripten/emscripten.h>
 #include <emscripten/websocket.h>
 #include <emscripten/threading.h>
+#include <emscripten/posix_socket.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <errno.h>
@@ -51,7 +52,6 @@ struct SocketCallResultHeader
 
 struct PosixSocketCallResult
 {
-  PosixSocketCallResult *next;
   int callId;
   int operationCompleted;
 
@@ -59,51 +59,77 @@ struct PosixSocketCallResult
   // After the call has finished, this field reports back the number of bytes pointed to by data, >= the expected value.
   int bytes;
 
-  // Result data:
+  // Result data. Points to inlineHeader if the reply had no data beyond the header, or if the reply payload was written
+  // straight to recvBuffer and recvAddress.
   SocketCallResultHeader *data;
+  SocketCallResultHeader inlineHeader;
+
+  // How the reply is stored: copied to a heap buffer, or scattered to the destinations below.
+  int resultMode;
+
+  // For recv() and recvfrom() calls, the caller's buffers that receive the payload and the sender address directly
+  // when the reply arrives.
+  void *recvBuffer;
+  size_t recvLength;
+  void *recvAddress;
+  socklen_t *recvAddressLen;
 };
 
-// Shield multithreaded accesses to POSIX sockets functions in the program, namely the two variables 'bridgeSocket' and 'callResultHead' below.
+#define RESULT_MODE_COPY 0
+#define RESULT_MODE_RECV 1
+#define RESULT_MODE_RECVFROM 2
+
+// Shield multithreaded accesses to the variable 'bridgeSocket' below.
 static pthread_mutex_t bridgeLock = PTHREAD_MUTEX_INITIALIZER;
 
 // Socket handle for the connection from browser WebSocket to the sockets bridge proxy server.
 static EMSCRIPTEN_WEBSOCKET_T bridgeSocket = (EMSCRIPTEN_WEBSOCKET_T)0;
 
-// Stores a linked list of all currently pending sockets operations (ones that are waiting for a reply back from the sockets proxy server)
-static PosixSocketCallResult *callResultHead = 0;
+// Maximum number of socket operations that can be waiting for a reply back from the sockets proxy server at the same time.
+// Must be a power of two.
+#define MAX_PENDING_CALLS 4096
+
+// Currently pending sockets operations, indexed by call ID modulo MAX_PENDING_CALLS. A call ID is only handed out when its
+// slot is free, so submitting calls from any thread and matching up replies on the main thread are O(1) and take no lock.
+static PosixSocketCallResult *pendingCalls[MAX_PENDING_CALLS];
+static uint32_t nextCallId = 1;
 
 static PosixSocketCallResult *allocate_call_result(int expectedBytes)
 {
-  pthread_mutex_lock(&bridgeLock); // Guard multithreaded access to 'callResultHead' and 'nextId' below
   PosixSocketCallResult *b = (PosixSocketCallResult*)(malloc(sizeof(PosixSocketCallResult)));
   if (!b)
   {
 #ifdef POSIX_SOCKET_DEBUG
     emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "allocate_call_result: Failed to allocate call result struct of size %d bytes!\n", (int)sizeof(PosixSocketCallResult));
 #endif
-    pthread_mutex_unlock(&bridgeLock);
     return 0;
   }
-  static int nextId = 1;
-  b->callId = nextId++;
-#ifdef POSIX_SOCKET_DEEP_DEBUG
-  emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "allocate_call_result: allocated call ID %d\n", b->callId);
-#endif
   b->bytes = expectedBytes;
   b->data = 0;
   b->operationCompleted = 0;
-  b->next = 0;
+  b->resultMode = RESULT_MODE_COPY;
+  b->recvBuffer = 0;
+  b->recvLength = 0;
+  b->recvAddress = 0;
+  b->recvAddressLen = 0;
 
-  if (!callResultHead)
-    callResultHead = b;
-  else
+  for(int i = 0; i < MAX_PENDING_CALLS; ++i)
   {
-    PosixSocketCallResult *t = callResultHead;
-    while(t->next) t = t->next;
-    t->next = b;
+    b->callId = (int)(emscripten_atomic_add_u32(&nextCallId, 1) & 0x7FFFFFFF);
+    uint32_t *slot = (uint32_t*)&pendingCalls[b->callId & (MAX_PENDING_CALLS-1)];
+    if (emscripten_atomic_cas_u32(slot, 0, (uint32_t)b) == 0)
+    {
+#ifdef POSIX_SOCKET_DEEP_DEBUG
+      emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "allocate_call_result: allocated call ID %d\n", b->callId);
+#endif
+      return b;
+    }
   }
-  pthread_mutex_unlock(&bridgeLock);
-  return b;
+#ifdef POSIX_SOCKET_DEBUG
+  emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "allocate_call_result: Too many pending socket calls, at most %d can be in flight!\n", MAX_PENDING_CALLS);
+#endif
+  free(b);
+  return 0;
 }
 
 static void free_call_result(PosixSocketCallResult *buffer)
@@ -113,34 +139,25 @@ static void free_call_result(PosixSocketCallResult *buffer)
     emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "free_call_result: freed call ID %d\n", buffer->callId);
 #endif
 
-  if (buffer->data) free(buffer->data);
+  if (buffer->data && buffer->data != &buffer->inlineHeader) free(buffer->data);
   free(buffer);
 }
 
+// Only called on the main browser thread, where the bridge socket messages are received.
 PosixSocketCallResult *pop_call_result(int callId)
 {
-  pthread_mutex_lock(&bridgeLock); // Guard multithreaded access to 'callResultHead'
-  PosixSocketCallResult *prev = 0;
-  PosixSocketCallResult *b = callResultHead;
-  while(b)
+  uint32_t *slot = (uint32_t*)&pendingCalls[callId & (MAX_PENDING_CALLS-1)];
+  PosixSocketCallResult *b = (PosixSocketCallResult*)emscripten_atomic_load_u32(slot);
+  if (b && b->callId == callId)
   {
-    if (b->callId == callId)
-    {
-      if (prev) prev->next = b->next;
-      else callResultHead = b->next;
-      b->next = 0;
+    emscripten_atomic_store_u32(slot, 0);
 #ifdef POSIX_SOCKET_DEEP_DEBUG
-      emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "pop_call_result: Removed call ID %d from pending sockets call queue\n", callId);
+    emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "pop_call_result: Removed call ID %d from pending sockets call table\n", callId);
 #endif
-      pthread_mutex_unlock(&bridgeLock);
-      return b;
-    }
-    prev = b;
-    b = b->next;
+    return b;
   }
-  pthread_mutex_unlock(&bridgeLock);
 #ifdef POSIX_SOCKET_DEBUG
-  emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "pop_call_result: No such call ID %d in pending sockets call queue!\n", callId);
+  emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "pop_call_result: No such call ID %d in pending sockets call table!\n", callId);
 #endif
   return 0;
 }
@@ -157,6 +174,40 @@ void wait_for_call_result(PosixSocketCallResult *b)
 #endif
 }
 
+// Writes the payload of a recv() or recvfrom() reply to the buffers that the caller registered with the call.
+static void scatter_recv_result(PosixSocketCallResult *b, const uint8_t *message, uint32_t numBytes)
+{
+  if (b->resultMode == RESULT_MODE_RECV)
+  {
+    struct Result {
+      SocketCallResultHeader header;
+      uint8_t data[];
+    };
+    const Result *r = (const Result*)message;
+    size_t dataLen = MIN(numBytes - sizeof(Result), b->recvLength);
+    if (b->recvBuffer) memcpy(b->recvBuffer, r->data, dataLen);
+  }
+  else if (b->resultMode == RESULT_MODE_RECVFROM)
+  {
+    struct Result {
+      SocketCallResultHeader header;
+      int data_len;
+      int address_len; // N.B. this is the reported address length of the sender, that may be larger than what is actually serialized to this message.
+      uint8_t data_and_address[];
+    };
+    if (numBytes < sizeof(Result))
+      return;
+    const Result *r = (const Result*)message;
+    size_t available = numBytes - sizeof(Result);
+    size_t dataLen = MIN((size_t)r->data_len, available);
+    if (b->recvBuffer) memcpy(b->recvBuffer, r->data_and_address, MIN(dataLen, b->recvLength));
+    size_t copiedAddressLen = MIN((b->recvAddressLen ? *b->recvAddressLen : 0), (size_t)r->address_len);
+    copiedAddressLen = MIN(copiedAddressLen, available - dataLen);
+    if (b->recvAddress) memcpy(b->recvAddress, r->data_and_address + dataLen, copiedAddressLen);
+    if (b->recvAddressLen) *b->recvAddressLen = r->address_len;
+  }
+}
+
 static EM_BOOL bridge_socket_on_message(int eventType, const EmscriptenWebSocketMessageEvent *websocketEvent, void *userData)
 {
   if (websocketEvent->numBytes < sizeof(SocketCallResultHeader))
@@ -187,12 +238,23 @@ static EM_BOOL bridge_socket_on_message(int eventType, const EmscriptenWebSocket
   }
 
   b->bytes = websocketEvent->numBytes;
-  b->data = (SocketCallResultHeader*)memdup(websocketEvent->data, websocketEvent->numBytes);
-
-  if (!b->data)
+  if (b->resultMode != RESULT_MODE_COPY || websocketEvent->numBytes == sizeof(SocketCallResultHeader))
   {
-    emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "Out of memory, tried to allocate %d bytes!\n", websocketEvent->numBytes);
-    return EM_TRUE;
+    // Scatter the payload straight to the caller's buffers, so that receiving needs no allocation and only one copy.
+    b->inlineHeader = *header;
+    b->data = &b->inlineHeader;
+    if (header->ret >= 0)
+      scatter_recv_result(b, websocketEvent->data, websocketEvent->numBytes);
+  }
+  else
+  {
+    b->data = (SocketCallResultHeader*)memdup(websocketEvent->data, websocketEvent->numBytes);
+
+    if (!b->data)
+    {
+      emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "Out of memory, tried to allocate %d bytes!\n", websocketEvent->numBytes);
+      return EM_TRUE;
+    }
   }
 
   if (b->operationCompleted != 0)
@@ -268,6 +330,11 @@ int socket(int domain, int type, int protocol)
   } d;
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_SOCKET;
   d.domain = domain;
@@ -301,6 +368,11 @@ int socketpair(int domain, int type, int protocol, int socket_vector[2])
   };
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(Result));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_SOCKETPAIR;
   d.domain = domain;
@@ -337,6 +409,11 @@ int shutdown(int socket, int how)
   } d;
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_SHUTDOWN;
   d.socket = socket;
@@ -366,6 +443,13 @@ int bind(int socket, const struct sockaddr *address, socklen_t address_len)
   Data *d = (Data*)malloc(numBytes);
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!d || !b)
+  {
+    errno = d ? ENOBUFS : ENOMEM;
+    free(d);
+    if (b) free_call_result(b);
+    return -1;
+  }
   d->header.callId = b->callId;
   d->header.function = POSIX_SOCKET_MSG_BIND;
   d->socket = socket;
@@ -399,6 +483,13 @@ int connect(int socket, const struct sockaddr *address, socklen_t address_len)
   Data *d = (Data*)malloc(numBytes);
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!d || !b)
+  {
+    errno = d ? ENOBUFS : ENOMEM;
+    free(d);
+    if (b) free_call_result(b);
+    return -1;
+  }
   d->header.callId = b->callId;
   d->header.function = POSIX_SOCKET_MSG_CONNECT;
   d->socket = socket;
@@ -429,6 +520,11 @@ int listen(int socket, int backlog)
   } d;
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_LISTEN;
   d.socket = socket;
@@ -455,6 +551,11 @@ int accept(int socket, struct sockaddr *address, socklen_t *address_len)
   } d;
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_ACCEPT;
   d.socket = socket;
@@ -504,6 +605,11 @@ int getsockname(int socket, struct sockaddr *address, socklen_t *address_len)
   };
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(Result));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_GETSOCKNAME;
   d.socket = socket;
@@ -547,6 +653,11 @@ int getpeername(int socket, struct sockaddr *address, socklen_t *address_len)
   };
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(Result));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_GETPEERNAME;
   d.socket = socket;
@@ -571,7 +682,7 @@ int getpeername(int socket, struct sockaddr *address, socklen_t *address_len)
   return ret;
 }
 
-ssize_t send(int socket, const void *message, size_t length, int flags)
+PosixSocketCallResult *emscripten_posix_socket_send_async(int socket, const void *message, size_t length, int flags)
 {
 #ifdef POSIX_SOCKET_DEBUG
   emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "send(socket=%d,message=%p,length=%zd,flags=%d)\n", socket, message, length, flags);
@@ -588,6 +699,14 @@ ssize_t send(int socket, const void *message, size_t length, int flags)
   MSG *d = (MSG*)malloc(sz);
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!d || !b)
+  {
+    // Running out of call slots is temporary, they are freed as pending calls complete.
+    errno = d ? EAGAIN : ENOMEM;
+    free(d);
+    if (b) free_call_result(b);
+    return 0;
+  }
   d->header.callId = b->callId;
   d->header.function = POSIX_SOCKET_MSG_SEND;
   d->socket = socket;
@@ -597,16 +716,11 @@ ssize_t send(int socket, const void *message, size_t length, int flags)
   else memset(d->message, 0, length);
   emscripten_websocket_send_binary(bridgeSocket, d, sz);
 
-  wait_for_call_result(b);
-  int ret = b->data->ret;
-  if (ret < 0) errno = b->data->errno_;
-  free_call_result(b);
-
   free(d);
-  return ret;
+  return b;
 }
 
-ssize_t recv(int socket, void *buffer, size_t length, int flags)
+PosixSocketCallResult *emscripten_posix_socket_recv_async(int socket, void *buffer, size_t length, int flags)
 {
 #ifdef POSIX_SOCKET_DEBUG
   emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "recv(socket=%d,buffer=%p,length=%zd,flags=%d)\n", socket, buffer, length, flags);
@@ -620,31 +734,60 @@ ssize_t recv(int socket, void *buffer, size_t length, int flags)
   } d;
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!b)
+  {
+    errno = EAGAIN;
+    return 0;
+  }
+  b->resultMode = RESULT_MODE_RECV;
+  b->recvBuffer = buffer;
+  b->recvLength = length;
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_RECV;
   d.socket = socket;
   d.length = length;
   d.flags = flags;
   emscripten_websocket_send_binary(bridgeSocket, &d, sizeof(d));
+  return b;
+}
 
-  wait_for_call_result(b);
-  int ret = b->data->ret;
-  if (ret >= 0)
+EM_BOOL emscripten_posix_socket_call_done(PosixSocketCallResult *call)
+{
+  return emscripten_atomic_load_u32(&call->operationCompleted) ? EM_TRUE : EM_FALSE;
+}
+
+ssize_t emscripten_posix_socket_call_wait(PosixSocketCallResult *call)
+{
+  wait_for_call_result(call);
+  // Any received data has already been written to the caller's buffer.
+  int ret = call->data->ret;
+  if (ret < 0) errno = call->data->errno_;
+  free_call_result(call);
+
+  return ret;
+}
+
+ssize_t send(int socket, const void *message, size_t length, int flags)
+{
+  PosixSocketCallResult *b = emscripten_posix_socket_send_async(socket, message, length, flags);
+  if (!b)
   {
-    struct Result {
-      SocketCallResultHeader header;
-      uint8_t data[];
-    };
-    Result *r = (Result*)b->data;
-    if (buffer) memcpy(buffer, r->data, MIN(ret, length));
+    // A blocking call does not report EAGAIN.
+    if (errno == EAGAIN) errno = ENOBUFS;
+    return -1;
   }
-  else
+  return emscripten_posix_socket_call_wait(b);
+}
+
+ssize_t recv(int socket, void *buffer, size_t length, int flags)
+{
+  PosixSocketCallResult *b = emscripten_posix_socket_recv_async(socket, buffer, length, flags);
+  if (!b)
   {
-    errno = b->data->errno_;
+    if (errno == EAGAIN) errno = ENOBUFS;
+    return -1;
   }
-  free_call_result(b);
-
-  return ret;
+  return emscripten_posix_socket_call_wait(b);
 }
 
 ssize_t sendto(int socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len)
@@ -666,6 +809,13 @@ ssize_t sendto(int socket, const void *message, size_t length, int flags, const
   MSG *d = (MSG*)malloc(sz);
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!d || !b)
+  {
+    errno = d ? ENOBUFS : ENOMEM;
+    free(d);
+    if (b) free_call_result(b);
+    return -1;
+  }
   d->header.callId = b->callId;
   d->header.function = POSIX_SOCKET_MSG_SENDTO;
   d->socket = socket;
@@ -702,34 +852,28 @@ ssize_t recvfrom(int socket, void *buffer, size_t length, int flags, struct sock
   } d;
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
+  b->resultMode = RESULT_MODE_RECVFROM;
+  b->recvBuffer = buffer;
+  b->recvLength = length;
+  b->recvAddress = address;
+  b->recvAddressLen = address_len;
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_RECVFROM;
   d.socket = socket;
   d.length = length;
   d.flags = flags;
-  d.address_len = *address_len;
+  d.address_len = address_len ? *address_len : 0;
   emscripten_websocket_send_binary(bridgeSocket, &d, sizeof(d));
 
   wait_for_call_result(b);
+  // The received data and sender address have already been written to the caller's buffers.
   int ret = b->data->ret;
-  if (ret >= 0)
-  {
-    struct Result {
-      SocketCallResultHeader header;
-      int data_len;
-      int address_len; // N.B. this is the reported address length of the sender, that may be larger than what is actually serialized to this message.
-      uint8_t data_and_address[];
-    };
-    Result *r = (Result*)b->data;
-    if (buffer) memcpy(buffer, r->data_and_address, MIN(r->data_len, length));
-    int copiedAddressLen = MIN((address_len ? *address_len : 0), r->address_len);
-    if (address) memcpy(address, r->data_and_address + r->data_len, copiedAddressLen);
-    if (address_len) *address_len = r->address_len;
-  }
-  else
-  {
-    errno = b->data->errno_;
-  }
+  if (ret < 0) errno = b->data->errno_;
   free_call_result(b);
 
   return ret;
@@ -775,6 +919,11 @@ int getsockopt(int socket, int level, int option_name, void *option_value, sockl
   };
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(Result));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return -1;
+  }
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_GETSOCKOPT;
   d.socket = socket;
@@ -818,6 +967,13 @@ int setsockopt(int socket, int level, int option_name, const void *option_value,
   MSG *d = (MSG*)malloc(messageSize);
 
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  if (!d || !b)
+  {
+    errno = d ? ENOBUFS : ENOMEM;
+    free(d);
+    if (b) free_call_result(b);
+    return -1;
+  }
   d->header.callId = b->callId;
   d->header.function = POSIX_SOCKET_MSG_SETSOCKOPT;
   d->socket = socket;
@@ -874,6 +1030,11 @@ int getaddrinfo(const char *node, const char *service, const struct addrinfo *hi
 
   memset(&d, 0, sizeof(d));
   PosixSocketCallResult *b = allocate_call_result(sizeof(Result));
+  if (!b)
+  {
+    errno = ENOBUFS;
+    return EAI_SYSTEM;
+  }
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_GETADDRINFO;
   if (node)
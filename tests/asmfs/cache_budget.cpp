@@ -0,0 +1,52 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+// Reads remote files that together do not fit in the ASMFS cache budget, and
+// checks that evicted files are downloaded again when reopened.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <emscripten/emscripten.h>
+#include <emscripten/fetch.h>
+
+#define NUM_FILES 8
+#define FILE_SIZE 100000
+#define BUDGET (3 * FILE_SIZE)
+
+static void read_file(int n)
+{
+  char name[32];
+  sprintf(name, "cached_%d.dat", n);
+  FILE* file = fopen(name, "rb");
+  assert(file);
+  static unsigned char data[FILE_SIZE + 1];
+  size_t size = fread(data, 1, sizeof(data), file);
+  assert(size == FILE_SIZE);
+  for(int i = 0; i < FILE_SIZE; ++i)
+    assert(data[i] == (unsigned char)(n + i));
+  fclose(file);
+}
+
+int main()
+{
+  emscripten_asmfs_set_cache_budget(BUDGET);
+  for(int n = 0; n < NUM_FILES; ++n)
+  {
+    read_file(n);
+    uint64_t usage = emscripten_asmfs_get_cache_usage();
+    printf("After file %d: %llu bytes cached\n", n, usage);
+    assert(usage <= BUDGET);
+    assert(usage >= FILE_SIZE);
+  }
+  // The first files have been evicted by now.
+  read_file(0);
+  read_file(1);
+  assert(emscripten_asmfs_get_cache_usage() <= BUDGET);
+
+#ifdef REPORT_RESULT
+  REPORT_RESULT(0);
+#endif
+}
@@ -0,0 +1,108 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+// Reads and writes files across chunk boundaries, and opens a remote file with
+// range requests enabled.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <emscripten/emscripten.h>
+#include <emscripten/fetch.h>
+
+#define FILE_SIZE (300 * 1024 + 17)
+#define GAP 100000
+
+static unsigned char expected(int i)
+{
+  return (unsigned char)(i * 7 + (i >> 8));
+}
+
+int main()
+{
+  unsigned char* buf = (unsigned char*)malloc(FILE_SIZE);
+  for(int i = 0; i < FILE_SIZE; ++i)
+    buf[i] = expected(i);
+
+  // Write in odd-sized pieces, so that writes straddle chunk boundaries.
+  int fd = open("/chunked.dat", O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  assert(fd >= 0);
+  for(int pos = 0; pos < FILE_SIZE;)
+  {
+    int n = FILE_SIZE - pos < 12345 ? FILE_SIZE - pos : 12345;
+    ssize_t ret = write(fd, buf + pos, n);
+    assert(ret == n);
+    pos += n;
+  }
+  // Writing past the end leaves a gap that reads back as zeroes.
+  off_t off = lseek(fd, GAP, SEEK_END);
+  assert(off == FILE_SIZE + GAP);
+  ssize_t ret = write(fd, "end", 3);
+  assert(ret == 3);
+  close(fd);
+
+  struct stat st;
+  int r = stat("/chunked.dat", &st);
+  assert(r == 0);
+  assert(st.st_size == FILE_SIZE + GAP + 3);
+
+  unsigned char* readBuf = (unsigned char*)malloc(st.st_size);
+  fd = open("/chunked.dat", O_RDONLY);
+  assert(fd >= 0);
+  ret = read(fd, readBuf, st.st_size);
+  assert(ret == st.st_size);
+  assert(!memcmp(readBuf, buf, FILE_SIZE));
+  for(int i = 0; i < GAP; ++i)
+    assert(readBuf[FILE_SIZE + i] == 0);
+  assert(!memcmp(readBuf + FILE_SIZE + GAP, "end", 3));
+  close(fd);
+
+  uint64_t resident, total;
+  emscripten_asmfs_compute_chunk_usage(&resident, &total);
+  printf("Chunks: %llu resident of %llu\n", resident, total);
+  assert(resident > 0 && resident <= total);
+
+  // Overwriting in the middle keeps the size.
+  fd = open("/chunked.dat", O_WRONLY);
+  assert(fd >= 0);
+  off = lseek(fd, 65530, SEEK_SET);
+  assert(off == 65530);
+  ret = write(fd, "0123456789", 10);
+  assert(ret == 10);
+  close(fd);
+  r = stat("/chunked.dat", &st);
+  assert(r == 0);
+  assert(st.st_size == FILE_SIZE + GAP + 3);
+  fd = open("/chunked.dat", O_RDONLY);
+  assert(fd >= 0);
+  off = lseek(fd, 65528, SEEK_SET);
+  assert(off == 65528);
+  char text[15] = {};
+  ret = read(fd, text, 14);
+  assert(ret == 14);
+  assert(text[0] == (char)expected(65528) && text[1] == (char)expected(65529));
+  assert(!memcmp(text + 2, "0123456789", 10));
+  assert(text[12] == (char)expected(65540) && text[13] == (char)expected(65541));
+  close(fd);
+
+  // The test server may or may not support range requests; the file must read the same either way.
+  emscripten_asmfs_set_range_requests(EM_TRUE);
+  FILE* file = fopen("hello_file.txt", "rb");
+  assert(file);
+  char hello[16] = {};
+  size_t n = fread(hello, 1, sizeof(hello) - 1, file);
+  printf("File contents: %s\n", hello);
+  assert(n == 6);
+  assert(!strcmp(hello, "Hello!"));
+  fclose(file);
+
+#ifdef REPORT_RESULT
+  REPORT_RESULT(0);
+#endif
+}
@@ -0,0 +1,98 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+// Measures open() and stat() throughput on directories with many files.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <emscripten/emscripten.h>
+
+#ifndef NUM_FILES
+#define NUM_FILES 5000
+#endif
+
+#ifndef NUM_LOOKUPS
+#define NUM_LOOKUPS 100000
+#endif
+
+static void file_name(char* dst, int i)
+{
+  sprintf(dst, "/assets/level%d/file_%05d.dat", i % 2, i);
+}
+
+int main()
+{
+  char path[256];
+  int ret = mkdir("/assets", 0777);
+  assert(ret == 0);
+  ret = mkdir("/assets/level0", 0777);
+  assert(ret == 0);
+  ret = mkdir("/assets/level1", 0777);
+  assert(ret == 0);
+
+  double t0 = emscripten_get_now();
+  for(int i = 0; i < NUM_FILES; ++i)
+  {
+    file_name(path, i);
+    int fd = open(path, O_CREAT | O_WRONLY, 0666);
+    assert(fd >= 0);
+    write(fd, &i, sizeof(i));
+    close(fd);
+  }
+  double t1 = emscripten_get_now();
+  printf("Created %d files in %f msecs\n", NUM_FILES, t1 - t0);
+
+  unsigned int rnd = 1;
+  for(int i = 0; i < NUM_LOOKUPS; ++i)
+  {
+    rnd = rnd * 1103515245 + 12345;
+    file_name(path, (rnd >> 8) % NUM_FILES);
+    struct stat st;
+    ret = stat(path, &st);
+    assert(ret == 0);
+    assert(st.st_size == sizeof(int));
+  }
+  double t2 = emscripten_get_now();
+  printf("stat: %f lookups/sec\n", NUM_LOOKUPS * 1000.0 / (t2 - t1));
+
+  for(int i = 0; i < NUM_LOOKUPS; ++i)
+  {
+    rnd = rnd * 1103515245 + 12345;
+    int n = (rnd >> 8) % NUM_FILES;
+    file_name(path, n);
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    int value = -1;
+    read(fd, &value, sizeof(value));
+    assert(value == n);
+    close(fd);
+  }
+  double t3 = emscripten_get_now();
+  printf("open: %f lookups/sec\n", NUM_LOOKUPS * 1000.0 / (t3 - t2));
+
+  // Removing files must keep the lookup index consistent.
+  for(int i = 0; i < NUM_FILES; i += 2)
+  {
+    file_name(path, i);
+    ret = unlink(path);
+    assert(ret == 0);
+  }
+  for(int i = 1; i < NUM_FILES; i += 2)
+  {
+    file_name(path, i);
+    struct stat st;
+    ret = stat(path, &st);
+    assert(ret == 0);
+  }
+  printf("Total time: %f\n", (emscripten_get_now() - t0) / 1000.0);
+
+#ifdef REPORT_RESULT
+  REPORT_RESULT(0);
+#endif
+}
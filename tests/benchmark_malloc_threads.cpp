@@ -0,0 +1,106 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+// Stress test for malloc()/free() from many threads at once. Each thread
+// keeps a window of live small allocations and randomly replaces them, and
+// a share of each thread's allocations are freed by the next thread to
+// exercise cross-thread frees.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+#include "tick.h"
+
+#ifndef NUM_THREADS
+#define NUM_THREADS 8
+#endif
+
+#ifndef NUM_OPS
+#define NUM_OPS 1000000
+#endif
+
+#ifndef MAX_SIZE
+#define MAX_SIZE 256
+#endif
+
+#define WINDOW 256
+#define HANDOFF 64
+
+// Allocations passed from thread i to thread i+1.
+static void* handoff[NUM_THREADS][HANDOFF];
+static pthread_barrier_t barrier;
+
+static unsigned int next_random(unsigned int* state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+static void* thread_main(void* arg)
+{
+	int id = (int)(long)arg;
+	unsigned int state = 1 + id;
+	void* live[WINDOW] = {};
+	long checksum = 0;
+
+	pthread_barrier_wait(&barrier);
+	for(int i = 0; i < NUM_OPS; ++i)
+	{
+		int slot = next_random(&state) % WINDOW;
+		size_t size = 1 + next_random(&state) % MAX_SIZE;
+		free(live[slot]);
+		live[slot] = malloc(size);
+		assert(live[slot]);
+		((char*)live[slot])[0] = (char)i;
+		((char*)live[slot])[size - 1] = (char)i;
+		checksum += ((char*)live[slot])[0];
+	}
+	for(int i = 0; i < HANDOFF; ++i)
+	{
+		handoff[id][i] = live[i];
+		live[i] = 0;
+	}
+	pthread_barrier_wait(&barrier);
+	int prev = (id + NUM_THREADS - 1) % NUM_THREADS;
+	for(int i = 0; i < HANDOFF; ++i) free(handoff[prev][i]);
+	for(int i = 0; i < WINDOW; ++i) free(live[i]);
+	return (void*)checksum;
+}
+
+int main()
+{
+	pthread_t threads[NUM_THREADS];
+	pthread_barrier_init(&barrier, 0, NUM_THREADS);
+
+	tick_t t0 = tick();
+	for(int i = 0; i < NUM_THREADS; ++i)
+	{
+		int rc = pthread_create(&threads[i], 0, thread_main, (void*)(long)i);
+		assert(rc == 0);
+	}
+	long checksum = 0;
+	for(int i = 0; i < NUM_THREADS; ++i)
+	{
+		void* result;
+		pthread_join(threads[i], &result);
+		checksum += (long)result;
+	}
+	tick_t t1 = tick();
+
+	double seconds = (double)(t1 - t0) / ticks_per_sec();
+	double opsPerSecond = (double)NUM_THREADS * NUM_OPS / seconds;
+	std::cout << "Threads: " << NUM_THREADS << std::endl;
+	std::cout << "Allocations per second: " << opsPerSecond << std::endl;
+	std::cout << "Result checksum: " << checksum << std::endl;
+	std::cout << "Total time: " << seconds << std::endl;
+
+#ifdef REPORT_RESULT
+	REPORT_RESULT(0);
+#endif
+}
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 
 #include <emscripten.h>
+#include <emscripten/emmalloc.h>
 
 #ifndef RANDOM_ITERS
 #define RANDOM_ITERS 12345
@@ -289,6 +290,73 @@ void randoms() {
   assert(check_where_we_would_malloc(10) == start);
 }
 
+struct walk_state {
+  void* next;
+  size_t used;
+  size_t free;
+};
+
+void walk_region(void* payload, size_t size, int used, void* user_data) {
+  walk_state* state = (walk_state*)user_data;
+  // Regions are visited in address order, and are adjacent.
+  assert(!state->next || payload == state->next);
+  state->next = (char*)payload + size + ALLOCATION_UNIT;
+  if (used) {
+    state->used += size;
+  } else {
+    state->free += size;
+  }
+}
+
+void stats() {
+  stage("stats");
+  emmalloc_blank_slate_from_orbit();
+  emmalloc_stats s;
+  emmalloc_get_stats(&s);
+  assert(s.sbrk_bytes == 0);
+  assert(s.used_regions == 0 && s.free_regions == 0);
+  assert(s.total_rounding_bytes == 0);
+  void* a = malloc(10);   // payload 16
+  void* b = malloc(100);  // payload 104
+  void* c = malloc(1000); // payload 1000
+  assert((char*)c + 1000 == sbrk(0));
+  free(b);
+  emmalloc_get_stats(&s);
+  assert(s.used_regions == 2);
+  assert(s.used_bytes == 16 + 1000);
+  assert(s.free_regions == 1);
+  assert(s.free_bytes == 104);
+  assert(s.largest_free == 104);
+  assert(s.metadata_bytes == 3 * ALLOCATION_UNIT);
+  // sbrk() may have needed some padding for alignment at the start.
+  size_t total = 3 * ALLOCATION_UNIT + 16 + 104 + 1000;
+  assert(s.sbrk_bytes >= total && s.sbrk_bytes < total + ALLOCATION_UNIT);
+  assert(s.total_rounding_bytes == 6 + 4);
+  for (int i = 0; i < EMMALLOC_NUM_FREELISTS; i++) {
+    if (i == 6) {
+      // 64 <= 104 < 128
+      assert(s.freelists[i].count == 1);
+      assert(s.freelists[i].bytes == 104);
+    } else {
+      assert(s.freelists[i].count == 0);
+    }
+  }
+  walk_state state = {nullptr, 0, 0};
+  emmalloc_walk_regions(walk_region, &state);
+  assert(state.used == s.used_bytes);
+  assert(state.free == s.free_bytes);
+  assert(state.next == (char*)sbrk(0) + ALLOCATION_UNIT);
+  free(a);
+  free(c);
+  // The rounding total is cumulative, freeing does not reduce it.
+  emmalloc_get_stats(&s);
+  assert(s.total_rounding_bytes == 6 + 4);
+  assert(s.used_regions == 0);
+  assert(s.free_regions == 1);
+  assert(s.largest_free == s.free_bytes);
+  assert(s.free_bytes + s.metadata_bytes == (char*)sbrk(0) - (char*)a + ALLOCATION_UNIT);
+}
+
 int main() {
   stage("beginning");
 
@@ -301,6 +369,7 @@ int main() {
   realloc();
   aligned();
   randoms();
+  stats();
 
   stage("the_end");
 }
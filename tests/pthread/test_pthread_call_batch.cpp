@@ -0,0 +1,87 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <emscripten/threading.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define NUM_CALLS 1000
+
+volatile int next_value = 0;
+volatile int out_of_order = 0;
+
+void record(int value, float f)
+{
+	assert(emscripten_is_main_browser_thread());
+	assert(f == value * 0.5f);
+	if (value != next_value)
+		out_of_order = 1;
+	emscripten_atomic_store_u32((void*)&next_value, value + 1);
+}
+
+em_queued_call_batch *make_batch(int first)
+{
+	em_queued_call_batch *batch = emscripten_create_call_batch();
+	assert(batch);
+	for(int i = first; i < first + NUM_CALLS; ++i)
+	{
+		int ok = emscripten_call_batch_add(batch, EM_FUNC_SIG_VIF, record, i, i * 0.5f);
+		assert(ok);
+	}
+	return batch;
+}
+
+void test_waitable()
+{
+	printf("Testing a waitable batch:\n");
+	em_queued_call *c = emscripten_async_waitable_run_batch_in_main_runtime_thread(make_batch(next_value));
+	assert(c);
+	EMSCRIPTEN_RESULT r = emscripten_wait_for_call_v(c, INFINITY);
+	assert(r == EMSCRIPTEN_RESULT_SUCCESS);
+	emscripten_async_waitable_close(c);
+	assert(next_value % NUM_CALLS == 0);
+	assert(!out_of_order);
+}
+
+void test_async()
+{
+	printf("Testing fire and forget batches:\n");
+	int start = next_value;
+	int end = start + 3 * NUM_CALLS;
+	for(int i = 0; i < 3; ++i)
+		emscripten_async_run_batch_in_main_runtime_thread(make_batch(start + i * NUM_CALLS));
+	while(emscripten_atomic_load_u32((void*)&next_value) != end)
+		;
+	assert(!out_of_order);
+}
+
+void *thread_main(void*)
+{
+	test_waitable();
+	test_async();
+	// A batch that is not submitted can be thrown away.
+	emscripten_destroy_call_batch(make_batch(0));
+	pthread_exit(0);
+}
+
+int main()
+{
+	// Batches submitted on the main thread itself run right away.
+	test_waitable();
+	test_async();
+
+	pthread_t thread;
+	int rc = pthread_create(&thread, 0, thread_main, 0);
+	assert(rc == 0);
+	rc = pthread_join(thread, 0);
+	assert(rc == 0);
+	printf("%d calls run\n", next_value);
+	assert(next_value == 8 * NUM_CALLS);
+
+#ifdef REPORT_RESULT
+	REPORT_RESULT(0);
+#endif
+}
@@ -0,0 +1,73 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+// A poll() proxied to the main thread that waits on the read end of a pipe
+// must complete as soon as the main thread writes to the pipe, and not only
+// when its timeout expires.
+
+#include <emscripten.h>
+#include <emscripten/threading.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+
+#define TIMEOUT_MSECS 10000
+
+int fds[2];
+volatile int polling = 0;
+volatile int done = 0;
+volatile int failed = 0;
+int written = 0;
+
+void write_to_pipe(void *arg)
+{
+	char c = 'x';
+	int ret = write(fds[1], &c, 1);
+	assert(ret == 1);
+}
+
+void *thread_main(void *arg)
+{
+	struct pollfd pfd = { fds[0], POLLIN, 0 };
+	emscripten_atomic_store_u32((void*)&polling, 1);
+	double t0 = emscripten_get_now();
+	int ret = poll(&pfd, 1, TIMEOUT_MSECS);
+	double elapsed = emscripten_get_now() - t0;
+	printf("poll() returned %d with revents 0x%x after %f msecs\n", ret, pfd.revents, elapsed);
+	if (ret != 1 || !(pfd.revents & POLLIN) || elapsed > TIMEOUT_MSECS / 2)
+		failed = 1;
+	emscripten_atomic_store_u32((void*)&done, 1);
+	return 0;
+}
+
+void main_loop()
+{
+	// Write from the main thread itself, not from a proxied call, once the
+	// thread is likely waiting in poll().
+	if (!written && emscripten_atomic_load_u32((void*)&polling))
+	{
+		written = 1;
+		emscripten_async_call(write_to_pipe, 0, 200);
+	}
+	if (!emscripten_atomic_load_u32((void*)&done))
+		return;
+	emscripten_cancel_main_loop();
+#ifdef REPORT_RESULT
+	REPORT_RESULT(failed);
+#endif
+}
+
+int main()
+{
+	int ret = pipe(fds);
+	assert(ret == 0);
+	pthread_t thread;
+	int rc = pthread_create(&thread, 0, thread_main, 0);
+	assert(rc == 0);
+	pthread_detach(thread);
+	emscripten_set_main_loop(main_loop, 10, 0);
+}
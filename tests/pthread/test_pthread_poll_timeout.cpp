@@ -0,0 +1,65 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+// poll() and select() calls from pthreads are proxied to the main thread. Waits
+// with different timeouts must all complete once their timeout expires, while
+// the main thread is idle in the browser event loop.
+
+#include <emscripten.h>
+#include <emscripten/threading.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <assert.h>
+#include <sys/select.h>
+
+#define NUM_THREADS 4
+
+volatile int num_done = 0;
+volatile int failed = 0;
+
+void *thread_main(void *arg)
+{
+	int timeout = 100 * (1 + (int)(long)arg);
+	double t0 = emscripten_get_now();
+	int ret;
+	if ((long)arg % 2)
+	{
+		struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+		ret = select(0, 0, 0, 0, &tv);
+	}
+	else
+	{
+		ret = poll(0, 0, timeout);
+	}
+	double elapsed = emscripten_get_now() - t0;
+	printf("Thread %ld: timeout %d msecs, returned %d after %f msecs\n", (long)arg, timeout, ret, elapsed);
+	if (ret != 0 || elapsed < timeout - 1 || elapsed > timeout + 2000)
+		failed = 1;
+	emscripten_atomic_add_u32((void*)&num_done, 1);
+	return 0;
+}
+
+void wait_for_threads()
+{
+	if (emscripten_atomic_load_u32((void*)&num_done) != NUM_THREADS)
+		return;
+	emscripten_cancel_main_loop();
+#ifdef REPORT_RESULT
+	REPORT_RESULT(failed);
+#endif
+}
+
+int main()
+{
+	for(long i = 0; i < NUM_THREADS; ++i)
+	{
+		pthread_t thread;
+		int rc = pthread_create(&thread, 0, thread_main, (void*)i);
+		assert(rc == 0);
+		pthread_detach(thread);
+	}
+	emscripten_set_main_loop(wait_for_threads, 10, 0);
+}
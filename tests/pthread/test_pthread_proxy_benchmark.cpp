@@ -0,0 +1,79 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+// Measures how many calls per second worker threads can proxy to the main
+// browser thread, with 1, 2, 4 and 8 threads queueing calls at the same time.
+
+#include <emscripten.h>
+#include <emscripten/threading.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <assert.h>
+
+#ifndef MAX_THREADS
+#define MAX_THREADS 8
+#endif
+
+#ifndef CALLS_PER_THREAD
+#define CALLS_PER_THREAD 20000
+#endif
+
+static int num_threads = 0;
+static int calls_received = 0;
+static long long checksum = 0;
+static double round_start = 0;
+
+static void start_round(int threads);
+
+// Runs on the main browser thread.
+static void on_main_thread(int value)
+{
+	assert(emscripten_is_main_browser_thread());
+	checksum += value;
+	if (++calls_received < num_threads * CALLS_PER_THREAD)
+		return;
+
+	double msecs = emscripten_get_now() - round_start;
+	printf("%d producer threads: %.0f proxied calls/sec\n", num_threads, calls_received * 1000.0 / msecs);
+	assert(checksum == (long long)num_threads * CALLS_PER_THREAD * (CALLS_PER_THREAD - 1) / 2);
+
+	if (num_threads < MAX_THREADS)
+		start_round(num_threads * 2);
+	else
+	{
+#ifdef REPORT_RESULT
+		REPORT_RESULT(0);
+#endif
+	}
+}
+
+static void *producer(void *)
+{
+	for(int i = 0; i < CALLS_PER_THREAD; ++i)
+		emscripten_async_run_in_main_runtime_thread(EM_FUNC_SIG_VI, on_main_thread, i);
+	return 0;
+}
+
+static void start_round(int threads)
+{
+	num_threads = threads;
+	calls_received = 0;
+	checksum = 0;
+	round_start = emscripten_get_now();
+	for(int i = 0; i < threads; ++i)
+	{
+		pthread_t thread;
+		int rc = pthread_create(&thread, 0, producer, 0);
+		assert(rc == 0);
+		pthread_detach(thread);
+	}
+}
+
+int main()
+{
+	start_round(1);
+	// Keep the runtime alive to receive the proxied calls.
+	emscripten_exit_with_live_runtime();
+}
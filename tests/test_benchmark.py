@@ -4,6 +4,7 @@
 # found in the LICENSE file.
 
 from __future__ import print_function
+import json
 import math
 import os
 import re
@@ -18,7 +19,7 @@ if __name__ == '__main__':
 
 from runner import RunnerCore, chdir
 from tools.shared import run_process, path_from_root, CLANG, Building, SPIDERMONKEY_ENGINE, LLVM_ROOT, CLOSURE_COMPILER, CLANG_CC, V8_ENGINE, PIPE, try_delete, PYTHON, EMCC
-from tools import shared, jsrun
+from tools import shared, jsrun, js_optimizer
 
 # standard arguments for timing:
 # 0: no runtime, just startup
@@ -974,6 +975,31 @@ class benchmark(RunnerCore):
 
     self.do_benchmark('sqlite', src, 'TOTAL...', shared_args=['-I' + path_from_root('tests', 'sqlite')], emcc_args=['-s', 'FILESYSTEM=1'], force_c=True)
 
+  @non_core
+  def test_zzz_native_optimizer_parse(self):
+    # How fast the native optimizer parses the asm.js of a real program, which
+    # every optimizer chunk pays for before running any pass
+    src = open(path_from_root('tests', 'sqlite', 'sqlite3.c'), 'r').read() + open(path_from_root('tests', 'sqlite', 'speedtest1.c'), 'r').read()
+    with open('sqlite.c', 'w') as f:
+      f.write(src)
+    run_process([PYTHON, EMCC, 'sqlite.c', '-I' + path_from_root('tests', 'sqlite'), '-O2', '-s', 'WASM=0', '-s', 'FILESYSTEM=1', '--js-opts', '0', '-o', 'sqlite.js'])
+    js = open('sqlite.js').read()
+    start = js.index(js_optimizer.start_funcs_marker) + len(js_optimizer.start_funcs_marker)
+    end = js.index(js_optimizer.end_funcs_marker)
+    with open('funcs.js', 'w') as f:
+      f.write(js[start:end])
+    size = (end - start) / (1024 * 1024.)
+
+    times = []
+    for i in range(TEST_REPS):
+      run_process([js_optimizer.get_native_optimizer(), 'funcs.js', 'asm', 'noop', 'profile=profile.json'], stdout=PIPE)
+      profile = json.loads(open('profile.json').read())
+      assert profile['steps'][0]['name'] == 'read'
+      times.append(profile['steps'][0]['ms'])
+    best = min(times)
+    print()
+    print('   native optimizer parse: %.2f MB in %.1f ms (best of %d), %.1f MB/s' % (size, best, len(times), size / (best / 1000.)))
+
   def test_zzz_poppler(self):
     with open('pre.js', 'w') as f:
       f.write('''
@@ -3754,14 +3754,32 @@ window.close = function() {
     self.btest(path_from_root('tests', 'pthread', 'test_pthread_attr_getstack.cpp'), expected='0', args=['-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=2'])
 
   # Test that memory allocation is thread-safe.
+  @parameterized({
+    'dlmalloc': (['-s', 'MALLOC=dlmalloc'],),
+    'emmalloc': (['-s', 'MALLOC=emmalloc'],),
+  })
   @requires_threads
-  def test_pthread_malloc(self):
-    self.btest(path_from_root('tests', 'pthread', 'test_pthread_malloc.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8'])
+  def test_pthread_malloc(self, args):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_malloc.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8'] + args)
 
   # Stress test pthreads allocating memory that will call to sbrk(), and main thread has to free up the data.
+  @parameterized({
+    'dlmalloc': (['-s', 'MALLOC=dlmalloc'],),
+    'emmalloc': (['-s', 'MALLOC=emmalloc'],),
+  })
+  @requires_threads
+  def test_pthread_malloc_free(self, args):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_malloc_free.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8', '-s', 'TOTAL_MEMORY=256MB'] + args)
+
+  # Many threads doing small malloc()s and free()s at once, including frees of
+  # memory allocated on other threads.
+  @parameterized({
+    'dlmalloc': (['-s', 'MALLOC=dlmalloc'],),
+    'emmalloc': (['-s', 'MALLOC=emmalloc'],),
+  })
   @requires_threads
-  def test_pthread_malloc_free(self):
-    self.btest(path_from_root('tests', 'pthread', 'test_pthread_malloc_free.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8', '-s', 'TOTAL_MEMORY=256MB'])
+  def test_pthread_malloc_threads_benchmark(self, args):
+    self.btest(path_from_root('tests', 'benchmark_malloc_threads.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8', '-DNUM_OPS=100000', '-I' + path_from_root('tests')] + args)
 
   # Test that the pthread_barrier API works ok.
   @requires_threads
@@ -3911,6 +3929,26 @@ window.close = function() {
   def test_pthread_run_on_main_thread_flood(self):
     self.btest(path_from_root('tests', 'pthread', 'test_pthread_run_on_main_thread_flood.cpp'), expected='0', args=['-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=1'])
 
+  # Test that batches of calls proxied to the main thread run in order, and complete once.
+  @requires_threads
+  def test_pthread_call_batch(self):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_call_batch.cpp'), expected='0', args=['-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=1'])
+
+  # Tests that select() and poll() proxied to the main thread time out while the main thread is idle.
+  @requires_threads
+  def test_pthread_poll_timeout(self):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_poll_timeout.cpp'), expected='0', args=['-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=4'])
+
+  # Tests that poll() proxied to the main thread completes when the main thread writes to the pipe it waits on.
+  @requires_threads
+  def test_pthread_poll_pipe(self):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_poll_pipe.cpp'), expected='0', args=['-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=1'])
+
+  # Measures the throughput of calls proxied to the main thread from 1 to 8 threads at once.
+  @requires_threads
+  def test_pthread_proxy_benchmark(self):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_proxy_benchmark.cpp'), expected='0', args=['-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8', '-s', 'TOTAL_MEMORY=64MB'])
+
   # Test that it is possible to synchronously call a JavaScript function on the main thread and get a return value back.
   @requires_threads
   def test_pthread_call_sync_on_main_thread(self):
@@ -4511,6 +4549,44 @@ window.close = function() {
   def test_asmfs_relative_paths(self):
     self.btest('asmfs/relative_paths.cpp', expected='0', args=['-s', 'ASMFS=1', '-s', 'WASM=0', '-s', 'USE_PTHREADS=1', '-s', 'FETCH_DEBUG=1'])
 
+  @requires_asmfs
+  @requires_threads
+  def test_asmfs_chunked_file(self):
+    shutil.copyfile(path_from_root('tests', 'asmfs', 'hello_file.txt'), 'hello_file.txt')
+    self.btest('asmfs/chunked_file.cpp', expected='0', args=['-s', 'ASMFS=1', '-s', 'WASM=0', '-s', 'USE_PTHREADS=1', '-s', 'FETCH_DEBUG=1', '-s', 'PROXY_TO_PTHREAD=1'])
+
+  @requires_asmfs
+  @requires_threads
+  def test_asmfs_cache_budget(self):
+    for n in range(8):
+      with open('cached_%d.dat' % n, 'wb') as f:
+        f.write(bytearray((n + i) % 256 for i in range(100000)))
+    self.btest('asmfs/cache_budget.cpp', expected='0', args=['-s', 'ASMFS=1', '-s', 'WASM=0', '-s', 'USE_PTHREADS=1', '-s', 'FETCH_DEBUG=1', '-s', 'PROXY_TO_PTHREAD=1'])
+
+  # Creates thousands of files in a directory, and measures open() and stat() on them.
+  @requires_asmfs
+  @requires_threads
+  def test_asmfs_large_directory_benchmark(self):
+    self.btest('asmfs/large_directory_benchmark.cpp', expected='0', args=['-s', 'ASMFS=1', '-s', 'WASM=0', '-s', 'USE_PTHREADS=1', '-s', 'PROXY_TO_PTHREAD=1', '-O2'])
+
+  # Appends packets one by one and in batches to a mocked Tizen elementary media track.
+  def test_tizen_emss_append_packets_benchmark(self):
+    self.btest('tizen_emss/append_packets_benchmark.cpp', expected='0', args=['-O2', '-I' + path_from_root('system', 'lib'), '--pre-js', path_from_root('tests', 'tizen_emss', 'side_thread_track_mock.js')])
+
+  # Appends encrypted packets to a mocked Tizen elementary media track.
+  def test_tizen_emss_append_encrypted_packets_benchmark(self):
+    self.btest('tizen_emss/append_encrypted_packets_benchmark.cpp', expected='0', args=['-O2', '-I' + path_from_root('system', 'lib'), '--pre-js', path_from_root('tests', 'tizen_emss', 'side_thread_track_mock.js')])
+
+  # Feeds a mocked Tizen elementary media track with ElementaryMediaTrackPipeline.
+  @requires_threads
+  def test_tizen_emss_track_pipeline(self):
+    self.btest('tizen_emss/track_pipeline.cpp', expected='0', args=['-O2', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=2', '--pre-js', path_from_root('tests', 'tizen_emss', 'side_thread_track_mock.js')])
+
+  # Changes sessions of a mocked Tizen elementary media track, and checks that
+  # packets of ended sessions are dropped and counted.
+  def test_tizen_emss_session_id_tracking(self):
+    self.btest('tizen_emss/session_id_tracking.cpp', expected='0', args=['-O2', '--pre-js', path_from_root('tests', 'tizen_emss', 'side_thread_track_mock.js')])
+
   @requires_threads
   def test_pthread_locale(self):
     for args in [
@@ -2250,9 +2250,9 @@ int f() {
         run_process(listify(NODE_JS) + [path_from_root('tools', 'js-optimizer.js'), input_temp, 'emitJSON'], stdin=PIPE, stdout=open(input_temp + '.js', 'w'))
         original = open(input).read()
         if '// EXTRA_INFO:' in original:
-          json = open(input_temp + '.js').read()
-          json += '\n' + original[original.find('// EXTRA_INFO:'):]
-          create_test_file(input_temp + '.js', json)
+          js = open(input_temp + '.js').read()
+          js += '\n' + original[original.find('// EXTRA_INFO:'):]
+          create_test_file(input_temp + '.js', js)
 
         # last is only relevant when we emit JS
         if 'last' not in passes and \
@@ -2269,6 +2269,30 @@ int f() {
         output = run_process([tools.js_optimizer.get_native_optimizer(), input] + passes, stdin=PIPE, stdout=PIPE).stdout
         check_js(output, expected)
 
+        print('  native (emitting JS, threaded)')
+        output = run_process([tools.js_optimizer.get_native_optimizer(), input] + passes + ['threads=4'], stdin=PIPE, stdout=PIPE).stdout
+        check_js(output, expected)
+
+        print('  native (binary AST)')
+        run_process([tools.js_optimizer.get_native_optimizer(), input, 'asm', 'noop', 'emitBinary'], stdin=PIPE, stdout=open(input_temp + '.bin', 'wb'))
+        output = run_process([tools.js_optimizer.get_native_optimizer(), input_temp + '.bin', 'receiveBinary'] + passes, stdin=PIPE, stdout=PIPE).stdout
+        check_js(output, expected)
+
+        print('  native (function cache)')
+        ensure_dir('optcache')
+        for expected_stats in [' 0 hits', ' 0 misses']:
+          proc = run_process([tools.js_optimizer.get_native_optimizer(), input] + passes + ['cacheDir=optcache', 'cacheStats'], stdin=PIPE, stdout=PIPE, stderr=PIPE)
+          check_js(proc.stdout, expected)
+          self.assertContained(expected_stats, proc.stderr)
+
+        print('  native (profile)')
+        output = run_process([tools.js_optimizer.get_native_optimizer(), input] + passes + ['profile=profile.json'], stdin=PIPE, stdout=PIPE).stdout
+        check_js(output, expected)
+        profile = json.loads(open('profile.json').read())
+        steps = [step['name'] for step in profile['steps']]
+        self.assertEqual(steps[0], 'read')
+        self.assertEqual(steps[-1], 'emit')
+
   def test_m_mm(self):
     create_test_file('foo.c', '''#include <emscripten.h>''')
     for opt in ['M', 'MM']:
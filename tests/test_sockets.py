@@ -483,3 +483,28 @@ class sockets(BrowserCore):
       with PythonTcpEchoServerProcess('7777'):
         # Build and run the TCP echo client program with Emscripten
         self.btest(path_from_root('tests', 'websocket', 'tcp_echo_client.cpp'), expected='101', args=['-lwebsocket', '-s', 'PROXY_POSIX_SOCKETS=1', '-s', 'USE_PTHREADS=1', '-s', 'PROXY_TO_PTHREAD=1'])
+
+  # Test that many send() and recv() calls can be in flight over the POSIX sockets bridge at once
+  def test_posix_proxy_sockets_pipelined(self):
+    run_process(['cmake', path_from_root('tools', 'websocket_to_posix_proxy')])
+    run_process(['cmake', '--build', '.'])
+    if os.name == 'nt':
+      proxy_server = os.path.join(self.get_dir(), 'Debug', 'websocket_to_posix_proxy.exe')
+    else:
+      proxy_server = os.path.join(self.get_dir(), 'websocket_to_posix_proxy')
+
+    with BackgroundServerProcess([proxy_server, '8080']):
+      with PythonTcpEchoServerProcess('7777'):
+        self.btest(path_from_root('tests', 'websocket', 'tcp_echo_client_pipelined.cpp'), expected='101', args=['-lwebsocket', '-s', 'PROXY_POSIX_SOCKETS=1', '-s', 'USE_PTHREADS=1', '-s', 'PROXY_TO_PTHREAD=1'])
+
+  # Test that pipelined send()s that fill up the socket buffers over the POSIX sockets bridge complete in full and in order
+  def test_posix_proxy_sockets_pipelined_stalled_reader(self):
+    run_process(['cmake', path_from_root('tools', 'websocket_to_posix_proxy')])
+    run_process(['cmake', '--build', '.'])
+    if os.name == 'nt':
+      proxy_server = os.path.join(self.get_dir(), 'Debug', 'websocket_to_posix_proxy.exe')
+    else:
+      proxy_server = os.path.join(self.get_dir(), 'websocket_to_posix_proxy')
+
+    with BackgroundServerProcess([proxy_server, '8080']):
+      self.btest(path_from_root('tests', 'websocket', 'tcp_pipelined_sends_to_stalled_reader.cpp'), expected='101', args=['-lwebsocket', '-s', 'PROXY_POSIX_SOCKETS=1', '-s', 'USE_PTHREADS=1', '-s', 'PROXY_TO_PTHREAD=1', '-s', 'TOTAL_MEMORY=64MB'])
@@ -0,0 +1,108 @@
+// Copyright 2020 Samsung Electronics
+// TizenTV Emscripten extensions are available under two separate licenses, the
+// MIT license and the University of Illinois/NCSA Open Source License.  Both
+// these licenses can be found in the LICENSE file.
+
+// Measures packets/sec appended one at a time and in batches through the
+// ElementaryMediaTrack bindings, against side_thread_track_mock.js.
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <emscripten/emscripten.h>
+
+#include "samsung/bindings/elementary_media_packet.h"
+#include "samsung/bindings/elementary_media_track.h"
+
+#ifndef NUM_PACKETS
+#define NUM_PACKETS 100000
+#endif
+
+#ifndef BATCH_SIZE
+#define BATCH_SIZE 32
+#endif
+
+#define PACKET_SIZE 188
+
+static const int kTrackHandle = 0;
+
+static EMSSElementaryMediaPacket packets[NUM_PACKETS];
+static unsigned char packet_data[PACKET_SIZE];
+
+static int appended_packets()
+{
+  return EM_ASM_INT(return tizentvwasm.SideThreadElementaryMediaTrack.appendedPackets);
+}
+
+static void reset_appended_packets()
+{
+  EM_ASM(tizentvwasm.SideThreadElementaryMediaTrack.appendedPackets = 0);
+}
+
+int main()
+{
+  for(int i = 0; i < NUM_PACKETS; ++i)
+  {
+    EMSSElementaryMediaPacket& packet = packets[i];
+    packet.pts = i / 30.0;
+    packet.dts = i / 30.0;
+    packet.duration = 1 / 30.0;
+    packet.is_key_frame = (i % 30) == 0;
+    packet.data_size = PACKET_SIZE;
+    packet.data = packet_data;
+    packet.width = 1920;
+    packet.height = 1080;
+    packet.framerate_num = 30;
+    packet.framerate_den = 1;
+    packet.session_id = -1;
+  }
+
+  double t0 = emscripten_get_now();
+  for(int i = 0; i < NUM_PACKETS; ++i)
+  {
+    EMSSOperationResult result = elementaryMediaTrackAppendPacket(kTrackHandle, &packets[i]);
+    assert(result == EmssSuccess);
+  }
+  double t1 = emscripten_get_now();
+  assert(appended_packets() == NUM_PACKETS);
+  printf("AppendPacket: %f packets/sec\n", NUM_PACKETS * 1000.0 / (t1 - t0));
+
+  reset_appended_packets();
+  for(int i = 0; i < NUM_PACKETS; i += BATCH_SIZE)
+  {
+    size_t count = NUM_PACKETS - i < BATCH_SIZE ? NUM_PACKETS - i : BATCH_SIZE;
+    size_t appended = 0;
+    EMSSOperationResult result = elementaryMediaTrackAppendPackets(kTrackHandle, &packets[i], count, &appended);
+    assert(result == EmssSuccess);
+    assert(appended == count);
+  }
+  double t2 = emscripten_get_now();
+  assert(appended_packets() == NUM_PACKETS);
+  printf("AppendPackets (%d per batch): %f packets/sec\n", BATCH_SIZE, NUM_PACKETS * 1000.0 / (t2 - t1));
+
+  reset_appended_packets();
+  for(int i = 0; i < NUM_PACKETS; i += BATCH_SIZE)
+  {
+    size_t count = NUM_PACKETS - i < BATCH_SIZE ? NUM_PACKETS - i : BATCH_SIZE;
+    size_t appended = 0;
+    EMSSOperationResult result = elementaryMediaTrackAppendPacketsAsync(kTrackHandle, &packets[i], count, &appended);
+    assert(result == EmssSuccess);
+    assert(appended == count);
+  }
+  double t3 = emscripten_get_now();
+  assert(appended_packets() == NUM_PACKETS);
+  printf("AppendPacketsAsync (%d per batch): %f packets/sec\n", BATCH_SIZE, NUM_PACKETS * 1000.0 / (t3 - t2));
+
+  // A failing packet stops the batch, and reports how many packets made it.
+  reset_appended_packets();
+  packets[5].pts = -1;
+  size_t appended = 0;
+  EMSSOperationResult result = elementaryMediaTrackAppendPackets(kTrackHandle, packets, 10, &appended);
+  assert(result == EmssAppendInvalidPts);
+  assert(appended == 5);
+  assert(appended_packets() == 5);
+
+#ifdef REPORT_RESULT
+  REPORT_RESULT(0);
+#endif
+}
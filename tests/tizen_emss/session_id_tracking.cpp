@@ -0,0 +1,153 @@
+// Copyright 2020 Samsung Electronics
+// TizenTV Emscripten extensions are available under two separate licenses, the
+// MIT license and the University of Illinois/NCSA Open Source License.  Both
+// these licenses can be found in the LICENSE file.
+
+// Changes sessions of tracks from side_thread_track_mock.js, and checks that
+// ElementaryMediaTrack follows them: session changed callbacks are called,
+// packets of ended sessions are dropped without reaching the platform, and
+// the append statistics count what happened. Platform sessions drop packets
+// with kAppendIgnored, and sessions emulated on legacy platforms with kFailed.
+
+#include <assert.h>
+#include <stdio.h>
+#include <utility>
+#include <vector>
+#include <emscripten/emscripten.h>
+
+#include "samsung/wasm/elementary_audio_track_config.h"
+#include "samsung/wasm/elementary_media_packet.h"
+#include "samsung/wasm/elementary_media_stream_source.h"
+#include "samsung/wasm/elementary_media_track.h"
+
+using namespace samsung::wasm;
+
+static unsigned char packet_data[188];
+
+static int platform_appended_packets()
+{
+  return EM_ASM_INT(return tizentvwasm.SideThreadElementaryMediaTrack.appendedPackets);
+}
+
+static ElementaryMediaPacket make_packet(double pts, SessionId session_id)
+{
+  ElementaryMediaPacket packet{};
+  packet.pts = Seconds(pts);
+  packet.dts = Seconds(pts);
+  packet.duration = Seconds(0.02);
+  packet.is_key_frame = true;
+  packet.data = packet_data;
+  packet.data_size = sizeof(packet_data);
+  packet.session_id = session_id;
+  return packet;
+}
+
+static ElementaryMediaTrack add_track(ElementaryMediaStreamSource& source)
+{
+  auto added = source.AddTrack(ElementaryAudioTrackConfig(
+    "audio/mp4; codecs=\"mp4a.40.2\"", {}, SampleFormat::kPlanarF32, ChannelLayout::kStereo, 48000));
+  assert(added);
+  return std::move(added.value);
+}
+
+static void test_platform_sessions()
+{
+  ElementaryMediaStreamSource source(
+    ElementaryMediaStreamSource::LatencyMode::kNormal,
+    ElementaryMediaStreamSource::RenderingMode::kMediaElement);
+  ElementaryMediaTrack track = add_track(source);
+  assert(*track.GetSessionId() == 0);
+
+  SessionId notified = -1;
+  auto callback_id = track.AddSessionIdChangedCallback([&](SessionId session_id) {
+    // The track already reports the new session.
+    assert(*track.GetSessionId() == session_id);
+    notified = session_id;
+  });
+  assert(callback_id);
+
+  assert(track.AppendPacket(make_packet(0, 0)));
+  // Rejected by the platform.
+  assert(track.AppendPacket(make_packet(-1, 0)).operation_result == OperationResult::kAppendInvalidPts);
+  assert(platform_appended_packets() == 1);
+
+  EM_ASM(tizentvwasm.ElementaryMediaTrack.last._changeSession(1));
+  assert(notified == 1);
+  assert(*track.GetSessionId() == 1);
+
+  // Packets of the old session are dropped at submission, synchronously or
+  // not, and a batch stops at the first of them.
+  assert(track.AppendPacket(make_packet(0.02, 0)).operation_result == OperationResult::kAppendIgnored);
+  assert(track.AppendPacketAsync(make_packet(0.02, 0)).operation_result == OperationResult::kAppendIgnored);
+  std::vector<ElementaryMediaPacket> batch = { make_packet(0, 1), make_packet(0.02, 1), make_packet(0.04, 0), make_packet(0.06, 1) };
+  auto appended = track.AppendPackets(batch.data(), batch.size());
+  assert(appended.operation_result == OperationResult::kAppendIgnored);
+  assert(appended.value == 2);
+  assert(platform_appended_packets() == 3);
+  assert(track.AppendPacket(make_packet(0.04, 1)));
+  assert(platform_appended_packets() == 4);
+
+  auto stats = track.GetAppendStatistics();
+  assert(stats);
+  assert(stats.value.appended_packets == 4);
+  assert(stats.value.dropped_stale_packets == 3);
+  assert(stats.value.failed_packets == 1);
+
+  assert(track.RemoveSessionIdChangedCallback(*callback_id));
+  assert(track.RemoveSessionIdChangedCallback(*callback_id).operation_result == OperationResult::kNoSuchListener);
+  EM_ASM(tizentvwasm.ElementaryMediaTrack.last._changeSession(2));
+  assert(notified == 1);
+  assert(*track.GetSessionId() == 2);
+}
+
+static void test_emulated_sessions()
+{
+  // Legacy platforms have no sessions, the track emulates them in low latency
+  // mode by starting a new one whenever the track closes.
+  EM_ASM({
+    tizentvwasm.availableApis = [{
+      name: 'ElementaryMediaStreamSource',
+      version: '0.1',
+      apiLevels: [0],
+      features: ['legacy-emss'],
+    }];
+  });
+  ElementaryMediaStreamSource source(
+    ElementaryMediaStreamSource::LatencyMode::kLow,
+    ElementaryMediaStreamSource::RenderingMode::kMediaElement);
+  ElementaryMediaTrack track = add_track(source);
+  assert(*track.GetSessionId() == 0);
+
+  SessionId notified = -1;
+  auto callback_id = track.AddSessionIdChangedCallback([&](SessionId session_id) {
+    notified = session_id;
+  });
+  assert(callback_id);
+
+  int platform_appended = platform_appended_packets();
+  assert(track.AppendPacket(make_packet(0, 0)));
+  EM_ASM(tizentvwasm.ElementaryMediaTrack.last._fire('trackclosed', {reason: 'trackseeking'}));
+  assert(notified == 1);
+  assert(*track.GetSessionId() == 1);
+
+  assert(track.AppendPacket(make_packet(0.02, 0)).operation_result == OperationResult::kFailed);
+  assert(track.AppendPacket(make_packet(0.02, 1)));
+  assert(platform_appended_packets() == platform_appended + 2);
+
+  auto stats = track.GetAppendStatistics();
+  assert(stats);
+  assert(stats.value.appended_packets == 2);
+  assert(stats.value.dropped_stale_packets == 1);
+  assert(stats.value.failed_packets == 0);
+}
+
+int main()
+{
+  test_platform_sessions();
+  test_emulated_sessions();
+  printf("ok\n");
+
+#ifdef REPORT_RESULT
+  REPORT_RESULT(0);
+#endif
+}
@@ -0,0 +1,134 @@
+// Copyright 2020 Samsung Electronics
+// TizenTV Emscripten extensions are available under two separate licenses, the
+// MIT license and the University of Illinois/NCSA Open Source License.  Both
+// these licenses can be found in the LICENSE file.
+
+// Stands in for the platform's tizentvwasm.SideThreadElementaryMediaTrack, so
+// that the packet append bindings can be exercised in a regular browser. It
+// validates packets the way the platform does for the errors tests rely on,
+// and counts what was appended.
+//
+// Tests that need more than the append bindings can also create sources and
+// tracks. Tracks never play anything, but tests can fire their events with
+// `_fire()` and `_changeSession()`.
+//
+// Appends made on a worker thread reach the mock of that worker, which doesn't
+// share its counters with the main thread. Tests that append from workers can
+// export a C function `emss_mock_append_hook(pts, sessionId)` instead. It is
+// called for each packet, and for each end of track with a NaN pts. A nonzero
+// return value fails the append with a full buffer.
+var tizentvwasm = {
+  availableApis: [{
+    name: 'ElementaryMediaStreamSource',
+    version: '1.0',
+    apiLevels: [1],
+    features: ['base-emss', 'construct-with-modes'],
+  }],
+  isApiSupported: function(name, apiLevel) {
+    return this.availableApis.some((api) => {
+      return api.name === name && api.apiLevels.includes(apiLevel);
+    });
+  },
+  isApiFeatureSupported: function(name, feature) {
+    return this.availableApis.some((api) => {
+      return api.name === name && api.features.includes(feature);
+    });
+  },
+  // Extends Blob, so that an object URL can be created for it.
+  ElementaryMediaStreamSource: class extends Blob {
+    constructor() {
+      super();
+      this._events = new EventTarget();
+    }
+    addEventListener(...args) {
+      this._events.addEventListener(...args);
+    }
+    removeEventListener(...args) {
+      this._events.removeEventListener(...args);
+    }
+    addAudioTrack(config) {
+      return new tizentvwasm.ElementaryMediaTrack();
+    }
+    addVideoTrack(config) {
+      return new tizentvwasm.ElementaryMediaTrack();
+    }
+    removeTrack(track) {
+    }
+  },
+  ElementaryMediaTrack: class extends EventTarget {
+    constructor() {
+      super();
+      this.trackId = tizentvwasm.ElementaryMediaTrack.nextTrackId++;
+      this.sessionId = 0;
+      this.isOpen = true;
+      // The track a test most recently created, to fire events on.
+      tizentvwasm.ElementaryMediaTrack.last = this;
+    }
+    _fire(type, properties) {
+      const event = new Event(type);
+      Object.assign(event, properties);
+      this.dispatchEvent(event);
+    }
+    _changeSession(sessionId) {
+      this.sessionId = sessionId;
+      this._fire('sessionidchanged', {sessionId: sessionId});
+    }
+  },
+  SideThreadElementaryMediaTrack: {
+    appendedPackets: 0,
+    appendedBytes: 0,
+    // Sums of the key id and subsample bytes of encrypted packets, so that
+    // tests can check what was passed without the mock keeping the packets.
+    keyIdChecksum: 0,
+    subsampleBytes: 0,
+    _fail: function(method, reason) {
+      throw new Error(`Failed to execute '${method}' on ` +
+          `'SideThreadElementaryMediaTrack': Append packet failed: ${reason}`);
+    },
+    _append: function(method, handle, packet, data) {
+      if (packet.pts < 0) {
+        this._fail(method, 'negative pts');
+      }
+      if (packet.isEncrypted) {
+        if (packet.keyId.length !== 16) {
+          this._fail(method, 'bad keyId');
+        }
+        if (packet.initializationVector.length !== 16) {
+          this._fail(method, 'bad initializationVector');
+        }
+        for (let i = 0; i < 16; ++i) {
+          this.keyIdChecksum += packet.keyId[i];
+        }
+        for (let i = 0; i < packet.subsamples.length; ++i) {
+          this.subsampleBytes += packet.subsamples[i].clearBytes +
+              packet.subsamples[i].encryptedBytes;
+        }
+      }
+      this._callHook(method, packet.pts, packet.sessionId);
+      this.appendedPackets++;
+      this.appendedBytes += data.length;
+    },
+    _callHook: function(method, pts, sessionId) {
+      const hook = Module['_emss_mock_append_hook'];
+      if (hook && hook(pts, sessionId === undefined ? -1 : sessionId)) {
+        const error = new Error(`Failed to execute '${method}' on ` +
+            `'SideThreadElementaryMediaTrack': Append failed: buffer full`);
+        error.name = 'AppendBufferFullError';
+        throw error;
+      }
+    },
+    appendPacketSync: function(handle, packet, data) {
+      this._append('appendPacketSync', handle, packet, data);
+    },
+    appendPacketAsync: function(handle, packet, data) {
+      this._append('appendPacketAsync', handle, packet, data);
+    },
+    appendEndOfTrackSync: function(handle, sessionId) {
+      this._callHook('appendEndOfTrackSync', NaN, sessionId);
+    },
+    appendEndOfTrackAsync: function(handle, sessionId) {
+      this._callHook('appendEndOfTrackAsync', NaN, sessionId);
+    },
+  },
+};
+tizentvwasm.ElementaryMediaTrack.nextTrackId = 0;
@@ -0,0 +1,245 @@
+// Copyright 2020 Samsung Electronics
+// TizenTV Emscripten extensions are available under two separate licenses, the
+// MIT license and the University of Illinois/NCSA Open Source License.  Both
+// these licenses can be found in the LICENSE file.
+
+// Runs an ElementaryMediaTrackPipeline against side_thread_track_mock.js, and
+// checks backpressure, retries on a full platform buffer, dropping buffered
+// packets on seeks and session changes, producing again after a session change
+// that follows the end of track, and stopping while both threads are blocked.
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <utility>
+#include <emscripten/emscripten.h>
+
+#include "samsung/wasm/elementary_audio_track_config.h"
+#include "samsung/wasm/elementary_media_stream_source.h"
+#include "samsung/wasm/elementary_media_track.h"
+#include "samsung/wasm/elementary_media_track_pipeline.h"
+
+using namespace samsung::wasm;
+
+// Exact in binary, so that the buffered duration adds up to exactly
+// kBufferDuration.
+static const double kPacketDuration = 0.25;
+static const double kBufferDuration = 1.0;
+static const int kPacketsPerBuffer = 4;
+// Long enough not to be reached unless the test skips to its end, because
+// packets are appended as fast as they are produced.
+static const double kTrackDuration = 1000000.0;
+
+static ElementaryMediaStreamSource* source;
+static ElementaryMediaTrack* track;
+static ElementaryMediaTrackPipeline* pipeline;
+
+// Shared with the producer and appending threads.
+static std::atomic<double> next_pts;
+static std::atomic<bool> producer_paused;
+static std::atomic<int> produced_packets;
+static std::atomic<double> seek_time;
+static std::atomic<bool> buffer_full;
+static std::atomic<int> buffer_full_appends;
+static std::atomic<int> appended_packets;
+static std::atomic<int> appended_end_of_tracks;
+// Appends accepted for packets that should have been dropped: from before the
+// last seek, or of a session that has already ended.
+static std::atomic<int> stale_appends;
+static std::atomic<double> min_pts;
+static std::atomic<int> current_session;
+
+extern "C" EMSCRIPTEN_KEEPALIVE int emss_mock_append_hook(double pts, int session_id)
+{
+  if (buffer_full)
+  {
+    ++buffer_full_appends;
+    return 1;
+  }
+  if (isnan(pts))
+    ++appended_end_of_tracks;
+  else
+  {
+    ++appended_packets;
+    if (pts < min_pts) ++stale_appends;
+  }
+  if (session_id != current_session) ++stale_appends;
+  return 0;
+}
+
+static ElementaryMediaTrackPipeline::ProducerStatus produce(ElementaryMediaTrackPipeline::Packet* packet)
+{
+  while(producer_paused) usleep(1000);
+  double pts = next_pts;
+  if (pts >= kTrackDuration)
+    return ElementaryMediaTrackPipeline::ProducerStatus::kEndOfTrack;
+  next_pts = pts + kPacketDuration;
+  packet->packet.pts = Seconds(pts);
+  packet->packet.dts = Seconds(pts);
+  packet->packet.duration = Seconds(kPacketDuration);
+  packet->packet.is_key_frame = true;
+  packet->data.assign(64, (uint8_t)produced_packets.load());
+  ++produced_packets;
+  return ElementaryMediaTrackPipeline::ProducerStatus::kPacket;
+}
+
+static void seek(Seconds new_time)
+{
+  next_pts = new_time.count();
+  seek_time = new_time.count();
+}
+
+static bool buffer_is_full()
+{
+  return pipeline->GetBufferedDuration().count() >= kBufferDuration;
+}
+
+static void fire_seek(double new_time)
+{
+  EM_ASM(tizentvwasm.ElementaryMediaTrack.last._fire('seek', {newTime: $0}), new_time);
+}
+
+static void change_session(int session_id)
+{
+  EM_ASM(tizentvwasm.ElementaryMediaTrack.last._changeSession($0), session_id);
+}
+
+// Each step waits for its condition, and returns true when the test can go on
+// to the next step.
+static int step = 0;
+static int mark = 0;
+
+static bool run_step()
+{
+  switch(step)
+  {
+    case 0:
+      // Nothing fits in the platform buffer: the queue fills up, the producer
+      // stops, and appends keep being retried.
+      if (!buffer_is_full() || buffer_full_appends < 3) return false;
+      assert(produced_packets == kPacketsPerBuffer);
+      mark = buffer_full_appends;
+      return true;
+    case 1:
+      if (buffer_full_appends < mark + 5) return false;
+      assert(produced_packets == kPacketsPerBuffer);
+      assert(appended_packets == 0);
+      buffer_full = false;
+      return true;
+    case 2:
+      // The retried packets go through, and production resumes.
+      if (appended_packets < 2 * kPacketsPerBuffer) return false;
+      buffer_full = true;
+      mark = buffer_full_appends;
+      return true;
+    case 3:
+      if (!buffer_is_full() || buffer_full_appends < mark + 3) return false;
+      // Seeking drops what was buffered for the old position.
+      producer_paused = true;
+      min_pts = 3.0;
+      fire_seek(3.0);
+      assert(pipeline->GetBufferedDuration().count() == 0);
+      return true;
+    case 4:
+      if (seek_time != 3.0) return false;
+      mark = appended_packets;
+      producer_paused = false;
+      buffer_full = false;
+      return true;
+    case 5:
+      if (appended_packets < mark + 2) return false;
+      assert(stale_appends == 0);
+      buffer_full = true;
+      mark = buffer_full_appends;
+      return true;
+    case 6:
+      if (!buffer_is_full() || buffer_full_appends < mark + 3) return false;
+      // So does a session change, packets are appended with the new session.
+      producer_paused = true;
+      current_session = 1;
+      change_session(1);
+      assert(pipeline->GetBufferedDuration().count() == 0);
+      mark = appended_packets;
+      // Skip to the last two packets of the track.
+      next_pts = kTrackDuration - 2 * kPacketDuration;
+      producer_paused = false;
+      buffer_full = false;
+      return true;
+    case 7:
+      // The producer runs to the end of the track.
+      if (appended_end_of_tracks < 1) return false;
+      assert(appended_packets == mark + 2);
+      assert(stale_appends == 0);
+      // A session change after the end of track starts producing again.
+      next_pts = 0;
+      min_pts = 0;
+      current_session = 2;
+      mark = appended_packets;
+      change_session(2);
+      return true;
+    case 8:
+      if (appended_packets < mark + 2) return false;
+      assert(stale_appends == 0);
+      buffer_full = true;
+      mark = buffer_full_appends;
+      return true;
+    case 9:
+      // Stopping does not wait for the platform buffer to drain, and drops
+      // the packets that were not appended.
+      if (!buffer_is_full() || buffer_full_appends < mark + 3) return false;
+      pipeline->Stop();
+      assert(pipeline->GetBufferedDuration().count() == 0);
+      mark = produced_packets;
+      return true;
+    default:
+      assert(produced_packets == mark);
+      assert(stale_appends == 0);
+      {
+        auto stats = track->GetAppendStatistics();
+        assert(stats);
+        printf("appended %llu packets, dropped %llu stale packets, %llu appends failed\n",
+          (unsigned long long)stats.value.appended_packets, (unsigned long long)stats.value.dropped_stale_packets,
+          (unsigned long long)stats.value.failed_packets);
+        assert(stats.value.appended_packets == (uint64_t)appended_packets);
+      }
+      delete pipeline;
+      emscripten_cancel_main_loop();
+#ifdef REPORT_RESULT
+      REPORT_RESULT(0);
+#endif
+      return false;
+  }
+}
+
+static void main_loop()
+{
+  while(run_step()) ++step;
+}
+
+int main()
+{
+  buffer_full = true;
+  min_pts = 0;
+  current_session = 0;
+  seek_time = -1;
+
+  source = new ElementaryMediaStreamSource(
+    ElementaryMediaStreamSource::LatencyMode::kNormal,
+    ElementaryMediaStreamSource::RenderingMode::kMediaElement);
+  assert(source->IsValid());
+  auto added = source->AddTrack(ElementaryAudioTrackConfig(
+    "audio/mp4; codecs=\"mp4a.40.2\"", {}, SampleFormat::kPlanarF32, ChannelLayout::kStereo, 48000));
+  assert(added);
+  track = new ElementaryMediaTrack(std::move(added.value));
+
+  ElementaryMediaTrackPipeline::Config config;
+  config.buffer_duration = Seconds(kBufferDuration);
+  config.buffer_full_retry_interval = Seconds(0.005);
+  pipeline = new ElementaryMediaTrackPipeline(track, produce, seek, config);
+  auto started = pipeline->Start();
+  assert(started);
+
+  emscripten_set_main_loop(main_loop, 0, 0);
+}
@@ -0,0 +1,78 @@
+// TCP client that keeps many send() and recv() calls in flight over the POSIX sockets bridge at once
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <emscripten.h>
+#include <emscripten/posix_socket.h>
+#include <emscripten/threading.h>
+
+#define NUM_MESSAGES 100
+#define MESSAGE_LENGTH 16
+
+int main(int argc , char *argv[])
+{
+  EMSCRIPTEN_WEBSOCKET_T bridgeSocket = emscripten_init_websocket_to_posix_socket_bridge("ws://localhost:8080");
+  // Synchronously wait until connection has been established.
+  uint16_t readyState = 0;
+  do {
+    emscripten_websocket_get_ready_state(bridgeSocket, &readyState);
+    emscripten_thread_sleep(100);
+  } while(readyState == 0);
+
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  assert(sock != -1);
+
+  struct sockaddr_in server;
+  server.sin_addr.s_addr = inet_addr("127.0.0.1");
+  server.sin_family = AF_INET;
+  server.sin_port = htons(7777);
+  if (connect(sock, (struct sockaddr *)&server, sizeof(server)) < 0)
+  {
+    perror("connect failed. Error");
+    return 1;
+  }
+
+  // A recv() submitted before any data has been sent completes once the echo arrives.
+  char first[MESSAGE_LENGTH] = {};
+  EMSCRIPTEN_POSIX_SOCKET_CALL_T firstRecv = emscripten_posix_socket_recv_async(sock, first, sizeof(first), 0);
+  assert(firstRecv);
+
+  // Submit all sends before waiting for any of them.
+  EMSCRIPTEN_POSIX_SOCKET_CALL_T sends[NUM_MESSAGES];
+  for(int i = 0; i < NUM_MESSAGES; ++i)
+  {
+    char message[MESSAGE_LENGTH] = {};
+    snprintf(message, sizeof(message), "message %06d", i);
+    sends[i] = emscripten_posix_socket_send_async(sock, message, MESSAGE_LENGTH, 0);
+    assert(sends[i]);
+  }
+  for(int i = 0; i < NUM_MESSAGES; ++i)
+  {
+    ssize_t ret = emscripten_posix_socket_call_wait(sends[i]);
+    assert(ret == MESSAGE_LENGTH);
+  }
+
+  ssize_t received = emscripten_posix_socket_call_wait(firstRecv);
+  assert(received > 0);
+  assert(!memcmp(first, "message 000000", received < 14 ? received : 14));
+
+  static char rest[NUM_MESSAGES * MESSAGE_LENGTH];
+  while(received < NUM_MESSAGES * MESSAGE_LENGTH)
+  {
+    ssize_t ret = recv(sock, rest, sizeof(rest), 0);
+    assert(ret > 0);
+    received += ret;
+  }
+  printf("Received %d bytes back from %d pipelined sends\n", (int)received, NUM_MESSAGES);
+
+  close(sock);
+#ifdef REPORT_RESULT
+  REPORT_RESULT(101);
+#endif
+  return 0;
+}
@@ -0,0 +1,108 @@
+// TCP client that pipelines many large send()s over the POSIX sockets bridge to a reader that does not read until they
+// have all been submitted, so that the socket buffers fill up and the bridge has to hold the sends back. Checks that
+// every send() completes in full, and that the bytes arrive in the order they were sent.
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <emscripten.h>
+#include <emscripten/posix_socket.h>
+#include <emscripten/threading.h>
+
+#define NUM_MESSAGES 1000
+#define MESSAGE_LENGTH 16384
+#define PORT 7778
+
+// Each message starts with its index, followed by bytes that depend on both the index and the position.
+static uint8_t ExpectedByte(int message, int offset)
+{
+  if (offset < (int)sizeof(int)) return (uint8_t)(message >> (offset * 8));
+  return (uint8_t)(message * 7 + offset);
+}
+
+int main(int argc , char *argv[])
+{
+  EMSCRIPTEN_WEBSOCKET_T bridgeSocket = emscripten_init_websocket_to_posix_socket_bridge("ws://localhost:8080");
+  // Synchronously wait until connection has been established.
+  uint16_t readyState = 0;
+  do {
+    emscripten_websocket_get_ready_state(bridgeSocket, &readyState);
+    emscripten_thread_sleep(100);
+  } while(readyState == 0);
+
+  // Both ends of the connection live on the bridge, the reader is simply not read from for now.
+  struct sockaddr_in server;
+  server.sin_addr.s_addr = inet_addr("127.0.0.1");
+  server.sin_family = AF_INET;
+  server.sin_port = htons(PORT);
+
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  assert(listener != -1);
+  int reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (bind(listener, (struct sockaddr *)&server, sizeof(server)) < 0 || listen(listener, 1) < 0)
+  {
+    perror("bind/listen failed. Error");
+    return 1;
+  }
+
+  int sender = socket(AF_INET, SOCK_STREAM, 0);
+  assert(sender != -1);
+  if (connect(sender, (struct sockaddr *)&server, sizeof(server)) < 0)
+  {
+    perror("connect failed. Error");
+    return 1;
+  }
+  int reader = accept(listener, 0, 0);
+  assert(reader > 0);
+
+  // Submit all sends before reading anything. They are much larger than the socket buffers can hold.
+  static EMSCRIPTEN_POSIX_SOCKET_CALL_T sends[NUM_MESSAGES];
+  static uint8_t message[MESSAGE_LENGTH];
+  for(int i = 0; i < NUM_MESSAGES; ++i)
+  {
+    for(int j = 0; j < MESSAGE_LENGTH; ++j)
+      message[j] = ExpectedByte(i, j);
+    sends[i] = emscripten_posix_socket_send_async(sender, message, MESSAGE_LENGTH, 0);
+    assert(sends[i]);
+  }
+  // Give the sends time to reach the bridge and fill up the buffers.
+  emscripten_thread_sleep(1000);
+
+  static uint8_t buffer[65536];
+  long long received = 0;
+  while(received < (long long)NUM_MESSAGES * MESSAGE_LENGTH)
+  {
+    ssize_t ret = recv(reader, buffer, sizeof(buffer), 0);
+    assert(ret > 0);
+    for(ssize_t k = 0; k < ret; ++k, ++received)
+    {
+      int i = (int)(received / MESSAGE_LENGTH), j = (int)(received % MESSAGE_LENGTH);
+      if (buffer[k] != ExpectedByte(i, j))
+      {
+        printf("Byte %d of message %d is out of order\n", j, i);
+        return 1;
+      }
+    }
+  }
+
+  // A blocking send() returns once all of its message has been sent.
+  for(int i = 0; i < NUM_MESSAGES; ++i)
+  {
+    ssize_t ret = emscripten_posix_socket_call_wait(sends[i]);
+    assert(ret == MESSAGE_LENGTH);
+  }
+  printf("Received %lld bytes in order from %d pipelined sends\n", received, NUM_MESSAGES);
+
+  close(reader);
+  close(sender);
+  close(listener);
+#ifdef REPORT_RESULT
+  REPORT_RESULT(101);
+#endif
+  return 0;
+}
@@ -15,7 +15,7 @@ import logging
 __rootpath__ = os.path.abspath(os.path.dirname(os.path.dirname(__file__)))
 sys.path.insert(1, __rootpath__)
 
-from tools.toolchain_profiler import ToolchainProfiler
+from tools.toolchain_profiler import ToolchainProfiler, EM_PROFILE_TOOLCHAIN
 if __name__ == '__main__':
   ToolchainProfiler.record_process_start()
 
@@ -51,6 +51,14 @@ func_sig_json = re.compile(r'\["defun", ?"([_\w$]+)",')
 import_sig = re.compile(r'(var|const) ([_\w$]+ *=[^;]+);')
 
 NATIVE_OPTIMIZER = os.environ.get('EMCC_NATIVE_OPTIMIZER') or '2' # use optimized native optimizer by default (can also be '1' or 'g')
+# Number of threads the native optimizer runs per-function passes on (0 means
+# one per core). With more than one, all functions go to a single optimizer
+# process, which parses them once, instead of being split across processes.
+NATIVE_OPTIMIZER_THREADS = int(os.environ.get('EMCC_NATIVE_OPTIMIZER_THREADS') or 0)
+# Directory the native optimizer caches optimized functions in, so relinking
+# only reoptimizes the functions that changed. '1' means a directory in the
+# emscripten cache; unset or '0' disables the cache.
+NATIVE_OPTIMIZER_CACHE = os.environ.get('EMCC_NATIVE_OPTIMIZER_CACHE')
 
 
 def split_funcs(js, just_split=False):
@@ -165,8 +173,10 @@ def get_native_optimizer():
                               shared.path_from_root('tools', 'optimizer', 'simple_ast.cpp'),
                               shared.path_from_root('tools', 'optimizer', 'optimizer.cpp'),
                               shared.path_from_root('tools', 'optimizer', 'optimizer-shared.cpp'),
+                              shared.path_from_root('tools', 'optimizer', 'optimizer-cache.cpp'),
+                              shared.path_from_root('tools', 'optimizer', 'optimizer-profile.cpp'),
                               shared.path_from_root('tools', 'optimizer', 'optimizer-main.cpp'),
-                              '-O3', '-std=c++11', '-fno-exceptions', '-fno-rtti', '-o', output] + args,
+                              '-O3', '-std=c++11', '-fno-exceptions', '-fno-rtti', '-pthread', '-o', output] + args,
                              stdout=log_output, stderr=log_output)
         except Exception as e:
           logging.debug(str(e))
@@ -267,6 +277,32 @@ start_asm_marker = '// EMSCRIPTEN_START_ASM\n'
 end_asm_marker = '// EMSCRIPTEN_END_ASM\n'
 
 
+# Merges the profiles the native optimizer wrote for each chunk (see
+# tools/optimizer/optimizer-profile.h). Times, node counts and bytes are summed
+# over the chunks, and the slowest functions of all of them are kept.
+def merge_native_profiles(filenames, slowest=20):
+  merged = {'chunks': len(filenames), 'ms': 0, 'arenaBytes': 0, 'strings': 0, 'steps': []}
+  steps = {}
+  for filename in filenames:
+    with open(filename) as f:
+      profile = json.load(f)
+    merged['ms'] += profile['ms']
+    merged['arenaBytes'] += profile['arenaBytes']
+    merged['strings'] = max(merged['strings'], profile['strings'])
+    for step in profile['steps']:
+      name = step['name']
+      if name not in steps:
+        steps[name] = {'name': name, 'ms': 0, 'nodes': 0, 'arenaBytes': 0, 'functions': 0, 'phases': {}, 'slowest': []}
+        merged['steps'].append(steps[name])
+      total = steps[name]
+      for key in ['ms', 'nodes', 'arenaBytes', 'functions']:
+        total[key] += step[key]
+      for phase in step['phases']:
+        total['phases'][phase] = total['phases'].get(phase, 0) + step['phases'][phase]
+      total['slowest'] = sorted(total['slowest'] + step['slowest'], key=lambda func: -func['ms'])[:slowest]
+  return merged
+
+
 def run_on_chunk(command):
   try:
     if JS_OPTIMIZER in command: # XXX hackish
@@ -412,8 +448,13 @@ EMSCRIPTEN_FUNCS();
     # if we are making source maps, we want our debug numbering to start from the
     # top of the file, so avoid breaking the JS into chunks
     cores = 1 if source_map else shared.Building.get_num_cores()
+    native_threads = 1
+    if not just_split and use_native(passes, source_map):
+      native_threads = NATIVE_OPTIMIZER_THREADS or cores
 
-    if not just_split:
+    if native_threads > 1:
+      chunks = [''.join(func[1] for func in funcs)]
+    elif not just_split:
       intended_num_chunks = int(round(cores * NUM_CHUNKS_PER_CORE))
       chunk_size = min(MAX_CHUNK_SIZE, max(MIN_CHUNK_SIZE, total_size / intended_num_chunks))
       chunks = shared.chunkify(funcs, chunk_size)
@@ -444,6 +485,7 @@ EMSCRIPTEN_FUNCS();
       filenames = []
 
   with ToolchainProfiler.profile_block('run_optimizer'):
+    profiles = []
     if len(filenames):
       if not use_native(passes, source_map):
         commands = [js_engine + [JS_OPTIMIZER, f, 'noPrintMetadata'] +
@@ -452,7 +494,20 @@ EMSCRIPTEN_FUNCS();
         # use the native optimizer
         shared.logging.debug('js optimizer using native')
         assert not source_map # XXX need to use js optimizer
-        commands = [[get_native_optimizer(), f] + passes for f in filenames]
+        threads = ['threads=%d' % native_threads] if native_threads > 1 else []
+        cache = []
+        if NATIVE_OPTIMIZER_CACHE and NATIVE_OPTIMIZER_CACHE != '0':
+          cache_dir = NATIVE_OPTIMIZER_CACHE
+          if cache_dir == '1':
+            cache_dir = shared.Cache.get_path('optimizer_functions')
+          shared.safe_ensure_dirs(cache_dir)
+          cache = ['cacheDir=' + cache_dir]
+          if DEBUG:
+            cache.append('cacheStats') # prints hits and misses per chunk
+        if EM_PROFILE_TOOLCHAIN:
+          # each chunk writes a profile of its passes, merged below
+          profiles = [f + '.profile.json' for f in filenames]
+        commands = [[get_native_optimizer(), f] + passes + threads + cache + (['profile=' + f + '.profile.json'] if profiles else []) for f in filenames]
       # print [' '.join(command) for command in commands]
 
       cores = min(cores, len(filenames))
@@ -474,6 +529,11 @@ EMSCRIPTEN_FUNCS();
     for filename in filenames:
       temp_files.note(filename)
 
+    if profiles:
+      ToolchainProfiler.record_data('native_optimizer', merge_native_profiles(profiles))
+      for filename in profiles:
+        temp_files.note(filename)
+
   with ToolchainProfiler.profile_block('split_closure_cleanup'):
     if closure or cleanup:
       # run on the shell code, everything but what we js-optimize
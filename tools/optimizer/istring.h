@@ -6,6 +6,7 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <set>
+#include <mutex>
 
 #include <string.h>
 #include <stdint.h>
@@ -46,9 +47,25 @@ struct IString {
     set(s, reuse);
   }
 
-  void set(const char *s, bool reuse=true) {
-    typedef std::unordered_set<const char *, CStringHash, CStringEqual> StringSet;
+  typedef std::unordered_set<const char *, CStringHash, CStringEqual> StringSet;
+  static StringSet* strings() {
     static StringSet* strings = new StringSet();
+    return strings;
+  }
+  static std::mutex* mutex() {
+    static std::mutex* mutex = new std::mutex(); // passes may intern from several threads at once
+    return mutex;
+  }
+
+  // Number of distinct strings interned so far
+  static size_t numStrings() {
+    std::lock_guard<std::mutex> lock(*mutex());
+    return strings()->size();
+  }
+
+  void set(const char *s, bool reuse=true) {
+    StringSet* strings = IString::strings();
+    std::lock_guard<std::mutex> lock(*mutex());
 
     if (reuse) {
       auto result = strings->insert(s); // if already present, does nothing
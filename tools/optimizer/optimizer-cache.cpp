@@ -0,0 +1,243 @@
+// Copyright 2020 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include "optimizer-cache.h"
+#include "optimizer.h"
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#include <sys/utime.h>
+#define getpid _getpid
+#define utime _utime
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+using namespace cashew;
+
+// Bump this when the passes change what they emit, to invalidate old entries
+#define CACHE_VERSION "2"
+
+// How many entries a cache directory keeps, beyond this the least recently
+// used ones are removed
+#ifndef CACHE_MAX_ENTRIES
+#define CACHE_MAX_ENTRIES 200000
+#endif
+
+// 64-bit FNV-1a
+static uint64_t hashString(const std::string& str) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : str) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Like Value::stringify, but with object keys sorted, as objects iterate in
+// an order that depends on where their keys were interned
+static void stringifyCanonical(std::ostream& os, Ref node) {
+  if (node->isArray()) {
+    os << '[';
+    for (size_t i = 0; i < node->size(); i++) {
+      if (i > 0) os << ", ";
+      stringifyCanonical(os, node[i]);
+    }
+    os << ']';
+  } else if (node->isObject()) {
+    std::vector<std::string> keys;
+    for (auto i : *node->obj) keys.push_back(i.first.c_str());
+    std::sort(keys.begin(), keys.end());
+    os << '{';
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (i > 0) os << ", ";
+      os << '"' << keys[i] << "\": ";
+      stringifyCanonical(os, node[IString(keys[i].c_str())]);
+    }
+    os << '}';
+  } else {
+    node->stringify(os);
+  }
+}
+
+FunctionCache::FunctionCache(const std::string& dir, const std::string& passes) : dir(dir) {
+  header = "emscripten optimizer cache " CACHE_VERSION "\n" + passes + "\n";
+  std::string padded = " " + passes;
+  readsGlobals = padded.find(" minifyLocals ") != std::string::npos;
+  readsDeadFunctions = padded.find(" eliminateDeadFuncs ") != std::string::npos;
+}
+
+void FunctionCache::load(Ref ast) {
+  assert(ast[0] == TOPLEVEL);
+
+  // Functions that create a float zero emit the name of the global one, so it
+  // is part of the key. Passes learn it lazily, find it up front instead.
+  detectAsmFloatZero(ast);
+  if (!ASM_FLOAT_ZERO.isNull()) header += ASM_FLOAT_ZERO.c_str();
+  header += "\n";
+  // Only what the passes read of the extra info is part of the key, so that
+  // the rest of it can change without missing on every function
+  IString GLOBALS("globals"), DEAD_FUNCTIONS("dead_functions");
+  if (readsGlobals && !!extraInfo && extraInfo->has(GLOBALS)) {
+    std::ostringstream globals;
+    stringifyCanonical(globals, extraInfo[GLOBALS]);
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hashString(globals.str()));
+    header += hex;
+  }
+  header += "\n";
+  if (readsDeadFunctions && !!extraInfo && extraInfo->has(DEAD_FUNCTIONS)) {
+    // Only dead functions change, so each key just says whether its function
+    // is one
+    Ref dead = extraInfo[DEAD_FUNCTIONS];
+    for (size_t i = 0; i < dead->size(); i++) {
+      deadFunctions.insert(dead[i]->getIString());
+    }
+  }
+
+  Ref stats = ast[1];
+  size_t numMisses = 0;
+  for (size_t i = 0; i < stats->size(); i++) {
+    Ref curr = stats[i];
+    std::string key;
+    if (curr[0] == DEFUN) {
+      key = keyFor(curr);
+      Ref cached = lookup(key);
+      if (!!cached) {
+        all.push_back(cached);
+        hits++;
+        continue;
+      }
+      misses++;
+    }
+    // Not a function (which is never cached) or a miss: leave it to the passes
+    all.push_back(Ref());
+    missKeys.push_back(key);
+    stats[numMisses++] = curr;
+  }
+  stats->setSize(numMisses);
+}
+
+void FunctionCache::store(Ref ast) {
+  Ref stats = ast[1];
+  assert(stats->size() == missKeys.size()); // passes do not add or remove functions
+  size_t next = 0;
+  for (auto& curr : all) {
+    if (!!curr) continue;
+    const std::string& key = missKeys[next];
+    curr = stats[next++];
+    if (!key.empty() && write(key, curr)) stored++;
+  }
+  stats->setSize(all.size());
+  for (size_t i = 0; i < all.size(); i++) stats[i] = all[i];
+  if (stored > 0) prune();
+}
+
+std::string FunctionCache::keyFor(Ref func) {
+  std::ostringstream key;
+  key << header;
+  if (deadFunctions.has(func[1]->getIString())) key << "dead\n";
+  func->stringify(key);
+  return key.str();
+}
+
+std::string FunctionCache::pathFor(const std::string& key) {
+  char name[22];
+  snprintf(name, sizeof(name), "%016llx.json", (unsigned long long)hashString(key));
+  return dir + "/" + name;
+}
+
+Ref FunctionCache::lookup(const std::string& key) {
+  FILE *f = fopen(pathFor(key).c_str(), "rb");
+  if (!f) return Ref();
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  rewind(f);
+  char *data = new char[size+1];
+  size_t num = fread(data, 1, size, f);
+  fclose(f);
+  data[num] = 0;
+  // An entry starts with its full key, the hash in the name may have collided
+  if (num <= key.size() || key.compare(0, key.size(), data, key.size()) != 0 || data[key.size()] != '\n') {
+    delete[] data;
+    return Ref();
+  }
+  Ref func = arena.alloc();
+  func->parse(data + key.size() + 1);
+  // do not free data, its contents are used as strings
+  // Mark the entry as recently used, so that pruning keeps it
+  utime(pathFor(key).c_str(), nullptr);
+  return func;
+}
+
+bool FunctionCache::write(const std::string& key, Ref func) {
+  std::ostringstream entry;
+  entry << key << '\n';
+  func->stringify(entry);
+  entry << '\n';
+  std::string contents = entry.str();
+
+  // The cache is best effort: if we cannot write an entry, we just miss on it
+  // next time
+  std::string path = pathFor(key);
+  std::string temp = path + ".tmp" + std::to_string(getpid());
+  FILE *f = fopen(temp.c_str(), "wb");
+  if (!f) return false;
+  bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+  ok = fclose(f) == 0 && ok;
+  if (ok && rename(temp.c_str(), path.c_str()) != 0) {
+    // rename() does not replace existing files on Windows
+    remove(path.c_str());
+    ok = rename(temp.c_str(), path.c_str()) == 0;
+  }
+  if (!ok) remove(temp.c_str());
+  return ok;
+}
+
+// Removes the least recently used entries beyond CACHE_MAX_ENTRIES. Other
+// processes may be pruning the same directory, so entries can vanish under us.
+void FunctionCache::prune() {
+  std::vector<std::pair<time_t, std::string>> entries;
+#ifdef _WIN32
+  struct _finddata_t data;
+  intptr_t find = _findfirst((dir + "/*.json").c_str(), &data);
+  if (find == -1) return;
+  do {
+    entries.emplace_back(data.time_write, data.name);
+  } while (_findnext(find, &data) == 0);
+  _findclose(find);
+#else
+  DIR *d = opendir(dir.c_str());
+  if (!d) return;
+  std::vector<std::string> names;
+  while (struct dirent *entry = readdir(d)) {
+    std::string name = entry->d_name;
+    // Entries are named by their hash, anything else (like a temporary file)
+    // is not ours to remove
+    if (name.size() == 21 && name.compare(16, 5, ".json") == 0) names.push_back(name);
+  }
+  closedir(d);
+  // Listing is cheap, only look at the times when there is something to prune
+  if (names.size() <= CACHE_MAX_ENTRIES) return;
+  for (auto& name : names) {
+    struct stat st;
+    if (stat((dir + "/" + name).c_str(), &st) == 0) entries.emplace_back(st.st_mtime, name);
+  }
+#endif
+  if (entries.size() <= CACHE_MAX_ENTRIES) return;
+  size_t excess = entries.size() - CACHE_MAX_ENTRIES;
+  std::nth_element(entries.begin(), entries.begin() + excess, entries.end());
+  for (size_t i = 0; i < excess; i++) {
+    remove((dir + "/" + entries[i].second).c_str());
+  }
+}
@@ -0,0 +1,67 @@
+// Copyright 2020 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#ifndef __optimizer_cache_h__
+#define __optimizer_cache_h__
+
+#include "simple_ast.h"
+
+#include <string>
+#include <vector>
+
+// On-disk cache of optimized functions, so that relinking a large program only
+// reoptimizes the functions that changed.
+//
+// Entries are content-addressed: the key of a function is its input AST (as
+// JSON) plus everything else its output depends on, which is the pass list,
+// the name of the global float zero, and the parts of the extra info that the
+// passes read: the global names for minifyLocals, and whether the function is
+// dead for eliminateDeadFuncs. Each entry is a file named by the hash of the
+// key, holding the key and the optimized function, so that hash collisions
+// are detected rather than trusted. Entries are written to a temporary file
+// and renamed into place, so concurrent optimizer processes may share a cache
+// directory.
+//
+// Hits refresh the modification time of their entry, and once a run stores
+// new entries the least recently used ones beyond CACHE_MAX_ENTRIES are
+// removed.
+//
+// All passes work on each function independently, so a function that hits the
+// cache can be taken out of the document while the passes run:
+//
+//   FunctionCache cache(dir, passes);
+//   cache.load(doc);  // swaps in cached functions and hides them
+//   ... run passes, which only see the misses ...
+//   cache.store(doc); // puts hits back in place, stores the optimized misses
+class FunctionCache {
+public:
+  FunctionCache(const std::string& dir, const std::string& passes);
+
+  void load(cashew::Ref ast);
+  void store(cashew::Ref ast);
+
+  size_t hits = 0, misses = 0, stored = 0;
+
+private:
+  std::string dir;
+  std::string header; // the part of the key shared by all functions
+  bool readsGlobals, readsDeadFunctions;
+  cashew::IStringSet deadFunctions;
+
+  // Toplevel statements of the document, with hits already replaced. Misses
+  // stay null here, they are in the document while the passes run.
+  std::vector<cashew::Ref> all;
+  // Keys of what the passes see, in document order; empty for statements that
+  // are not functions.
+  std::vector<std::string> missKeys;
+
+  std::string keyFor(cashew::Ref func);
+  std::string pathFor(const std::string& key);
+  cashew::Ref lookup(const std::string& key); // null on a miss
+  bool write(const std::string& key, cashew::Ref func);
+  void prune();
+};
+
+#endif // __optimizer_cache_h__
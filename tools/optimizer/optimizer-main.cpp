@@ -15,12 +15,64 @@
 
 #include "simple_ast.h"
 #include "optimizer.h"
+#include "optimizer-cache.h"
+#include "optimizer-profile.h"
 
+#include <memory>
 #include <string.h> // only use this for param checking
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace cashew;
 
+static void binaryFileError(const char *filename) {
+  fprintf(stderr, "could not read binary AST file %s\n", filename);
+  exit(1);
+}
+
+// Maps a binary AST file into memory (or reads it, where we cannot map). It is
+// never unmapped, as the AST uses the strings in it.
+static const char* mapBinaryFile(const char *filename, size_t& size) {
+#ifdef _WIN32
+  FILE *f = fopen(filename, "rb");
+  if (!f) binaryFileError(filename);
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  char *data = new char[size];
+  rewind(f);
+  size_t num = fread(data, 1, size, f);
+  fclose(f);
+  if (num != size) binaryFileError(filename);
+  return data;
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) binaryFileError(filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0) binaryFileError(filename);
+  size = st.st_size;
+  if (size == 0) binaryFileError(filename); // mmap() rejects empty mappings
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) binaryFileError(filename);
+  close(fd);
+  return (const char*)data;
+#endif
+}
+
 int main(int argc, char **argv) {
+  std::string cacheDir;
+  bool cacheStats = false;
+  std::string profilePath;
+  // Everything the output AST depends on besides the input, for the cache
+  std::string passes;
+
   // Read directives
   for (int i = 2; i < argc; i++) {
     std::string str(argv[i]);
@@ -28,65 +80,89 @@ int main(int argc, char **argv) {
     else if (str == "asmPreciseF32") preciseF32 = true;
     else if (str == "receiveJSON") receiveJSON = true;
     else if (str == "emitJSON") emitJSON = true;
+    else if (str == "receiveBinary") receiveBinary = true;
+    else if (str == "emitBinary") emitBinary = true;
     else if (str == "minifyWhitespace") minifyWhitespace = true;
     else if (str == "last") last = true;
+    else if (str.compare(0, 8, "threads=") == 0) numThreads = std::max(1, atoi(str.c_str() + 8));
+    else if (str.compare(0, 9, "cacheDir=") == 0) cacheDir = str.substr(9);
+    else if (str == "cacheStats") cacheStats = true;
+    else if (str.compare(0, 8, "profile=") == 0) profilePath = str.substr(8);
+    if (str.compare(0, 8, "threads=") != 0 && str.compare(0, 9, "cacheDir=") != 0 && str != "cacheStats" &&
+        str.compare(0, 8, "profile=") != 0 &&
+        str != "receiveJSON" && str != "emitJSON" && str != "receiveBinary" && str != "emitBinary") {
+      passes += str + " ";
+    }
   }
 
-#ifdef PROFILING
-    std::string str("reading and parsing");
-    clock_t start = clock();
-    errv("starting %s", str.c_str());
-#endif
-
-  // Read input file
-  FILE *f = fopen(argv[1], "r");
-  assert(f);
-  fseek(f, 0, SEEK_END);
-  int size = ftell(f);
-  char *input = new char[size+1];
-  rewind(f);
-  int num = fread(input, 1, size, f);
-  // On Windows, ftell() gives the byte position (\r\n counts as two bytes), but when
-  // reading, fread() returns the number of characters read (\r\n is read as one char \n, and counted as one),
-  // so return value of fread can be less than size reported by ftell, and that is normal.
-  assert((num > 0 || size == 0) && num <= size);
-  fclose(f);
-  input[num] = 0;
-
-  char *extraInfoStart = strstr(input, "// EXTRA_INFO:");
-  if (extraInfoStart) {
-    extraInfo = arena.alloc();
-    extraInfo->parse(extraInfoStart + 14);
-    *extraInfoStart = 0; // ignore extra info when parsing
+  std::unique_ptr<Profile> profiler;
+  if (!profilePath.empty()) {
+    profiler.reset(new Profile(profilePath));
+    profile = profiler.get();
+    profile->beginStep("read");
   }
 
   Ref doc;
 
-  if (receiveJSON) {
-    // Parse JSON source into the document
-    doc = arena.alloc();
-    doc->parse(input);
+  if (receiveBinary) {
+    size_t size;
+    const char *data = mapBinaryFile(argv[1], size);
+    doc = readBinary(data, size, &extraInfo);
   } else {
-    cashew::Parser<Ref, ValueBuilder> builder;
-    doc = builder.parseToplevel(input);
+    // Read input file
+    FILE *f = fopen(argv[1], "r");
+    assert(f);
+    fseek(f, 0, SEEK_END);
+    int size = ftell(f);
+    char *input = new char[size+1];
+    rewind(f);
+    int num = fread(input, 1, size, f);
+    // On Windows, ftell() gives the byte position (\r\n counts as two bytes), but when
+    // reading, fread() returns the number of characters read (\r\n is read as one char \n, and counted as one),
+    // so return value of fread can be less than size reported by ftell, and that is normal.
+    assert((num > 0 || size == 0) && num <= size);
+    fclose(f);
+    input[num] = 0;
+
+    char *extraInfoStart = strstr(input, "// EXTRA_INFO:");
+    if (extraInfoStart) {
+      extraInfo = arena.alloc();
+      extraInfo->parse(extraInfoStart + 14);
+      *extraInfoStart = 0; // ignore extra info when parsing
+    }
+
+    if (receiveJSON) {
+      // Parse JSON source into the document
+      doc = arena.alloc();
+      doc->parse(input);
+    } else {
+      cashew::Parser<Ref, ValueBuilder> builder;
+      doc = builder.parseToplevel(input);
+    }
+    // do not free input, its contents are used as strings
   }
-  // do not free input, its contents are used as strings
 
-#ifdef PROFILING
-    errv("    %s took %lu milliseconds", str.c_str(), (clock() - start)/1000);
-#endif
+  if (profile) profile->endStep();
+
+  // Functions that are in the cache are taken out of the document until the
+  // passes are done
+  std::unique_ptr<FunctionCache> cache;
+  if (!cacheDir.empty()) {
+    if (profile) profile->beginStep("cacheLoad");
+    cache.reset(new FunctionCache(cacheDir, passes));
+    cache->load(doc);
+    if (profile) profile->endStep();
+  }
 
   // Run passes on the Document
   for (int i = 2; i < argc; i++) {
     std::string str(argv[i]);
-#ifdef PROFILING
-    clock_t start = clock();
-    errv("starting %s", str.c_str());
-#endif
+    if (profile) profile->beginStep(str);
     bool worked = true;
     if (str == "asm") { worked = false; } // the default for us
     else if (str == "asmPreciseF32") { worked = false; }
     else if (str == "receiveJSON" || str == "emitJSON") { worked = false; }
+    else if (str == "receiveBinary" || str == "emitBinary") { worked = false; }
     else if (str == "eliminateDeadFuncs") eliminateDeadFuncs(doc);
     else if (str == "eliminate") eliminate(doc);
     else if (str == "eliminateMemSafe") eliminateMemSafe(doc);
@@ -100,13 +176,17 @@ int main(int argc, char **argv) {
     else if (str == "asmLastOpts") asmLastOpts(doc);
     else if (str == "last") { worked = false; }
     else if (str == "noop") { worked = false; }
+    else if (str.compare(0, 8, "threads=") == 0) { worked = false; }
+    else if (str.compare(0, 9, "cacheDir=") == 0 || str == "cacheStats") { worked = false; }
+    else if (str.compare(0, 8, "profile=") == 0) { worked = false; }
     else {
       fprintf(stderr, "unrecognized argument: %s\n", str.c_str());
       abort();
     }
-#ifdef PROFILING
-    errv("    %s took %lu milliseconds", str.c_str(), (clock() - start)/1000);
-#endif
+    if (profile) {
+      if (worked) profile->endStep();
+      else profile->discardStep();
+    }
 #ifdef DEBUGGING
     if (worked) {
       std::cerr << "ast after " << str << ":\n";
@@ -116,8 +196,24 @@ int main(int argc, char **argv) {
 #endif
   }
 
+  if (cache) {
+    if (profile) profile->beginStep("cacheStore");
+    cache->store(doc);
+    if (profile) profile->endStep();
+    if (cacheStats) {
+      errv("optimizer cache: %lu hits, %lu misses, %lu stored",
+           (unsigned long)cache->hits, (unsigned long)cache->misses, (unsigned long)cache->stored);
+    }
+  }
+
   // Emit
-  if (emitJSON) {
+  if (profile) profile->beginStep("emit");
+  if (emitBinary) {
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    writeBinary(std::cout, doc, extraInfo);
+  } else if (emitJSON) {
     doc->stringify(std::cout);
     std::cout << "\n";
   } else {
@@ -125,6 +221,13 @@ int main(int argc, char **argv) {
     jser.printAst();
     std::cout << jser.buffer << "\n";
   }
+  if (profile) {
+    std::cout.flush();
+    profile->endStep();
+    if (!profile->write()) {
+      errv("could not write profile to %s", profilePath.c_str());
+    }
+  }
   return 0;
 }
 
@@ -0,0 +1,148 @@
+// Copyright 2020 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include "optimizer-profile.h"
+#include "optimizer.h"
+
+#include <fstream>
+
+using namespace cashew;
+
+// How many of the slowest functions to list for each step
+#define SLOWEST_FUNCTIONS 20
+
+Profile *profile = nullptr;
+
+static double toMs(Profile::Clock::duration time) {
+  return std::chrono::duration<double, std::milli>(time).count();
+}
+
+// Names come from the command line and from the input, quote them properly
+static void writeString(std::ostream& os, const char *str) {
+  os << '"';
+  for (; *str; str++) {
+    unsigned char c = *str;
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (c < 0x20) {
+      char hex[8];
+      snprintf(hex, sizeof(hex), "\\u%04x", c);
+      os << hex;
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+Profile::Profile(const std::string& path) : path(path), start(Clock::now()) {}
+
+void Profile::beginStep(const std::string& name) {
+  steps.emplace_back();
+  steps.back().name = name;
+  stepTraversedNodes = traversedNodes;
+  stepArenaBytes = Arena::totalBytes;
+  stepStart = Clock::now();
+}
+
+void Profile::endStep() {
+  Step& step = steps.back();
+  step.time = Clock::now() - stepStart;
+  // Nodes visited in functions were already added, and taken out of the
+  // counter of the thread that visited them
+  step.nodes += traversedNodes - stepTraversedNodes;
+  step.arenaBytes = Arena::totalBytes - stepArenaBytes;
+  step.numFunctions = step.functions.size();
+  auto& functions = step.functions;
+  size_t keep = std::min(functions.size(), size_t(SLOWEST_FUNCTIONS));
+  std::partial_sort(functions.begin(), functions.begin() + keep, functions.end(), [](const Function& a, const Function& b) {
+    return a.time > b.time;
+  });
+  functions.resize(keep);
+}
+
+void Profile::discardStep() {
+  steps.pop_back();
+}
+
+void Profile::addFunction(Ref func, Clock::duration time, size_t nodes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Step& step = steps.back();
+  step.functions.push_back(Function{ func[1]->getIString(), time, nodes });
+  step.nodes += nodes;
+}
+
+void Profile::addPhase(const char *name, Clock::duration time) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& phases = steps.back().phases;
+  for (auto& phase : phases) {
+    if (phase.first == name) {
+      phase.second += time;
+      return;
+    }
+  }
+  phases.emplace_back(name, time);
+}
+
+bool Profile::write() {
+  std::ofstream os(path);
+  if (!os) return false;
+  char ms[32];
+  auto writeMs = [&](Clock::duration time) {
+    snprintf(ms, sizeof(ms), "%.3f", toMs(time));
+    os << ms;
+  };
+  os << "{\"threads\": " << numThreads
+     << ", \"ms\": ";
+  writeMs(Clock::now() - start);
+  os << ", \"arenaBytes\": " << Arena::totalBytes
+     << ", \"strings\": " << IString::numStrings()
+     << ", \"steps\": [";
+  for (size_t i = 0; i < steps.size(); i++) {
+    Step& step = steps[i];
+    os << (i > 0 ? ",\n  " : "\n  ") << "{\"name\": ";
+    writeString(os, step.name.c_str());
+    os << ", \"ms\": ";
+    writeMs(step.time);
+    os << ", \"nodes\": " << step.nodes
+       << ", \"arenaBytes\": " << step.arenaBytes
+       << ", \"functions\": " << step.numFunctions
+       << ", \"phases\": {";
+    for (size_t j = 0; j < step.phases.size(); j++) {
+      if (j > 0) os << ", ";
+      writeString(os, step.phases[j].first.c_str());
+      os << ": ";
+      writeMs(step.phases[j].second);
+    }
+    os << "}, \"slowest\": [";
+    for (size_t j = 0; j < step.functions.size(); j++) {
+      Function& func = step.functions[j];
+      os << (j > 0 ? ", " : "") << "{\"name\": ";
+      writeString(os, func.name.c_str());
+      os << ", \"ms\": ";
+      writeMs(func.time);
+      os << ", \"nodes\": " << func.nodes << "}";
+    }
+    os << "]}";
+  }
+  os << "\n]}\n";
+  return !!os;
+}
+
+PhaseTimer::~PhaseTimer() {
+  for (auto& phase : phases) {
+    profile->addPhase(phase.first, phase.second);
+  }
+}
+
+void PhaseTimer::charge(const char *name, Profile::Clock::duration time) {
+  for (auto& phase : phases) {
+    if (phase.first == name) {
+      phase.second += time;
+      return;
+    }
+  }
+  phases.emplace_back(name, time);
+}
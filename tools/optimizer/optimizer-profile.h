@@ -0,0 +1,98 @@
+// Copyright 2020 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#ifndef __optimizer_profile_h__
+#define __optimizer_profile_h__
+
+#include "simple_ast.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Profile of an optimizer run, written out as JSON at the end of the run when
+// the profile=<file> directive is given. tools/js_optimizer.py merges the
+// profiles of all chunks into the toolchain profiler's log.
+//
+// The run is split into steps: reading the input, each pass, and emitting the
+// output. For each step we record the wall time, how many nodes the AST
+// traversals visited, how many bytes the arenas allocated, and the functions
+// that took the longest. Passes can further split the time they spend on each
+// function into named phases with a PhaseTimer; phase times are summed over
+// all functions and threads, so they are not wall time when running threaded.
+class Profile {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  Profile(const std::string& path);
+
+  void beginStep(const std::string& name);
+  void endStep();
+  void discardStep(); // for directives that do no work
+
+  // These are called from the threads running a pass
+  void addFunction(cashew::Ref func, Clock::duration time, size_t nodes);
+  void addPhase(const char *name, Clock::duration time);
+
+  bool write();
+
+private:
+  struct Function {
+    cashew::IString name;
+    Clock::duration time;
+    size_t nodes;
+  };
+  struct Step {
+    std::string name;
+    Clock::duration time;
+    size_t nodes = 0, arenaBytes = 0, numFunctions = 0;
+    std::vector<std::pair<std::string, Clock::duration>> phases; // in order of first appearance
+    std::vector<Function> functions; // the slowest ones, once the step ends
+  };
+
+  std::string path;
+  Clock::time_point start;
+  std::vector<Step> steps;
+  std::mutex mutex;
+
+  // The step in progress
+  Clock::time_point stepStart;
+  size_t stepTraversedNodes = 0, stepArenaBytes = 0;
+};
+
+extern Profile *profile; // null unless profiling
+
+// Charges the time a pass spends on a function to named phases:
+//
+//   PhaseTimer timer;
+//   ... build the flow graph ...
+//   timer.phase("flowgraph"); // everything since the last call, or since construction
+//
+// Does nothing when not profiling.
+class PhaseTimer {
+public:
+  PhaseTimer() : active(profile != nullptr) {
+    if (active) last = Profile::Clock::now();
+  }
+  ~PhaseTimer();
+
+  void phase(const char *name) {
+    if (!active) return;
+    auto now = Profile::Clock::now();
+    charge(name, now - last);
+    last = now;
+  }
+
+private:
+  bool active;
+  Profile::Clock::time_point last;
+  // Phases are few, and named by literals, so look them up by pointer
+  std::vector<std::pair<const char*, Profile::Clock::duration>> phases;
+
+  void charge(const char *name, Profile::Clock::duration time);
+};
+
+#endif // __optimizer_profile_h__
@@ -58,7 +58,7 @@ AsmType detectType(Ref node, AsmData *asmData, bool inVarDef) {
         return ASM_INT;
       } else if (node[0] == NAME) {
         if (asmData) {
-          AsmType ret = asmData->getType(node[1]->getCString());
+          AsmType ret = asmData->getType(node[1]->getIString());
           if (ret != ASM_NONE) return ret;
         }
         if (!inVarDef) {
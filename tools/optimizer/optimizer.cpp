@@ -9,9 +9,15 @@
 #include <string>
 #include <algorithm>
 #include <map>
+#include <mutex>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "simple_ast.h"
 #include "optimizer.h"
+#include "optimizer-profile.h"
 
 using namespace cashew;
 
@@ -586,13 +592,54 @@ int measureCost(Ref ast) {
 bool preciseF32 = false,
      receiveJSON = false,
      emitJSON = false,
+     receiveBinary = false,
+     emitBinary = false,
      minifyWhitespace = false,
      last = false;
 
+int numThreads = 1;
+
 //=====================
 // Optimization passes
 //=====================
 
+// AsmData learns the name of the global float zero (f0) lazily, from the first
+// var definition that uses it. Find it up front when running in parallel, so
+// that concurrently processed functions do not race on it.
+void detectAsmFloatZero(Ref ast) {
+  traverseFunctions(ast, [](Ref func) {
+    if (!ASM_FLOAT_ZERO.isNull()) return;
+    Ref stats = func[3];
+    size_t i = 0;
+    while (i < stats->size() && stats[i][0] == STAT && stats[i][1][0] == ASSIGN) i++; // param coercions
+    for (; i < stats->size() && stats[i][0] == VAR; i++) {
+      Ref defs = stats[i][1];
+      for (size_t j = 0; j < defs->size(); j++) {
+        if (defs[j]->size() > 1 && defs[j][1][0] == NAME) {
+          detectType(defs[j][1], nullptr, true);
+          return;
+        }
+      }
+    }
+  });
+}
+
+// Runs a pass that works on each function independently, on numThreads threads
+void traverseFunctionsInParallel(Ref ast, std::function<void (Ref)> visit) {
+  if (numThreads > 1) detectAsmFloatZero(ast);
+  if (profile) {
+    traverseFunctionsParallel(ast, numThreads, [&visit](Ref func) {
+      size_t nodes = traversedNodes;
+      auto start = Profile::Clock::now();
+      visit(func);
+      profile->addFunction(func, Profile::Clock::now() - start, traversedNodes - nodes);
+      traversedNodes = nodes; // already counted for the pass
+    });
+    return;
+  }
+  traverseFunctionsParallel(ast, numThreads, visit);
+}
+
 #define HASES \
   bool has(const IString& str) { \
     return count(str) > 0; \
@@ -755,29 +802,14 @@ public:
 };
 
 void eliminate(Ref ast, bool memSafe) {
-#ifdef PROFILING
-  clock_t tasmdata = 0;
-  clock_t tfnexamine = 0;
-  clock_t tvarcheck = 0;
-  clock_t tstmtelim = 0;
-  clock_t tstmtscan = 0;
-  clock_t tcleanvars = 0;
-  clock_t treconstruct = 0;
-#endif
-
   // Find variables that have a single use, and if they can be eliminated, do so
-  traverseFunctions(ast, [&](Ref func) {
+  traverseFunctionsInParallel(ast, [&](Ref func) {
 
-#ifdef PROFILING
-    clock_t start = clock();
-#endif
+    PhaseTimer timer;
 
     AsmData asmData(func);
 
-#ifdef PROFILING
-    tasmdata += clock() - start;
-    start = clock();
-#endif
+    timer.phase("asmData");
 
     // First, find the potentially eliminatable functions: that have one definition and one use
 
@@ -810,10 +842,7 @@ void eliminate(Ref ast, bool memSafe) {
       }
     });
 
-#ifdef PROFILING
-    tfnexamine += clock() - start;
-    start = clock();
-#endif
+    timer.phase("examine");
 
     StringSet potentials; // local variables with 1 definition and 1 use
     StringSet sideEffectFree; // whether a local variable has no side effects in its definition. Only relevant when there are no uses
@@ -876,10 +905,7 @@ void eliminate(Ref ast, bool memSafe) {
       processVariable(name.first);
     }
 
-#ifdef PROFILING
-    tvarcheck += clock() - start;
-    start = clock();
-#endif
+    timer.phase("varCheck");
 
     //printErr('defs: ' + JSON.stringify(definitions));
     //printErr('uses: ' + JSON.stringify(uses));
@@ -1212,15 +1238,9 @@ void eliminate(Ref ast, bool memSafe) {
         }
         // Check for things that affect elimination
         if (ELIMINATION_SAFE_NODES.has(type)) {
-#ifdef PROFILING
-          tstmtelim += clock() - start;
-          start = clock();
-#endif
+          timer.phase("stmtElim");
           scan(node);
-#ifdef PROFILING
-          tstmtscan += clock() - start;
-          start = clock();
-#endif
+          timer.phase("stmtScan");
         } else if (type == VAR) {
           continue; // asm normalisation has reduced 'var' to just the names
         } else {
@@ -1229,10 +1249,7 @@ void eliminate(Ref ast, bool memSafe) {
       }
     });
 
-#ifdef PROFILING
-    tstmtelim += clock() - start;
-    start = clock();
-#endif
+    timer.phase("stmtElim");
 
     StringIntMap seenUses;
     StringStringMap helperReplacements; // for looper-helper optimization
@@ -1448,10 +1465,7 @@ void eliminate(Ref ast, bool memSafe) {
       }
     });
 
-#ifdef PROFILING
-    tcleanvars += clock() - start;
-    start = clock();
-#endif
+    timer.phase("cleanVars");
 
     for (auto v : varsToRemove) {
       if (v.second == 2 && asmData.isVar(v.first)) asmData.deleteVar(v.first);
@@ -1459,19 +1473,11 @@ void eliminate(Ref ast, bool memSafe) {
 
     asmData.denormalize();
 
-#ifdef PROFILING
-    treconstruct += clock() - start;
-    start = clock();
-#endif
+    timer.phase("reconstruct");
 
   });
 
   removeAllEmptySubNodes(ast);
-
-#ifdef PROFILING
-  errv("    EL stages: a:%li fe:%li vc:%li se:%li (ss:%li) cv:%li r:%li",
-    tasmdata, tfnexamine, tvarcheck, tstmtelim, tstmtscan, tcleanvars, treconstruct);
-#endif
 }
 
 void eliminateMemSafe(Ref ast) {
@@ -1918,7 +1924,7 @@ void simplifyExpressions(Ref ast) {
     });
   };
 
-  traverseFunctions(ast, [&](Ref func) {
+  traverseFunctionsInParallel(ast, [&](Ref func) {
     simplifyIntegerConversions(func);
     simplifyOps(func);
     traversePre(func, [](Ref node) {
@@ -1933,7 +1939,7 @@ void simplifyExpressions(Ref ast) {
 }
 
 void simplifyIfs(Ref ast) {
-  traverseFunctions(ast, [](Ref func) {
+  traverseFunctionsInParallel(ast, [](Ref func) {
     bool simplifiedAnElse = false;
 
     traversePre(func, [&simplifiedAnElse](Ref node) {
@@ -2148,7 +2154,7 @@ IString getRegName(AsmType type, int num) {
 }
 
 void registerize(Ref ast) {
-  traverseFunctions(ast, [](Ref fun) {
+  traverseFunctionsInParallel(ast, [](Ref fun) {
     AsmData asmData(fun);
     // Add parameters as a first (fake) var (with assignment), so they get taken into consideration
     // note: params are special, they can never share a register between them (see later)
@@ -2376,6 +2382,98 @@ void registerize(Ref ast) {
   });
 }
 
+static inline int lowestBit(uint64_t word) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, word);
+  return index;
+#else
+  return __builtin_ctzll(word);
+#endif
+}
+
+static inline int highestBit(uint64_t word) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanReverse64(&index, word);
+  return index;
+#else
+  return 63 - __builtin_clzll(word);
+#endif
+}
+
+// A set of small non-negative integers, such as densely numbered variables.
+class BitSet {
+  std::vector<uint64_t> words;
+
+public:
+  BitSet() {}
+  explicit BitSet(size_t size) : words((size + 63) / 64) {}
+
+  bool has(size_t i) const {
+    return (words[i >> 6] >> (i & 63)) & 1;
+  }
+  void insert(size_t i) {
+    words[i >> 6] |= uint64_t(1) << (i & 63);
+  }
+  void erase(size_t i) {
+    words[i >> 6] &= ~(uint64_t(1) << (i & 63));
+  }
+
+  // this |= other
+  void insertAll(const BitSet& other) {
+    for (size_t i = 0; i < words.size(); i++) words[i] |= other.words[i];
+  }
+
+  bool operator==(const BitSet& other) const { return words == other.words; }
+  bool operator!=(const BitSet& other) const { return words != other.words; }
+
+  // Visits the members in increasing order
+  template<typename F>
+  void forEach(F visit) const {
+    for (size_t i = 0; i < words.size(); i++) {
+      uint64_t word = words[i];
+      while (word) {
+        visit(i * 64 + lowestBit(word));
+        word &= word - 1;
+      }
+    }
+  }
+
+  // Returns the largest member, or -1 if the set is empty; words above limit
+  // must be empty, and limit is lowered past the empty words found on the way
+  int largest(size_t& limit) const {
+    while (limit > 0 && !words[limit - 1]) limit--;
+    if (limit == 0) return -1;
+    return (limit - 1) * 64 + highestBit(words[limit - 1]);
+  }
+};
+
+// A worklist of ids that always hands out the largest one first.
+class WorkSet {
+  BitSet members;
+  size_t limit = 0; // no words from here on have members
+
+public:
+  explicit WorkSet(size_t size) : members(size) {}
+
+  void insert(int id) {
+    members.insert(id);
+    limit = std::max(limit, size_t(id / 64 + 1));
+  }
+  void erase(int id) { members.erase(id); }
+
+  // Returns -1 when empty
+  int popLargest() {
+    int id = members.largest(limit);
+    if (id >= 0) members.erase(id);
+    return id;
+  }
+  bool empty() {
+    return members.largest(limit) < 0;
+  }
+};
+
 // Assign variables to 'registers', coalescing them onto a smaller number of shared
 // variables.
 //
@@ -2398,23 +2496,9 @@ void registerize(Ref ast) {
 //     (e.g. unnecessary assignments to the 'label' variable).
 //
 void registerizeHarder(Ref ast) {
-#ifdef PROFILING
-  clock_t tasmdata = 0;
-  clock_t tflowgraph = 0;
-  clock_t tlabelfix = 0;
-  clock_t tbackflow = 0;
-  clock_t tjuncvaruniqassign = 0;
-  clock_t tjuncvarsort = 0;
-  clock_t tregassign = 0;
-  clock_t tblockproc = 0;
-  clock_t treconstruct = 0;
-#endif
+  traverseFunctionsInParallel(ast, [&](Ref fun) {
 
-  traverseFunctions(ast, [&](Ref fun) {
-
-#ifdef PROFILING
-    clock_t start = clock();
-#endif
+    PhaseTimer timer;
 
     // Do not try to process non-validating methods, like the heap replacer
     bool abort = false;
@@ -2429,10 +2513,27 @@ void registerizeHarder(Ref ast) {
 
     AsmData asmData(fun);
 
-#ifdef PROFILING
-    tasmdata += clock() - start;
-    start = clock();
-#endif
+    // Number the locals densely, in name order, so that sets of them can be
+    // bitsets that iterate in the same order as an IOrderedStringSet would.
+    size_t numLocals = asmData.locals.size();
+    std::vector<IString> numToName;
+    numToName.reserve(numLocals);
+    for (auto kv : asmData.locals) {
+      numToName.push_back(kv.first);
+    }
+    std::sort(numToName.begin(), numToName.end());
+    std::unordered_map<IString, size_t> nameToNum;
+    nameToNum.reserve(numLocals);
+    for (size_t i = 0; i < numLocals; i++) {
+      nameToNum[numToName[i]] = i;
+    }
+    auto localNum = [&](IString name) {
+      auto iter = nameToNum.find(name);
+      assert(iter != nameToNum.end()); // only locals are tracked
+      return iter->second;
+    };
+
+    timer.phase("asmData");
 
     // Utilities for allocating register variables.
     // We need distinct register pools for each type of variable.
@@ -2469,9 +2570,9 @@ void registerizeHarder(Ref ast) {
 
     struct Junction {
       int id;
-      std::set<int> inblocks, outblocks;
-      IOrderedStringSet live;
-      Junction(int id_) : id(id_) {}
+      std::vector<int> inblocks, outblocks;
+      BitSet live;
+      Junction(int id_, size_t numLocals) : id(id_), live(numLocals) {}
     };
     struct Node {
     };
@@ -2482,6 +2583,10 @@ void registerizeHarder(Ref ast) {
       std::vector<bool> isexpr;
       StringIntMap use;
       StringSet kill;
+      // The same, numbered. useNums is sorted and keeps the locations in use,
+      // as a change in those also counts as a change of the block.
+      std::vector<std::pair<size_t, int>> useNums;
+      std::vector<size_t> killNums;
       StringStringMap link;
       StringIntMap lastUseLoc;
       StringIntMap firstDeadLoc;
@@ -2514,7 +2619,7 @@ void registerizeHarder(Ref ast) {
       // Create a new junction, without inserting it into the graph.
       // This is useful for e.g. pre-allocating an exit node.
       int id = junctions.size();
-      junctions.push_back(Junction(id));
+      junctions.push_back(Junction(id, numLocals));
       return id;
     };
 
@@ -2551,8 +2656,8 @@ void registerizeHarder(Ref ast) {
         nextBasicBlock->id = blocks.size();
         nextBasicBlock->entry = currEntryJunction;
         nextBasicBlock->exit = id;
-        junctions[currEntryJunction].outblocks.insert(nextBasicBlock->id);
-        junctions[id].inblocks.insert(nextBasicBlock->id);
+        junctions[currEntryJunction].outblocks.push_back(nextBasicBlock->id);
+        junctions[id].inblocks.push_back(nextBasicBlock->id);
         blocks.push_back(nextBasicBlock);
       } 
       nextBasicBlock = new Block();
@@ -2931,10 +3036,7 @@ void registerizeHarder(Ref ast) {
 
     buildFlowGraph(fun);
 
-#ifdef PROFILING
-    tflowgraph += clock() - start;
-    start = clock();
-#endif
+    timer.phase("flowGraph");
 
     assert(junctions[ENTRY_JUNCTION].inblocks.size() == 0); // 'function entry must have no incoming blocks');
     assert(junctions[EXIT_JUNCTION].outblocks.size() == 0); // 'function exit must have no outgoing blocks');
@@ -2949,6 +3051,9 @@ void registerizeHarder(Ref ast) {
     typedef std::pair<Ref, Block*> Jump;
     std::vector<Jump> labelledJumps;
 
+    // Jumps are assignments to LABEL, so there are none unless it is a local
+    if (!asmData.isLocal(LABEL)) goto AFTER_FINDLABELLEDBLOCKS;
+
     for (size_t i = 0; i < blocks.size(); i++) {
       Block* block = blocks[i];
       // Does it have any labels as preconditions to its entry?
@@ -2994,13 +3099,18 @@ void registerizeHarder(Ref ast) {
 
     AFTER_FINDLABELLEDBLOCKS:
 
+    auto removeBlock = [](std::vector<int>& blockIds, int id) {
+      auto iter = std::find(blockIds.begin(), blockIds.end(), id);
+      if (iter != blockIds.end()) blockIds.erase(iter);
+    };
+
     for (auto labelVal : labelledBlocks) {
       Block* block = labelVal.second;
       // Disconnect it from the graph, and create a
       // new junction for jumps targetting this label.
-      junctions[block->entry].outblocks.erase(block->id);
+      removeBlock(junctions[block->entry].outblocks, block->id);
       block->entry = addJunction();
-      junctions[block->entry].outblocks.insert(block->id);
+      junctions[block->entry].outblocks.push_back(block->id);
       // Add a fake use of LABEL to keep it alive in predecessor.
       block->use[LABEL] = 1;
       block->nodes.insert(block->nodes.begin(), makeName(LABEL));
@@ -3012,16 +3122,13 @@ void registerizeHarder(Ref ast) {
       Block* targetBlock = labelledBlocks[labelVal->getInteger()];
       if (targetBlock) {
         // Redirect its exit to entry of the target block.
-        junctions[block->exit].inblocks.erase(block->id);
+        removeBlock(junctions[block->exit].inblocks, block->id);
         block->exit = targetBlock->entry;
-        junctions[block->exit].inblocks.insert(block->id);
+        junctions[block->exit].inblocks.push_back(block->id);
       }
     }
 
-#ifdef PROFILING
-    tlabelfix += clock() - start;
-    start = clock();
-#endif
+    timer.phase("labelFix");
 
     // Do a backwards data-flow analysis to determine the set of live
     // variables at each junction, and to use this information to eliminate
@@ -3030,22 +3137,36 @@ void registerizeHarder(Ref ast) {
     // junction.  The outer phase uses this to try to eliminate redundant
     // stores in each basic block, which might in turn affect liveness info.
 
+    auto updateBlockNums = [&](Block* block) {
+      block->useNums.clear();
+      for (auto pair : block->use) {
+        block->useNums.push_back(std::make_pair(localNum(pair.first), pair.second));
+      }
+      std::sort(block->useNums.begin(), block->useNums.end());
+      block->killNums.clear();
+      for (auto name : block->kill) {
+        block->killNums.push_back(localNum(name));
+      }
+    };
+
+    BitSet liveSucc(numLocals);
     auto analyzeJunction = [&](Junction& junc) {
-      // Update the live set for this junction.
-      IOrderedStringSet live;
+      // Update the live set for this junction, returning whether it changed.
+      BitSet live(numLocals);
       for (auto b : junc.outblocks) {
         Block* block = blocks[b];
-        IOrderedStringSet& liveSucc = junctions[block->exit].live;
-        for (auto name : liveSucc) {
-          if (!block->kill.has(name)) {
-            live.insert(name);
-          }
+        liveSucc = junctions[block->exit].live;
+        for (auto num : block->killNums) {
+          liveSucc.erase(num);
         }
-        for (auto name : block->use) {
-          live.insert(name.first);
+        live.insertAll(liveSucc);
+        for (auto numLoc : block->useNums) {
+          live.insert(numLoc.first);
         }
       }
-      junc.live = live;
+      if (live == junc.live) return false;
+      junc.live = std::move(live);
+      return true;
     };
 
     auto analyzeBlock = [&](Block* block) {
@@ -3063,16 +3184,17 @@ void registerizeHarder(Ref ast) {
       StringIntMap firstDeadLoc;
       StringIntMap firstKillLoc;
       StringIntMap lastKillLoc;
-      for (auto name : live) {
+      live.forEach([&](size_t num) {
+        IString name = numToName[num];
         link[name] = name;
         lastUseLoc[name] = block->nodes.size();
         firstDeadLoc[name] = block->nodes.size();
-      }
+      });
       for (int j = block->nodes.size() - 1; j >= 0 ; j--) {
         Ref node = block->nodes[j];
         if (node[0] == NAME) {
           IString name = node[1]->getIString();
-          live.insert(name);
+          live.insert(localNum(name));
           use[name] = j;
           if (lastUseLoc.count(name) == 0) {
             lastUseLoc[name] = j;
@@ -3081,10 +3203,11 @@ void registerizeHarder(Ref ast) {
         } else {
           IString name = node[2][1]->getIString();
           // We only keep assignments if they will be subsequently used.
-          if (live.has(name)) {
+          size_t num = localNum(name);
+          if (live.has(num)) {
             kill.insert(name);
             use.erase(name);
-            live.erase(name);
+            live.erase(num);
             firstDeadLoc[name] = j;
             firstKillLoc[name] = j;
             if (lastUseLoc.count(name) == 0) {
@@ -3149,11 +3272,16 @@ void registerizeHarder(Ref ast) {
       block->firstDeadLoc = firstDeadLoc;
       block->firstKillLoc = firstKillLoc;
       block->lastKillLoc = lastKillLoc;
+      updateBlockNums(block);
     };
 
-    // Ordered map to work in approximate reverse order of junction appearance
-    std::set<int> jWorkSet;
-    std::set<int> bWorkSet;
+    for (auto block : blocks) {
+      updateBlockNums(block);
+    }
+
+    // Work in approximate reverse order of junction appearance
+    WorkSet jWorkSet(junctions.size());
+    WorkSet bWorkSet(blocks.size());
 
     // Be sure to visit every junction at least once.
     // This avoids missing some vars because we disconnected them
@@ -3171,14 +3299,10 @@ void registerizeHarder(Ref ast) {
       // Iterate on just the junctions until we get stable live sets.
       // The first run of this loop will grow the live sets to their maximal size.
       // Subsequent runs will shrink them based on eliminated in-block uses.
-      while (jWorkSet.size() > 0) {
-        auto last = jWorkSet.end();
-        --last;
-        Junction& junc = junctions[*last];
-        jWorkSet.erase(last);
-        IOrderedStringSet oldLive = junc.live; // copy it here, to check for changes later
-        analyzeJunction(junc);
-        if (oldLive != junc.live) {
+      int j;
+      while ((j = jWorkSet.popLargest()) >= 0) {
+        Junction& junc = junctions[j];
+        if (analyzeJunction(junc)) {
           // Live set changed, updated predecessor blocks and junctions.
           for (auto b : junc.inblocks) {
             bWorkSet.insert(b);
@@ -3187,31 +3311,26 @@ void registerizeHarder(Ref ast) {
         }
       }
       // Now update the blocks based on the calculated live sets.
-      while (bWorkSet.size() > 0) {
-        auto last = bWorkSet.end();
-        --last;
-        Block* block = blocks[*last];
-        bWorkSet.erase(last);
-        auto oldUse = block->use;
+      int b;
+      while ((b = bWorkSet.popLargest()) >= 0) {
+        Block* block = blocks[b];
+        auto oldUse = block->useNums;
         analyzeBlock(block);
-        if (oldUse != block->use) {
+        if (oldUse != block->useNums) {
           // The use set changed, re-process the entry junction.
           jWorkSet.insert(block->entry);
         }
       }
-    } while (jWorkSet.size() > 0);
+    } while (!jWorkSet.empty());
 
-#ifdef PROFILING
-    tbackflow += clock() - start;
-    start = clock();
-#endif
+    timer.phase("backFlow");
 
     // Insist that all function parameters are alive at function entry.
     // This ensures they will be assigned independent registers, even
     // if they happen to be unused.
 
     for (auto name : asmData.params) {
-      junctions[ENTRY_JUNCTION].live.insert(name);
+      junctions[ENTRY_JUNCTION].live.insert(localNum(name));
     }
 
     // For variables that are live at one or more junctions, we assign them
@@ -3228,61 +3347,50 @@ void registerizeHarder(Ref ast) {
       bool used;
       JuncVar() : reg(-1), used(false) {}
     };
-    size_t numLocals = asmData.locals.size();
-    std::unordered_map<IString, size_t> nameToNum;
-    std::vector<IString> numToName;
-    nameToNum.reserve(numLocals);
-    numToName.reserve(numLocals);
-    for (auto kv : asmData.locals) {
-      nameToNum[kv.first] = numToName.size();
-      numToName.push_back(kv.first);
-    }
-
     std::vector<JuncVar> juncVars(numLocals);
     for (Junction& junc : junctions) {
-      for (IString name : junc.live) {
-        JuncVar& jVar = juncVars[nameToNum[name]];
+      junc.live.forEach([&](size_t num) {
+        JuncVar& jVar = juncVars[num];
         jVar.used = true;
         jVar.conf.assign(numLocals, false);
-      }
+      });
     }
-    std::map<IString, std::vector<Block*>> possibleBlockConflictsMap;
-    std::vector<std::pair<size_t, std::vector<Block*>>> possibleBlockConflicts;
+    // Successor blocks where each variable is live at exit, for the current
+    // junction; only the entries of possibleConflictNums are non-empty
+    std::vector<std::vector<Block*>> possibleBlockConflicts(numLocals);
+    std::vector<size_t> possibleConflictNums;
     std::unordered_map<IString, std::vector<Block*>> possibleBlockLinks;
-    possibleBlockConflicts.reserve(numLocals);
     possibleBlockLinks.reserve(numLocals);
+    std::vector<size_t> liveJVarNums;
 
     for (Junction& junc : junctions) {
       // Pre-compute the possible conflicts and links for each block rather
       // than checking potentially impossible options for each var
-      possibleBlockConflictsMap.clear();
-      possibleBlockConflicts.clear();
+      for (size_t num : possibleConflictNums) {
+        possibleBlockConflicts[num].clear();
+      }
+      possibleConflictNums.clear();
       possibleBlockLinks.clear();
       for (auto b : junc.outblocks) {
         Block* block = blocks[b];
         Junction& jSucc = junctions[block->exit];
-        for (auto name : jSucc.live) {
-          possibleBlockConflictsMap[name].push_back(block);
-        }
+        jSucc.live.forEach([&](size_t num) {
+          // The variables live here are marked as conflicting below anyhow
+          if (junc.live.has(num)) return;
+          if (possibleBlockConflicts[num].empty()) possibleConflictNums.push_back(num);
+          possibleBlockConflicts[num].push_back(block);
+        });
         for (auto name_linkname : block->link) {
           if (name_linkname.first != name_linkname.second) {
             possibleBlockLinks[name_linkname.first].push_back(block);
           }
         }
       }
-      // Find the live variables in this block, mark them as unnecessary to
-      // check for conflicts (we mark all live vars as conflicting later)
-      std::vector<size_t> liveJVarNums;
-      liveJVarNums.reserve(junc.live.size());
-      for (auto name : junc.live) {
-        size_t jVarNum = nameToNum[name];
-        liveJVarNums.push_back(jVarNum);
-        possibleBlockConflictsMap.erase(name);
-      }
-      // Extract just the variables we might want to check for conflicts
-      for (auto kv : possibleBlockConflictsMap) {
-        possibleBlockConflicts.push_back(std::make_pair(nameToNum[kv.first], kv.second));
-      }
+      std::sort(possibleConflictNums.begin(), possibleConflictNums.end());
+      liveJVarNums.clear();
+      junc.live.forEach([&](size_t num) {
+        liveJVarNums.push_back(num);
+      });
 
       for (size_t jVarNum : liveJVarNums) {
         JuncVar& jvar = juncVars[jVarNum];
@@ -3295,10 +3403,9 @@ void registerizeHarder(Ref ast) {
 
         // It conflicts with any output vars of successor blocks,
         // if they're assigned before it goes dead in that block.
-        for (auto jvarnum_blocks : possibleBlockConflicts) {
-          size_t otherJVarNum = jvarnum_blocks.first;
+        for (size_t otherJVarNum : possibleConflictNums) {
           IString otherName = numToName[otherJVarNum];
-          for (auto block : jvarnum_blocks.second) {
+          for (auto block : possibleBlockConflicts[otherJVarNum]) {
             if (block->lastKillLoc[otherName] < block->firstDeadLoc[name]) {
               jvar.conf[otherJVarNum] = true;
               juncVars[otherJVarNum].conf[jVarNum] = true;
@@ -3316,10 +3423,7 @@ void registerizeHarder(Ref ast) {
       }
     }
 
-#ifdef PROFILING
-    tjuncvaruniqassign += clock() - start;
-    start = clock();
-#endif
+    timer.phase("juncVarUniqAssign");
 
     // Attempt to sort the junction variables to heuristically reduce conflicts.
     // Simple starting point: handle the most-conflicted variables first.
@@ -3341,10 +3445,7 @@ void registerizeHarder(Ref ast) {
       return false;
     });
 
-#ifdef PROFILING
-    tjuncvarsort += clock() - start;
-    start = clock();
-#endif
+    timer.phase("juncVarSort");
 
     // We can now assign a register to each junction variable.
     // Process them in order, trying available registers until we find
@@ -3396,10 +3497,7 @@ void registerizeHarder(Ref ast) {
       tryAssignRegister(name, createReg(name));
     }
 
-#ifdef PROFILING
-    tregassign += clock() - start;
-    start = clock();
-#endif
+    timer.phase("regAssign");
 
     // Each basic block can now be processed in turn.
     // There may be internal-use-only variables that still need a register
@@ -3418,15 +3516,16 @@ void registerizeHarder(Ref ast) {
       StringSet inputVars;
       std::unordered_map<int, int> inputDeadLoc;
       std::unordered_map<int, IString> inputVarsByReg;
-      for (auto name : jExit.live) {
+      jExit.live.forEach([&](size_t num) {
+        IString name = numToName[num];
         if (!block->kill.has(name)) {
           inputVars.insert(name);
-          int reg = juncVars[nameToNum[name]].reg;
+          int reg = juncVars[num].reg;
           assert(reg > 0); // 'input variable doesnt have a register');
           inputDeadLoc[reg] = block->firstDeadLoc[name];
           inputVarsByReg[reg] = name;
         }
-      }
+      });
       for (auto pair : block->use) {
         IString name = pair.first;
         if (!inputVars.has(name)) {
@@ -3445,12 +3544,13 @@ void registerizeHarder(Ref ast) {
       StringIntMap assignedRegs;
       auto freeRegsByTypePre = allRegsByType; // XXX copy
       // Begin with all live vars assigned per the exit junction.
-      for (auto name : jExit.live) {
-        int reg = juncVars[nameToNum[name]].reg;
+      jExit.live.forEach([&](size_t num) {
+        IString name = numToName[num];
+        int reg = juncVars[num].reg;
         assert(reg > 0); // 'output variable doesnt have a register');
         assignedRegs[name] = reg;
         freeRegsByTypePre[asmData.getType(name)].erase(reg); // XXX assert?
-      }
+      });
       std::vector<std::vector<int>> freeRegsByType;
       freeRegsByType.resize(freeRegsByTypePre.size());
       for (size_t j = 0; j < freeRegsByTypePre.size(); j++) {
@@ -3531,10 +3631,7 @@ void registerizeHarder(Ref ast) {
       }
     }
 
-#ifdef PROFILING
-    tblockproc += clock() - start;
-    start = clock();
-#endif
+    timer.phase("blockProc");
 
     // Assign registers to function params based on entry junction
 
@@ -3570,16 +3667,9 @@ void registerizeHarder(Ref ast) {
 
     removeAllUselessSubNodes(fun); // XXX vacuum?    vacuum(fun);
 
-#ifdef PROFILING
-    treconstruct += clock() - start;
-    start = clock();
-#endif
+    timer.phase("reconstruct");
 
   });
-#ifdef PROFILING
-  errv("    RH stages: a:%li fl:%li lf:%li bf:%li jvua:%li jvs:%li jra:%li bp:%li r:%li",
-    tasmdata, tflowgraph, tlabelfix, tbackflow, tjuncvaruniqassign, tjuncvarsort, tregassign, tblockproc, treconstruct);
-#endif
 }
 // end registerizeHarder
 
@@ -3591,10 +3681,14 @@ const char *VALID_MIN_LATERS = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUV
 StringVec minifiedNames;
 std::vector<int> minifiedState;
 
-void ensureMinifiedNames(int n) { // make sure the nth index in minifiedNames exists. done 100% deterministically
+std::mutex minifiedNamesMutex;
+
+IString getMinifiedName(int n) { // returns the nth minified name, generating it if needed. done 100% deterministically
   static int VALID_MIN_INITS_LEN = strlen(VALID_MIN_INITS);
   static int VALID_MIN_LATERS_LEN = strlen(VALID_MIN_LATERS);
 
+  std::lock_guard<std::mutex> lock(minifiedNamesMutex);
+
   while ((int)minifiedNames.size() < n+1) {
     // generate the current name
     std::string name;
@@ -3615,17 +3709,23 @@ void ensureMinifiedNames(int n) { // make sure the nth index in minifiedNames ex
       if (i == minifiedState.size()) minifiedState.push_back(-1); // will become 0 after increment in next loop head
     }
   }
+  return minifiedNames[n];
 }
 
 void minifyLocals(Ref ast) {
   assert(!!extraInfo);
   IString GLOBALS("globals");
   assert(extraInfo->has(GLOBALS));
-  Ref globals = extraInfo[GLOBALS];
+  // Read the global names into a map of our own before the threads start, as
+  // Value::operator[] may insert, and the threads only need to find()
+  std::unordered_map<IString, IString> globals;
+  for (auto& kv : *extraInfo[GLOBALS]->obj) {
+    globals[kv.first] = kv.second->getIString();
+  }
 
   if (minifiedState.size() == 0) minifiedState.push_back(0);
 
-  traverseFunctions(ast, [&globals](Ref fun) {
+  traverseFunctionsInParallel(ast, [&globals](Ref fun) {
     // Analyse the asmjs to figure out local variable names,
     // but operate on the original source tree so that we don't
     // miss any global names in e.g. variable initializers.
@@ -3642,8 +3742,9 @@ void minifyLocals(Ref ast) {
       if (node[0] == NAME) {
         IString name = node[1]->getIString();
         if (!asmData.isLocal(name)) {
-          if (globals->has(name)) {
-            IString minified = globals[name]->getIString();
+          auto global = globals.find(name);
+          if (global != globals.end()) {
+            IString minified = global->second;
             assert(!!minified);
             newNames[name] = minified;
             usedNames.insert(minified);
@@ -3660,8 +3761,7 @@ void minifyLocals(Ref ast) {
     auto getNextMinifiedName = [&]() {
       IString minified;
       while (1) {
-        ensureMinifiedNames(nextMinifiedName);
-        minified = minifiedNames[nextMinifiedName++];
+        minified = getMinifiedName(nextMinifiedName++);
         // TODO: we can probably remove !isLocalName here
         if (!usedNames.has(minified) && !asmData.isLocal(minified)) {
           return minified;
@@ -3674,13 +3774,13 @@ void minifyLocals(Ref ast) {
     StringStringMap newLabels;
     int nextMinifiedLabel = 0;
     auto getNextMinifiedLabel = [&]() {
-      ensureMinifiedNames(nextMinifiedLabel);
-      return minifiedNames[nextMinifiedLabel++];
+      return getMinifiedName(nextMinifiedLabel++);
     };
 
     // Traverse and minify all names.
-    if (globals->has(fun[1]->getIString())) {
-      fun[1]->setString(globals[fun[1]->getIString()]->getIString());
+    auto global = globals.find(fun[1]->getIString());
+    if (global != globals.end()) {
+      fun[1]->setString(global->second);
       assert(!!fun[1]);
     }
     if (!!fun[2]) {
@@ -3727,8 +3827,8 @@ void minifyLocals(Ref ast) {
 }
 
 void asmLastOpts(Ref ast) {
-  std::vector<Ref> statsStack;
-  traverseFunctions(ast, [&](Ref fun) {
+  traverseFunctionsInParallel(ast, [&](Ref fun) {
+    std::vector<Ref> statsStack;
     traversePrePost(fun, [&](Ref node) {
       Ref type = node[0];
       Ref stats = getStatements(node);
@@ -3877,7 +3977,7 @@ void eliminateDeadFuncs(Ref ast) {
   for (size_t i = 0; i < extraInfo[DEAD_FUNCTIONS]->size(); i++) {
     deadFunctions.insert(extraInfo[DEAD_FUNCTIONS][i]->getIString());
   }
-  traverseFunctions(ast, [&](Ref fun) {
+  traverseFunctionsInParallel(ast, [&](Ref fun) {
     if (!deadFunctions.has(fun[1].get()->getIString())) {
       return;
     }
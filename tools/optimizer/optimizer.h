@@ -7,11 +7,17 @@
 extern bool preciseF32,
             receiveJSON,
             emitJSON,
+            receiveBinary,
+            emitBinary,
             minifyWhitespace,
             last;
 
+extern int numThreads;
+
 extern cashew::Ref extraInfo;
 
+void detectAsmFloatZero(cashew::Ref ast);
+
 void eliminateDeadFuncs(cashew::Ref ast);
 void eliminate(cashew::Ref ast, bool memSafe=false);
 void eliminateMemSafe(cashew::Ref ast);
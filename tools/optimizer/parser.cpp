@@ -107,6 +107,8 @@ std::vector<OperatorClass> operatorClasses;
 
 static std::vector<std::unordered_map<IString, int>> precedences; // op, type => prec
 
+unsigned char charClasses[256];
+
 struct Init {
   Init() {
     // operators, rtl, type
@@ -131,6 +133,16 @@ struct Init {
         precedences[operatorClasses[prec].type][curr] = prec;
       }
     }
+
+    for (int c = 0; c < 256; c++) {
+      unsigned char cls = 0;
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r') cls |= CHAR_SPACE;
+      if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$') cls |= CHAR_IDENT_INIT | CHAR_IDENT_PART;
+      if (c >= '0' && c <= '9') cls |= CHAR_DIGIT | CHAR_IDENT_PART;
+      if (c && strchr(OPERATOR_INITS, c)) cls |= CHAR_OPERATOR_INIT;
+      if (c && strchr(SEPARATORS, c)) cls |= CHAR_SEPARATOR;
+      charClasses[c] = cls;
+    }
   }
 };
 
@@ -144,8 +156,5 @@ bool OperatorClass::getRtl(int prec) {
   return operatorClasses[prec].rtl;
 }
 
-bool isIdentInit(char x) { return (x >= 'a' && x <= 'z') || (x >= 'A' && x <= 'Z') || x == '_' || x == '$'; }
-bool isIdentPart(char x) { return isIdentInit(x) || (x >= '0' && x <= '9'); }
-
 } // namespace cashew
 
@@ -131,19 +131,40 @@ struct OperatorClass {
 
 extern std::vector<OperatorClass> operatorClasses;
 
-extern bool isIdentInit(char x);
-extern bool isIdentPart(char x);
+// Character classes, for the tokenizer to look up instead of comparing
+enum CharClass {
+  CHAR_SPACE = 1, // space, tab, linefeed/newline, or return
+  CHAR_IDENT_INIT = 2,
+  CHAR_IDENT_PART = 4,
+  CHAR_DIGIT = 8,
+  CHAR_OPERATOR_INIT = 16,
+  CHAR_SEPARATOR = 32
+};
+
+extern unsigned char charClasses[256];
+
+inline bool hasCharClass(char x, int cls) { return (charClasses[(unsigned char)x] & cls) != 0; }
+
+inline bool isIdentInit(char x) { return hasCharClass(x, CHAR_IDENT_INIT); }
+inline bool isIdentPart(char x) { return hasCharClass(x, CHAR_IDENT_PART); }
+
+// Returns the first character from curr on that is not in the class. The input
+// is null-terminated, and null is in no class.
+inline char* skipCharClass(char* curr, int cls) {
+  while (hasCharClass(*curr, cls)) curr++;
+  return curr;
+}
 
 // parser
 
 template<class NodeRef, class Builder>
 class Parser {
 
-  static bool isSpace(char x) { return x == 32 || x == 9 || x == 10 || x == 13; } /* space, tab, linefeed/newline, or return */
+  static bool isSpace(char x) { return hasCharClass(x, CHAR_SPACE); }
   static void skipSpace(char*& curr) {
     while (*curr) {
       if (isSpace(*curr)) {
-        curr++;
+        curr = skipCharClass(curr + 1, CHAR_SPACE);
         continue;
       }
       if (curr[0] == '/' && curr[1] == '/') {
@@ -162,7 +183,7 @@ class Parser {
     }
   }
 
-  static bool isDigit(char x) { return x >= '0' && x <= '9'; }
+  static bool isDigit(char x) { return hasCharClass(x, CHAR_DIGIT); }
 
   static bool hasChar(const char* list, char x) { while (*list) if (*list++ == x) return true; return false; }
 
@@ -201,10 +222,7 @@ class Parser {
       char *start = src;
       if (isIdentInit(*src)) {
         // read an identifier or a keyword
-        src++;
-        while (isIdentPart(*src)) {
-          src++;
-        }
+        src = skipCharClass(src + 1, CHAR_IDENT_PART);
         if (*src == 0) {
           str.set(start);
         } else {
@@ -213,7 +231,9 @@ class Parser {
           str.set(start, false);
           *src = temp;
         }
-        type = keywords.has(str) ? KEYWORD : IDENT;
+        // keywords start with a lowercase letter, which lets most asm.js
+        // identifiers ($x, _f, HEAP32) skip the lookup
+        type = (*start >= 'a' && *start <= 'z' && keywords.has(str)) ? KEYWORD : IDENT;
       } else if (isDigit(*src) || (src[0] == '.' && isDigit(src[1]))) {
         if (src[0] == '0' && (src[1] == 'x' || src[1] == 'X')) {
           // Explicitly parse hex numbers of form "0x...", because strtod
@@ -229,7 +249,19 @@ class Parser {
             src++;
           }
         } else {
-          num = strtod(start, &src);
+          // Most numbers are small integers, which we can read much faster
+          // than strtod can. Up to 15 digits they are exact as a double.
+          uint64_t value = 0;
+          char *digits = src;
+          while (isDigit(*src) && src - digits < 15) {
+            value = value * 10 + (*src - '0');
+            src++;
+          }
+          if (src > digits && !isDigit(*src) && *src != '.' && *src != 'e' && *src != 'E') {
+            num = (double)value;
+          } else {
+            num = strtod(start, &src);
+          }
         }
         // asm.js must have a '.' for double values. however, we also tolerate
         // uglify's tendency to emit without a '.' (and fix it later with a +).
@@ -238,7 +270,7 @@ class Parser {
         // is quite the same at this point anyhow
         type = (std::find(start, src, '.') == src && is32Bit(num)) ? INT : DOUBLE;
         assert(src > start);
-      } else if (hasChar(OPERATOR_INITS, *src)) {
+      } else if (hasCharClass(*src, CHAR_OPERATOR_INIT)) {
         switch (*src) {
           case '!': str = src[1] == '=' ? NE : L_NOT; break;
           case '%': str = MOD; break;
@@ -268,7 +300,7 @@ class Parser {
 #endif
         type = OPERATOR;
         return;
-      } else if (hasChar(SEPARATORS, *src)) {
+      } else if (hasCharClass(*src, CHAR_SEPARATOR)) {
         type = SEPARATOR;
         char temp = src[1];
         src[1] = 0;
@@ -3,6 +3,9 @@
 // University of Illinois/NCSA Open Source License.  Both these licenses can be
 // found in the LICENSE file.
 
+#include <atomic>
+#include <thread>
+
 #include "simple_ast.h"
 
 namespace cashew {
@@ -43,11 +46,14 @@ bool Ref::operator!() {
 
 // Arena
 
-Arena arena;
+thread_local Arena arena;
+
+std::atomic<size_t> Arena::totalBytes(0);
 
 Ref Arena::alloc() {
   if (chunks.size() == 0 || index == CHUNK_SIZE) {
     chunks.push_back(new Value[CHUNK_SIZE]);
+    totalBytes += CHUNK_SIZE * sizeof(Value);
     index = 0;
   }
   return &chunks.back()[index++];
@@ -56,11 +62,68 @@ Ref Arena::alloc() {
 ArrayStorage* Arena::allocArray() {
   if (arr_chunks.size() == 0 || arr_index == CHUNK_SIZE) {
     arr_chunks.push_back(new ArrayStorage[CHUNK_SIZE]);
+    totalBytes += CHUNK_SIZE * sizeof(ArrayStorage);
     arr_index = 0;
   }
   return &arr_chunks.back()[arr_index++];
 }
 
+// Capacities up to 8 are exact, larger ones are powers of 2
+static int elemsClass(uint32_t& capacity) {
+  if (capacity <= 8) return capacity - 1;
+  int log = 4;
+  while ((1u << log) < capacity) log++;
+  capacity = 1u << log;
+  return 8 + log - 4;
+}
+
+Ref* Arena::allocElems(uint32_t& capacity) {
+  int c = elemsClass(capacity);
+  assert(c < NUM_ELEMS_CLASSES);
+  if (free_elems[c]) {
+    // the first element of a free buffer links to the next one
+    Ref* ret = free_elems[c];
+    free_elems[c] = (Ref*)ret[0].inst;
+    return ret;
+  }
+  if (capacity > ELEMS_CHUNK_SIZE / 8) {
+    totalBytes += capacity * sizeof(Ref);
+    return new Ref[capacity];
+  }
+  if (elems_index + capacity > ELEMS_CHUNK_SIZE) {
+    elems_chunks.push_back(new Ref[ELEMS_CHUNK_SIZE]);
+    totalBytes += ELEMS_CHUNK_SIZE * sizeof(Ref);
+    elems_index = 0;
+  }
+  Ref* ret = elems_chunks.back() + elems_index;
+  elems_index += capacity;
+  return ret;
+}
+
+void Arena::freeElems(Ref* elems, uint32_t capacity) {
+  int c = elemsClass(capacity);
+  elems[0].inst = (Value*)free_elems[c];
+  free_elems[c] = elems;
+}
+
+// ArrayStorage methods
+
+void ArrayStorage::grow(size_t size, bool exact) {
+  uint32_t capacity = exact ? size : std::max(size, std::max(size_t(4), size_t(allocated) * 2));
+  Ref* bigger = arena.allocElems(capacity);
+  std::copy(elems, elems + used, bigger);
+  if (allocated) arena.freeElems(elems, allocated);
+  elems = bigger;
+  allocated = capacity;
+}
+
+void ArrayStorage::shrink_to_fit() {
+  if (used > 0 || allocated == 0) return;
+  arena.freeElems(elems, allocated);
+  elems = nullptr;
+  allocated = 0;
+}
+
 // dump
 
 void dump(const char *str, Ref node, bool pretty) {
@@ -70,6 +133,209 @@ void dump(const char *str, Ref node, bool pretty) {
   std::cerr << std::endl;
 }
 
+// Binary AST format
+
+static const char BINARY_MAGIC[4] = { 'C', 'A', 'S', 'T' };
+static const uint8_t BINARY_VERSION = 1;
+
+struct BinaryWriter {
+  std::ostream &os;
+  std::unordered_map<const char*, uint32_t> indexes; // interned, so pointers are unique
+  std::vector<const char*> strings;
+
+  BinaryWriter(std::ostream &os) : os(os) {}
+
+  void noteString(const IString &str) {
+    if (indexes.count(str.str)) return;
+    indexes[str.str] = strings.size();
+    strings.push_back(str.str);
+  }
+
+  void noteStrings(Ref node) {
+    switch (node->type) {
+      case Value::String: noteString(node->getIString()); break;
+      case Value::Array: {
+        for (auto child : node->getArray()) noteStrings(child);
+        break;
+      }
+      case Value::Object: {
+        for (auto i : *node->obj) {
+          noteString(i.first);
+          noteStrings(i.second);
+        }
+        break;
+      }
+      default: break;
+    }
+  }
+
+  template<typename T>
+  void write(T value) {
+    os.write((const char*)&value, sizeof(T));
+  }
+
+  void writeU32LEB(uint32_t value) {
+    do {
+      uint8_t byte = value & 127;
+      value >>= 7;
+      if (value) byte |= 128;
+      write(byte);
+    } while (value);
+  }
+
+  void writeStrings() {
+    writeU32LEB(strings.size());
+    for (auto str : strings) {
+      uint32_t len = strlen(str);
+      writeU32LEB(len);
+      os.write(str, len + 1);
+    }
+  }
+
+  void writeTree(Ref node) {
+    write<uint8_t>(node->type);
+    switch (node->type) {
+      case Value::String: writeU32LEB(indexes[node->getCString()]); break;
+      case Value::Number: write(node->getNumber()); break;
+      case Value::Array: {
+        writeU32LEB(node->size());
+        for (auto child : node->getArray()) writeTree(child);
+        break;
+      }
+      case Value::Null: break;
+      case Value::Bool: write<uint8_t>(node->getBool()); break;
+      case Value::Object: {
+        writeU32LEB(node->obj->size());
+        for (auto i : *node->obj) {
+          writeU32LEB(indexes[i.first.str]);
+          writeTree(i.second);
+        }
+        break;
+      }
+    }
+  }
+};
+
+void writeBinary(std::ostream &os, Ref doc, Ref extra) {
+  BinaryWriter writer(os);
+  writer.noteStrings(doc);
+  if (!!extra) writer.noteStrings(extra);
+  os.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+  writer.write<uint8_t>(BINARY_VERSION);
+  writer.write<uint8_t>(!!extra);
+  writer.write<uint16_t>(0);
+  writer.writeStrings();
+  writer.writeTree(doc);
+  if (!!extra) writer.writeTree(extra);
+}
+
+// Binary input comes from files that may be truncated or corrupt, so unlike
+// the rest of the optimizer, the reader checks its input even with NDEBUG
+static void binaryError(const char *what) {
+  fprintf(stderr, "invalid binary AST: %s\n", what);
+  exit(1);
+}
+
+struct BinaryReader {
+  const char *curr, *end;
+  std::vector<IString> strings;
+
+  BinaryReader(const char *data, size_t size) : curr(data), end(data + size) {}
+
+  size_t remaining() { return end - curr; }
+
+  template<typename T>
+  T read() {
+    if (remaining() < sizeof(T)) binaryError("unexpected end of input");
+    T value;
+    memcpy(&value, curr, sizeof(T)); // may be unaligned
+    curr += sizeof(T);
+    return value;
+  }
+
+  uint32_t readU32LEB() {
+    uint32_t value = 0;
+    int shift = 0;
+    while (1) {
+      uint8_t byte = read<uint8_t>();
+      value |= uint32_t(byte & 127) << shift;
+      if (!(byte & 128)) return value;
+      shift += 7;
+      if (shift >= 35) binaryError("LEB number too long");
+    }
+  }
+
+  void readStrings() {
+    uint32_t num = readU32LEB();
+    if (num > remaining()) binaryError("too many strings"); // each takes at least a byte
+    strings.reserve(num);
+    for (uint32_t i = 0; i < num; i++) {
+      uint32_t len = readU32LEB();
+      if (len >= remaining() || curr[len] != 0) binaryError("bad string");
+      strings.push_back(IString(curr));
+      curr += len + 1;
+    }
+  }
+
+  IString& readString() {
+    uint32_t index = readU32LEB();
+    if (index >= strings.size()) binaryError("bad string index");
+    return strings[index];
+  }
+
+  Ref readTree() {
+    Ref node = arena.alloc();
+    switch (read<uint8_t>()) {
+      case Value::String: node->setString(readString()); break;
+      case Value::Number: node->setNumber(read<double>()); break;
+      case Value::Array: {
+        uint32_t size = readU32LEB();
+        if (size > remaining()) binaryError("bad array size"); // each element takes at least a byte
+        node->setArray(size);
+        for (uint32_t i = 0; i < size; i++) node->push_back(readTree());
+        break;
+      }
+      case Value::Null: break;
+      case Value::Bool: node->setBool(read<uint8_t>() != 0); break;
+      case Value::Object: {
+        uint32_t size = readU32LEB();
+        if (size > remaining()) binaryError("bad object size");
+        node->setObject();
+        for (uint32_t i = 0; i < size; i++) {
+          IString key = readString();
+          (*node)[key] = readTree();
+        }
+        break;
+      }
+      default: binaryError("bad node type");
+    }
+    return node;
+  }
+};
+
+bool isBinary(const char *data, size_t size) {
+  return size >= sizeof(BINARY_MAGIC) && memcmp(data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+}
+
+Ref readBinary(const char *data, size_t size, Ref *extra) {
+  if (!isBinary(data, size)) binaryError("bad magic number");
+  BinaryReader reader(data + sizeof(BINARY_MAGIC), size - sizeof(BINARY_MAGIC));
+  uint8_t version = reader.read<uint8_t>();
+  if (version != BINARY_VERSION) {
+    fprintf(stderr, "unsupported binary AST version %d\n", version);
+    exit(1);
+  }
+  bool hasExtra = reader.read<uint8_t>() != 0;
+  reader.read<uint16_t>();
+  reader.readStrings();
+  Ref doc = reader.readTree();
+  if (hasExtra) {
+    Ref extraTree = reader.readTree();
+    if (extra) *extra = extraTree;
+  }
+  return doc;
+}
+
 // AST traversals
 
 // Traversals
@@ -133,10 +399,13 @@ struct StackedStack { // a stack, on the stack
 
 #define TRAV_STACK 40
 
+thread_local size_t traversedNodes = 0;
+
 // Traverse, calling visit before the children
 void traversePre(Ref node, std::function<void (Ref)> visit) {
   if (!visitable(node)) return;
   visit(node);
+  size_t visited = 1;
   StackedStack<TraverseInfo, TRAV_STACK> stack;
   int index = 0;
   ArrayStorage* arr = &node->getArray();
@@ -151,6 +420,7 @@ void traversePre(Ref node, std::function<void (Ref)> visit) {
         stack.back().index = index;
         index = 0;
         visit(sub);
+        visited++;
         arr = &sub->getArray();
         arrsize = (int)arr->size();
         arrdata = arr->data();
@@ -158,7 +428,10 @@ void traversePre(Ref node, std::function<void (Ref)> visit) {
       }
     } else {
       stack.pop_back();
-      if (stack.size() == 0) break;
+      if (stack.size() == 0) {
+        traversedNodes += visited;
+        break;
+      }
       TraverseInfo& back = stack.back();
       index = back.index;
       arr = back.arr;
@@ -172,6 +445,7 @@ void traversePre(Ref node, std::function<void (Ref)> visit) {
 void traversePrePost(Ref node, std::function<void (Ref)> visitPre, std::function<void (Ref)> visitPost) {
   if (!visitable(node)) return;
   visitPre(node);
+  size_t visited = 1;
   StackedStack<TraverseInfo, TRAV_STACK> stack;
   int index = 0;
   ArrayStorage* arr = &node->getArray();
@@ -186,6 +460,7 @@ void traversePrePost(Ref node, std::function<void (Ref)> visitPre, std::function
         stack.back().index = index;
         index = 0;
         visitPre(sub);
+        visited++;
         arr = &sub->getArray();
         arrsize = (int)arr->size();
         arrdata = arr->data();
@@ -194,7 +469,10 @@ void traversePrePost(Ref node, std::function<void (Ref)> visitPre, std::function
     } else {
       visitPost(stack.back().node);
       stack.pop_back();
-      if (stack.size() == 0) break;
+      if (stack.size() == 0) {
+        traversedNodes += visited;
+        break;
+      }
       TraverseInfo& back = stack.back();
       index = back.index;
       arr = back.arr;
@@ -207,7 +485,11 @@ void traversePrePost(Ref node, std::function<void (Ref)> visitPre, std::function
 // Traverse, calling visitPre before the children and visitPost after. If pre returns false, do not traverse children
 void traversePrePostConditional(Ref node, std::function<bool (Ref)> visitPre, std::function<void (Ref)> visitPost) {
   if (!visitable(node)) return;
-  if (!visitPre(node)) return;
+  size_t visited = 1;
+  if (!visitPre(node)) {
+    traversedNodes += visited;
+    return;
+  }
   StackedStack<TraverseInfo, TRAV_STACK> stack;
   int index = 0;
   ArrayStorage* arr = &node->getArray();
@@ -219,6 +501,7 @@ void traversePrePostConditional(Ref node, std::function<bool (Ref)> visitPre, st
       Ref sub = *(arrdata+index);
       index++;
       if (visitable(sub)) {
+        visited++;
         if (visitPre(sub)) {
           stack.back().index = index;
           index = 0;
@@ -231,7 +514,10 @@ void traversePrePostConditional(Ref node, std::function<bool (Ref)> visitPre, st
     } else {
       visitPost(stack.back().node);
       stack.pop_back();
-      if (stack.size() == 0) break;
+      if (stack.size() == 0) {
+        traversedNodes += visited;
+        break;
+      }
       TraverseInfo& back = stack.back();
       index = back.index;
       arr = back.arr;
@@ -255,6 +541,33 @@ void traverseFunctions(Ref ast, std::function<void (Ref)> visit) {
   }
 }
 
+void traverseFunctionsParallel(Ref ast, int numThreads, std::function<void (Ref)> visit) {
+  std::vector<Ref> funcs;
+  traverseFunctions(ast, [&funcs](Ref func) {
+    funcs.push_back(func);
+  });
+  numThreads = std::min(numThreads, (int)funcs.size());
+  if (numThreads <= 1) {
+    for (auto func : funcs) visit(func);
+    return;
+  }
+  // functions vary a lot in size, so hand them out one at a time
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    while (1) {
+      size_t i = next++;
+      if (i >= funcs.size()) break;
+      visit(funcs[i]);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < numThreads; i++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto& worker : workers) worker.join();
+}
+
 // ValueBuilder
 
 IStringSet ValueBuilder::statable("assign call binary unary-prefix if name num conditional dot new sub seq string object array");
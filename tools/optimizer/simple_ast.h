@@ -14,6 +14,7 @@
 #include <iomanip>
 #include <functional>
 #include <algorithm>
+#include <atomic>
 #include <set>
 #include <unordered_set>
 #include <unordered_map>
@@ -56,9 +57,97 @@ struct Ref {
   bool operator!(); // check if null, in effect
 };
 
-// Arena allocation, free it all on process exit
+// The children of an array node. This is the subset of std::vector<Ref> that
+// the AST uses, but the elements are allocated from the arena, contiguously
+// with those of the nodes created around the same time, rather than getting a
+// heap allocation each. Most nodes have a small, fixed number of children and
+// are created with a size hint, and up to 8 elements capacity is exact, so a
+// typical node costs 8 bytes per child and nothing else.
 
-typedef std::vector<Ref> ArrayStorage;
+struct ArrayStorage {
+  typedef Ref* iterator;
+
+  Ref* elems;
+  uint32_t used, allocated;
+
+  ArrayStorage() : elems(nullptr), used(0), allocated(0) {}
+  ArrayStorage(const ArrayStorage& other) : elems(nullptr), used(0), allocated(0) {
+    *this = other;
+  }
+  ~ArrayStorage() {
+    clear();
+    shrink_to_fit();
+  }
+
+  ArrayStorage& operator=(const ArrayStorage& other) {
+    if (this == &other) return *this;
+    clear();
+    reserve(other.used);
+    std::copy(other.elems, other.elems + other.used, elems);
+    used = other.used;
+    return *this;
+  }
+
+  size_t size() const { return used; }
+  bool empty() const { return used == 0; }
+
+  Ref* data() { return elems; }
+  iterator begin() { return elems; }
+  iterator end() { return elems + used; }
+
+  Ref& operator[](size_t i) { return elems[i]; }
+  Ref& at(size_t i) {
+    assert(i < used);
+    return elems[i];
+  }
+  Ref& back() {
+    assert(used > 0);
+    return elems[used - 1];
+  }
+
+  void reserve(size_t size) {
+    if (size > allocated) grow(size, true);
+  }
+  void resize(size_t size) {
+    reserve(size);
+    for (size_t i = used; i < size; i++) elems[i] = Ref();
+    used = size;
+  }
+  void clear() { used = 0; }
+  // Gives the elements back to the arena, if the array is empty
+  void shrink_to_fit();
+
+  void push_back(Ref r) {
+    if (used == allocated) grow(used + 1, false);
+    elems[used++] = r;
+  }
+  void pop_back() {
+    assert(used > 0);
+    used--;
+  }
+
+  void insert(iterator pos, size_t num, Ref r) {
+    size_t index = pos - elems;
+    assert(index <= used);
+    reserve(used + num);
+    std::copy_backward(elems + index, elems + used, elems + used + num);
+    std::fill(elems + index, elems + index + num, r);
+    used += num;
+  }
+  void erase(iterator first, iterator last) {
+    assert(elems <= first && first <= last && last <= elems + used);
+    std::copy(last, elems + used, first);
+    used -= last - first;
+  }
+
+private:
+  // Reallocates to hold at least size elements, or exactly that many if they
+  // are known up front
+  void grow(size_t size, bool exact);
+};
+
+// Arena allocation, free it all on process exit. Each thread allocates from
+// its own arena; chunks are never freed, so nodes outlive their thread.
 
 struct Arena {
   #define CHUNK_SIZE 1000
@@ -68,13 +157,30 @@ struct Arena {
   std::vector<ArrayStorage*> arr_chunks;
   int arr_index;
 
-  Arena() : index(0), arr_index(0) {}
+  // Elements of ArrayStorages. Elements that an array gives back when it
+  // grows or is freed go on a free list for their size class, which may be
+  // that of another thread's arena than the one they came from.
+  #define ELEMS_CHUNK_SIZE (64 * 1024)
+  #define NUM_ELEMS_CLASSES 40
+  std::vector<Ref*> elems_chunks;
+  size_t elems_index;
+  Ref* free_elems[NUM_ELEMS_CLASSES];
+
+  Arena() : index(0), arr_index(0), elems_index(ELEMS_CHUNK_SIZE) {
+    std::fill(free_elems, free_elems + NUM_ELEMS_CLASSES, nullptr);
+  }
 
   Ref alloc();
   ArrayStorage* allocArray();
+  // Allocates at least capacity elements, and updates capacity to how many
+  Ref* allocElems(uint32_t& capacity);
+  void freeElems(Ref* elems, uint32_t capacity);
+
+  // Bytes of chunks allocated so far by the arenas of all threads
+  static std::atomic<size_t> totalBytes;
 };
 
-extern Arena arena;
+extern thread_local Arena arena;
 
 // Main value type
 struct Value {
@@ -539,8 +645,30 @@ struct Value {
   }
 };
 
+// Binary AST format, for handing ASTs between processes without tokenizing
+// text again. Layout (native endianness, no padding, so a file can be read
+// straight from a read-only mapping):
+//
+//   "CAST" u8 version u8 hasExtra u16 unused
+//   numStrings, then each string as its length, bytes and a terminating 0
+//   the document tree, then the extra info tree if hasExtra
+//
+// A tree is a u8 Value::Type followed by: String: string index; Number: raw
+// double; Array: size and that many trees; Bool: u8; Object: size and that
+// many (key string index, tree) pairs; Null: nothing. Sizes, lengths and
+// indexes are unsigned LEB128.
+//
+// Strings are interned in place, so the buffer given to readBinary must stay
+// alive as long as the AST does (like the text given to Value::parse).
+void writeBinary(std::ostream &os, Ref doc, Ref extra=nullptr);
+Ref readBinary(const char *data, size_t size, Ref *extra=nullptr);
+bool isBinary(const char *data, size_t size);
+
 // AST traversals
 
+// Number of nodes the traversals have visited on this thread, for profiling
+extern thread_local size_t traversedNodes;
+
 // Traverse, calling visit before the children
 void traversePre(Ref node, std::function<void (Ref)> visit);
 
@@ -553,6 +681,11 @@ void traversePrePostConditional(Ref node, std::function<bool (Ref)> visitPre, st
 // Traverses all the top-level functions in the document
 void traverseFunctions(Ref ast, std::function<void (Ref)> visit);
 
+// Traverses all the top-level functions in the document, visiting up to
+// numThreads of them concurrently. visit must only touch the function it is
+// given (plus read-only or locked global state).
+void traverseFunctionsParallel(Ref ast, int numThreads, std::function<void (Ref)> visit);
+
 // JS printer
 
 struct JSPrinter {
@@ -922,8 +922,9 @@ class libmalloc(MTLibrary, NoBCLibrary):
 
     super(libmalloc, self).__init__(**kwargs)
 
-    if self.malloc != 'dlmalloc':
+    if self.malloc == 'none':
       assert not self.is_mt
+    if self.malloc != 'dlmalloc':
       assert not self.is_tracing
 
   def get_files(self):
@@ -982,7 +983,7 @@ class libmalloc(MTLibrary, NoBCLibrary):
     combos = super(libmalloc, cls).variations()
     return ([dict(malloc='dlmalloc', **combo) for combo in combos] +
             [dict(malloc='emmalloc', **combo) for combo in combos
-             if not combo['is_mt'] and not combo['is_tracing']])
+             if not combo['is_tracing']])
 
 
 class libal(Library):
@@ -1310,7 +1311,7 @@ class libstandalonewasm(MuslInternalLibrary):
     return shared.Settings.WASM_BACKEND
 
 
-class lib_tizen_emss(CXXLibrary):
+class lib_tizen_emss(CXXLibrary, MTLibrary):
   name = 'lib_tizen_emss'
   cflags = [
     '-std=c++14',
@@ -1328,6 +1329,8 @@ class lib_tizen_emss(CXXLibrary):
       shared.path_from_root('system', 'lib', 'samsung', 'wasm', 'emss_version_info.cc'),
       shared.path_from_root('system', 'lib', 'samsung', 'wasm', 'elementary_media_stream_source.cc'),
       shared.path_from_root('system', 'lib', 'samsung', 'wasm', 'elementary_media_track.cc'),
+      shared.path_from_root('system', 'lib', 'samsung', 'wasm', 'elementary_media_track_pipeline.cc'),
+      shared.path_from_root('system', 'lib', 'samsung', 'wasm', 'encrypted_packet_pool.cc'),
       shared.path_from_root('system', 'lib', 'samsung', 'wasm', 'media_key.cc'),
       shared.path_from_root('system', 'lib', 'samsung', 'wasm', 'session_id.cc'),
     ]
@@ -3,6 +3,7 @@
 # University of Illinois/NCSA Open Source License.  Both these licenses can be
 # found in the LICENSE file.
 
+import json
 import subprocess
 import os
 import time
@@ -159,6 +160,13 @@ if EM_PROFILE_TOOLCHAIN:
       with ToolchainProfiler.log_access() as f:
         f.write(',\n{"pid":' + ToolchainProfiler.mypid_str + ',"subprocessPid":' + str(os.getpid()) + ',"op":"finish","targetPid":' + str(process_pid) + ',"time":' + ToolchainProfiler.timestamp() + ',"returncode":' + str(returncode) + '}')
 
+    @staticmethod
+    def record_data(name, data):
+      # Attaches a JSON-serializable report, such as a profile written by a
+      # native tool, to the log of this process
+      with ToolchainProfiler.log_access() as f:
+        f.write(',\n{"pid":' + ToolchainProfiler.mypid_str + ',"subprocessPid":' + str(os.getpid()) + ',"op":"data","name":"' + name + '","time":' + ToolchainProfiler.timestamp() + ',"data":' + json.dumps(data) + '}')
+
     @staticmethod
     def enter_block(block_name):
       with ToolchainProfiler.log_access() as f:
@@ -226,6 +234,10 @@ else:
     def record_subprocess_finish(process_pid, returncode):
       pass
 
+    @staticmethod
+    def record_data(name, data):
+      pass
+
     @staticmethod
     def enter_block(block_name):
       pass
@@ -0,0 +1,138 @@
+// Measures the throughput of decoding received WebSocket frames in the proxy, for a stream of many small frames and
+// for a stream of large fragmented messages. The data is fed to the decoder in chunks as a recv() would return it.
+//
+// Usage: websocket_to_posix_proxy_frame_decoder_benchmark [number of small frames] [number of large messages]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+
+#include "../src/websocket_frame_decoder.h"
+
+#define RECV_CHUNK_SIZE 16384
+
+static double Now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Appends a masked frame carrying the given payload, like a browser would send.
+static void AppendFrame(std::vector<uint8_t> &stream, int opcode, bool fin, const uint8_t *payload, size_t length)
+{
+  stream.push_back((fin ? 0x80 : 0) | opcode);
+  if (length < 126)
+    stream.push_back(0x80 | (uint8_t)length);
+  else if (length <= 65535)
+  {
+    stream.push_back(0x80 | 126);
+    stream.push_back((uint8_t)(length >> 8));
+    stream.push_back((uint8_t)length);
+  }
+  else
+  {
+    stream.push_back(0x80 | 127);
+    for(int i = 7; i >= 0; --i)
+      stream.push_back((uint8_t)((uint64_t)length >> (i*8)));
+  }
+  const uint8_t mask[4] = { 0xA1, 0xB2, 0xC3, 0xD4 };
+  stream.insert(stream.end(), mask, mask + 4);
+  for(size_t i = 0; i < length; ++i)
+    stream.push_back(payload[i] ^ mask[i % 4]);
+}
+
+// Decodes the stream, and returns the number of messages and a checksum of their payloads.
+static void Decode(const std::vector<uint8_t> &stream, uint64_t *numMessages, uint64_t *checksum)
+{
+  WebSocketFrameDecoder decoder;
+  *numMessages = 0;
+  *checksum = 0;
+  for(size_t pos = 0; pos < stream.size(); pos += RECV_CHUNK_SIZE)
+  {
+    size_t chunk = stream.size() - pos < RECV_CHUNK_SIZE ? stream.size() - pos : RECV_CHUNK_SIZE;
+    memcpy(WebSocketDecoderWritePointer(&decoder, chunk), &stream[pos], chunk);
+    WebSocketDecoderCommit(&decoder, chunk);
+
+    int opcode;
+    uint8_t *payload;
+    uint64_t payloadLength;
+    int status;
+    while((status = WebSocketDecoderNextMessage(&decoder, &opcode, &payload, &payloadLength)) == WEBSOCKET_DECODE_MESSAGE)
+    {
+      ++*numMessages;
+      *checksum += payloadLength ? payload[0] + payload[payloadLength-1] : 0;
+    }
+    if (status == WEBSOCKET_DECODE_ERROR)
+    {
+      fprintf(stderr, "Decoding failed!\n");
+      exit(1);
+    }
+  }
+}
+
+static void RunBenchmark(const char *name, const std::vector<uint8_t> &stream, uint64_t expectedMessages, uint64_t expectedChecksum)
+{
+  uint64_t numMessages, checksum;
+  Decode(stream, &numMessages, &checksum); // Warm up
+
+  const int numRepeats = 5;
+  double t0 = Now();
+  for(int i = 0; i < numRepeats; ++i)
+    Decode(stream, &numMessages, &checksum);
+  double seconds = (Now() - t0) / numRepeats;
+
+  if (numMessages != expectedMessages || checksum != expectedChecksum)
+  {
+    fprintf(stderr, "%s: decoded %llu messages with checksum %llu, expected %llu messages with checksum %llu!\n", name,
+      (unsigned long long)numMessages, (unsigned long long)checksum, (unsigned long long)expectedMessages, (unsigned long long)expectedChecksum);
+    exit(1);
+  }
+  printf("%s: %.1f MB/s, %.0f messages/s\n", name, stream.size() / seconds / (1024*1024), numMessages / seconds);
+}
+
+int main(int argc, char *argv[])
+{
+  int numSmallFrames = (argc >= 2) ? atoi(argv[1]) : 1000000;
+  int numLargeMessages = (argc >= 3) ? atoi(argv[2]) : 64;
+
+  // Small frames, sized like typical proxied socket calls.
+  std::vector<uint8_t> smallStream;
+  uint64_t smallChecksum = 0;
+  for(int i = 0; i < numSmallFrames; ++i)
+  {
+    uint8_t payload[24];
+    for(size_t j = 0; j < sizeof(payload); ++j)
+      payload[j] = (uint8_t)(i + j);
+    AppendFrame(smallStream, 0x02, true, payload, sizeof(payload));
+    smallChecksum += payload[0] + payload[sizeof(payload)-1];
+  }
+  RunBenchmark("Small frames (24 bytes)", smallStream, numSmallFrames, smallChecksum);
+
+  // Large messages, each sent as four fragments.
+  const size_t largeMessageSize = 1024*1024;
+  const size_t fragmentSize = largeMessageSize / 4;
+  std::vector<uint8_t> largePayload(largeMessageSize);
+  std::vector<uint8_t> largeStream;
+  uint64_t largeChecksum = 0;
+  for(int i = 0; i < numLargeMessages; ++i)
+  {
+    for(size_t j = 0; j < largeMessageSize; ++j)
+      largePayload[j] = (uint8_t)(i * 7 + j);
+    for(size_t offset = 0; offset < largeMessageSize; offset += fragmentSize)
+      AppendFrame(largeStream, offset ? 0x00 : 0x02, offset + fragmentSize >= largeMessageSize, &largePayload[offset], fragmentSize);
+    largeChecksum += largePayload[0] + largePayload[largeMessageSize-1];
+  }
+  RunBenchmark("Large fragmented messages (1 MB)", largeStream, numLargeMessages, largeChecksum);
+
+  // Raw unmasking throughput, for payloads that are not a multiple of the vector width.
+  std::vector<uint8_t> unmaskData(16*1024*1024 + 3);
+  double t0 = Now();
+  const int numUnmasks = 20;
+  for(int i = 0; i < numUnmasks; ++i)
+    WebSocketMessageUnmaskPayload(&unmaskData[0], unmaskData.size(), 0x12345678u);
+  double seconds = Now() - t0;
+  printf("Unmasking: %.1f MB/s\n", unmaskData.size() * (double)numUnmasks / seconds / (1024*1024));
+  return 0;
+}
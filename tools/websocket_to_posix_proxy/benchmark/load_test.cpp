@@ -0,0 +1,342 @@
+// Load test for websocket_to_posix_proxy: runs a number of simulated WebSocket clients against a running proxy. Each
+// client makes TCP send()/recv() round trips through the proxy to an echo server hosted by this program, while also
+// keeping a number of recv() calls blocked on sockets that never receive anything, like an application that waits for
+// data on many connections at once would.
+//
+// Usage: websocket_to_posix_proxy_load_test [proxy port] [number of clients] [idle sockets per client] [round trips per client] [message size]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "../src/posix_sockets.h"
+#include "../src/threads.h"
+
+#define on_error(...) { fprintf(stderr, __VA_ARGS__); fflush(stderr); exit(1); }
+
+// Protocol constants of the proxy, see websocket_to_posix_proxy.cpp.
+#define POSIX_SOCKET_MSG_SOCKET 1
+#define POSIX_SOCKET_MSG_CONNECT 5
+#define POSIX_SOCKET_MSG_SEND 10
+#define POSIX_SOCKET_MSG_RECV 11
+#define MUSL_AF_INET 2
+#define MUSL_SOCK_STREAM 1
+
+static int proxyPort = 8080;
+static int numClients = 32;
+static int numIdleSockets = 16;
+static int numRoundTrips = 1000;
+static int messageSize = 64;
+static int echoPort = 0;
+static int silentPort = 0;
+
+static MUTEX_T resultsLock;
+static std::vector<double> latencies; // in microseconds
+static int numFailedClients = 0;
+
+static double Now()
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool SendAll(SOCKET_T s, const void *data, size_t numBytes)
+{
+  const char *d = (const char *)data;
+  while(numBytes > 0)
+  {
+    SEND_RET_TYPE sent = send(s, d, (int)numBytes, 0);
+    if (sent <= 0) return false;
+    d += sent;
+    numBytes -= (size_t)sent;
+  }
+  return true;
+}
+
+static bool RecvAll(SOCKET_T s, void *data, size_t numBytes)
+{
+  char *d = (char *)data;
+  while(numBytes > 0)
+  {
+    SEND_RET_TYPE received = recv(s, d, (int)numBytes, 0);
+    if (received <= 0) return false;
+    d += received;
+    numBytes -= (size_t)received;
+  }
+  return true;
+}
+
+static SOCKET_T ListenOnLocalhost(int *port, int backlog)
+{
+  SOCKET_T s = socket(AF_INET, SOCK_STREAM, 0);
+  if (s < 0) on_error("Could not create socket\n");
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  if (bind(s, (sockaddr *)&addr, sizeof(addr)) < 0) on_error("Could not bind socket\n");
+  if (listen(s, backlog) < 0) on_error("Could not listen on socket\n");
+  socklen_t addrLen = sizeof(addr);
+  getsockname(s, (sockaddr *)&addr, &addrLen);
+  *port = ntohs(addr.sin_port);
+  return s;
+}
+
+static THREAD_RETURN_T echo_connection_thread(void *arg)
+{
+  SOCKET_T s = (SOCKET_T)(uintptr_t)arg;
+  char buf[4096];
+  for(;;)
+  {
+    SEND_RET_TYPE received = recv(s, buf, sizeof(buf), 0);
+    if (received <= 0 || !SendAll(s, buf, (size_t)received)) break;
+  }
+  CLOSE_SOCKET(s);
+  EXIT_THREAD(0);
+}
+
+static THREAD_RETURN_T echo_server_thread(void *arg)
+{
+  SOCKET_T server = (SOCKET_T)(uintptr_t)arg;
+  for(;;)
+  {
+    SOCKET_T s = accept(server, 0, 0);
+    if (s < 0) continue;
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (SETSOCKOPT_PTR_TYPE)&one, sizeof(one));
+    THREAD_T thread;
+    CREATE_THREAD(thread, echo_connection_thread, (void*)(uintptr_t)s);
+  }
+  EXIT_THREAD(0);
+}
+
+// A WebSocket connection to the proxy that makes proxied socket calls.
+struct ProxyClient
+{
+  SOCKET_T fd;
+  int nextCallId;
+  std::vector<uint8_t> reply;
+
+  bool Connect()
+  {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(proxyPort);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) return false;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (SETSOCKOPT_PTR_TYPE)&one, sizeof(one));
+
+    const char handshake[] =
+      "GET / HTTP/1.1\r\n"
+      "Host: localhost\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+      "Sec-WebSocket-Version: 13\r\n"
+      "\r\n";
+    if (!SendAll(fd, handshake, strlen(handshake))) return false;
+
+    // Read the response up to the empty line that ends it.
+    char response[1024];
+    size_t len = 0;
+    while(len < 4 || memcmp(response + len - 4, "\r\n\r\n", 4))
+    {
+      if (len >= sizeof(response) || !RecvAll(fd, response + len, 1)) return false;
+      ++len;
+    }
+    nextCallId = 1;
+    return true;
+  }
+
+  // Sends a proxied call as a masked binary WebSocket frame, filling in its call ID. Returns the call ID.
+  int Call(void *msg, size_t numBytes)
+  {
+    int callId = nextCallId++;
+    ((int*)msg)[0] = callId;
+
+    std::vector<uint8_t> frame;
+    frame.push_back(0x82); // FIN + binary frame
+    if (numBytes < 126)
+      frame.push_back(0x80 | (uint8_t)numBytes);
+    else
+    {
+      frame.push_back(0x80 | 126);
+      frame.push_back((uint8_t)(numBytes >> 8));
+      frame.push_back((uint8_t)numBytes);
+    }
+    const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    frame.insert(frame.end(), mask, mask + 4);
+    for(size_t i = 0; i < numBytes; ++i)
+      frame.push_back(((uint8_t*)msg)[i] ^ mask[i % 4]);
+    return SendAll(fd, &frame[0], frame.size()) ? callId : -1;
+  }
+
+  // Reads reply messages until the one for the given call arrives. Returns its ret field.
+  bool WaitReply(int callId, int *ret)
+  {
+    for(;;)
+    {
+      uint8_t header[2];
+      if (!RecvAll(fd, header, 2)) return false;
+      uint64_t length = header[1] & 0x7F;
+      if (length == 126)
+      {
+        uint8_t ext[2];
+        if (!RecvAll(fd, ext, 2)) return false;
+        length = (ext[0] << 8) | ext[1];
+      }
+      else if (length == 127)
+        return false; // Not expected in this test
+      reply.resize((size_t)length);
+      if (length > 0 && !RecvAll(fd, &reply[0], (size_t)length)) return false;
+      if (length >= 2*sizeof(int) && ((int*)&reply[0])[0] == callId)
+      {
+        *ret = ((int*)&reply[0])[1];
+        return true;
+      }
+    }
+  }
+
+  int Socket()
+  {
+    int msg[5] = { 0, POSIX_SOCKET_MSG_SOCKET, MUSL_AF_INET, MUSL_SOCK_STREAM, 0 };
+    int ret;
+    return WaitReply(Call(msg, sizeof(msg)), &ret) ? ret : -1;
+  }
+
+  bool ConnectSocket(int s, int port)
+  {
+    struct {
+      int callId;
+      int function;
+      int socket;
+      uint32_t address_len;
+      sockaddr_in address;
+    } msg = {};
+    msg.function = POSIX_SOCKET_MSG_CONNECT;
+    msg.socket = s;
+    msg.address_len = sizeof(msg.address);
+    msg.address.sin_family = AF_INET;
+    msg.address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    msg.address.sin_port = htons(port);
+    int ret;
+    return WaitReply(Call(&msg, sizeof(msg)), &ret) && ret == 0;
+  }
+
+  // Issues a recv() on the socket without waiting for its reply.
+  int RecvAsync(int s, int length)
+  {
+    int msg[5] = { 0, POSIX_SOCKET_MSG_RECV, s, length, 0 };
+    return Call(msg, sizeof(msg));
+  }
+
+  bool SendAndRecv(int s, const std::vector<uint8_t> &payload)
+  {
+    std::vector<uint8_t> msg(5*sizeof(int) + payload.size());
+    int *m = (int*)&msg[0];
+    m[1] = POSIX_SOCKET_MSG_SEND;
+    m[2] = s;
+    m[3] = (int)payload.size();
+    m[4] = 0;
+    memcpy(&msg[5*sizeof(int)], &payload[0], payload.size());
+    int ret;
+    if (!WaitReply(Call(&msg[0], msg.size()), &ret) || ret != (int)payload.size()) return false;
+
+    // TCP may split the echo, so receive until all of it has arrived.
+    int received = 0;
+    while(received < (int)payload.size())
+    {
+      if (!WaitReply(RecvAsync(s, (int)payload.size() - received), &ret) || ret <= 0) return false;
+      received += ret;
+    }
+    return true;
+  }
+};
+
+static THREAD_RETURN_T client_thread(void * /*arg*/)
+{
+  ProxyClient client;
+  std::vector<double> clientLatencies;
+  bool ok = client.Connect();
+
+  // Park recv() calls on sockets that never receive anything. These must not hold up the other calls of the client.
+  for(int i = 0; ok && i < numIdleSockets; ++i)
+  {
+    int s = client.Socket();
+    ok = s > 0 && client.ConnectSocket(s, silentPort) && client.RecvAsync(s, 16) > 0;
+  }
+
+  int s = ok ? client.Socket() : -1;
+  ok = ok && s > 0 && client.ConnectSocket(s, echoPort);
+
+  std::vector<uint8_t> payload(messageSize, 0x42);
+  for(int i = 0; ok && i < numRoundTrips; ++i)
+  {
+    double t0 = Now();
+    ok = client.SendAndRecv(s, payload);
+    clientLatencies.push_back(Now() - t0);
+  }
+
+  LOCK_MUTEX(&resultsLock);
+  if (!ok) ++numFailedClients;
+  latencies.insert(latencies.end(), clientLatencies.begin(), clientLatencies.end());
+  UNLOCK_MUTEX(&resultsLock);
+
+  // Closing the WebSocket makes the proxy close all the sockets of this client, and fail its parked calls.
+  CLOSE_SOCKET(client.fd);
+  EXIT_THREAD(0);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc >= 2) proxyPort = atoi(argv[1]);
+  if (argc >= 3) numClients = atoi(argv[2]);
+  if (argc >= 4) numIdleSockets = atoi(argv[3]);
+  if (argc >= 5) numRoundTrips = atoi(argv[4]);
+  if (argc >= 6) messageSize = atoi(argv[5]);
+
+#ifdef _WIN32
+  WSADATA wsaData;
+  WSAStartup(MAKEWORD(2,2), &wsaData);
+#else
+  signal(SIGPIPE, SIG_IGN);
+#endif
+  CREATE_MUTEX(&resultsLock);
+
+  SOCKET_T echoServer = ListenOnLocalhost(&echoPort, 128);
+  THREAD_T echoThread;
+  CREATE_THREAD(echoThread, echo_server_thread, (void*)(uintptr_t)echoServer);
+
+  // Connections to the silent server complete in the listen backlog, but are never accepted or sent anything.
+  ListenOnLocalhost(&silentPort, numClients * numIdleSockets + 128);
+
+  printf("Running %d clients with %d idle sockets each, %d round trips of %d bytes per client, against proxy at port %d\n",
+    numClients, numIdleSockets, numRoundTrips, messageSize, proxyPort);
+
+  double t0 = Now();
+  std::vector<THREAD_T> threads(numClients);
+  for(int i = 0; i < numClients; ++i)
+    CREATE_THREAD(threads[i], client_thread, 0);
+  for(int i = 0; i < numClients; ++i)
+  {
+#ifdef _WIN32
+    WaitForSingleObject(threads[i], INFINITE);
+#else
+    pthread_join(threads[i], 0);
+#endif
+  }
+  double seconds = (Now() - t0) / 1e6;
+
+  if (latencies.empty()) on_error("No round trips completed! Is the proxy running at port %d?\n", proxyPort);
+  std::sort(latencies.begin(), latencies.end());
+  printf("%d round trips in %.3f seconds: %.1f round trips/second\n", (int)latencies.size(), seconds, latencies.size() / seconds);
+  printf("Latency: median %.1f usecs, 99th percentile %.1f usecs, max %.1f usecs\n",
+    latencies[latencies.size()/2], latencies[latencies.size()*99/100], latencies.back());
+  if (numFailedClients) printf("%d clients failed!\n", numFailedClients);
+  return numFailedClients ? 1 : 0;
+}
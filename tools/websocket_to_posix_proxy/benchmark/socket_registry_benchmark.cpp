@@ -0,0 +1,92 @@
+// Measures socket ownership checks of the proxy's socket registry, which run on every proxied socket call, with
+// thousands of sockets per proxy connection, from one and from several threads at once.
+//
+// Usage: websocket_to_posix_proxy_socket_registry_benchmark [number of connections] [sockets per connection] [number of threads]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+
+#include "../src/socket_registry.h"
+#include "../src/threads.h"
+
+// The registry never touches the tracked sockets unless they are closed, so the benchmark uses made up socket numbers
+// that do not collide with real ones.
+#define FIRST_SOCKET 1000000
+
+static int numConnections = 8;
+static int numSocketsPerConnection = 4096;
+static int numThreads = 4;
+static const int numChecksPerThread = 4000000;
+
+static double Now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static SOCKET_T SocketOf(int connection, int i)
+{
+  return (SOCKET_T)(FIRST_SOCKET + i * numConnections + connection);
+}
+
+static THREAD_RETURN_T check_thread(void *arg)
+{
+  unsigned int rnd = (unsigned int)(uintptr_t)arg + 1;
+  int numFailed = 0;
+  for(int i = 0; i < numChecksPerThread; ++i)
+  {
+    rnd = rnd * 1103515245 + 12345;
+    int connection = (rnd >> 8) % numConnections;
+    int socket = (rnd >> 4) % numSocketsPerConnection;
+    // Every other check asks about a socket of another connection, which must fail.
+    int asker = (i & 1) ? (connection + 1) % numConnections : connection;
+    if (IsSocketPartOfConnection(asker, SocketOf(connection, socket)) != (asker == connection))
+      ++numFailed;
+  }
+  if (numFailed)
+  {
+    fprintf(stderr, "%d ownership checks returned the wrong result!\n", numFailed);
+    exit(1);
+  }
+  EXIT_THREAD(0);
+}
+
+static void RunChecks(int threads)
+{
+  double t0 = Now();
+  std::vector<THREAD_T> handles(threads);
+  for(int i = 0; i < threads; ++i)
+    CREATE_THREAD(handles[i], check_thread, (void*)(uintptr_t)i);
+  for(int i = 0; i < threads; ++i)
+  {
+#ifdef _WIN32
+    WaitForSingleObject(handles[i], INFINITE);
+#else
+    pthread_join(handles[i], 0);
+#endif
+  }
+  double seconds = Now() - t0;
+  printf("%d thread(s): %.1f million ownership checks/second\n", threads, threads * (double)numChecksPerThread / seconds / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc >= 2) numConnections = atoi(argv[1]);
+  if (argc >= 3) numSocketsPerConnection = atoi(argv[2]);
+  if (argc >= 4) numThreads = atoi(argv[3]);
+  if (numConnections < 2) numConnections = 2;
+
+  double t0 = Now();
+  for(int i = 0; i < numSocketsPerConnection; ++i)
+    for(int c = 0; c < numConnections; ++c)
+      TrackSocketUsedByConnection(c, SocketOf(c, i));
+  double seconds = Now() - t0;
+  printf("Tracked %d sockets in %d connections in %.3f msecs\n", numConnections * numSocketsPerConnection, numConnections, seconds * 1000.0);
+
+  RunChecks(1);
+  if (numThreads > 1)
+    RunChecks(numThreads);
+  return 0;
+}
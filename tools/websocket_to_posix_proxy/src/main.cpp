@@ -10,6 +10,8 @@
 #include "sha1.h"
 #include "websocket_to_posix_proxy.h"
 #include "socket_registry.h"
+#include "proxy_connection.h"
+#include "reactor.h"
 
 // #define PROXY_DEBUG
 
@@ -33,6 +35,9 @@ static void base64_encode(void *dst, const void *src, size_t len) // thread-safe
 }
 
 #define BUFFER_SIZE 1024
+
+// Number of bytes to try to read from a proxy connection at a time.
+#define RECV_CHUNK_SIZE 16384
 #define on_error(...) { fprintf(stderr, __VA_ARGS__); fflush(stderr); exit(1); }
 
 // Given a multiline string of HTTP headers, returns a pointer to the beginning of the value of given header inside the string that was passed in.
@@ -74,97 +79,14 @@ void SendHandshake(int fd, const char *request)
   printf("Sent handshake:\n%s\n", handshakeMsg);
 }
 
-// Validates if the given, possibly partially received WebSocket message has enough bytes to contain a full WebSocket header.
-static bool WebSocketHasFullHeader(uint8_t *data, uint64_t obtainedNumBytes)
-{
-  if (obtainedNumBytes < 2) return false;
-  uint64_t expectedNumBytes = 2;
-  WebSocketMessageHeader *header = (WebSocketMessageHeader *)data;
-  if (header->mask) expectedNumBytes += 4;
-  switch(header->payloadLength)
-  {
-    case 127: return expectedNumBytes += 8; break;
-    case 126: return expectedNumBytes += 2; break;
-    default: break;
-  }
-  return obtainedNumBytes >= expectedNumBytes;
-}
-
-// Computes the total number of bytes that the given WebSocket message will take up.
-uint64_t WebSocketFullMessageSize(uint8_t *data, uint64_t obtainedNumBytes)
-{
-  assert(WebSocketHasFullHeader(data, obtainedNumBytes));
-
-  uint64_t expectedNumBytes = 2;
-  WebSocketMessageHeader *header = (WebSocketMessageHeader *)data;
-  if (header->mask) expectedNumBytes += 4;
-  switch(header->payloadLength)
-  {
-    case 127: return expectedNumBytes += 8 + ntoh64(*(uint64_t*)(data+2)); break;
-    case 126: return expectedNumBytes += 2 + ntohs(*(uint16_t*)(data+2)); break;
-    default: expectedNumBytes += header->payloadLength; break;
-  }
-  return expectedNumBytes;
-}
-
-// Tests the structure integrity of the websocket message length.
-bool WebSocketValidateMessageSize(uint8_t *data, uint64_t obtainedNumBytes)
-{
-  uint64_t expectedNumBytes = WebSocketFullMessageSize(data, obtainedNumBytes);
-
-  if (expectedNumBytes != obtainedNumBytes)
-  {
-    printf("Corrupt WebSocket message size! (got %llu bytes, expected %llu bytes)\n", obtainedNumBytes, expectedNumBytes);
-    printf("Received data:");
-    for(size_t i = 0; i < obtainedNumBytes; ++i)
-      printf(" %02X", data[i]);
-    printf("\n");
-  }
-  return expectedNumBytes == obtainedNumBytes;
-}
-
-uint64_t WebSocketMessagePayloadLength(uint8_t *data, uint64_t numBytes)
-{
-  WebSocketMessageHeader *header = (WebSocketMessageHeader *)data;
-  switch(header->payloadLength)
-  {
-    case 127: return ntoh64(*(uint64_t*)(data+2));
-    case 126: return ntohs(*(uint16_t*)(data+2));
-    default: return header->payloadLength;
-  }
-}
-
-uint32_t WebSocketMessageMaskingKey(uint8_t *data, uint64_t numBytes)
-{
-  WebSocketMessageHeader *header = (WebSocketMessageHeader *)data;
-  if (!header->mask) return 0;
-  switch(header->payloadLength)
-  {
-    case 127: return *(uint32_t*)(data+10);
-    case 126: return *(uint32_t*)(data+4);
-    default: return *(uint32_t*)(data+2);
-  }
-}
-
-uint8_t *WebSocketMessageData(uint8_t *data, uint64_t numBytes)
-{
-  WebSocketMessageHeader *header = (WebSocketMessageHeader *)data;
-  data += 2; // Two bytes of fixed size header
-  if (header->mask) data += 4; // If there is a masking key present in the header, that takes up 4 bytes
-  switch(header->payloadLength)
-  {
-    case 127: return data + 8; // 64-bit length
-    case 126: return data + 2; // 16-bit length
-    default: return data; // 7-bit length that was embedded in fixed size header.
-  }
-}
-
-void CloseWebSocket(int client_fd)
+void CloseWebSocket(ProxyConnection *connection)
 {
+  int client_fd = (int)connection->client_fd;
   printf("Closing WebSocket connection %d\n", client_fd);
   CloseAllSocketsByConnection(client_fd);
   shutdown(client_fd, SHUTDOWN_BIDIRECTIONAL);
-  CLOSE_SOCKET(client_fd);
+  // The socket itself is closed once the socket calls still pending on this connection have finished.
+  ReleaseProxyConnection(connection);
 }
 
 const char *WebSocketOpcodeToString(int opcode)
@@ -174,18 +96,9 @@ const char *WebSocketOpcodeToString(int opcode)
   return opcodes[opcode];
 }
 
-void DumpWebSocketMessage(uint8_t *data, uint64_t numBytes)
+void DumpWebSocketMessage(int opcode, uint8_t *payload, uint64_t payloadLength)
 {
-  bool goodMessageSize = WebSocketValidateMessageSize(data, numBytes);
-  if (!goodMessageSize)
-    return;
-
-  WebSocketMessageHeader *header = (WebSocketMessageHeader *)data;
-  uint64_t payloadLength = WebSocketMessagePayloadLength(data, numBytes);
-  uint8_t *payload = WebSocketMessageData(data, numBytes);
-
-  printf("Received: FIN: %d, opcode: %s, mask: 0x%08X, payload length: %llu bytes, unmasked payload:", header->fin, WebSocketOpcodeToString(header->opcode),
-    WebSocketMessageMaskingKey(data, numBytes), payloadLength);
+  printf("Received: opcode: %s, payload length: %llu bytes, unmasked payload:", WebSocketOpcodeToString(opcode), payloadLength);
   for(uint64_t i = 0; i < payloadLength; ++i)
   {
     if (i%16 == 0) printf("\n");
@@ -200,27 +113,45 @@ void DumpWebSocketMessage(uint8_t *data, uint64_t numBytes)
   printf("\n");
 }
 
-// connection thread manages a single active proxy connection.
-THREAD_RETURN_T connection_thread(void *arg)
+// Reads the data that is available on the given proxy connection, and processes all the complete WebSocket messages
+// received so far. Returns false if the connection should be closed.
+static bool ReadFromClient(ProxyConnection *connection)
 {
-  int client_fd = (int)(uintptr_t)arg;
-  printf("Established new proxy connection handler thread for incoming connection, at fd=%d\n", client_fd); // TODO: print out getpeername()+getsockname() for more info
-
-  // Waiting for connection upgrade handshake
-  char buf[BUFFER_SIZE];
-  int read = recv(client_fd, buf, BUFFER_SIZE, 0);
+  int client_fd = (int)connection->client_fd;
 
-  if (!read)
+  if (!connection->handshakeDone)
   {
-    CloseWebSocket(client_fd);
-    EXIT_THREAD(0);
+    // Waiting for connection upgrade handshake
+    char buf[BUFFER_SIZE];
+    int read = recv(client_fd, buf, BUFFER_SIZE-1, 0);
+    if (!read) return false; // done reading
+    if (read < 0)
+    {
+      fprintf(stderr, "Client read failed\n");
+      return false;
+    }
+    buf[read] = '\0';
+#ifdef PROXY_DEEP_DEBUG
+    printf("Received:\n%s\n", buf);
+#endif
+    SendHandshake(client_fd, buf);
+    connection->handshakeDone = true;
+#ifdef PROXY_DEEP_DEBUG
+    printf("Handshake received, entering message loop:\n");
+#endif
+    return true;
   }
 
+  // Receive straight into the frame decoder, without an intermediate copy.
+  WebSocketFrameDecoder *decoder = &connection->decoder;
+  uint8_t *buf = WebSocketDecoderWritePointer(decoder, RECV_CHUNK_SIZE);
+  int read = recv(client_fd, (char*)buf, RECV_CHUNK_SIZE, 0);
+
+  if (!read) return false; // done reading
   if (read < 0)
   {
     fprintf(stderr, "Client read failed\n");
-    CloseWebSocket(client_fd);
-    EXIT_THREAD(0);
+    return false;
   }
 
 #ifdef PROXY_DEEP_DEBUG
@@ -230,105 +161,57 @@ THREAD_RETURN_T connection_thread(void *arg)
     printf(" %02X", buf[i]);
   }
   printf("\n");
-//  printf("In text:\n%s\n", buf);
-#endif
-  SendHandshake(client_fd, buf);
-
-#ifdef PROXY_DEEP_DEBUG
-  printf("Handshake received, entering message loop:\n");
 #endif
+  WebSocketDecoderCommit(decoder, read);
 
-  std::vector<uint8_t> fragmentData;
-
-  bool connectionAlive = true;
-  while (connectionAlive)
+  // Process received messages until there is not enough data for a full message
+  for(;;)
   {
-    int read = recv(client_fd, buf, BUFFER_SIZE, 0);
-
-    if (!read) break; // done reading
-    if (read < 0)
+    int opcode;
+    uint8_t *payload;
+    uint64_t payloadLength;
+    int status = WebSocketDecoderNextMessage(decoder, &opcode, &payload, &payloadLength);
+    if (status == WEBSOCKET_DECODE_NEED_MORE_DATA)
+      return true;
+    if (status == WEBSOCKET_DECODE_ERROR)
     {
-      fprintf(stderr, "Client read failed\n");
-      EXIT_THREAD(0);
+      fprintf(stderr, "Corrupt WebSocket frame received!\n");
+      return false;
     }
 
 #ifdef PROXY_DEEP_DEBUG
-    printf("Received:");
-    for(int i = 0; i < read; ++i)
-    {
-      printf(" %02X", ((unsigned char*)buf)[i]);
-    }
-    printf("\n");
-//    printf("In text:\n%s\n", buf);
-#endif
-
-#ifdef PROXY_DEEP_DEBUG
-    printf("Have %d+%d==%d bytes now in queue\n", (int)fragmentData.size(), (int)read, (int)(fragmentData.size()+read));
+    DumpWebSocketMessage(opcode, payload, payloadLength);
 #endif
-    fragmentData.insert(fragmentData.end(), buf, buf+read);
 
-    // Process received fragments until there is not enough data for a full message
-    while(!fragmentData.empty())
+    switch(opcode)
     {
-      bool hasFullHeader = WebSocketHasFullHeader(&fragmentData[0], fragmentData.size());
-      if (!hasFullHeader)
-      {
-#ifdef PROXY_DEEP_DEBUG
-        printf("(not enough for a full WebSocket header)\n");
-#endif
-        break;
-      }
-      uint64_t neededBytes = WebSocketFullMessageSize(&fragmentData[0], fragmentData.size());
-      if (fragmentData.size() < neededBytes)
-      {
-#ifdef PROXY_DEEP_DEBUG
-        printf("(not enough for a full WebSocket message, needed %d bytes)\n", (int)neededBytes);
-#endif
-        break;
-      }
-
-      WebSocketMessageHeader *header = (WebSocketMessageHeader *)&fragmentData[0];
-      uint64_t payloadLength = WebSocketMessagePayloadLength(&fragmentData[0], neededBytes);
-      uint8_t *payload = WebSocketMessageData(&fragmentData[0], neededBytes);
-
-      // Unmask payload
-      if (header->mask)
-        WebSocketMessageUnmaskPayload(payload, payloadLength, WebSocketMessageMaskingKey(&fragmentData[0], neededBytes));
-
-#ifdef PROXY_DEEP_DEBUG
-        DumpWebSocketMessage(&fragmentData[0], neededBytes);
-#endif
-
-      switch(header->opcode)
-      {
-      case 0x02: /*binary message*/ ProcessWebSocketMessage(client_fd, payload, payloadLength); break;
-      case 0x08: connectionAlive = false; break;
-      default:
-        fprintf(stderr, "Unknown WebSocket opcode received %x!\n", header->opcode);
-        connectionAlive = false; // Kill connection
-        break;
-      }
-
-      fragmentData.erase(fragmentData.begin(), fragmentData.begin() + (ptrdiff_t)neededBytes);
-#ifdef PROXY_DEEP_DEBUG
-      printf("Cleared used bytes, got %d left in fragment queue.\n", (int)fragmentData.size());
-#endif
+    case 0x02: /*binary message*/ ProcessWebSocketMessage(client_fd, payload, payloadLength); break;
+    case 0x08: return false;
+    case 0x0A: /*pong*/ break;
+    default:
+      fprintf(stderr, "Unknown WebSocket opcode received %x!\n", opcode);
+      return false; // Kill connection
     }
   }
-  printf("Proxy connection closed\n");
-  CloseWebSocket(client_fd);
-  EXIT_THREAD(0);
 }
 
-// Technically only would need one lock per connection, but this is now one lock per all connections, which would be
-// slightly inefficient if we were handling multiple proxied connections at the same time. (currently that is a rare
-// use case, expected to only be proxying one connection at a time - if this proxy bridge is expected to be used
-// for hundreds of connections simultaneously, this mutex should be refactored to be per-connection)
-MUTEX_T webSocketSendLock;
+// Runs on a worker thread when a proxy connection has data to read. Only one read of each connection is in flight at a
+// time, so the messages of a connection are processed in the order they were sent.
+static void OnClientReadable(void *arg)
+{
+  ProxyConnection *connection = (ProxyConnection*)arg;
+  if (ReadFromClient(connection))
+    WaitForSocket(connection->client_fd, SOCKET_WAIT_READ, OnClientReadable, connection);
+  else
+  {
+    printf("Proxy connection closed\n");
+    CloseWebSocket(connection);
+  }
+}
 
 int main(int argc, char *argv[])
 {
-  if (argc < 2) on_error("websocket_to_posix_proxy creates a bridge that allows WebSocket connections on a web page to proxy out to perform TCP/UDP connections.\nUsage: %s [port]\n", argv[0]);
+  if (argc < 2) on_error("websocket_to_posix_proxy creates a bridge that allows WebSocket connections on a web page to proxy out to perform TCP/UDP connections.\nUsage: %s [port] [number of worker threads]\n", argv[0]);
 
 #ifdef _WIN32
   WSADATA wsaData;
@@ -362,7 +245,11 @@ int main(int argc, char *argv[])
 
   printf("websocket_to_posix_proxy server is now listening for WebSocket connections to ws://localhost:%d/\n", port);
 
-  CREATE_MUTEX(&webSocketSendLock);
+  // Worker threads run the socket calls, and the reactor thread waits for any sockets that are not ready for them yet.
+  // Calls that would block do not occupy a worker, so the pool only needs to cover calls that are running at once.
+  const int numWorkerThreads = (argc >= 3 && atoi(argv[2]) > 0) ? atoi(argv[2]) : 16;
+  StartWorkerThreads(numWorkerThreads);
+  StartReactor();
 
   while (1)
   {
@@ -373,13 +260,13 @@ int main(int argc, char *argv[])
       continue; // Do not quit here, but keep serving any existing proxy connections.
     }
 
-    THREAD_T connection;
-    CREATE_THREAD_RETURN_T ret = CREATE_THREAD(connection, connection_thread, (void*)(uintptr_t)client_fd);
-    if (!CREATE_THREAD_SUCCEEDED(ret))
-    {
-      fprintf(stderr, "Failed to create a connection handler thread for incoming proxy connection!\n");
-      continue; // Do not quit here, but keep program alive to manage other existing proxy connections.
-    }
+    printf("Established new incoming proxy connection, at fd=%d\n", (int)client_fd); // TODO: print out getpeername()+getsockname() for more info
+    // Replies are small messages sent as soon as each call completes, so do not let Nagle's algorithm hold them back.
+    int nodelay = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (SETSOCKOPT_PTR_TYPE)&nodelay, sizeof nodelay);
+
+    ProxyConnection *connection = CreateProxyConnection(client_fd);
+    WaitForSocket(client_fd, SOCKET_WAIT_READ, OnClientReadable, connection);
   }
 
 #ifdef _WIN32
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdint.h>
 
 template<typename T>
 int CHECKED_TRUNCATE_TO_POSITIVE_INT32(const T &val)
@@ -20,6 +21,9 @@ int CHECKED_TRUNCATE_TO_POSITIVE_INT32(const T &val)
 #include <unistd.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
 
 #define SOCKET_T int
 #define SHUTDOWN_READ SHUT_RD
@@ -32,6 +36,35 @@ int CHECKED_TRUNCATE_TO_POSITIVE_INT32(const T &val)
 
 #define GET_SOCKET_ERROR() (errno)
 
+// Flag for recv() and friends to not block even if the socket is in blocking mode.
+#define RECV_NONBLOCKING_FLAG MSG_DONTWAIT
+
+// Tests if the given socket error code means that a nonblocking call could not complete yet.
+#define SOCKET_WOULD_BLOCK(errorCode) ((errorCode) == EAGAIN || (errorCode) == EWOULDBLOCK || (errorCode) == EINPROGRESS)
+
+static inline void SET_SOCKET_BLOCKING(SOCKET_T socket, bool blocking)
+{
+  int flags = fcntl(socket, F_GETFL, 0);
+  fcntl(socket, F_SETFL, blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+}
+
+// Scatter-gather buffers for sending several buffers with a single call.
+#define IOVEC_T struct iovec
+#define IOVEC_DATA(v) ((uint8_t*)(v).iov_base)
+#define IOVEC_LENGTH(v) ((v).iov_len)
+
+static inline void SET_IOVEC(IOVEC_T &v, const void *data, size_t length)
+{
+  v.iov_base = (void*)data;
+  v.iov_len = length;
+}
+
+// Sends the given buffers, and returns the number of bytes sent, or -1 on error.
+static inline SEND_RET_TYPE SEND_IOVECS(SOCKET_T socket, IOVEC_T *iovecs, int numIovecs)
+{
+  return writev(socket, iovecs, numIovecs);
+}
+
 #define PRINT_SOCKET_ERROR(errorCode) do { \
   printf("Call failed! errno: %s(%d)\n", strerror(errorCode), errorCode); \
   } while(0)
@@ -52,6 +85,33 @@ int CHECKED_TRUNCATE_TO_POSITIVE_INT32(const T &val)
 
 #define GET_SOCKET_ERROR() (WSAGetLastError())
 
+// Windows does not have a per-call nonblocking flag, calls are only made once the socket is known to be ready.
+#define RECV_NONBLOCKING_FLAG 0
+
+#define SOCKET_WOULD_BLOCK(errorCode) ((errorCode) == WSAEWOULDBLOCK)
+
+static inline void SET_SOCKET_BLOCKING(SOCKET_T socket, bool blocking)
+{
+  u_long nonBlocking = blocking ? 0 : 1;
+  ioctlsocket(socket, FIONBIO, &nonBlocking);
+}
+
+#define IOVEC_T WSABUF
+#define IOVEC_DATA(v) ((uint8_t*)(v).buf)
+#define IOVEC_LENGTH(v) ((v).len)
+
+static inline void SET_IOVEC(IOVEC_T &v, const void *data, size_t length)
+{
+  v.buf = (CHAR*)data;
+  v.len = (ULONG)length;
+}
+
+static inline SEND_RET_TYPE SEND_IOVECS(SOCKET_T socket, IOVEC_T *iovecs, int numIovecs)
+{
+  DWORD sent = 0;
+  return (WSASend(socket, iovecs, (DWORD)numIovecs, &sent, 0, 0, 0) == 0) ? (SEND_RET_TYPE)sent : -1;
+}
+
 static inline void PRINT_SOCKET_ERROR(int errorCode)
 {
 	void *lpMsgBuf = 0;
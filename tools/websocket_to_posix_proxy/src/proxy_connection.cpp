@@ -0,0 +1,56 @@
+#include "proxy_connection.h"
+
+#include <stdio.h>
+#include <unordered_map>
+
+namespace
+{
+	struct ConnectionsLock
+	{
+		MUTEX_T mutex;
+		ConnectionsLock() { CREATE_MUTEX(&mutex); }
+	} connectionsLock;
+
+	// Guarded by connectionsLock, as are the reference counts of the connections.
+	std::unordered_map<SOCKET_T, ProxyConnection*> connections;
+}
+
+ProxyConnection *CreateProxyConnection(SOCKET_T client_fd)
+{
+	ProxyConnection *connection = new ProxyConnection();
+	connection->client_fd = client_fd;
+	CREATE_MUTEX(&connection->sendLock);
+	connection->refCount = 1;
+	connection->sending = false;
+	connection->handshakeDone = false;
+
+	LOCK_MUTEX(&connectionsLock.mutex);
+	connections[client_fd] = connection;
+	UNLOCK_MUTEX(&connectionsLock.mutex);
+	return connection;
+}
+
+ProxyConnection *AcquireProxyConnection(SOCKET_T client_fd)
+{
+	LOCK_MUTEX(&connectionsLock.mutex);
+	std::unordered_map<SOCKET_T, ProxyConnection*>::iterator iter = connections.find(client_fd);
+	ProxyConnection *connection = (iter != connections.end()) ? iter->second : 0;
+	if (connection) ++connection->refCount;
+	UNLOCK_MUTEX(&connectionsLock.mutex);
+	return connection;
+}
+
+void ReleaseProxyConnection(ProxyConnection *connection)
+{
+	LOCK_MUTEX(&connectionsLock.mutex);
+	bool lastReference = (--connection->refCount == 0);
+	if (lastReference) connections.erase(connection->client_fd);
+	UNLOCK_MUTEX(&connectionsLock.mutex);
+
+	if (lastReference)
+	{
+		CLOSE_SOCKET(connection->client_fd);
+		DESTROY_MUTEX(&connection->sendLock);
+		delete connection;
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "posix_sockets.h"
+#include "threads.h"
+#include "websocket_frame_decoder.h"
+
+#include <stdint.h>
+#include <vector>
+
+// State of one incoming WebSocket proxy connection. Connections are reference counted: the reader of the connection
+// and every socket call that is waiting for its socket to become ready hold a reference, so that the WebSocket is not
+// closed, and its fd reused by another connection, while a reply may still be sent to it.
+struct ProxyConnection
+{
+  SOCKET_T client_fd;
+
+  // Guards 'sending' and 'queuedReplies'.
+  MUTEX_T sendLock;
+
+  // True while a thread is sending to this connection. Replies that become ready meanwhile are appended, already
+  // framed, to queuedReplies, and that thread sends them all together when it is done.
+  bool sending;
+  std::vector<uint8_t> queuedReplies;
+
+  int refCount;
+  bool handshakeDone;
+
+  // Received data that does not yet form a complete WebSocket message.
+  WebSocketFrameDecoder decoder;
+};
+
+// Creates the state for a new incoming proxy connection, holding one reference.
+ProxyConnection *CreateProxyConnection(SOCKET_T client_fd);
+
+// Returns a new reference to the connection with the given fd, or 0 if there is no such connection.
+ProxyConnection *AcquireProxyConnection(SOCKET_T client_fd);
+
+// Drops a reference to the connection. Closes the WebSocket when the last reference is gone.
+void ReleaseProxyConnection(ProxyConnection *connection);
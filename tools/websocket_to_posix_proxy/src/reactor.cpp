@@ -0,0 +1,224 @@
+#include "reactor.h"
+#include "threads.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#elif defined(_WIN32)
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+namespace
+{
+	struct SocketWait
+	{
+		int events;
+		WORK_FUNC func;
+		void *arg;
+	};
+
+	// Guards 'waits' below, and on Linux keeps the epoll registration of each socket in sync with its pending waits.
+	MUTEX_T waitLock;
+	std::unordered_map<SOCKET_T, std::vector<SocketWait> > waits;
+
+#ifdef __linux__
+	int epollFd = -1;
+#endif
+}
+
+static int PendingEvents(const std::vector<SocketWait> &socketWaits)
+{
+	int events = 0;
+	for(size_t i = 0; i < socketWaits.size(); ++i)
+		events |= socketWaits[i].events;
+	return events;
+}
+
+// Asks the reactor thread to report the given events on the socket, once. Returns false if the socket cannot be waited
+// on, e.g. because it has been closed. waitLock must be held.
+static bool ArmSocket(SOCKET_T socket, int events)
+{
+#ifdef __linux__
+	epoll_event ev = {};
+	ev.events = (uint32_t)EPOLLONESHOT | ((events & SOCKET_WAIT_READ) ? (uint32_t)EPOLLIN : 0) | ((events & SOCKET_WAIT_WRITE) ? (uint32_t)EPOLLOUT : 0);
+	ev.data.fd = socket;
+	// A socket stays registered after its one-shot event fires, but closing a socket unregisters it.
+	if (epoll_ctl(epollFd, EPOLL_CTL_MOD, socket, &ev) == 0)
+		return true;
+	if (errno == ENOENT && epoll_ctl(epollFd, EPOLL_CTL_ADD, socket, &ev) == 0)
+		return true;
+	if (errno != EBADF)
+		fprintf(stderr, "epoll_ctl() failed to wait on socket %d!\n", (int)socket);
+	return false;
+#else
+	// The poll() loop picks up the pending waits on its next round, and reports closed sockets as ready.
+	return true;
+#endif
+}
+
+// Takes all waits pending on the socket out of 'waits', after the socket could not be armed. waitLock must be held.
+static void TakeSocketWaits(std::unordered_map<SOCKET_T, std::vector<SocketWait> >::iterator iter, std::vector<SocketWait> &taken)
+{
+	taken.insert(taken.end(), iter->second.begin(), iter->second.end());
+	waits.erase(iter);
+}
+
+// Queues the waits on the socket that the given ready events satisfy to the worker threads.
+static void DispatchReadySocket(SOCKET_T socket, int readyEvents)
+{
+	std::vector<SocketWait> fired;
+	LOCK_MUTEX(&waitLock);
+	std::unordered_map<SOCKET_T, std::vector<SocketWait> >::iterator iter = waits.find(socket);
+	if (iter == waits.end())
+	{
+		UNLOCK_MUTEX(&waitLock);
+		return;
+	}
+	std::vector<SocketWait> &socketWaits = iter->second;
+	size_t numPending = 0;
+	for(size_t i = 0; i < socketWaits.size(); ++i)
+	{
+		if (socketWaits[i].events & readyEvents)
+			fired.push_back(socketWaits[i]);
+		else
+			socketWaits[numPending++] = socketWaits[i];
+	}
+	socketWaits.resize(numPending);
+	if (socketWaits.empty())
+		waits.erase(iter);
+	else if (!ArmSocket(socket, PendingEvents(socketWaits)))
+		TakeSocketWaits(iter, fired); // The remaining waits would never fire, so fire them now.
+	UNLOCK_MUTEX(&waitLock);
+
+	for(size_t i = 0; i < fired.size(); ++i)
+		QueueWork(fired[i].func, fired[i].arg);
+}
+
+#ifdef __linux__
+
+static THREAD_RETURN_T reactor_thread(void * /*arg*/)
+{
+	epoll_event events[256];
+	for(;;)
+	{
+		int numEvents = epoll_wait(epollFd, events, sizeof(events)/sizeof(events[0]), -1);
+		if (numEvents < 0)
+		{
+			if (errno == EINTR) continue;
+			fprintf(stderr, "epoll_wait() failed!\n");
+			break;
+		}
+		for(int i = 0; i < numEvents; ++i)
+		{
+			int readyEvents = 0;
+			if (events[i].events & (EPOLLIN | EPOLLPRI)) readyEvents |= SOCKET_WAIT_READ;
+			if (events[i].events & EPOLLOUT) readyEvents |= SOCKET_WAIT_WRITE;
+			// Errors and hang-ups complete all waits, the calls themselves will report what happened.
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) readyEvents |= SOCKET_WAIT_READ | SOCKET_WAIT_WRITE;
+			DispatchReadySocket(events[i].data.fd, readyEvents);
+		}
+	}
+	EXIT_THREAD(0);
+}
+
+#else
+
+static THREAD_RETURN_T reactor_thread(void * /*arg*/)
+{
+	// Sockets gain new waits from other threads, which poll() cannot be told about, so wake up periodically to pick
+	// them up.
+	const int pollIntervalMsecs = 10;
+	std::vector<pollfd> fds;
+	for(;;)
+	{
+		fds.clear();
+		LOCK_MUTEX(&waitLock);
+		for(std::unordered_map<SOCKET_T, std::vector<SocketWait> >::iterator iter = waits.begin(); iter != waits.end(); ++iter)
+		{
+			int events = PendingEvents(iter->second);
+			pollfd fd = {};
+			fd.fd = iter->first;
+			fd.events = ((events & SOCKET_WAIT_READ) ? POLLIN : 0) | ((events & SOCKET_WAIT_WRITE) ? POLLOUT : 0);
+			fds.push_back(fd);
+		}
+		UNLOCK_MUTEX(&waitLock);
+
+		if (fds.empty())
+		{
+#ifdef _WIN32
+			Sleep(pollIntervalMsecs);
+#else
+			poll(0, 0, pollIntervalMsecs);
+#endif
+			continue;
+		}
+
+		int numReady = poll(&fds[0], (unsigned long)fds.size(), pollIntervalMsecs);
+		for(size_t i = 0; i < fds.size() && numReady > 0; ++i)
+		{
+			if (!fds[i].revents) continue;
+			--numReady;
+			int readyEvents = 0;
+			if (fds[i].revents & POLLIN) readyEvents |= SOCKET_WAIT_READ;
+			if (fds[i].revents & POLLOUT) readyEvents |= SOCKET_WAIT_WRITE;
+			if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) readyEvents |= SOCKET_WAIT_READ | SOCKET_WAIT_WRITE;
+			DispatchReadySocket(fds[i].fd, readyEvents);
+		}
+	}
+	EXIT_THREAD(0);
+}
+
+#endif
+
+void StartReactor()
+{
+	CREATE_MUTEX(&waitLock);
+#ifdef __linux__
+	epollFd = epoll_create1(0);
+	if (epollFd < 0)
+	{
+		fprintf(stderr, "epoll_create1() failed!\n");
+		exit(1);
+	}
+#endif
+	THREAD_T thread;
+	CREATE_THREAD_RETURN_T ret = CREATE_THREAD(thread, reactor_thread, 0);
+	if (!CREATE_THREAD_SUCCEEDED(ret))
+	{
+		fprintf(stderr, "Failed to create the reactor thread!\n");
+		exit(1);
+	}
+}
+
+bool WaitForSocket(SOCKET_T socket, int events, WORK_FUNC func, void *arg)
+{
+	SocketWait wait = { events, func, arg };
+	std::vector<SocketWait> others;
+	LOCK_MUTEX(&waitLock);
+	std::unordered_map<SOCKET_T, std::vector<SocketWait> >::iterator iter = waits.insert(std::make_pair(socket, std::vector<SocketWait>())).first;
+	iter->second.push_back(wait);
+	bool armed = ArmSocket(socket, PendingEvents(iter->second));
+	if (!armed)
+	{
+		iter->second.pop_back();
+		TakeSocketWaits(iter, others);
+	}
+	UNLOCK_MUTEX(&waitLock);
+
+	// Other waits on a socket that cannot be waited on would never fire either.
+	for(size_t i = 0; i < others.size(); ++i)
+		QueueWork(others[i].func, others[i].arg);
+	return armed;
+}
+
+void CancelSocketWaits(SOCKET_T socket)
+{
+	DispatchReadySocket(socket, SOCKET_WAIT_READ | SOCKET_WAIT_WRITE);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "posix_sockets.h"
+#include "work_queue.h"
+
+// The reactor waits for readiness of any number of sockets on a single thread, so that socket calls that would block
+// do not each need a thread of their own. Uses epoll on Linux, and poll() elsewhere.
+
+#define SOCKET_WAIT_READ 1
+#define SOCKET_WAIT_WRITE 2
+
+// Starts the thread that waits for socket readiness. Must be called once, after StartWorkerThreads().
+void StartReactor();
+
+// Queues func(arg) to a worker thread once the socket is readable or writable as requested by events, or has an error
+// or hang-up condition. Each wait fires only once, and several waits can be pending on the same socket. Returns false,
+// without queueing func, if the socket cannot be waited on, e.g. because it has already been closed.
+bool WaitForSocket(SOCKET_T socket, int events, WORK_FUNC func, void *arg);
+
+// Fires all waits pending on the given socket, e.g. because it has been closed and will never become ready.
+void CancelSocketWaits(SOCKET_T socket);
@@ -1,50 +1,123 @@
 #include "socket_registry.h"
+#include "reactor.h"
+#include "threads.h"
 
-#include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#include <algorithm>
 
 namespace
 {
-	std::map<int, std::vector<SOCKET_T> > socketsPerProxyConnection;
+	// Each socket is owned by at most one proxy connection, so ownership checks, which are done on every proxied call,
+	// look up the owner of the socket. The owners are split into shards with a lock of their own, so that worker
+	// threads processing calls of different sockets rarely contend.
+	const int NUM_OWNER_SHARDS = 16;
+
+	struct OwnerShard
+	{
+		MUTEX_T lock;
+		std::unordered_map<SOCKET_T, int> owners;
+		OwnerShard() { CREATE_MUTEX(&lock); }
+	} ownerShards[NUM_OWNER_SHARDS];
+
+	// The sockets of each proxy connection, so that they can be closed when the connection disconnects. Only touched when
+	// sockets are created or closed.
+	struct ConnectionSockets
+	{
+		MUTEX_T lock;
+		std::unordered_map<int, std::unordered_set<SOCKET_T> > sockets;
+		ConnectionSockets() { CREATE_MUTEX(&lock); }
+	} connectionSockets;
+}
+
+static OwnerShard &ShardOf(SOCKET_T socket)
+{
+	return ownerShards[(size_t)socket % NUM_OWNER_SHARDS];
+}
+
+// Removes the ownership of the socket, if it is owned by the given proxy connection. Returns true if it was.
+static bool RemoveOwner(int proxyConnection, SOCKET_T usedSocket)
+{
+	OwnerShard &shard = ShardOf(usedSocket);
+	LOCK_MUTEX(&shard.lock);
+	std::unordered_map<SOCKET_T, int>::iterator iter = shard.owners.find(usedSocket);
+	bool owned = (iter != shard.owners.end() && iter->second == proxyConnection);
+	if (owned) shard.owners.erase(iter);
+	UNLOCK_MUTEX(&shard.lock);
+	return owned;
 }
 
 void TrackSocketUsedByConnection(int proxyConnection, SOCKET_T usedSocket)
 {
 	if (usedSocket == 0) return;
-	if (IsSocketPartOfConnection(proxyConnection, usedSocket))
-		return;
-	socketsPerProxyConnection[proxyConnection].push_back(usedSocket);
+	LOCK_MUTEX(&connectionSockets.lock);
+	connectionSockets.sockets[proxyConnection].insert(usedSocket);
+	UNLOCK_MUTEX(&connectionSockets.lock);
+
+	OwnerShard &shard = ShardOf(usedSocket);
+	LOCK_MUTEX(&shard.lock);
+	shard.owners[usedSocket] = proxyConnection;
+	UNLOCK_MUTEX(&shard.lock);
 }
 
 void CloseSocketByConnection(int proxyConnection, SOCKET_T usedSocket)
 {
-	if (!IsSocketPartOfConnection(proxyConnection, usedSocket))
+	if (!RemoveOwner(proxyConnection, usedSocket))
 		return;
+	LOCK_MUTEX(&connectionSockets.lock);
+	std::unordered_map<int, std::unordered_set<SOCKET_T> >::iterator iter = connectionSockets.sockets.find(proxyConnection);
+	if (iter != connectionSockets.sockets.end())
+		iter->second.erase(usedSocket);
+	UNLOCK_MUTEX(&connectionSockets.lock);
+
 	printf("Closing socket fd %d used by proxy connection %d\n", (int)usedSocket, proxyConnection);
 	CLOSE_SOCKET(usedSocket);
-	std::vector<SOCKET_T> &sockets = socketsPerProxyConnection[proxyConnection];
-	sockets.erase(std::remove(sockets.begin(), sockets.end(), usedSocket), sockets.end());
+	// Wake up calls still waiting on the socket, they will find that it is no longer part of the connection and fail.
+	CancelSocketWaits(usedSocket);
 }
 
 void CloseAllSocketsByConnection(int proxyConnection)
 {
-	std::vector<SOCKET_T> &sockets = socketsPerProxyConnection[proxyConnection];
-	for(size_t i = 0; i < sockets.size(); ++i)
+	std::unordered_set<SOCKET_T> sockets;
+	LOCK_MUTEX(&connectionSockets.lock);
+	std::unordered_map<int, std::unordered_set<SOCKET_T> >::iterator iter = connectionSockets.sockets.find(proxyConnection);
+	if (iter != connectionSockets.sockets.end())
 	{
-		printf("Closing socket fd %d used by proxy connection %d.\n", (int)sockets[i], proxyConnection);
-		shutdown(sockets[i], SHUTDOWN_BIDIRECTIONAL);
-		CLOSE_SOCKET(sockets[i]);
+		sockets.swap(iter->second);
+		connectionSockets.sockets.erase(iter);
+	}
+	UNLOCK_MUTEX(&connectionSockets.lock);
+
+	for(std::unordered_set<SOCKET_T>::iterator s = sockets.begin(); s != sockets.end(); ++s)
+	{
+		if (!RemoveOwner(proxyConnection, *s))
+			continue;
+		printf("Closing socket fd %d used by proxy connection %d.\n", (int)*s, proxyConnection);
+		shutdown(*s, SHUTDOWN_BIDIRECTIONAL);
+		CLOSE_SOCKET(*s);
+		CancelSocketWaits(*s);
 	}
-	socketsPerProxyConnection.erase(proxyConnection);
 }
 
 bool IsSocketPartOfConnection(int proxyConnection, SOCKET_T usedSocket)
 {
 	if (usedSocket == 0) return true; // Allow all proxy connections to access "socket 0" when/if they need to refer to socket that does not exist.
-	if (socketsPerProxyConnection.find(proxyConnection) == socketsPerProxyConnection.end())
-		return false;
+	OwnerShard &shard = ShardOf(usedSocket);
+	LOCK_MUTEX(&shard.lock);
+	std::unordered_map<SOCKET_T, int>::iterator iter = shard.owners.find(usedSocket);
+	bool isPart = (iter != shard.owners.end() && iter->second == proxyConnection);
+	UNLOCK_MUTEX(&shard.lock);
+	return isPart;
+}
 
-	std::vector<SOCKET_T> &sockets = socketsPerProxyConnection[proxyConnection];
-	return std::find(sockets.begin(), sockets.end(), usedSocket) != sockets.end();
+bool WaitForSocketOfConnection(int proxyConnection, SOCKET_T usedSocket, int events, WORK_FUNC func, void *arg)
+{
+	// Ownership is removed under the shard lock before the socket is closed and its waits are cancelled, so a wait
+	// registered while the lock is held either sees the socket gone, or is woken up by the cancellation.
+	OwnerShard &shard = ShardOf(usedSocket);
+	LOCK_MUTEX(&shard.lock);
+	std::unordered_map<SOCKET_T, int>::iterator iter = shard.owners.find(usedSocket);
+	bool waiting = (iter != shard.owners.end() && iter->second == proxyConnection) && WaitForSocket(usedSocket, events, func, arg);
+	UNLOCK_MUTEX(&shard.lock);
+	return waiting;
 }
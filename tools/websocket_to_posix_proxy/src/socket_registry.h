@@ -1,9 +1,11 @@
 #pragma once
 
 #include "posix_sockets.h"
+#include "work_queue.h"
 
 // Socket Registry remembers all the sockets created by incoming proxy connections, so that those sockets can be properly
 // shut down when an incoming proxy connection disconnects.
+// The registry can be accessed from several threads at once.
 
 // Tracks that the given socket is part of the specified proxy connection. When proxyConnection disconnects, all sockets
 // used by it are shut down.
@@ -19,3 +21,7 @@ void CloseAllSocketsByConnection(int proxyConnection);
 // This is used to gate socket connections so that two proxy connections can not access
 // each others' sockets.
 bool IsSocketPartOfConnection(int proxyConnection, SOCKET_T usedSocket);
+
+// Waits for the given events on the socket as WaitForSocket() does, if the socket is still owned by the specified proxy
+// connection. Returns false, without queueing func, if it is not, or if the socket cannot be waited on.
+bool WaitForSocketOfConnection(int proxyConnection, SOCKET_T usedSocket, int events, WORK_FUNC func, void *arg);
@@ -0,0 +1,184 @@
+#include "websocket_frame_decoder.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UNMASK_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UNMASK_NEON
+#endif
+
+void WebSocketMessageUnmaskPayload(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey) // thread-safe, re-entrant
+{
+	uint8_t *data = payload;
+	uint8_t *end = payload + payloadLength;
+
+	// All the wide steps below are multiples of 4 bytes, so the mask stays in phase with the payload.
+#if defined(UNMASK_SSE2)
+	const __m128i mask = _mm_set1_epi32((int)maskingKey);
+	while(end - data >= 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)data);
+		__m128i b = _mm_loadu_si128((const __m128i*)(data + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(data + 32));
+		__m128i d = _mm_loadu_si128((const __m128i*)(data + 48));
+		_mm_storeu_si128((__m128i*)data, _mm_xor_si128(a, mask));
+		_mm_storeu_si128((__m128i*)(data + 16), _mm_xor_si128(b, mask));
+		_mm_storeu_si128((__m128i*)(data + 32), _mm_xor_si128(c, mask));
+		_mm_storeu_si128((__m128i*)(data + 48), _mm_xor_si128(d, mask));
+		data += 64;
+	}
+	while(end - data >= 16)
+	{
+		_mm_storeu_si128((__m128i*)data, _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), mask));
+		data += 16;
+	}
+#elif defined(UNMASK_NEON)
+	const uint8x16_t mask = vreinterpretq_u8_u32(vdupq_n_u32(maskingKey));
+	while(end - data >= 64)
+	{
+		uint8x16_t a = vld1q_u8(data);
+		uint8x16_t b = vld1q_u8(data + 16);
+		uint8x16_t c = vld1q_u8(data + 32);
+		uint8x16_t d = vld1q_u8(data + 48);
+		vst1q_u8(data, veorq_u8(a, mask));
+		vst1q_u8(data + 16, veorq_u8(b, mask));
+		vst1q_u8(data + 32, veorq_u8(c, mask));
+		vst1q_u8(data + 48, veorq_u8(d, mask));
+		data += 64;
+	}
+	while(end - data >= 16)
+	{
+		vst1q_u8(data, veorq_u8(vld1q_u8(data), mask));
+		data += 16;
+	}
+#endif
+
+	const uint64_t mask64 = ((uint64_t)maskingKey << 32) | maskingKey;
+	while(end - data >= 8)
+	{
+		uint64_t v;
+		memcpy(&v, data, 8);
+		v ^= mask64;
+		memcpy(data, &v, 8);
+		data += 8;
+	}
+
+	uint8_t maskingKey8[4];
+	memcpy(maskingKey8, &maskingKey, 4);
+	for(int i = 0; data < end; ++i)
+		*data++ ^= maskingKey8[i & 3];
+}
+
+uint8_t *WebSocketDecoderWritePointer(WebSocketFrameDecoder *decoder, size_t numBytes)
+{
+	if (decoder->readPos == decoder->writePos)
+		decoder->readPos = decoder->writePos = 0;
+
+	if (decoder->buffer.size() - decoder->writePos < numBytes)
+	{
+		// Move the undecoded data, at most one partially received frame, to the front before growing the buffer.
+		if (decoder->readPos > 0)
+		{
+			memmove(&decoder->buffer[0], &decoder->buffer[decoder->readPos], decoder->writePos - decoder->readPos);
+			decoder->writePos -= decoder->readPos;
+			decoder->readPos = 0;
+		}
+		if (decoder->buffer.size() - decoder->writePos < numBytes)
+			decoder->buffer.resize(decoder->writePos + numBytes);
+	}
+	return &decoder->buffer[decoder->writePos];
+}
+
+void WebSocketDecoderCommit(WebSocketFrameDecoder *decoder, size_t numBytes)
+{
+	decoder->writePos += numBytes;
+}
+
+int WebSocketDecoderNextMessage(WebSocketFrameDecoder *decoder, int *opcode, uint8_t **payload, uint64_t *payloadLength)
+{
+	decoder->assembledPayload.clear();
+
+	for(;;)
+	{
+		size_t available = decoder->writePos - decoder->readPos;
+		if (available < 2)
+			return WEBSOCKET_DECODE_NEED_MORE_DATA;
+		uint8_t *frame = &decoder->buffer[decoder->readPos];
+
+		bool fin = (frame[0] & 0x80) != 0;
+		int frameOpcode = frame[0] & 0x0F;
+		bool masked = (frame[1] & 0x80) != 0;
+		uint64_t length = frame[1] & 0x7F;
+		size_t headerBytes = 2;
+		if (length == 126)
+		{
+			if (available < 4) return WEBSOCKET_DECODE_NEED_MORE_DATA;
+			length = ((uint64_t)frame[2] << 8) | frame[3];
+			headerBytes = 4;
+		}
+		else if (length == 127)
+		{
+			if (available < 10) return WEBSOCKET_DECODE_NEED_MORE_DATA;
+			length = 0;
+			for(int i = 0; i < 8; ++i)
+				length = (length << 8) | frame[2+i];
+			headerBytes = 10;
+		}
+		uint32_t maskingKey = 0;
+		if (masked)
+		{
+			if (available < headerBytes + 4) return WEBSOCKET_DECODE_NEED_MORE_DATA;
+			memcpy(&maskingKey, frame + headerBytes, 4);
+			headerBytes += 4;
+		}
+		if (length > available - headerBytes)
+			return WEBSOCKET_DECODE_NEED_MORE_DATA;
+
+		uint8_t *framePayload = frame + headerBytes;
+		if (masked)
+			WebSocketMessageUnmaskPayload(framePayload, length, maskingKey);
+		decoder->readPos += headerBytes + (size_t)length;
+
+		if (frameOpcode >= 0x08)
+		{
+			// Control frames can appear in the middle of a fragmented message, but can not be fragmented themselves.
+			if (!fin || length > 125)
+				return WEBSOCKET_DECODE_ERROR;
+			*opcode = frameOpcode;
+			*payload = framePayload;
+			*payloadLength = length;
+			return WEBSOCKET_DECODE_MESSAGE;
+		}
+
+		if (frameOpcode == 0x00)
+		{
+			if (!decoder->fragmentedOpcode)
+				return WEBSOCKET_DECODE_ERROR; // Continuation frame without a message to continue
+			decoder->fragmentedPayload.insert(decoder->fragmentedPayload.end(), framePayload, framePayload + length);
+			if (!fin)
+				continue;
+			*opcode = decoder->fragmentedOpcode;
+			decoder->fragmentedOpcode = 0;
+			decoder->assembledPayload.swap(decoder->fragmentedPayload);
+			*payload = decoder->assembledPayload.empty() ? 0 : &decoder->assembledPayload[0];
+			*payloadLength = decoder->assembledPayload.size();
+			return WEBSOCKET_DECODE_MESSAGE;
+		}
+
+		if (decoder->fragmentedOpcode)
+			return WEBSOCKET_DECODE_ERROR; // New message before the previous fragmented message finished
+		if (!fin)
+		{
+			decoder->fragmentedOpcode = frameOpcode;
+			decoder->fragmentedPayload.assign(framePayload, framePayload + length);
+			continue;
+		}
+		*opcode = frameOpcode;
+		*payload = framePayload;
+		*payloadLength = length;
+		return WEBSOCKET_DECODE_MESSAGE;
+	}
+}
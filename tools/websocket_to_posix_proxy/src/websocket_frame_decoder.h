@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Incrementally decodes a stream of received WebSocket frames into messages. Received data is written directly into
+// the decoder's buffer, and decoded frames are consumed by advancing a read offset, so decoding takes time linear in
+// the amount of received data regardless of how many frames arrive in a single read. Fragmented messages are
+// reassembled from their continuation frames.
+struct WebSocketFrameDecoder
+{
+  // Received bytes that have not been decoded yet are at buffer[readPos, writePos).
+  std::vector<uint8_t> buffer;
+  size_t readPos;
+  size_t writePos;
+
+  // Opcode and payload received so far of a fragmented message, or 0 if no fragmented message is in progress.
+  int fragmentedOpcode;
+  std::vector<uint8_t> fragmentedPayload;
+
+  // Holds the payload of the last returned fragmented message.
+  std::vector<uint8_t> assembledPayload;
+
+  WebSocketFrameDecoder() : readPos(0), writePos(0), fragmentedOpcode(0) {}
+};
+
+#define WEBSOCKET_DECODE_ERROR -1
+#define WEBSOCKET_DECODE_NEED_MORE_DATA 0
+#define WEBSOCKET_DECODE_MESSAGE 1
+
+// Returns a pointer to where at most numBytes of newly received data can be written. Invalidates the payload pointers
+// returned by WebSocketDecoderNextMessage().
+uint8_t *WebSocketDecoderWritePointer(WebSocketFrameDecoder *decoder, size_t numBytes);
+
+// Marks numBytes of data written to the pointer returned by WebSocketDecoderWritePointer() as received.
+void WebSocketDecoderCommit(WebSocketFrameDecoder *decoder, size_t numBytes);
+
+// Decodes the next complete message from the received data. Returns WEBSOCKET_DECODE_MESSAGE and the unmasked payload
+// of the message, which stays valid until the next call to a decoder function. Returns WEBSOCKET_DECODE_NEED_MORE_DATA
+// if no complete message has been received yet, or WEBSOCKET_DECODE_ERROR if the stream violates the WebSocket
+// framing rules.
+int WebSocketDecoderNextMessage(WebSocketFrameDecoder *decoder, int *opcode, uint8_t **payload, uint64_t *payloadLength);
+
+// XORs the given payload with the masking key, which is in the byte order it was received in.
+void WebSocketMessageUnmaskPayload(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey);
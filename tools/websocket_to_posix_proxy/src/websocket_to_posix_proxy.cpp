@@ -6,9 +6,13 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <deque>
+#include <unordered_map>
 
 #include "websocket_to_posix_proxy.h"
 #include "socket_registry.h"
+#include "proxy_connection.h"
+#include "reactor.h"
 
 // Uncomment to enable debug printing
 // #define POSIX_SOCKET_DEBUG
@@ -72,33 +76,10 @@ static char *BufferToString(const void *buf, size_t len) // not thread-safe, but
   return buf_temp_str;
 }
 
-void WebSocketMessageUnmaskPayload(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey) // thread-safe, re-entrant
+// Writes the header of a binary WebSocket message with the given payload length, and returns its size in bytes.
+static int WriteWebSocketMessageHeader(uint8_t *headerData, uint64_t numBytes)
 {
-  uint8_t maskingKey8[4];
-  memcpy(maskingKey8, &maskingKey, 4);
-  uint32_t *data_u32 = (uint32_t *)payload;
-  uint32_t *end_u32 = (uint32_t *)((uintptr_t)(payload + (payloadLength & ~3u)));
-
-  while(data_u32 < end_u32)
-    *data_u32++ ^= maskingKey;
-
-  uint8_t *end = payload + payloadLength;
-  uint8_t *data = (uint8_t *)data_u32;
-  while(data < end)
-  {
-    *data ^= maskingKey8[(data-payload) % 4];
-    ++data;
-  }
-}
-
-extern MUTEX_T webSocketSendLock;
-
-void SendWebSocketMessage(int client_fd, void *buf, uint64_t numBytes)
-{
-  // Guard send() calls to the client_fd socket so that two threads won't ever race to send to the 
-  // same socket. (This could be per-socket, currently global for simplicity)
-  LOCK_MUTEX(&webSocketSendLock);
-  uint8_t headerData[sizeof(WebSocketMessageHeader) + 8/*possible extended length*/] = {};
+  memset(headerData, 0, sizeof(WebSocketMessageHeader));
   WebSocketMessageHeader *header = (WebSocketMessageHeader *)headerData;
   header->opcode = 0x02;
   header->fin = 1;
@@ -109,15 +90,50 @@ void SendWebSocketMessage(int client_fd, void *buf, uint64_t numBytes)
   else if (numBytes <= 65535)
   {
     header->payloadLength = 126;
-    *(uint16_t*)(headerData+headerBytes) = htons((unsigned short)numBytes);
+    uint16_t length = htons((unsigned short)numBytes);
+    memcpy(headerData+headerBytes, &length, sizeof(length));
     headerBytes += 2;
   }
   else
   {
     header->payloadLength = 127;
-    *(uint64_t*)(headerData+headerBytes) = hton64(numBytes);
+    uint64_t length = hton64(numBytes);
+    memcpy(headerData+headerBytes, &length, sizeof(length));
     headerBytes += 8;
   }
+  return headerBytes;
+}
+
+// Sends all of the given buffers, continuing after partial sends.
+static bool SendAllIovecs(SOCKET_T socket, IOVEC_T *iovecs, int numIovecs)
+{
+  while(numIovecs > 0)
+  {
+    SEND_RET_TYPE sent = SEND_IOVECS(socket, iovecs, numIovecs);
+    if (sent < 0) return false;
+    while(numIovecs > 0 && (size_t)sent >= IOVEC_LENGTH(*iovecs))
+    {
+      sent -= IOVEC_LENGTH(*iovecs);
+      ++iovecs;
+      --numIovecs;
+    }
+    if (numIovecs > 0)
+      SET_IOVEC(*iovecs, IOVEC_DATA(*iovecs) + sent, IOVEC_LENGTH(*iovecs) - sent);
+  }
+  return true;
+}
+
+void SendWebSocketMessage(int client_fd, void *buf, uint64_t numBytes)
+{
+  ProxyConnection *connection = AcquireProxyConnection(client_fd);
+  if (!connection)
+  {
+    fprintf(stderr, "SendWebSocketMessage(): proxy connection client_fd=%d has already been closed\n", client_fd);
+    return;
+  }
+
+  uint8_t headerData[sizeof(WebSocketMessageHeader) + 8/*possible extended length*/];
+  int headerBytes = WriteWebSocketMessageHeader(headerData, numBytes);
 
 #ifdef POSIX_SOCKET_DEEP_DEBUG
   printf("Sending %llu bytes message (%llu bytes of payload) to WebSocket\n", headerBytes + numBytes, numBytes);
@@ -132,9 +148,41 @@ void SendWebSocketMessage(int client_fd, void *buf, uint64_t numBytes)
   printf("\n");
 #endif
 
-  send(client_fd, (const char*)headerData, headerBytes, 0); // header
-  send(client_fd, (const char*)buf, (int)numBytes, 0); // payload
-  UNLOCK_MUTEX(&webSocketSendLock);
+  // Only one thread sends to the client_fd socket at a time, so that messages are never interleaved. If another thread
+  // is already sending, leave the message for it to send, instead of waiting for it to finish.
+  LOCK_MUTEX(&connection->sendLock);
+  if (connection->sending)
+  {
+    std::vector<uint8_t> &queue = connection->queuedReplies;
+    queue.insert(queue.end(), headerData, headerData + headerBytes);
+    queue.insert(queue.end(), (uint8_t*)buf, (uint8_t*)buf + numBytes);
+    UNLOCK_MUTEX(&connection->sendLock);
+    ReleaseProxyConnection(connection);
+    return;
+  }
+  connection->sending = true;
+  UNLOCK_MUTEX(&connection->sendLock);
+
+  IOVEC_T iovecs[2];
+  SET_IOVEC(iovecs[0], headerData, headerBytes);
+  SET_IOVEC(iovecs[1], buf, (size_t)numBytes);
+  SendAllIovecs(connection->client_fd, iovecs, 2);
+
+  // Send the replies that other threads queued up meanwhile, all of them with one call.
+  std::vector<uint8_t> replies;
+  LOCK_MUTEX(&connection->sendLock);
+  while(!connection->queuedReplies.empty())
+  {
+    replies.swap(connection->queuedReplies);
+    UNLOCK_MUTEX(&connection->sendLock);
+    SET_IOVEC(iovecs[0], &replies[0], replies.size());
+    SendAllIovecs(connection->client_fd, iovecs, 1);
+    replies.clear();
+    LOCK_MUTEX(&connection->sendLock);
+  }
+  connection->sending = false;
+  UNLOCK_MUTEX(&connection->sendLock);
+  ReleaseProxyConnection(connection);
 }
 
 #define MUSL_PF_UNSPEC       0
@@ -907,7 +955,10 @@ void Bind(int client_fd, uint8_t *data, uint64_t numBytes) // int bind(int socke
   SendWebSocketMessage(client_fd, &r, sizeof(r));
 }
 
-void Connect(int client_fd, uint8_t *data, uint64_t numBytes) // int connect(int socket, const struct sockaddr *address, socklen_t address_len);
+// Socket calls that could block return false if they were not able to complete yet. In that case no reply has been sent,
+// and the call should be resumed once its socket becomes ready.
+
+bool Connect(int client_fd, uint8_t *data, uint64_t numBytes, bool resumed) // int connect(int socket, const struct sockaddr *address, socklen_t address_len);
 {
   struct MSG {
     SocketCallHeader header;
@@ -923,8 +974,24 @@ void Connect(int client_fd, uint8_t *data, uint64_t numBytes) // int connect(int
 
   if (IsSocketPartOfConnection(client_fd, d->socket))
   {
-    ret = connect(d->socket, (sockaddr*)d->address, actualAddressLen);
-    errorCode = (ret != 0) ? GET_SOCKET_ERROR() : 0;
+    if (!resumed)
+    {
+      // Connect in nonblocking mode, and wait for the socket to become writable if the connection is not established
+      // immediately.
+      SET_SOCKET_BLOCKING(d->socket, false);
+      ret = connect(d->socket, (sockaddr*)d->address, actualAddressLen);
+      errorCode = (ret != 0) ? GET_SOCKET_ERROR() : 0;
+      if (ret != 0 && SOCKET_WOULD_BLOCK(errorCode))
+        return false;
+    }
+    else
+    {
+      socklen_t errorCodeLen = sizeof(errorCode);
+      errorCode = 0;
+      getsockopt(d->socket, SOL_SOCKET, SO_ERROR, (char*)&errorCode, &errorCodeLen);
+      ret = errorCode ? -1 : 0;
+    }
+    SET_SOCKET_BLOCKING(d->socket, true);
 #ifdef POSIX_SOCKET_DEBUG
     printf("connect(socket=%d,address=%p,address_len=%d, address=\"%s\")->%d\n", d->socket, d->address, d->address_len, BufferToString(d->address, actualAddressLen), ret);
     if (errorCode) PRINT_SOCKET_ERROR(errorCode);
@@ -943,8 +1010,9 @@ void Connect(int client_fd, uint8_t *data, uint64_t numBytes) // int connect(int
   } r;
   r.callId = d->header.callId;
   r.ret = ret;
-  r.errno_ = (ret != 0) ? errno : 0;
+  r.errno_ = (ret != 0) ? errorCode : 0;
   SendWebSocketMessage(client_fd, &r, sizeof(r));
+  return true;
 }
 
 void Listen(int client_fd, uint8_t *data, uint64_t numBytes) // int listen(int socket, int backlog);
@@ -984,7 +1052,7 @@ void Listen(int client_fd, uint8_t *data, uint64_t numBytes) // int listen(int s
   SendWebSocketMessage(client_fd, &r, sizeof(r));
 }
 
-void Accept(int client_fd, uint8_t *data, uint64_t numBytes) // int accept(int socket, struct sockaddr *address, socklen_t *address_len);
+bool Accept(int client_fd, uint8_t *data, uint64_t numBytes, bool /*resumed*/) // int accept(int socket, struct sockaddr *address, socklen_t *address_len);
 {
   struct MSG {
     SocketCallHeader header;
@@ -1004,8 +1072,14 @@ void Accept(int client_fd, uint8_t *data, uint64_t numBytes) // int accept(int s
 #ifdef POSIX_SOCKET_DEBUG
     printf("accept(socket=%d,address=%p,address_len=%u, address=\"%s\")\n", d->socket, address, d->address_len, BufferToString(address, addressLen));
 #endif
+    SET_SOCKET_BLOCKING(d->socket, false);
     ret = accept(d->socket, d->address_len ? (sockaddr*)address : 0, d->address_len ? &addressLen : 0);
     errorCode = (ret < 0) ? GET_SOCKET_ERROR() : 0;
+    SET_SOCKET_BLOCKING(d->socket, true);
+    if (ret < 0 && SOCKET_WOULD_BLOCK(errorCode))
+      return false;
+    if (ret > 0)
+      SET_SOCKET_BLOCKING(ret, true); // Accepted sockets may inherit the nonblocking mode of the listening socket.
 
 #ifdef POSIX_SOCKET_DEBUG
     printf("accept returned %d (address=\"%s\")\n", ret, BufferToString(address, addressLen));
@@ -1043,6 +1117,7 @@ void Accept(int client_fd, uint8_t *data, uint64_t numBytes) // int accept(int s
   memcpy(r->address, address, actualAddressLen);
   SendWebSocketMessage(client_fd, r, resultSize);
   free(r);
+  return true;
 }
 
 void Getsockname(int client_fd, uint8_t *data, uint64_t numBytes) // int getsockname(int socket, struct sockaddr *address, socklen_t *address_len);
@@ -1146,7 +1221,53 @@ void Getpeername(int client_fd, uint8_t *data, uint64_t numBytes) // int getpeer
   free(r);
 }
 
-void Send(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int send(int socket, const void *message, size_t length, int flags);
+#define MUSL_MSG_DONTWAIT 0x0040
+
+// Tests if a send() or recv() type call that could not transfer anything should wait for its socket to become ready,
+// instead of replying. This is the case unless the caller asked for a nonblocking call.
+static bool ShouldWaitForSocket(int ret, int errorCode, int flags)
+{
+  return ret < 0 && SOCKET_WOULD_BLOCK(errorCode) && !(flags & MUSL_MSG_DONTWAIT);
+}
+
+// send() and sendto() are done without blocking as well: a blocking send() with a full send buffer would hold up a
+// worker thread until the peer reads. Instead, whatever fits in the send buffer is sent, and the call waits for the socket
+// to become writable to send the rest. *sentBytes keeps count of what has been sent across attempts. Like a blocking
+// send(), the call only replies once the whole message has been sent, or an error occurs; a call with MSG_DONTWAIT
+// replies with whatever it could send right away. Returns false if the call has to wait, or else the result to reply
+// with in ret and errorCode.
+static bool SendWithoutBlocking(SOCKET_T socket, const uint8_t *message, uint32_t length, int flags, const sockaddr *destAddr, socklen_t destLen, uint64_t *sentBytes, SEND_RET_TYPE &ret, int &errorCode)
+{
+  uint64_t sent = *sentBytes;
+  for(;;)
+  {
+    const char *rest = (const char *)message + sent;
+    size_t restLength = (size_t)(length - sent);
+    ret = destAddr ? sendto(socket, rest, restLength, flags | RECV_NONBLOCKING_FLAG, destAddr, destLen)
+                   : send(socket, rest, restLength, flags | RECV_NONBLOCKING_FLAG);
+    errorCode = (ret < 0) ? GET_SOCKET_ERROR() : 0;
+    if (ShouldWaitForSocket((int)ret, errorCode, flags))
+    {
+      *sentBytes = sent;
+      return false;
+    }
+    if (ret <= 0)
+      break;
+    sent += ret;
+    if (sent >= length || (flags & MUSL_MSG_DONTWAIT))
+      break;
+  }
+  *sentBytes = sent;
+  // What has been sent before an error is reported as sent, the error will come up again on the next call.
+  if (sent > 0)
+  {
+    ret = (SEND_RET_TYPE)sent;
+    errorCode = 0;
+  }
+  return true;
+}
+
+bool Send(int client_fd, uint8_t *data, uint64_t numBytes, bool resumed, uint64_t *sentBytes) // ssize_t/int send(int socket, const void *message, size_t length, int flags);
 {
   struct MSG {
     SocketCallHeader header;
@@ -1163,8 +1284,10 @@ void Send(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int send(i
 
   if (IsSocketPartOfConnection(client_fd, d->socket))
   {
-    ret = send(d->socket, (const char *)d->message, actualBytes, d->flags);
-    errorCode = (ret != 0) ? GET_SOCKET_ERROR() : 0;
+    if (!resumed && !RECV_NONBLOCKING_FLAG && !(d->flags & MUSL_MSG_DONTWAIT))
+      return false;
+    if (!SendWithoutBlocking(d->socket, d->message, actualBytes, d->flags, 0, 0, sentBytes, ret, errorCode))
+      return false;
 
 #ifdef POSIX_SOCKET_DEBUG
     printf("send(socket=%d,message=%p,length=%zd,flags=%d, data=\"%s\")->" SEND_FORMATTING_SPECIFIER "\n", d->socket, d->message, d->length, d->flags, BufferToString(d->message, d->length), ret);
@@ -1184,11 +1307,12 @@ void Send(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int send(i
   } r;
   r.callId = d->header.callId;
   r.ret = (int)ret;
-  r.errno_ = (ret != 0) ? errno : 0;
+  r.errno_ = errorCode;
   SendWebSocketMessage(client_fd, &r, sizeof(r));
+  return true;
 }
 
-void Recv(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int recv(int socket, void *buffer, size_t length, int flags);
+bool Recv(int client_fd, uint8_t *data, uint64_t numBytes, bool resumed) // ssize_t/int recv(int socket, void *buffer, size_t length, int flags);
 {
   struct MSG {
     SocketCallHeader header;
@@ -1198,19 +1322,35 @@ void Recv(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int recv(i
   };
   MSG *d = (MSG*)data;
 
-  uint8_t *buffer = (uint8_t*)malloc(d->length);
+  struct Result {
+    int callId;
+    int/*ssize_t/int*/ ret;
+    int errno_;
+    uint8_t data[];
+  };
+
   SEND_RET_TYPE ret;
   int errorCode;
   int receivedBytes;
+  Result *r;
 
   if (IsSocketPartOfConnection(client_fd, d->socket))
   {
-    ret = recv(d->socket, (char *)buffer, d->length, d->flags);
+    if (!resumed && !RECV_NONBLOCKING_FLAG && !(d->flags & MUSL_MSG_DONTWAIT))
+      return false;
+    // Receive directly into the result message.
+    r = (Result *)malloc(sizeof(Result) + d->length);
+    ret = recv(d->socket, (char *)r->data, d->length, d->flags | RECV_NONBLOCKING_FLAG);
     errorCode = (ret != 0) ? GET_SOCKET_ERROR() : 0;
+    if (ShouldWaitForSocket((int)ret, errorCode, d->flags))
+    {
+      free(r);
+      return false;
+    }
     receivedBytes = MAX(ret, 0);
 
 #ifdef POSIX_SOCKET_DEBUG
-    printf("recv(socket=%d,buffer=%p,length=%zd,flags=%d)->" SEND_FORMATTING_SPECIFIER " received \"%s\"\n", d->socket, buffer, d->length, d->flags, ret, BufferToString(buffer, receivedBytes));
+    printf("recv(socket=%d,buffer=%p,length=%zd,flags=%d)->" SEND_FORMATTING_SPECIFIER " received \"%s\"\n", d->socket, r->data, d->length, d->flags, ret, BufferToString(r->data, receivedBytes));
     if (errorCode) PRINT_SOCKET_ERROR(errorCode);
 #endif
   }
@@ -1219,26 +1359,19 @@ void Recv(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int recv(i
     fprintf(stderr, "recv(): Proxy client connection client_fd=%d attempted to call recv() on a socket fd=%d that it did not create (or has already shut down)\n", client_fd, d->socket);
     ret = errorCode = -1;
     receivedBytes = 0;
+    r = (Result *)malloc(sizeof(Result));
   }
 
-  struct Result {
-    int callId;
-    int/*ssize_t/int*/ ret;
-    int errno_;
-    uint8_t data[];
-  };
   int resultSize = sizeof(Result) + receivedBytes;
-  Result *r = (Result *)malloc(resultSize);
   r->callId = d->header.callId;
   r->ret = (int)ret;
   r->errno_ = errorCode;
-  memcpy(r->data, buffer, receivedBytes);
-  free(buffer);
   SendWebSocketMessage(client_fd, r, resultSize);
   free(r);
+  return true;
 }
 
-void Sendto(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int sendto(int socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len);
+bool Sendto(int client_fd, uint8_t *data, uint64_t numBytes, bool resumed, uint64_t *sentBytes) // ssize_t/int sendto(int socket, const void *message, size_t length, int flags, const struct sockaddr *dest_addr, socklen_t dest_len);
 {
   struct MSG {
     SocketCallHeader header;
@@ -1256,8 +1389,10 @@ void Sendto(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int send
 
   if (IsSocketPartOfConnection(client_fd, d->socket))
   {
-    ret = sendto(d->socket, (const char *)d->message, d->length, d->flags, (sockaddr*)d->dest_addr, d->dest_len);
-    errorCode = (ret != 0) ? GET_SOCKET_ERROR() : 0;
+    if (!resumed && !RECV_NONBLOCKING_FLAG && !(d->flags & MUSL_MSG_DONTWAIT))
+      return false;
+    if (!SendWithoutBlocking(d->socket, d->message, d->length, d->flags, (sockaddr*)d->dest_addr, d->dest_len, sentBytes, ret, errorCode))
+      return false;
 
 #ifdef POSIX_SOCKET_DEBUG
     printf("sendto(socket=%d,message=%p,length=%zd,flags=%d,dest_addr=%p,dest_len=%d)->" SEND_FORMATTING_SPECIFIER "\n", d->socket, d->message, d->length, d->flags, d->dest_addr, d->dest_len, ret);
@@ -1277,11 +1412,12 @@ void Sendto(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int send
   } r;
   r.callId = d->header.callId;
   r.ret = (int)ret;
-  r.errno_ = (ret != 0) ? errno : 0;
+  r.errno_ = errorCode;
   SendWebSocketMessage(client_fd, &r, sizeof(r));
+  return true;
 }
 
-void Recvfrom(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int recvfrom(int socket, void *buffer, size_t length, int flags, struct sockaddr *address, socklen_t *address_len);
+bool Recvfrom(int client_fd, uint8_t *data, uint64_t numBytes, bool resumed) // ssize_t/int recvfrom(int socket, void *buffer, size_t length, int flags, struct sockaddr *address, socklen_t *address_len);
 {
   struct MSG {
     SocketCallHeader header;
@@ -1292,19 +1428,36 @@ void Recvfrom(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int re
   };
   MSG *d = (MSG*)data;
 
-  uint8_t address[MAX_SOCKADDR_SIZE];
-  uint8_t *buffer = (uint8_t *)malloc(d->length);
+  struct Result {
+    int callId;
+    int/*ssize_t/int*/ ret;
+    int errno_;
+    int data_len;
+    int address_len; // N.B. this is the reported address length of the sender, that may be larger than what is actually serialized to this message.
+    uint8_t data_and_address[];
+  };
 
-  socklen_t address_len = (socklen_t)d->address_len;
+  uint8_t address[MAX_SOCKADDR_SIZE];
+  socklen_t address_len = (socklen_t)MIN(d->address_len, MAX_SOCKADDR_SIZE);
 
   int ret, errorCode, receivedBytes;
+  Result *r;
 
   if (IsSocketPartOfConnection(client_fd, d->socket))
   {
-    ret = recvfrom(d->socket, (char *)buffer, d->length, d->flags, (sockaddr*)address, &address_len);
+    if (!resumed && !RECV_NONBLOCKING_FLAG && !(d->flags & MUSL_MSG_DONTWAIT))
+      return false;
+    // Receive directly into the result message, the sender address is copied after the data.
+    r = (Result *)malloc(sizeof(Result) + d->length + address_len);
+    ret = recvfrom(d->socket, (char *)r->data_and_address, d->length, d->flags | RECV_NONBLOCKING_FLAG, (sockaddr*)address, &address_len);
     errorCode = (ret != 0) ? GET_SOCKET_ERROR() : 0;
+    if (ShouldWaitForSocket(ret, errorCode, d->flags))
+    {
+      free(r);
+      return false;
+    }
 #ifdef POSIX_SOCKET_DEBUG
-    printf("recvfrom(socket=%d,buffer=%p,length=%zd,flags=%d,address=%p,address_len=%u, address=\"%s\")->%d\n", d->socket, buffer, d->length, d->flags, address, d->address_len, BufferToString(address, address_len), ret);
+    printf("recvfrom(socket=%d,buffer=%p,length=%zd,flags=%d,address=%p,address_len=%u, address=\"%s\")->%d\n", d->socket, r->data_and_address, d->length, d->flags, address, d->address_len, BufferToString(address, address_len), ret);
     if (errorCode) PRINT_SOCKET_ERROR(errorCode);
 #endif
     receivedBytes = MAX(ret, 0);
@@ -1315,47 +1468,55 @@ void Recvfrom(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int re
     ret = errorCode = -1;
     receivedBytes = 0;
     address_len = 0;
+    r = (Result *)malloc(sizeof(Result));
   }
 
-  int actualAddressLen = MIN(address_len, (socklen_t)d->address_len);
-
-  struct Result {
-    int callId;
-    int/*ssize_t/int*/ ret;
-    int errno_;
-    int data_len;
-    int address_len; // N.B. this is the reported address length of the sender, that may be larger than what is actually serialized to this message.
-    uint8_t data_and_address[];
-  };
+  int actualAddressLen = MIN(MIN(address_len, (socklen_t)d->address_len), MAX_SOCKADDR_SIZE);
   int resultSize = sizeof(Result) + receivedBytes + actualAddressLen;
-  Result *r = (Result *)malloc(resultSize);
   r->callId = d->header.callId;
   r->ret = (int)ret;
   r->errno_ = errorCode;
   r->data_len = receivedBytes;
   r->address_len = d->address_len; // How many bytes would have been needed to fit the whole sender address, not the actual size provided
-  memcpy(r->data_and_address, buffer, receivedBytes);
   memcpy(r->data_and_address + receivedBytes, address, actualAddressLen);
   SendWebSocketMessage(client_fd, r, resultSize);
   free(r);
+  return true;
+}
+
+// Replies to a socket call that failed before it could be run, in the result layout of the call.
+static void SendCallError(int client_fd, uint8_t *data, int errorCode)
+{
+  SocketCallHeader *header = (SocketCallHeader*)data;
+  struct {
+    int callId;
+    int ret;
+    int errno_;
+    int extra[2]; // Accept: address_len, Recvfrom: data_len and address_len
+  } r = {};
+  r.callId = header->callId;
+  r.ret = -1;
+  r.errno_ = errorCode;
+  int numExtra = (header->function == POSIX_SOCKET_MSG_ACCEPT) ? 1 : ((header->function == POSIX_SOCKET_MSG_RECVFROM) ? 2 : 0);
+  SendWebSocketMessage(client_fd, &r, sizeof(r) - sizeof(r.extra) + numExtra * sizeof(int));
 }
 
-void Sendmsg(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int sendmsg(int socket, const struct msghdr *message, int flags);
+// sendmsg() and recvmsg() have no wire format for the msghdr, so they fail with ENOSYS, replying so that the caller is
+// not left waiting.
+void Sendmsg(int client_fd, uint8_t *data, uint64_t /*numBytes*/) // ssize_t/int sendmsg(int socket, const struct msghdr *message, int flags);
 {
-	printf("TODO implement sendmsg()\n");
 #ifdef POSIX_SOCKET_DEBUG
-//  printf("sendmsg(socket=%d,message=%p,flags=%d)\n", d->socket, d->message, d->flags);
+  printf("sendmsg() is not supported\n");
 #endif
-
-  // TODO
+  SendCallError(client_fd, data, ENOSYS);
 }
 
-void Recvmsg(int client_fd, uint8_t *data, uint64_t numBytes) // ssize_t/int recvmsg(int socket, struct msghdr *message, int flags);
+void Recvmsg(int client_fd, uint8_t *data, uint64_t /*numBytes*/) // ssize_t/int recvmsg(int socket, struct msghdr *message, int flags);
 {
-	printf("TODO implement recvmsg()\n");
 #ifdef POSIX_SOCKET_DEBUG
-//  printf("recvmsg(socket=%d,message=%p,flags=%d)\n", d->socket, d->message, d->flags);
+  printf("recvmsg() is not supported\n");
 #endif
+  SendCallError(client_fd, data, ENOSYS);
 }
 
 void Getsockopt(int client_fd, uint8_t *data, uint64_t numBytes) // int getsockopt(int socket, int level, int option_name, void *option_value, socklen_t *option_len);
@@ -1584,40 +1745,47 @@ static void *memdup(const void *ptr, size_t sz)
   return dup;
 }
 
-struct MessageArg
+// A socket call that is waiting for its socket to become ready, or for the calls received before it on the same socket
+// to complete. Holds a reference to the proxy connection so that the connection stays open until the call has replied.
+struct PendingCall
 {
-  int client_fd;
+  ProxyConnection *connection;
   uint8_t *payload;
   uint64_t numBytes;
+  SOCKET_T socket;
+  int events; // SOCKET_WAIT_READ or SOCKET_WAIT_WRITE, what the call waits for
+  bool attempted; // The call has already been run, but could not complete without blocking
+  uint64_t sentBytes; // How much of the message of a send() or sendto() has been sent
 };
 
-void ProcessWebSocketMessageSynchronouslyInCurrentThread(int client_fd, uint8_t *payload, uint64_t numBytes);
+namespace
+{
+  // The calls waiting on each socket, in the order they were received, with a queue for reading and one for writing.
+  // Only the call at the head of a queue waits for the socket, and the calls after it run once it has completed, so that
+  // e.g. the messages of pipelined send()s reach the socket in order, and later calls do not overtake them. Calls are
+  // only added by the reader of the proxy connection that owns the socket, and removed by the calls that complete.
+  const int NUM_PENDING_SHARDS = 16;
 
-THREAD_RETURN_T message_processing_thread(void *arg)
+  struct PendingShard
+  {
+    MUTEX_T lock;
+    std::unordered_map<SOCKET_T, std::deque<PendingCall*> > queues[2]; // Indexed by whether the calls write
+    PendingShard() { CREATE_MUTEX(&lock); }
+  } pendingShards[NUM_PENDING_SHARDS];
+}
+
+static PendingShard &PendingShardOf(SOCKET_T socket)
 {
-  MessageArg *msg = (MessageArg*)arg;
-  assert(msg);
-  assert(msg->client_fd);
-  ProcessWebSocketMessageSynchronouslyInCurrentThread(msg->client_fd, msg->payload, msg->numBytes);
-  free(msg->payload);
-  free(msg);
-  EXIT_THREAD(0);
+  return pendingShards[(size_t)socket % NUM_PENDING_SHARDS];
 }
 
-// Offloads the processing of the given message to a background thread.
-void ProcessWebSocketMessageAsynchronouslyInBackgroundThread(int client_fd, uint8_t *payload, uint64_t numBytes)
+static std::unordered_map<SOCKET_T, std::deque<PendingCall*> > &PendingQueuesOf(PendingShard &shard, int events)
 {
-  MessageArg *arg = (MessageArg*)malloc(sizeof(MessageArg));
-  arg->client_fd = client_fd;
-  arg->payload = (uint8_t*)memdup(payload, (size_t)numBytes);
-  arg->numBytes = numBytes;
-  THREAD_T thread;
-  // TODO: Instead of unconditionally always creating a thread here, create a thread pool and push messages to it.
-  // (leaving this as a future optimization because not sure if it matters here much at all for performance)
-	CREATE_THREAD(thread, message_processing_thread, arg);
+  return shard.queues[events == SOCKET_WAIT_WRITE ? 1 : 0];
 }
 
-void ProcessWebSocketMessageSynchronouslyInCurrentThread(int client_fd, uint8_t *payload, uint64_t numBytes)
+// Runs the given socket call, returning false if it could not complete without blocking.
+static bool ProcessSocketCall(int client_fd, uint8_t *payload, uint64_t numBytes, bool resumed, uint64_t *sentBytes)
 {
   assert(numBytes >= sizeof(SocketCallHeader)); // Already validated in ProcessWebSocketMessage() before coming here, so we should be good.
   SocketCallHeader *header = (SocketCallHeader*)payload;
@@ -1627,15 +1795,15 @@ void ProcessWebSocketMessageSynchronouslyInCurrentThread(int client_fd, uint8_t
     case POSIX_SOCKET_MSG_SOCKETPAIR: Socketpair(client_fd, payload, numBytes); break;
     case POSIX_SOCKET_MSG_SHUTDOWN: Shutdown(client_fd, payload, numBytes); break;
     case POSIX_SOCKET_MSG_BIND: Bind(client_fd, payload, numBytes); break;
-    case POSIX_SOCKET_MSG_CONNECT: Connect(client_fd, payload, numBytes); break;
+    case POSIX_SOCKET_MSG_CONNECT: return Connect(client_fd, payload, numBytes, resumed);
     case POSIX_SOCKET_MSG_LISTEN: Listen(client_fd, payload, numBytes); break;
-    case POSIX_SOCKET_MSG_ACCEPT: Accept(client_fd, payload, numBytes); break;
+    case POSIX_SOCKET_MSG_ACCEPT: return Accept(client_fd, payload, numBytes, resumed);
     case POSIX_SOCKET_MSG_GETSOCKNAME: Getsockname(client_fd, payload, numBytes); break;
     case POSIX_SOCKET_MSG_GETPEERNAME: Getpeername(client_fd, payload, numBytes); break;
-    case POSIX_SOCKET_MSG_SEND: Send(client_fd, payload, numBytes); break;
-    case POSIX_SOCKET_MSG_RECV: Recv(client_fd, payload, numBytes); break;
-    case POSIX_SOCKET_MSG_SENDTO: Sendto(client_fd, payload, numBytes); break;
-    case POSIX_SOCKET_MSG_RECVFROM: Recvfrom(client_fd, payload, numBytes); break;
+    case POSIX_SOCKET_MSG_SEND: return Send(client_fd, payload, numBytes, resumed, sentBytes);
+    case POSIX_SOCKET_MSG_RECV: return Recv(client_fd, payload, numBytes, resumed);
+    case POSIX_SOCKET_MSG_SENDTO: return Sendto(client_fd, payload, numBytes, resumed, sentBytes);
+    case POSIX_SOCKET_MSG_RECVFROM: return Recvfrom(client_fd, payload, numBytes, resumed);
     case POSIX_SOCKET_MSG_SENDMSG: Sendmsg(client_fd, payload, numBytes); break;
     case POSIX_SOCKET_MSG_RECVMSG: Recvmsg(client_fd, payload, numBytes); break;
     case POSIX_SOCKET_MSG_GETSOCKOPT: Getsockopt(client_fd, payload, numBytes); break;
@@ -1645,7 +1813,99 @@ void ProcessWebSocketMessageSynchronouslyInCurrentThread(int client_fd, uint8_t
     default:
       printf("Unknown POSIX_SOCKET_MSG %u received!\n", header->function);
       break;
-	}
+  }
+  return true;
+}
+
+// Finds the socket and the readiness that the given call may have to wait for. Returns false for calls that never wait.
+// Those calls all operate on a socket that immediately follows the call header in the message.
+static bool GetWaitOfCall(uint8_t *payload, uint64_t numBytes, SOCKET_T &socket, int &events)
+{
+  switch(((SocketCallHeader*)payload)->function)
+  {
+    case POSIX_SOCKET_MSG_CONNECT:
+    case POSIX_SOCKET_MSG_SEND:
+    case POSIX_SOCKET_MSG_SENDTO:
+      events = SOCKET_WAIT_WRITE;
+      break;
+    case POSIX_SOCKET_MSG_ACCEPT:
+    case POSIX_SOCKET_MSG_RECV:
+    case POSIX_SOCKET_MSG_RECVFROM:
+      events = SOCKET_WAIT_READ;
+      break;
+    default:
+      return false;
+  }
+  if (numBytes < sizeof(SocketCallHeader) + sizeof(int))
+    return false;
+  socket = *(int*)(payload + sizeof(SocketCallHeader));
+  return true;
+}
+
+static PendingCall *CreatePendingCall(int client_fd, uint8_t *payload, uint64_t numBytes, SOCKET_T socket, int events)
+{
+  PendingCall *call = (PendingCall*)malloc(sizeof(PendingCall));
+  call->connection = AcquireProxyConnection(client_fd);
+  call->payload = (uint8_t*)memdup(payload, (size_t)numBytes);
+  call->numBytes = numBytes;
+  call->socket = socket;
+  call->events = events;
+  call->attempted = false;
+  call->sentBytes = 0;
+  return call;
+}
+
+// Removes the given call, which has replied, from the head of its queue and frees it. Returns the call that is now at the
+// head of the queue, or 0 if there is none.
+static PendingCall *FinishPendingCall(PendingCall *call)
+{
+  PendingShard &shard = PendingShardOf(call->socket);
+  std::unordered_map<SOCKET_T, std::deque<PendingCall*> > &queues = PendingQueuesOf(shard, call->events);
+  LOCK_MUTEX(&shard.lock);
+  std::unordered_map<SOCKET_T, std::deque<PendingCall*> >::iterator iter = queues.find(call->socket);
+  assert(iter != queues.end() && iter->second.front() == call);
+  iter->second.pop_front();
+  PendingCall *next = iter->second.empty() ? 0 : iter->second.front();
+  if (!next)
+    queues.erase(iter);
+  UNLOCK_MUTEX(&shard.lock);
+
+  ReleaseProxyConnection(call->connection);
+  free(call->payload);
+  free(call);
+  return next;
+}
+
+static void ResumePendingCall(void *arg);
+
+// Parks the call at the head of its queue until its socket becomes ready. The socket may have been closed after the
+// call was attempted. Parking on it then would never be woken up, or worse, be woken up by a new socket that reuses the
+// descriptor, so the call fails instead: returns false after replying with an error.
+static bool WaitForPendingCall(PendingCall *call)
+{
+  if (WaitForSocketOfConnection(call->connection->client_fd, call->socket, call->events, ResumePendingCall, call))
+    return true;
+  SendCallError(call->connection->client_fd, call->payload, EBADF);
+  return false;
+}
+
+// Runs the call at the head of its queue, and the calls queued after it, until one of them has to wait for the socket.
+static void RunPendingCalls(PendingCall *call)
+{
+  while(call)
+  {
+    bool resumed = call->attempted;
+    call->attempted = true;
+    // A call may find its socket not ready after all, e.g. when an error condition woke it up, and keeps waiting.
+    if (!ProcessSocketCall(call->connection->client_fd, call->payload, call->numBytes, resumed, &call->sentBytes) && WaitForPendingCall(call))
+      return;
+    call = FinishPendingCall(call);
+  }
+}
+
+static void ResumePendingCall(void *arg)
+{
+  RunPendingCalls((PendingCall*)arg);
 }
 
 void ProcessWebSocketMessage(int client_fd, uint8_t *payload, uint64_t numBytes)
@@ -1655,17 +1915,42 @@ void ProcessWebSocketMessage(int client_fd, uint8_t *payload, uint64_t numBytes)
     printf("Received too small sockets call message! size: %d bytes, expected at least %d bytes\n", (int)numBytes, (int)sizeof(SocketCallHeader));
     return;
   }
-  SocketCallHeader *header = (SocketCallHeader*)payload;
-  if (header->function == POSIX_SOCKET_MSG_RECV || header->function == POSIX_SOCKET_MSG_RECVFROM || header->function == POSIX_SOCKET_MSG_RECVMSG || header->function == POSIX_SOCKET_MSG_CONNECT || header->function == POSIX_SOCKET_MSG_LISTEN)
-  {
-    // Synchonous/blocking recv()s can halt indefinitely until a message is actually received. An application might
-    // be send()ing messages in one thread while using another thread to wait for recv(). Therefore run these potentially
-    // blocking recv()s in a separate thread. The nonblocking operations can run synchronously in calling thread (they could
-    // also run in a background thread, but for performance, do not offload them since it is not necessary)
-    ProcessWebSocketMessageAsynchronouslyInBackgroundThread(client_fd, payload, numBytes);
-  }
-  else
+
+  // Calls that would block, e.g. a recv() that waits for data to arrive, must not hold up the calls that come after
+  // them: an application might be send()ing in one thread while another thread waits in recv(). Therefore each call is
+  // first attempted without blocking, and if it cannot complete yet, it is parked until its socket becomes ready
+  // instead of occupying a thread of its own.
+  SOCKET_T socket;
+  int events;
+  if (!GetWaitOfCall(payload, numBytes, socket, events))
   {
-    ProcessWebSocketMessageSynchronouslyInCurrentThread(client_fd, payload, numBytes);
+    ProcessSocketCall(client_fd, payload, numBytes, false, 0);
+    return;
   }
+
+  // A call on a socket that already has calls waiting in the same direction goes behind them, to run in its turn.
+  PendingShard &shard = PendingShardOf(socket);
+  std::unordered_map<SOCKET_T, std::deque<PendingCall*> > &queues = PendingQueuesOf(shard, events);
+  LOCK_MUTEX(&shard.lock);
+  std::unordered_map<SOCKET_T, std::deque<PendingCall*> >::iterator iter = queues.find(socket);
+  bool queued = (iter != queues.end());
+  if (queued)
+    iter->second.push_back(CreatePendingCall(client_fd, payload, numBytes, socket, events));
+  UNLOCK_MUTEX(&shard.lock);
+  if (queued)
+    return;
+
+  uint64_t sentBytes = 0;
+  if (ProcessSocketCall(client_fd, payload, numBytes, false, &sentBytes))
+    return;
+
+  PendingCall *call = CreatePendingCall(client_fd, payload, numBytes, socket, events);
+  call->attempted = true;
+  call->sentBytes = sentBytes;
+  // Only this thread adds calls of the socket, so the queue is still empty, and the call becomes its head.
+  LOCK_MUTEX(&shard.lock);
+  queues[socket].push_back(call);
+  UNLOCK_MUTEX(&shard.lock);
+  if (!WaitForPendingCall(call))
+    RunPendingCalls(FinishPendingCall(call));
 }
@@ -5,7 +5,6 @@
 uint64_t ntoh64(uint64_t x);
 #define hton64 ntoh64
 
-void WebSocketMessageUnmaskPayload(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey);
 void ProcessWebSocketMessage(int client_fd, uint8_t *payload, uint64_t numBytes);
 
 #ifdef _MSC_VER
@@ -0,0 +1,57 @@
+#include "work_queue.h"
+#include "threads.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+
+namespace
+{
+	struct WorkItem
+	{
+		WORK_FUNC func;
+		void *arg;
+	};
+
+	MUTEX_T queueLock;
+	CONDITION_T queueNotEmpty;
+	std::deque<WorkItem> queue;
+}
+
+static THREAD_RETURN_T worker_thread(void * /*arg*/)
+{
+	for(;;)
+	{
+		LOCK_MUTEX(&queueLock);
+		while(queue.empty())
+			WAIT_CONDITION(&queueNotEmpty, &queueLock);
+		WorkItem item = queue.front();
+		queue.pop_front();
+		UNLOCK_MUTEX(&queueLock);
+
+		item.func(item.arg);
+	}
+	EXIT_THREAD(0);
+}
+
+void StartWorkerThreads(int numThreads)
+{
+	CREATE_MUTEX(&queueLock);
+	CREATE_CONDITION(&queueNotEmpty);
+	for(int i = 0; i < numThreads; ++i)
+	{
+		THREAD_T thread;
+		CREATE_THREAD_RETURN_T ret = CREATE_THREAD(thread, worker_thread, 0);
+		if (!CREATE_THREAD_SUCCEEDED(ret))
+			fprintf(stderr, "Failed to create a worker thread!\n");
+	}
+}
+
+void QueueWork(WORK_FUNC func, void *arg)
+{
+	WorkItem item = { func, arg };
+	LOCK_MUTEX(&queueLock);
+	queue.push_back(item);
+	UNLOCK_MUTEX(&queueLock);
+	SIGNAL_CONDITION(&queueNotEmpty);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// A fixed size pool of worker threads that runs queued work items in FIFO order.
+
+typedef void (*WORK_FUNC)(void *arg);
+
+// Starts the given number of worker threads. Must be called once, before QueueWork().
+void StartWorkerThreads(int numThreads);
+
+// Queues func(arg) to be run on one of the worker threads.
+void QueueWork(WORK_FUNC func, void *arg);